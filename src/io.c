@@ -23,6 +23,8 @@
 #include <unistd.h>
 #include <signal.h>
 #include <time.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
 
 #ifdef NC_ENABLED_TLS
 #   include <openssl/err.h>
@@ -34,111 +36,216 @@
 
 #define BUFFERSIZE 512
 
-static ssize_t
-nc_read(struct nc_session *session, char *buf, size_t count, uint32_t inact_timeout, struct timespec *ts_act_timeout)
+#ifdef NC_BUSY_WAIT
+
+int
+nc_sock_wait(int UNUSED(sock), short UNUSED(events), int UNUSED(timeout))
 {
-    size_t readd = 0;
-    ssize_t r = -1;
-    struct timespec ts_cur, ts_inact_timeout;
+    /* the caller checks its timeouts and retries */
+    usleep(NC_TIMEOUT_STEP);
+    return 1;
+}
 
-    assert(session);
-    assert(buf);
+#else
 
-    if ((session->status != NC_STATUS_RUNNING) && (session->status != NC_STATUS_STARTING)) {
+int
+nc_sock_wait(int sock, short events, int timeout)
+{
+    struct pollfd pfd;
+    int ret;
+
+    pfd.fd = sock;
+    pfd.events = events;
+    pfd.revents = 0;
+
+    ret = poll(&pfd, 1, timeout);
+    if (ret < 0) {
+        if (errno == EINTR) {
+            /* the caller retries */
+            return 0;
+        }
+        ERR("Poll on socket %d failed (%s).", sock, strerror(errno));
         return -1;
     }
 
-    if (!count) {
-        return 0;
+    /* any socket error or hang-up is reported by the following I/O operation */
+    return ret;
+}
+
+#endif
+
+/* wait until data can be read from (or written to if out is set) the session transport,
+ * returns 0 on timeout, -1 on error */
+static int
+nc_session_wait(struct nc_session *session, int out, int timeout)
+{
+    int sock;
+    short events;
+
+    events = out ? POLLOUT : POLLIN;
+    switch (session->ti_type) {
+    case NC_TI_FD:
+        sock = out ? session->ti.fd.out : session->ti.fd.in;
+        break;
+#ifdef NC_ENABLED_SSH
+    case NC_TI_LIBSSH:
+#ifndef NC_BUSY_WAIT
+        if (!out) {
+            /* libssh processes all the incoming SSH packets meanwhile, errors and EOF are reported by the read */
+            return ssh_channel_poll_timeout(session->ti.libssh.channel, timeout, 0) ? 1 : 0;
+        }
+#endif
+        sock = ssh_get_fd(session->ti.libssh.session);
+        if (!ssh_channel_window_size(session->ti.libssh.channel)) {
+            /* the peer must adjust the window first */
+            events = POLLIN;
+        }
+        break;
+#endif
+#ifdef NC_ENABLED_TLS
+    case NC_TI_OPENSSL:
+        sock = SSL_get_fd(session->ti.tls);
+        break;
+#endif
+    default:
+        ERRINT;
+        return -1;
     }
 
-    nc_gettimespec_mono(&ts_inact_timeout);
-    nc_addtimespec(&ts_inact_timeout, inact_timeout);
-    do {
-        switch (session->ti_type) {
-        case NC_TI_NONE:
-            return 0;
+    return nc_sock_wait(sock, events, timeout);
+}
+/* a single read attempt, returns the number of bytes read, 0 if there are no data available, -1 on error */
+static ssize_t
+nc_read_once(struct nc_session *session, char *buf, size_t count)
+{
+    ssize_t r = -1;
 
-        case NC_TI_FD:
-            /* read via standard file descriptor */
-            r = read(session->ti.fd.in, buf + readd, count - readd);
-            if (r < 0) {
-                if ((errno == EAGAIN) || (errno == EINTR)) {
-                    r = 0;
-                    break;
-                } else {
-                    ERR("Session %u: reading from file descriptor (%d) failed (%s).",
-                        session->id, session->ti.fd.in, strerror(errno));
-                    session->status = NC_STATUS_INVALID;
-                    session->term_reason = NC_SESSION_TERM_OTHER;
-                    return -1;
-                }
-            } else if (r == 0) {
-                ERR("Session %u: communication file descriptor (%d) unexpectedly closed.",
-                    session->id, session->ti.fd.in);
+    switch (session->ti_type) {
+    case NC_TI_NONE:
+        return 0;
+
+    case NC_TI_FD:
+        /* read via standard file descriptor */
+        NC_STATS_ADD(session, read_calls, 1);
+        r = read(session->ti.fd.in, buf, count);
+        if (r < 0) {
+            if ((errno == EAGAIN) || (errno == EINTR)) {
+                r = 0;
+                break;
+            } else {
+                ERR("Session %u: reading from file descriptor (%d) failed (%s).",
+                    session->id, session->ti.fd.in, strerror(errno));
                 session->status = NC_STATUS_INVALID;
-                session->term_reason = NC_SESSION_TERM_DROPPED;
+                session->term_reason = NC_SESSION_TERM_OTHER;
                 return -1;
             }
-            break;
+        } else if (r == 0) {
+            ERR("Session %u: communication file descriptor (%d) unexpectedly closed.",
+                session->id, session->ti.fd.in);
+            session->status = NC_STATUS_INVALID;
+            session->term_reason = NC_SESSION_TERM_DROPPED;
+            return -1;
+        }
+        break;
 
 #ifdef NC_ENABLED_SSH
-        case NC_TI_LIBSSH:
-            /* read via libssh */
-            r = ssh_channel_read(session->ti.libssh.channel, buf + readd, count - readd, 0);
-            if (r == SSH_AGAIN) {
-                r = 0;
-                break;
-            } else if (r == SSH_ERROR) {
-                ERR("Session %u: reading from the SSH channel failed (%s).", session->id,
-                    ssh_get_error(session->ti.libssh.session));
+    case NC_TI_LIBSSH:
+        /* read via libssh */
+        NC_STATS_ADD(session, read_calls, 1);
+        r = ssh_channel_read(session->ti.libssh.channel, buf, count, 0);
+        if (r == SSH_AGAIN) {
+            r = 0;
+            break;
+        } else if (r == SSH_ERROR) {
+            ERR("Session %u: reading from the SSH channel failed (%s).", session->id,
+                ssh_get_error(session->ti.libssh.session));
+            session->status = NC_STATUS_INVALID;
+            session->term_reason = NC_SESSION_TERM_OTHER;
+            return -1;
+        } else if (r == 0) {
+            if (ssh_channel_is_eof(session->ti.libssh.channel)) {
+                ERR("Session %u: SSH channel unexpected EOF.", session->id);
                 session->status = NC_STATUS_INVALID;
-                session->term_reason = NC_SESSION_TERM_OTHER;
+                session->term_reason = NC_SESSION_TERM_DROPPED;
                 return -1;
-            } else if (r == 0) {
-                if (ssh_channel_is_eof(session->ti.libssh.channel)) {
-                    ERR("Session %u: SSH channel unexpected EOF.", session->id);
-                    session->status = NC_STATUS_INVALID;
-                    session->term_reason = NC_SESSION_TERM_DROPPED;
-                    return -1;
-                }
-                break;
             }
             break;
+        }
+        break;
 #endif
 
 #ifdef NC_ENABLED_TLS
-        case NC_TI_OPENSSL:
-            /* read via OpenSSL */
-            r = SSL_read(session->ti.tls, buf + readd, count - readd);
-            if (r <= 0) {
-                int x;
-                switch (x = SSL_get_error(session->ti.tls, r)) {
-                case SSL_ERROR_WANT_READ:
-                    r = 0;
-                    break;
-                case SSL_ERROR_ZERO_RETURN:
-                    ERR("Session %u: communication socket unexpectedly closed (OpenSSL).", session->id);
-                    session->status = NC_STATUS_INVALID;
-                    session->term_reason = NC_SESSION_TERM_DROPPED;
-                    return -1;
-                default:
-                    ERR("Session %u: reading from the TLS session failed (SSL code %d).", session->id, x);
-                    session->status = NC_STATUS_INVALID;
-                    session->term_reason = NC_SESSION_TERM_OTHER;
-                    return -1;
-                }
+    case NC_TI_OPENSSL:
+        /* read via OpenSSL */
+        NC_STATS_ADD(session, read_calls, 1);
+        r = SSL_read(session->ti.tls, buf, count);
+        if (r <= 0) {
+            int x;
+            switch (x = SSL_get_error(session->ti.tls, r)) {
+            case SSL_ERROR_WANT_READ:
+                r = 0;
+                break;
+            case SSL_ERROR_ZERO_RETURN:
+                ERR("Session %u: communication socket unexpectedly closed (OpenSSL).", session->id);
+                session->status = NC_STATUS_INVALID;
+                session->term_reason = NC_SESSION_TERM_DROPPED;
+                return -1;
+            default:
+                ERR("Session %u: reading from the TLS session failed (SSL code %d).", session->id, x);
+                session->status = NC_STATUS_INVALID;
+                session->term_reason = NC_SESSION_TERM_OTHER;
+                return -1;
             }
-            break;
+        }
+        break;
 #endif
+    }
+
+    if (r > 0) {
+        NC_STATS_ADD(session, bytes_in, r);
+    }
+    return r;
+}
+
+/* reads at least min and at most count bytes, it blocks until min bytes are read or a timeout elapses */
+static ssize_t
+nc_read(struct nc_session *session, char *buf, size_t min, size_t count, uint32_t inact_timeout,
+        struct timespec *ts_act_timeout)
+{
+    size_t readd = 0;
+    ssize_t r;
+    int32_t inact_left, act_left;
+    struct timespec ts_cur, ts_inact_timeout;
+
+    assert(session);
+    assert(buf);
+    assert(min <= count);
+
+    if ((session->status != NC_STATUS_RUNNING) && (session->status != NC_STATUS_STARTING)) {
+        return -1;
+    }
+
+    if (!min) {
+        return 0;
+    }
+
+    nc_gettimespec_mono(&ts_inact_timeout);
+    nc_addtimespec(&ts_inact_timeout, inact_timeout);
+    do {
+        if (session->ti_type == NC_TI_NONE) {
+            return 0;
         }
 
-        if (r == 0) {
-            /* nothing read */
-            usleep(NC_TIMEOUT_STEP);
+        r = nc_read_once(session, buf + readd, count - readd);
+        if (r < 0) {
+            return -1;
+        } else if (r == 0) {
+            /* nothing read, wait for more data */
             nc_gettimespec_mono(&ts_cur);
-            if ((nc_difftimespec(&ts_cur, &ts_inact_timeout) < 1) || (nc_difftimespec(&ts_cur, ts_act_timeout) < 1)) {
-                if (nc_difftimespec(&ts_cur, &ts_inact_timeout) < 1) {
+            inact_left = nc_difftimespec(&ts_cur, &ts_inact_timeout);
+            act_left = nc_difftimespec(&ts_cur, ts_act_timeout);
+            if ((inact_left < 1) || (act_left < 1)) {
+                if (inact_left < 1) {
                     ERR("Session %u: inactive read timeout elapsed.", session->id);
                 } else {
                     ERR("Session %u: active read timeout elapsed.", session->id);
@@ -147,6 +254,12 @@ nc_read(struct nc_session *session, char *buf, size_t count, uint32_t inact_time
                 session->term_reason = NC_SESSION_TERM_OTHER;
                 return -1;
             }
+
+            if (nc_session_wait(session, 0, (act_left < inact_left) ? act_left : inact_left) < 0) {
+                session->status = NC_STATUS_INVALID;
+                session->term_reason = NC_SESSION_TERM_OTHER;
+                return -1;
+            }
         } else {
             /* something read */
             readd += r;
@@ -156,129 +269,332 @@ nc_read(struct nc_session *session, char *buf, size_t count, uint32_t inact_time
             nc_addtimespec(&ts_inact_timeout, inact_timeout);
         }
 
-    } while (readd < count);
-    buf[count] = '\0';
+    } while (readd < min);
 
     return (ssize_t)readd;
 }
 
+/* reads up to count bytes, if wait is set it blocks until some are read, otherwise only the data
+ * available right away are read, returns 0 if there are none */
+static ssize_t
+nc_read_avail(struct nc_session *session, int wait, char *buf, size_t count, uint32_t inact_timeout)
+{
+    struct pollfd pfd;
+
+    if (wait) {
+        return nc_read(session, buf, 1, count, inact_timeout, &session->rmsg.ts_act_timeout);
+    }
+
+    if ((session->status != NC_STATUS_RUNNING) && (session->status != NC_STATUS_STARTING)) {
+        return -1;
+    }
+
+    if (session->ti_type == NC_TI_FD) {
+        /* the file descriptor may be blocking */
+        pfd.fd = session->ti.fd.in;
+        pfd.events = POLLIN;
+        pfd.revents = 0;
+        if (!poll(&pfd, 1, 0)) {
+            return 0;
+        }
+    }
+
+    return nc_read_once(session, buf, count);
+}
+
+/* reads more data into the session input buffer, see nc_read_avail() */
 static ssize_t
-nc_read_chunk(struct nc_session *session, size_t len, uint32_t inact_timeout, struct timespec *ts_act_timeout, char **chunk)
+nc_read_more(struct nc_session *session, int wait, uint32_t inact_timeout)
 {
+    size_t avail;
     ssize_t r;
 
-    assert(session);
-    assert(chunk);
+    avail = session->rbuf.end - session->rbuf.start;
+    if (!session->rbuf.data) {
+        session->rbuf.data = malloc(NC_READ_BUF_SIZE);
+        if (!session->rbuf.data) {
+            ERRMEM;
+            return -1;
+        }
+        session->rbuf.start = 0;
+        session->rbuf.end = 0;
+    } else if (session->rbuf.start) {
+        /* move the unprocessed data to the beginning of the buffer */
+        memmove(session->rbuf.data, session->rbuf.data + session->rbuf.start, avail);
+        session->rbuf.start = 0;
+        session->rbuf.end = avail;
+    }
+    assert(session->rbuf.end < NC_READ_BUF_SIZE);
 
-    if (!len) {
+    r = nc_read_avail(session, wait, session->rbuf.data + session->rbuf.end, NC_READ_BUF_SIZE - session->rbuf.end,
+                      inact_timeout);
+    if (r > 0) {
+        session->rbuf.end += r;
+    }
+    return r;
+}
+
+/* parse the chunk size (or the end-of-chunks '#') following "\n#", chunk_len is 0 for the end of chunks,
+ * returns the length of the parsed header part, 0 if it is not complete, -1 if it is invalid */
+static int
+nc_parse_chunk_size(const char *data, size_t len, uint64_t *chunk_len)
+{
+    size_t i;
+
+    /* RFC 6242 chunk-size is at most 10 digits long, followed by LF */
+    for (i = 0; (i < len) && (data[i] != '\n'); ++i) {
+        if (i == 10) {
+            return -1;
+        }
+    }
+    if (i == len) {
         return 0;
     }
 
-    *chunk = malloc((len + 1) * sizeof **chunk);
-    if (!*chunk) {
-        ERRMEM;
-        return -1;
+    *chunk_len = 0;
+    if ((i == 1) && (data[0] == '#')) {
+        /* end of chunks */
+        return 2;
     }
 
-    r = nc_read(session, *chunk, len, inact_timeout, ts_act_timeout);
-    if (r <= 0) {
-        free(*chunk);
+    if (!i || (data[0] < '1') || (data[0] > '9')) {
+        return -1;
+    }
+    for (len = 0; len < i; ++len) {
+        if ((data[len] < '0') || (data[len] > '9')) {
+            return -1;
+        }
+        *chunk_len = *chunk_len * 10 + (data[len] - '0');
+    }
+    if (*chunk_len > UINT32_MAX) {
         return -1;
     }
 
-    /* terminating null byte */
-    (*chunk)[r] = 0;
+    return i + 1;
+}
 
-    return r;
+/* forget the message being received */
+static void
+nc_read_msg_reset(struct nc_session *session)
+{
+    free(session->rmsg.data);
+    memset(&session->rmsg, 0, sizeof session->rmsg);
 }
 
-static ssize_t
-nc_read_until(struct nc_session *session, const char *endtag, size_t limit, uint32_t inact_timeout,
-              struct timespec *ts_act_timeout, char **result)
+/* make room for count more bytes and the terminating null byte in the message being received */
+static int
+nc_read_msg_grow(struct nc_session *session, size_t count, size_t max_size)
 {
-    char *chunk = NULL;
-    size_t size, count = 0, r, len, i, matched = 0;
+    size_t size, need;
 
-    assert(session);
-    assert(endtag);
+    need = session->rmsg.len + count + 1;
+    if (need <= session->rmsg.size) {
+        return 0;
+    }
 
-    if (limit && limit < BUFFERSIZE) {
-        size = limit;
-    } else {
-        size = BUFFERSIZE;
+    /* grow geometrically, but at least as much as needed */
+    size = session->rmsg.size ? session->rmsg.size * 2 : BUFFERSIZE;
+    if (size < need) {
+        size = need;
     }
-    chunk = malloc((size + 1) * sizeof *chunk);
-    if (!chunk) {
+    if (max_size && (size > max_size + 1) && (need <= max_size + 1)) {
+        size = max_size + 1;
+    }
+
+    session->rmsg.data = nc_realloc(session->rmsg.data, size);
+    if (!session->rmsg.data) {
         ERRMEM;
+        session->rmsg.size = 0;
         return -1;
     }
+    session->rmsg.size = size;
 
-    len = strlen(endtag);
-    while (1) {
-        if (limit && count == limit) {
-            free(chunk);
-            WRN("Session %u: reading limit (%d) reached.", session->id, limit);
-            ERR("Session %u: invalid input data (missing \"%s\" sequence).", session->id, endtag);
-            return -1;
-        }
+    return 0;
+}
 
-        /* resize buffer if needed */
-        if ((count + (len - matched)) >= size) {
-            /* get more memory */
-            size = size + BUFFERSIZE;
-            chunk = nc_realloc(chunk, (size + 1) * sizeof *chunk);
-            if (!chunk) {
-                ERRMEM;
-                return -1;
-            }
-        }
+/*
+ * Decode a message from the session input, the decoder state is kept in the session so that a message can be
+ * received in several calls. If wait is not set, only the data available right away are read.
+ *
+ * returns 1 if the message is complete (msg set), 0 if the rest of it is not available yet (only if !wait),
+ * -1 on error (session invalidated), -2 on a malformed message, -3 on a malformed message whose remaining
+ * data cannot be skipped
+ */
+static int
+nc_read_msg_decode(struct nc_session *session, int wait, uint32_t inact_timeout, size_t max_size, char **msg)
+{
+    char *data;
+    const char *found;
+    size_t avail, from, over, count;
+    uint64_t chunk_len;
+    ssize_t r;
+    int ret;
 
-        /* get another character */
-        r = nc_read(session, &(chunk[count]), len - matched, inact_timeout, ts_act_timeout);
-        if (r != len - matched) {
-            free(chunk);
-            return -1;
-        }
+    if (!session->rmsg.active) {
+        /* new message */
+        nc_gettimespec_mono(&session->rmsg.ts_act_timeout);
+        nc_addtimespec(&session->rmsg.ts_act_timeout, NC_READ_ACT_TIMEOUT * 1000);
+        session->rmsg.active = 1;
+    }
 
-        count += len - matched;
+    while (1) {
+        avail = session->rbuf.end - session->rbuf.start;
+        data = session->rbuf.data + session->rbuf.start;
+
+        if (session->version == NC_VERSION_10) {
+            if (avail) {
+                /* take all the data and search for the end tag, also at the end of the already searched data */
+                if (nc_read_msg_grow(session, avail, max_size)) {
+                    ret = -1;
+                    goto error;
+                }
+                memcpy(session->rmsg.data + session->rmsg.len, data, avail);
+                session->rmsg.len += avail;
+                session->rbuf.start += avail;
+
+                from = session->rmsg.scanned;
+                from = (from < NC_VERSION_10_ENDTAG_LEN - 1) ? 0 : from - (NC_VERSION_10_ENDTAG_LEN - 1);
+                found = nc_scan_tag(session->rmsg.data + from, session->rmsg.len - from, NC_VERSION_10_ENDTAG,
+                                    NC_VERSION_10_ENDTAG_LEN);
+                if (found) {
+                    /* the data following the end tag belong to the next message, they are still in the buffer */
+                    over = (session->rmsg.data + session->rmsg.len) - (found + NC_VERSION_10_ENDTAG_LEN);
+                    session->rbuf.start -= over;
+                    session->rmsg.len = found - session->rmsg.data;
+                } else {
+                    session->rmsg.scanned = session->rmsg.len;
+                }
 
-        for (i = len - matched; i > 0; i--) {
-            if (!strncmp(&endtag[matched], &(chunk[count - i]), i)) {
-                /*part of endtag found */
-                matched += i;
-                break;
+                if (max_size && (session->rmsg.len > (found ? max_size : max_size + NC_VERSION_10_ENDTAG_LEN - 1))) {
+                    ERR("Session %u: message exceeds the maximum size (%zu bytes).", session->id, max_size);
+                    ret = -3;
+                    goto error;
+                } else if (found) {
+                    goto done;
+                }
+            }
+        } else if (session->rmsg.chunk_left) {
+            /* chunk data, the message grows as they arrive */
+            if (avail) {
+                if (avail > session->rmsg.chunk_left) {
+                    avail = session->rmsg.chunk_left;
+                }
+                if (nc_read_msg_grow(session, avail, max_size)) {
+                    ret = -1;
+                    goto error;
+                }
+                memcpy(session->rmsg.data + session->rmsg.len, data, avail);
+                session->rmsg.len += avail;
+                session->rmsg.chunk_left -= avail;
+                session->rbuf.start += avail;
+                continue;
+            } else if (session->rmsg.chunk_left >= NC_READ_BUF_SIZE) {
+                /* large chunk, read it directly without copying it through the buffer, into the room there is */
+                if (nc_read_msg_grow(session, NC_READ_BUF_SIZE, max_size)) {
+                    ret = -1;
+                    goto error;
+                }
+                count = session->rmsg.size - session->rmsg.len - 1;
+                if (count > session->rmsg.chunk_left) {
+                    count = session->rmsg.chunk_left;
+                }
+                r = nc_read_avail(session, wait, session->rmsg.data + session->rmsg.len, count, inact_timeout);
+                if (r < 0) {
+                    ret = -1;
+                    goto error;
+                } else if (!r) {
+                    return 0;
+                }
+                session->rmsg.len += r;
+                session->rmsg.chunk_left -= r;
+                continue;
+            }
+        } else {
+            /* chunk header */
+            found = nc_scan_tag(data, avail, "\n#", 2);
+            if (!found) {
+                /* skip anything that is not a chunk header, only the last LF may be its beginning */
+                session->rbuf.start += (avail && (data[avail - 1] == '\n')) ? avail - 1 : avail;
             } else {
-                matched = 0;
+                session->rbuf.start += found - data;
+                avail -= found - data;
+                ret = nc_parse_chunk_size(found + 2, avail - 2, &chunk_len);
+                if (ret < 0) {
+                    ERR("Session %u: invalid frame chunk size detected, fatal error.", session->id);
+                    /* skip the invalid header */
+                    session->rbuf.start += 2;
+                    ret = -2;
+                    goto error;
+                } else if (ret) {
+                    session->rbuf.start += 2 + ret;
+
+                    if (!chunk_len) {
+                        /* end of chunked framing message */
+                        if (!session->rmsg.len) {
+                            ERR("Session %u: invalid frame chunk delimiters.", session->id);
+                            ret = -2;
+                            goto error;
+                        }
+                        goto done;
+                    }
+
+                    if (max_size && (session->rmsg.len + chunk_len > max_size)) {
+                        ERR("Session %u: message exceeds the maximum size (%zu bytes).", session->id, max_size);
+                        ret = -3;
+                        goto error;
+                    }
+
+                    /* the chunk size is only announced, make room for a part of it before the data arrive */
+                    count = (chunk_len < NC_READ_CHUNK_RESERVE) ? chunk_len : NC_READ_CHUNK_RESERVE;
+                    if (nc_read_msg_grow(session, count, max_size)) {
+                        ret = -1;
+                        goto error;
+                    }
+                    session->rmsg.chunk_left = chunk_len;
+                    NC_STATS_ADD(session, chunks_in, 1);
+                    continue;
+                }
+                /* incomplete chunk header */
             }
         }
 
-        /* whole endtag found */
-        if (matched == len) {
-            break;
+        /* more data needed */
+        r = nc_read_more(session, wait, inact_timeout);
+        if (r < 0) {
+            ret = -1;
+            goto error;
+        } else if (!r) {
+            return 0;
         }
     }
 
-    /* terminating null byte */
-    chunk[count] = 0;
+done:
+    session->rmsg.data[session->rmsg.len] = '\0';
+    *msg = session->rmsg.data;
+    session->rmsg.data = NULL;
+    nc_read_msg_reset(session);
+    return 1;
 
-    if (result) {
-        *result = chunk;
-    } else {
-        free(chunk);
+error:
+    nc_read_msg_reset(session);
+    if (ret < -1) {
+        NC_STATS_ADD(session, bad_framing, 1);
     }
-    return count;
+    if ((ret == -1) && (session->status != NC_STATUS_INVALID)) {
+        /* the rest of the message is still to be read, the session is unusable */
+        session->status = NC_STATUS_INVALID;
+        session->term_reason = NC_SESSION_TERM_OTHER;
+    }
+    return ret;
 }
 
 /* return NC_MSG_ERROR can change session status, acquires IO lock as needed */
 NC_MSG_TYPE
-nc_read_msg_io(struct nc_session *session, int io_timeout, struct lyxml_elem **data, int passing_io_lock)
+nc_read_msg_io(struct nc_session *session, int io_timeout, struct lyxml_elem **data, int partial, int passing_io_lock)
 {
-    int ret, io_locked = passing_io_lock;
-    char *msg = NULL, *chunk;
-    uint64_t chunk_len, len = 0;
-    /* use timeout in milliseconds instead seconds */
-    uint32_t inact_timeout = NC_READ_INACT_TIMEOUT * 1000;
-    struct timespec ts_act_timeout;
+    int ret, io_locked = passing_io_lock, drop = 0;
+    char *msg = NULL;
+    size_t max_size;
     struct nc_server_reply *reply;
 
     assert(session && data);
@@ -290,8 +606,7 @@ nc_read_msg_io(struct nc_session *session, int io_timeout, struct lyxml_elem **d
         goto cleanup;
     }
 
-    nc_gettimespec_mono(&ts_act_timeout);
-    nc_addtimespec(&ts_act_timeout, NC_READ_ACT_TIMEOUT * 1000);
+    max_size = nc_max_msg_size;
 
     if (!io_locked) {
         /* SESSION IO LOCK */
@@ -307,69 +622,18 @@ nc_read_msg_io(struct nc_session *session, int io_timeout, struct lyxml_elem **d
     }
 
     /* read the message */
-    switch (session->version) {
-    case NC_VERSION_10:
-        ret = nc_read_until(session, NC_VERSION_10_ENDTAG, 0, inact_timeout, &ts_act_timeout, &msg);
-        if (ret == -1) {
-            ret = NC_MSG_ERROR;
-            goto cleanup;
-        }
-
-        /* cut off the end tag */
-        msg[ret - NC_VERSION_10_ENDTAG_LEN] = '\0';
-        break;
-    case NC_VERSION_11:
-        while (1) {
-            ret = nc_read_until(session, "\n#", 0, inact_timeout, &ts_act_timeout, NULL);
-            if (ret == -1) {
-                ret = NC_MSG_ERROR;
-                goto cleanup;
-            }
-            ret = nc_read_until(session, "\n", 0, inact_timeout, &ts_act_timeout, &chunk);
-            if (ret == -1) {
-                ret = NC_MSG_ERROR;
-                goto cleanup;
-            }
-
-            if (!strcmp(chunk, "#\n")) {
-                /* end of chunked framing message */
-                free(chunk);
-                if (!msg) {
-                    ERR("Session %u: invalid frame chunk delimiters.", session->id);
-                    goto malformed_msg;
-                }
-                break;
-            }
-
-            /* convert string to the size of the following chunk */
-            chunk_len = strtoul(chunk, (char **)NULL, 10);
-            free(chunk);
-            if (!chunk_len) {
-                ERR("Session %u: invalid frame chunk size detected, fatal error.", session->id);
-                goto malformed_msg;
-            }
-
-            /* now we have size of next chunk, so read the chunk */
-            ret = nc_read_chunk(session, chunk_len, inact_timeout, &ts_act_timeout, &chunk);
-            if (ret == -1) {
-                ret = NC_MSG_ERROR;
-                goto cleanup;
-            }
-
-            /* realloc message buffer, remember to count terminating null byte */
-            msg = nc_realloc(msg, len + chunk_len + 1);
-            if (!msg) {
-                ERRMEM;
-                ret = NC_MSG_ERROR;
-                goto cleanup;
-            }
-            memcpy(msg + len, chunk, chunk_len);
-            len += chunk_len;
-            msg[len] = '\0';
-            free(chunk);
-        }
-
-        break;
+    ret = nc_read_msg_decode(session, !partial, NC_READ_INACT_TIMEOUT * 1000, max_size, &msg);
+    if (ret == 0) {
+        /* the rest of the message will be read later */
+        ret = NC_MSG_WOULDBLOCK;
+        goto cleanup;
+    } else if (ret == -1) {
+        ret = NC_MSG_ERROR;
+        goto cleanup;
+    } else if (ret < 0) {
+        /* if the rest of the message cannot be skipped, the session is unusable */
+        drop = (ret == -3);
+        goto malformed_msg;
     }
 
     /* SESSION IO UNLOCK */
@@ -379,7 +643,8 @@ nc_read_msg_io(struct nc_session *session, int io_timeout, struct lyxml_elem **d
 
     DBG("Session %u: received message:\n%s\n", session->id, msg);
 
-    /* build XML tree */
+    /* build XML tree, libyang offers no incremental XML parser so the message can only be parsed whole,
+     * the decoded chunks are at least assembled directly in msg and it is freed right after parsing */
     *data = lyxml_parse_mem(session->ctx, msg, 0);
     if (!*data) {
         goto malformed_msg;
@@ -393,18 +658,18 @@ nc_read_msg_io(struct nc_session *session, int io_timeout, struct lyxml_elem **d
     /* get and return message type */
     if (!strcmp((*data)->ns->value, NC_NS_BASE)) {
         if (!strcmp((*data)->name, "rpc")) {
-            return NC_MSG_RPC;
+            ret = NC_MSG_RPC;
         } else if (!strcmp((*data)->name, "rpc-reply")) {
-            return NC_MSG_REPLY;
+            ret = NC_MSG_REPLY;
         } else if (!strcmp((*data)->name, "hello")) {
-            return NC_MSG_HELLO;
+            ret = NC_MSG_HELLO;
         } else {
             ERR("Session %u: invalid message root element (invalid name \"%s\").", session->id, (*data)->name);
             goto malformed_msg;
         }
     } else if (!strcmp((*data)->ns->value, NC_NS_NOTIF)) {
         if (!strcmp((*data)->name, "notification")) {
-            return NC_MSG_NOTIF;
+            ret = NC_MSG_NOTIF;
         } else {
             ERR("Session %u: invalid message root element (invalid name \"%s\").", session->id, (*data)->name);
             goto malformed_msg;
@@ -414,6 +679,9 @@ nc_read_msg_io(struct nc_session *session, int io_timeout, struct lyxml_elem **d
         goto malformed_msg;
     }
 
+    NC_STATS_ADD(session, msgs_in[ret], 1);
+    return ret;
+
 malformed_msg:
     ERR("Session %u: malformed message received.", session->id);
     if ((session->side == NC_SERVER) && (session->version == NC_VERSION_11)) {
@@ -435,6 +703,10 @@ malformed_msg:
         }
         nc_server_reply_free(reply);
     }
+    if (drop && (session->status != NC_STATUS_INVALID)) {
+        session->status = NC_STATUS_INVALID;
+        session->term_reason = NC_SESSION_TERM_OTHER;
+    }
     ret = NC_MSG_ERROR;
 
 cleanup:
@@ -461,6 +733,11 @@ nc_read_poll(struct nc_session *session, int io_timeout)
         return -1;
     }
 
+    if (session->rbuf.end > session->rbuf.start) {
+        /* some data already buffered */
+        return 1;
+    }
+
     switch (session->ti_type) {
 #ifdef NC_ENABLED_SSH
     case NC_TI_LIBSSH:
@@ -583,7 +860,7 @@ nc_read_msg_poll_io(struct nc_session *session, int io_timeout, struct lyxml_ele
     }
 
     /* SESSION IO LOCK passed down */
-    return nc_read_msg_io(session, io_timeout, data, 1);
+    return nc_read_msg_io(session, io_timeout, data, 0, 1);
 }
 
 /* does not really log, only fatal errors */
@@ -630,18 +907,153 @@ nc_session_is_connected(struct nc_session *session)
     return 1;
 }
 
-#define WRITE_BUFSIZE (2 * BUFFERSIZE)
+/* room for the NETCONF 1.1 chunk header ("\n#" and up to 10 digits and "\n") before the buffered data */
+#define NC_CHUNK_HDR_LEN 13
+/* room for the end tag after the buffered data, NETCONF 1.0 one is the longer */
+#define NC_ENDTAG_MAX_LEN 6
+/* maximum number of buffers gathered into one write */
+#define NC_WRITE_IOV 16
+
+/* write buffers larger than this are not kept for the next message */
+#define NC_WRITE_BUF_KEEP (1024 * 1024)
+
 struct wclb_arg {
     struct nc_session *session;
-    char buf[WRITE_BUFSIZE];
+    char *mem;                  /* NC_CHUNK_HDR_LEN + cap + NC_ENDTAG_MAX_LEN bytes */
+    char *buf;                  /* mem + NC_CHUNK_HDR_LEN */
+    size_t cap;
+    size_t size;                /* buffered data are written once they would exceed it */
     size_t len;
+    size_t chunk_size;
+    int buffered;               /* the whole message is printed into buf first and written afterwards */
+    int error;
 };
 
+/* thread-specific write buffer kept between messages */
+struct nc_write_buf {
+    char *mem;
+    size_t cap;
+};
+
+static pthread_once_t nc_write_buf_once = PTHREAD_ONCE_INIT;
+static pthread_key_t nc_write_buf_key;
+
+static void
+nc_write_buf_free(void *ptr)
+{
+    struct nc_write_buf *wbuf = (struct nc_write_buf *)ptr;
+
+    free(wbuf->mem);
+    free(wbuf);
+}
+
+static void
+nc_write_buf_createkey(void)
+{
+    int r;
+
+    while ((r = pthread_key_create(&nc_write_buf_key, nc_write_buf_free)) == EAGAIN);
+}
+
+/* take the thread write buffer with room for at least cap bytes of data */
 static int
-nc_write(struct nc_session *session, const void *buf, size_t count)
+nc_write_buf_take(struct wclb_arg *warg, size_t cap)
 {
-    int c;
-    size_t written = 0;
+    struct nc_write_buf *wbuf;
+
+    pthread_once(&nc_write_buf_once, nc_write_buf_createkey);
+    wbuf = pthread_getspecific(nc_write_buf_key);
+    if (!wbuf) {
+        wbuf = calloc(1, sizeof *wbuf);
+        if (!wbuf) {
+            ERRMEM;
+            return -1;
+        }
+        pthread_setspecific(nc_write_buf_key, wbuf);
+    }
+
+    if (wbuf->cap < cap) {
+        free(wbuf->mem);
+        wbuf->mem = malloc(NC_CHUNK_HDR_LEN + cap + NC_ENDTAG_MAX_LEN);
+        if (!wbuf->mem) {
+            ERRMEM;
+            wbuf->cap = 0;
+            return -1;
+        }
+        wbuf->cap = cap;
+    }
+
+    warg->mem = wbuf->mem;
+    warg->buf = warg->mem + NC_CHUNK_HDR_LEN;
+    warg->cap = wbuf->cap;
+    wbuf->mem = NULL;
+    wbuf->cap = 0;
+
+    return 0;
+}
+
+/* return the write buffer to the thread for the next message */
+static void
+nc_write_buf_release(struct wclb_arg *warg)
+{
+    struct nc_write_buf *wbuf;
+
+    wbuf = pthread_getspecific(nc_write_buf_key);
+    if (wbuf && !wbuf->mem && (warg->cap <= NC_WRITE_BUF_KEEP)) {
+        wbuf->mem = warg->mem;
+        wbuf->cap = warg->cap;
+    } else {
+        free(warg->mem);
+    }
+    warg->mem = NULL;
+}
+
+/*
+ * Neither a write() into a pipe nor OpenSSL writing into its socket can be told not to raise SIGPIPE,
+ * so it is blocked in the writing thread and any SIGPIPE generated meanwhile discarded.
+ */
+static void
+nc_sigpipe_block(sigset_t *oldmask, int *pending)
+{
+    sigset_t sigpipe, sigpend;
+
+    sigemptyset(&sigpipe);
+    sigaddset(&sigpipe, SIGPIPE);
+    pthread_sigmask(SIG_BLOCK, &sigpipe, oldmask);
+
+    /* SIGPIPE that was pending before is not ours to discard */
+    sigpending(&sigpend);
+    *pending = sigismember(&sigpend, SIGPIPE);
+}
+
+static void
+nc_sigpipe_restore(const sigset_t *oldmask, int pending, int epipe)
+{
+    sigset_t sigpipe;
+    struct timespec ts = {0, 0};
+    int errno_bck = errno;
+
+    if (epipe && !pending) {
+        sigemptyset(&sigpipe);
+        sigaddset(&sigpipe, SIGPIPE);
+        while ((sigtimedwait(&sigpipe, NULL, &ts) == -1) && (errno == EINTR));
+    }
+    pthread_sigmask(SIG_SETMASK, oldmask, NULL);
+
+    errno = errno_bck;
+}
+
+/* writes all the buffers, they are modified, invalidates the session on error, if written is set,
+ * the buffers are written only until the transport would block and the length written is added to it */
+static int
+nc_write_iov(struct nc_session *session, struct iovec *iov, int iovcnt, size_t *written)
+{
+    int ret = 0, sigpipe = 0, pending = 0, epipe = 0, i;
+    ssize_t c;
+    int32_t timeout;
+    struct msghdr msg;
+    sigset_t oldmask;
+    struct timespec ts_cur, ts_inact_timeout;
 #ifdef NC_ENABLED_TLS
     unsigned long e;
 #endif
@@ -650,23 +1062,62 @@ nc_write(struct nc_session *session, const void *buf, size_t count)
         return -1;
     }
 
-    /* prevent SIGPIPE this way */
-    if (!nc_session_is_connected(session)) {
-        ERR("Session %u: communication socket unexpectedly closed.", session->id);
-        session->status = NC_STATUS_INVALID;
-        session->term_reason = NC_SESSION_TERM_DROPPED;
-        return -1;
+    for (i = 0; i < iovcnt; ++i) {
+        DBG("Session %u: sending message:\n%.*s\n", session->id, (int)iov[i].iov_len, (char *)iov[i].iov_base);
     }
 
-    DBG("Session %u: sending message:\n%.*s\n", session->id, count, buf);
+    if ((session->ti_type == NC_TI_FD) && (session->flags & NC_SESSION_FD_NOTSOCK)) {
+        sigpipe = 1;
+    }
+#ifdef NC_ENABLED_TLS
+    if (session->ti_type == NC_TI_OPENSSL) {
+        sigpipe = 1;
+    }
+#endif
+    if (sigpipe) {
+        nc_sigpipe_block(&oldmask, &pending);
+    }
 
+    nc_gettimespec_mono(&ts_inact_timeout);
+    nc_addtimespec(&ts_inact_timeout, NC_READ_INACT_TIMEOUT * 1000);
     do {
         switch (session->ti_type) {
         case NC_TI_FD:
-            c = write(session->ti.fd.out, (char *)(buf + written), count - written);
-            if (c < 0) {
-                ERR("Session %u: socket error (%s).", session->id, strerror(errno));
-                return -1;
+            if (sigpipe) {
+                c = writev(session->ti.fd.out, iov, iovcnt);
+            } else {
+                /* a dead peer is reported by EPIPE instead of SIGPIPE */
+                memset(&msg, 0, sizeof msg);
+                msg.msg_iov = iov;
+                msg.msg_iovlen = iovcnt;
+                c = sendmsg(session->ti.fd.out, &msg, MSG_NOSIGNAL | (written ? MSG_DONTWAIT : 0));
+                if ((c == -1) && (errno == ENOTSOCK)) {
+                    /* a pipe or a file, use write() from now on */
+                    session->flags |= NC_SESSION_FD_NOTSOCK;
+                    sigpipe = 1;
+                    nc_sigpipe_block(&oldmask, &pending);
+                    continue;
+                }
+            }
+            if (c == -1) {
+                if ((errno == EAGAIN) || (errno == EWOULDBLOCK) || (errno == EINTR)) {
+                    c = 0;
+                    break;
+                } else if ((errno == EPIPE) || (errno == ECONNRESET)) {
+                    epipe = (errno == EPIPE);
+                    ERR("Session %u: communication file descriptor (%d) unexpectedly closed.",
+                        session->id, session->ti.fd.out);
+                    session->status = NC_STATUS_INVALID;
+                    session->term_reason = NC_SESSION_TERM_DROPPED;
+                    ret = -1;
+                    goto cleanup;
+                }
+                ERR("Session %u: writing into file descriptor (%d) failed (%s).",
+                    session->id, session->ti.fd.out, strerror(errno));
+                session->status = NC_STATUS_INVALID;
+                session->term_reason = NC_SESSION_TERM_OTHER;
+                ret = -1;
+                goto cleanup;
             }
             break;
 
@@ -680,186 +1131,341 @@ nc_write(struct nc_session *session, const void *buf, size_t count)
                 }
                 session->status = NC_STATUS_INVALID;
                 session->term_reason = NC_SESSION_TERM_DROPPED;
-                return -1;
+                ret = -1;
+                goto cleanup;
             }
-            c = ssh_channel_write(session->ti.libssh.channel, (char *)(buf + written), count - written);
+            /* libssh has no gathering write, the buffers are written one by one */
+            c = ssh_channel_write(session->ti.libssh.channel, iov->iov_base, iov->iov_len);
             if ((c == SSH_ERROR) || (c == -1)) {
-                ERR("Session %u: SSH channel write failed.", session->id);
-                return -1;
+                ERR("Session %u: SSH channel write failed (%s).", session->id, ssh_get_error(session->ti.libssh.session));
+                session->status = NC_STATUS_INVALID;
+                session->term_reason = NC_SESSION_TERM_OTHER;
+                ret = -1;
+                goto cleanup;
             }
             break;
 #endif
 #ifdef NC_ENABLED_TLS
         case NC_TI_OPENSSL:
-            c = SSL_write(session->ti.tls, (char *)(buf + written), count - written);
+            /* OpenSSL has no gathering write, the buffers are written one by one */
+            c = SSL_write(session->ti.tls, iov->iov_base, iov->iov_len);
             if (c < 1) {
                 switch ((e = SSL_get_error(session->ti.tls, c))) {
-                case SSL_ERROR_ZERO_RETURN:
-                    ERR("Session %u: SSL connection was properly closed.", session->id);
-                    return -1;
                 case SSL_ERROR_WANT_WRITE:
                     c = 0;
                     break;
+                case SSL_ERROR_ZERO_RETURN:
+                    ERR("Session %u: SSL connection was properly closed.", session->id);
+                    session->status = NC_STATUS_INVALID;
+                    session->term_reason = NC_SESSION_TERM_DROPPED;
+                    ret = -1;
+                    goto cleanup;
                 case SSL_ERROR_SYSCALL:
-                    ERR("Session %u: SSL socket error (%s).", session->id, strerror(errno));
-                    return -1;
+                    if ((errno == EPIPE) || (errno == ECONNRESET)) {
+                        epipe = (errno == EPIPE);
+                        ERR("Session %u: communication socket unexpectedly closed (OpenSSL).", session->id);
+                        session->status = NC_STATUS_INVALID;
+                        session->term_reason = NC_SESSION_TERM_DROPPED;
+                    } else {
+                        ERR("Session %u: SSL socket error (%s).", session->id, strerror(errno));
+                        session->status = NC_STATUS_INVALID;
+                        session->term_reason = NC_SESSION_TERM_OTHER;
+                    }
+                    ret = -1;
+                    goto cleanup;
                 case SSL_ERROR_SSL:
                     ERR("Session %u: SSL error (%s).", session->id, ERR_reason_error_string(e));
-                    return -1;
+                    session->status = NC_STATUS_INVALID;
+                    session->term_reason = NC_SESSION_TERM_OTHER;
+                    ret = -1;
+                    goto cleanup;
                 default:
                     ERR("Session %u: unknown SSL error occured.", session->id);
-                    return -1;
+                    session->status = NC_STATUS_INVALID;
+                    session->term_reason = NC_SESSION_TERM_OTHER;
+                    ret = -1;
+                    goto cleanup;
                 }
             }
             break;
 #endif
         default:
             ERRINT;
-            return -1;
+            ret = -1;
+            goto cleanup;
         }
 
+        NC_STATS_ADD(session, write_calls, 1);
         if (c == 0) {
+            if (written) {
+                /* the rest is to be written later */
+                goto cleanup;
+            }
+
             /* we must wait */
-            usleep(NC_TIMEOUT_STEP);
-        }
+            NC_STATS_ADD(session, write_retries, 1);
+            nc_gettimespec_mono(&ts_cur);
+            timeout = nc_difftimespec(&ts_cur, &ts_inact_timeout);
+            if (timeout < 1) {
+                ERR("Session %u: inactive write timeout elapsed.", session->id);
+                session->status = NC_STATUS_INVALID;
+                session->term_reason = NC_SESSION_TERM_OTHER;
+                ret = -1;
+                goto cleanup;
+            }
 
-        written += c;
-    } while (written < count);
+            if (nc_session_wait(session, 1, timeout) < 0) {
+                session->status = NC_STATUS_INVALID;
+                session->term_reason = NC_SESSION_TERM_OTHER;
+                ret = -1;
+                goto cleanup;
+            }
+            continue;
+        }
 
-    return written;
-}
+        /* reset inactive timeout */
+        nc_gettimespec_mono(&ts_inact_timeout);
+        nc_addtimespec(&ts_inact_timeout, NC_READ_INACT_TIMEOUT * 1000);
 
-static int
-nc_write_starttag_and_msg(struct nc_session *session, const void *buf, size_t count)
-{
-    int ret = 0, c;
-    char chunksize[20];
+        NC_STATS_ADD(session, bytes_out, c);
+        if (written) {
+            *written += c;
+        }
 
-    if (session->version == NC_VERSION_11) {
-        sprintf(chunksize, "\n#%zu\n", count);
-        ret = nc_write(session, chunksize, strlen(chunksize));
-        if (ret == -1) {
-            return -1;
+        /* skip the written data */
+        while (iovcnt && ((size_t)c >= iov->iov_len)) {
+            c -= iov->iov_len;
+            ++iov;
+            --iovcnt;
         }
-    }
+        if (c) {
+            iov->iov_base = (char *)iov->iov_base + c;
+            iov->iov_len -= c;
+        }
+        if (c || ((session->ti_type == NC_TI_FD) && iovcnt)) {
+            /* only a part of the data was written */
+            NC_STATS_ADD(session, write_retries, 1);
+        }
+    } while (iovcnt);
 
-    c = nc_write(session, buf, count);
-    if (c == -1) {
-        return -1;
+cleanup:
+    if (sigpipe) {
+        nc_sigpipe_restore(&oldmask, pending, epipe);
     }
-    ret += c;
-
     return ret;
 }
 
+/*
+ * Write the buffered data, then data, if any, and then the end tag, if set. All of it is gathered
+ * into as few writes as possible, data larger than the chunk size are split into several chunks.
+ */
 static int
-nc_write_endtag(struct nc_session *session)
+nc_write_clb_flush(struct wclb_arg *warg, const char *data, size_t count, int endtag)
 {
-    int ret;
+    struct nc_session *session = warg->session;
+    struct iovec iov[NC_WRITE_IOV];
+    char hdrs[NC_WRITE_IOV / 2][NC_CHUNK_HDR_LEN + 1];
+    const char *tag;
+    int iovcnt = 0, hdrcnt = 0, hdr_len = 0;
+    size_t tag_len, piece;
 
     if (session->version == NC_VERSION_11) {
-        ret = nc_write(session, "\n##\n", 4);
+        tag = "\n##\n";
     } else {
-        ret = nc_write(session, "]]>]]>", 6);
+        tag = NC_VERSION_10_ENDTAG;
     }
+    tag_len = strlen(tag);
 
-    return ret;
+    if (warg->len) {
+        /* the buffered data are written contiguously with their chunk header and possibly the end tag */
+        if (session->version == NC_VERSION_11) {
+            hdr_len = sprintf(hdrs[0], "\n#%zu\n", warg->len);
+            memcpy(warg->buf - hdr_len, hdrs[0], hdr_len);
+            NC_STATS_ADD(session, chunks_out, 1);
+        }
+        iov[0].iov_base = warg->buf - hdr_len;
+        iov[0].iov_len = hdr_len + warg->len;
+        if (endtag && !count) {
+            memcpy(warg->buf + warg->len, tag, tag_len);
+            iov[0].iov_len += tag_len;
+            endtag = 0;
+        }
+        iovcnt = 1;
+        warg->len = 0;
+    }
+
+    while (count) {
+        if (iovcnt + 3 > NC_WRITE_IOV) {
+            /* no room for another chunk and the end tag */
+            if (nc_write_iov(session, iov, iovcnt, NULL)) {
+                return -1;
+            }
+            iovcnt = 0;
+            hdrcnt = 0;
+        }
+
+        piece = count;
+        if (session->version == NC_VERSION_11) {
+            if (piece > warg->chunk_size) {
+                piece = warg->chunk_size;
+            }
+            iov[iovcnt].iov_base = hdrs[hdrcnt];
+            iov[iovcnt].iov_len = sprintf(hdrs[hdrcnt], "\n#%zu\n", piece);
+            ++iovcnt;
+            ++hdrcnt;
+            NC_STATS_ADD(session, chunks_out, 1);
+        }
+        iov[iovcnt].iov_base = (char *)data;
+        iov[iovcnt].iov_len = piece;
+        ++iovcnt;
+
+        data += piece;
+        count -= piece;
+    }
+
+    if (endtag) {
+        iov[iovcnt].iov_base = (char *)tag;
+        iov[iovcnt].iov_len = tag_len;
+        ++iovcnt;
+    }
+
+    if (iovcnt && nc_write_iov(session, iov, iovcnt, NULL)) {
+        return -1;
+    }
+    return 0;
 }
 
+/* make room for count more bytes in the buffer, by writing the buffered data or, if the whole message
+ * is buffered, by enlarging it */
 static int
-nc_write_clb_flush(struct wclb_arg *warg)
+nc_write_clb_reserve(struct wclb_arg *warg, size_t count)
 {
-    int ret = 0;
+    char *mem;
+    size_t cap;
 
-    /* flush current buffer */
-    if (warg->len) {
-        ret = nc_write_starttag_and_msg(warg->session, warg->buf, warg->len);
-        warg->len = 0;
+    if (warg->len + count <= warg->size) {
+        return 0;
     }
 
-    return ret;
+    if (!warg->buffered) {
+        /* dump current buffer */
+        if (nc_write_clb_flush(warg, NULL, 0, 0)) {
+            warg->error = 1;
+            return -1;
+        }
+        return 0;
+    }
+
+    for (cap = warg->cap * 2; cap < warg->len + count; cap *= 2);
+    mem = realloc(warg->mem, NC_CHUNK_HDR_LEN + cap + NC_ENDTAG_MAX_LEN);
+    if (!mem) {
+        ERRMEM;
+        warg->error = 1;
+        return -1;
+    }
+    warg->mem = mem;
+    warg->buf = mem + NC_CHUNK_HDR_LEN;
+    warg->cap = cap;
+    warg->size = cap;
+
+    return 0;
 }
 
 static ssize_t
 nc_write_clb(void *arg, const void *buf, size_t count, int xmlcontent)
 {
-    int ret = 0, c;
-    size_t l;
+    ssize_t ret = 0;
+    size_t l, run, piece;
     struct wclb_arg *warg = (struct wclb_arg *)arg;
 
-    if (!buf) {
-        c = nc_write_clb_flush(warg);
-        if (c == -1) {
-            return -1;
-        }
-        ret += c;
+    if (warg->error) {
+        return -1;
+    }
 
-        /* endtag */
-        c = nc_write_endtag(warg->session);
-        if (c == -1) {
-            return -1;
+    if (!buf) {
+        if (warg->buffered) {
+            /* written by the caller */
+            return 0;
         }
-        ret += c;
 
-        return ret;
+        /* flush with the end tag */
+        return nc_write_clb_flush(warg, NULL, 0, 1);
     }
 
-    if (warg->len && (warg->len + count > WRITE_BUFSIZE)) {
-        /* dump current buffer */
-        c = nc_write_clb_flush(warg);
-        if (c == -1) {
+    if (!warg->buffered && !xmlcontent && (count > warg->size)) {
+        /* write directly, together with the current buffer */
+        if (nc_write_clb_flush(warg, buf, count, 0)) {
+            warg->error = 1;
             return -1;
         }
-        ret += c;
+        return count;
     }
 
-    if (!xmlcontent && count > WRITE_BUFSIZE) {
-        /* write directly */
-        c = nc_write_starttag_and_msg(warg->session, buf, count);
-        if (c == -1) {
-            return -1;
-        }
-        ret += c;
-    } else {
-        /* keep in buffer and write later */
-        if (xmlcontent) {
-            for (l = 0; l < count; l++) {
-                if (warg->len + 5 >= WRITE_BUFSIZE) {
-                    /* buffer is full */
-                    c = nc_write_clb_flush(warg);
-                    if (c == -1) {
+    /* keep in buffer and write later */
+    if (xmlcontent) {
+        l = 0;
+        while (l < count) {
+            /* runs without any special characters are copied (or written) in bulk */
+            run = nc_scan_xml_special((char *)buf + l, count - l);
+            if (!warg->buffered && (run > warg->size)) {
+                if (nc_write_clb_flush(warg, (char *)buf + l, run, 0)) {
+                    warg->error = 1;
+                    return -1;
+                }
+                l += run;
+                ret += run;
+                run = 0;
+            }
+            while (run) {
+                if ((warg->len == warg->size) || warg->buffered) {
+                    if (nc_write_clb_reserve(warg, run)) {
                         return -1;
                     }
                 }
 
-                switch (((char *)buf)[l]) {
-                case '&':
-                    ret += 5;
-                    memcpy(&warg->buf[warg->len], "&amp;", 5);
-                    warg->len += 5;
-                    break;
-                case '<':
-                    ret += 4;
-                    memcpy(&warg->buf[warg->len], "&lt;", 4);
-                    warg->len += 4;
-                    break;
-                case '>':
-                    /* not needed, just for readability */
-                    ret += 4;
-                    memcpy(&warg->buf[warg->len], "&gt;", 4);
-                    warg->len += 4;
-                    break;
-                default:
-                    ret++;
-                    memcpy(&warg->buf[warg->len], &((char *)buf)[l], 1);
-                    warg->len++;
-                }
+                piece = (run < warg->size - warg->len) ? run : warg->size - warg->len;
+                memcpy(&warg->buf[warg->len], (char *)buf + l, piece);
+                warg->len += piece;
+                l += piece;
+                ret += piece;
+                run -= piece;
             }
-        } else {
-            memcpy(&warg->buf[warg->len], buf, count);
-            warg->len += count; /* is <= WRITE_BUFSIZE */
-            ret += count;
+            if (l == count) {
+                break;
+            }
+
+            /* room for the escaped character */
+            if (nc_write_clb_reserve(warg, 5)) {
+                return -1;
+            }
+
+            switch (((char *)buf)[l]) {
+            case '&':
+                ret += 5;
+                memcpy(&warg->buf[warg->len], "&amp;", 5);
+                warg->len += 5;
+                break;
+            case '<':
+                ret += 4;
+                memcpy(&warg->buf[warg->len], "&lt;", 4);
+                warg->len += 4;
+                break;
+            case '>':
+                /* not needed, just for readability */
+                ret += 4;
+                memcpy(&warg->buf[warg->len], "&gt;", 4);
+                warg->len += 4;
+                break;
+            }
+            ++l;
+        }
+    } else {
+        if (nc_write_clb_reserve(warg, count)) {
+            return -1;
         }
+        memcpy(&warg->buf[warg->len], buf, count);
+        warg->len += count; /* is <= size */
+        ret += count;
     }
 
     return ret;
@@ -1046,14 +1652,42 @@ nc_write_error(struct wclb_arg *arg, struct nc_server_error *err, const char *pr
             nc_write_error_elem(arg, "bad-namespace", 13, prefix, pref_len, 0, 0);
         }
 
-        for (i = 0; i < err->other_count; ++i) {
-            lyxml_print_clb(nc_write_xmlclb, (void *)arg, err->other[i], 0);
-        }
+        for (i = 0; i < err->other_count; ++i) {
+            lyxml_print_clb(nc_write_xmlclb, (void *)arg, err->other[i], 0);
+        }
+
+        nc_write_error_elem(arg, "error-info", 10, prefix, pref_len, 0, 0);
+    }
+
+    nc_write_error_elem(arg, "rpc-error", 9, prefix, pref_len, 0, 0);
+}
+
+static void
+nc_write_hello_cpblts(struct wclb_arg *arg, const char **capabilities)
+{
+    uint32_t i;
+
+    nc_write_clb((void *)arg, "<hello xmlns=\""NC_NS_BASE"\"><capabilities>", 14 + 39 + 16, 0);
+    for (i = 0; capabilities[i]; i++) {
+        nc_write_clb((void *)arg, "<capability>", 12, 0);
+        nc_write_clb((void *)arg, capabilities[i], strlen(capabilities[i]), 1);
+        nc_write_clb((void *)arg, "</capability>", 13, 0);
+    }
+}
 
-        nc_write_error_elem(arg, "error-info", 10, prefix, pref_len, 0, 0);
+static int
+nc_write_notif(struct wclb_arg *arg, const struct nc_server_notif *notif)
+{
+    nc_write_clb((void *)arg, "<notification xmlns=\""NC_NS_NOTIF"\">", 21 + 47 + 2, 0);
+    nc_write_clb((void *)arg, "<eventTime>", 11, 0);
+    nc_write_clb((void *)arg, notif->eventtime, strlen(notif->eventtime), 0);
+    nc_write_clb((void *)arg, "</eventTime>", 12, 0);
+    if (lyd_print_clb(nc_write_xmlclb, (void *)arg, notif->tree, LYD_XML, 0)) {
+        return -1;
     }
+    nc_write_clb((void *)arg, "</notification>", 15, 0);
 
-    nc_write_error_elem(arg, "rpc-error", 9, prefix, pref_len, 0, 0);
+    return 0;
 }
 
 /* return NC_MSG_ERROR can change session status, acquires IO lock as needed */
@@ -1071,8 +1705,9 @@ nc_write_msg_io(struct nc_session *session, int io_timeout, int type, ...)
     char *buf = NULL;
     struct wclb_arg arg;
     const char **capabilities;
+    const struct nc_msg_buf *hello;
     uint32_t *sid = NULL, i;
-    int wd = 0;
+    int wd = 0, io_locked = 0;
 
     assert(session);
 
@@ -1082,18 +1717,40 @@ nc_write_msg_io(struct nc_session *session, int io_timeout, int type, ...)
     }
 
     arg.session = session;
+    arg.chunk_size = session->chunk_size ? session->chunk_size : NC_WRITE_CHUNK_SIZE;
     arg.len = 0;
-
-    /* SESSION IO LOCK */
-    ret = nc_session_io_lock(session, io_timeout, __func__);
-    if (ret < 0) {
+    arg.error = 0;
+    if (nc_write_buf_take(&arg, arg.chunk_size)) {
         return NC_MSG_ERROR;
-    } else if (!ret) {
-        return NC_MSG_WOULDBLOCK;
+    }
+
+    /* replies and notifications can be printed before the IO lock is acquired, printing RPCs modifies the session */
+    arg.buffered = nc_print_unlocked && ((type == NC_MSG_REPLY) || (type == NC_MSG_NOTIF));
+    if (arg.buffered) {
+        arg.size = arg.cap;
+    } else {
+        arg.size = arg.chunk_size;
+
+        /* SESSION IO LOCK */
+        ret = nc_session_io_lock(session, io_timeout, __func__);
+        if (ret < 0) {
+            nc_write_buf_release(&arg);
+            return NC_MSG_ERROR;
+        } else if (!ret) {
+            nc_write_buf_release(&arg);
+            return NC_MSG_WOULDBLOCK;
+        }
+        io_locked = 1;
     }
 
     va_start(ap, type);
 
+    /* a partially written queued notification must be finished first, all of them before a notification */
+    if (io_locked && (session->side == NC_SERVER) && (nc_ntf_queue_write(session, 0, type != NC_MSG_NOTIF) == -1)) {
+        ret = NC_MSG_ERROR;
+        goto cleanup;
+    }
+
     switch (type) {
     case NC_MSG_RPC:
         content = va_arg(ap, struct lyd_node *);
@@ -1197,15 +1854,10 @@ nc_write_msg_io(struct nc_session *session, int io_timeout, int type, ...)
     case NC_MSG_NOTIF:
         notif = va_arg(ap, struct nc_server_notif *);
 
-        nc_write_clb((void *)&arg, "<notification xmlns=\""NC_NS_NOTIF"\">", 21 + 47 + 2, 0);
-        nc_write_clb((void *)&arg, "<eventTime>", 11, 0);
-        nc_write_clb((void *)&arg, notif->eventtime, strlen(notif->eventtime), 0);
-        nc_write_clb((void *)&arg, "</eventTime>", 12, 0);
-        if (lyd_print_clb(nc_write_xmlclb, (void *)&arg, notif->tree, LYD_XML, 0)) {
+        if (nc_write_notif(&arg, notif)) {
             ret = NC_MSG_ERROR;
             goto cleanup;
         }
-        nc_write_clb((void *)&arg, "</notification>", 15, 0);
         break;
 
     case NC_MSG_HELLO:
@@ -1216,18 +1868,12 @@ nc_write_msg_io(struct nc_session *session, int io_timeout, int type, ...)
         capabilities = va_arg(ap, const char **);
         sid = va_arg(ap, uint32_t*);
 
-        count = asprintf(&buf, "<hello xmlns=\"%s\"><capabilities>", NC_NS_BASE);
-        if (count == -1) {
-            ERRMEM;
-            ret = NC_MSG_ERROR;
-            goto cleanup;
-        }
-        nc_write_clb((void *)&arg, buf, count, 0);
-        free(buf);
-        for (i = 0; capabilities[i]; i++) {
-            nc_write_clb((void *)&arg, "<capability>", 12, 0);
-            nc_write_clb((void *)&arg, capabilities[i], strlen(capabilities[i]), 1);
-            nc_write_clb((void *)&arg, "</capability>", 13, 0);
+        if (capabilities) {
+            nc_write_hello_cpblts(&arg, capabilities);
+        } else {
+            /* capabilities already serialized by nc_msg_buf_hello() */
+            hello = va_arg(ap, const struct nc_msg_buf *);
+            nc_write_clb((void *)&arg, hello->data, hello->len, 0);
         }
         if (sid) {
             count = asprintf(&buf, "</capabilities><session-id>%u</session-id></hello>", *sid);
@@ -1248,8 +1894,36 @@ nc_write_msg_io(struct nc_session *session, int io_timeout, int type, ...)
         goto cleanup;
     }
 
-    /* flush message */
-    nc_write_clb((void *)&arg, NULL, 0, 0);
+    if (arg.buffered) {
+        if (arg.error) {
+            ret = NC_MSG_ERROR;
+            goto cleanup;
+        }
+
+        /* SESSION IO LOCK */
+        ret = nc_session_io_lock(session, io_timeout, __func__);
+        if (ret < 0) {
+            ret = NC_MSG_ERROR;
+            goto cleanup;
+        } else if (!ret) {
+            ret = NC_MSG_WOULDBLOCK;
+            goto cleanup;
+        }
+        io_locked = 1;
+
+        if ((session->side == NC_SERVER) && (nc_ntf_queue_write(session, 0, type != NC_MSG_NOTIF) == -1)) {
+            ret = NC_MSG_ERROR;
+            goto cleanup;
+        }
+
+        /* write the whole message, split into chunks */
+        count = arg.len;
+        arg.len = 0;
+        nc_write_clb_flush(&arg, arg.buf, count, 1);
+    } else {
+        /* flush message */
+        nc_write_clb((void *)&arg, NULL, 0, 0);
+    }
 
     if ((session->status != NC_STATUS_RUNNING) && (session->status != NC_STATUS_STARTING)) {
         /* error was already written */
@@ -1257,14 +1931,450 @@ nc_write_msg_io(struct nc_session *session, int io_timeout, int type, ...)
     } else {
         /* specific message successfully sent */
         ret = type;
+        NC_STATS_ADD(session, msgs_out[type], 1);
     }
 
 cleanup:
     va_end(ap);
+    if (io_locked) {
+        nc_session_io_unlock(session, __func__);
+    }
+    nc_write_buf_release(&arg);
+    return ret;
+}
+
+static int
+nc_msg_buf_start(struct wclb_arg *arg)
+{
+    /* printed whole into the thread write buffer, no session is needed for that */
+    memset(arg, 0, sizeof *arg);
+    arg->buffered = 1;
+    if (nc_write_buf_take(arg, NC_WRITE_CHUNK_SIZE)) {
+        return -1;
+    }
+    arg->size = arg->cap;
+
+    return 0;
+}
+
+static struct nc_msg_buf *
+nc_msg_buf_finish(struct wclb_arg *arg)
+{
+    struct nc_msg_buf *msg = NULL;
+
+    if (arg->error) {
+        goto cleanup;
+    }
+
+    msg = malloc(sizeof *msg + arg->len);
+    if (!msg) {
+        ERRMEM;
+        goto cleanup;
+    }
+    atomic_init(&msg->refs, 1);
+    msg->len = arg->len;
+    memcpy(msg->data, arg->buf, arg->len);
+
+cleanup:
+    nc_write_buf_release(arg);
+    return msg;
+}
+
+struct nc_msg_buf *
+nc_msg_buf_notif(const struct nc_server_notif *notif)
+{
+    struct wclb_arg arg;
+
+    if (nc_msg_buf_start(&arg)) {
+        return NULL;
+    }
+
+    if (nc_write_notif(&arg, notif)) {
+        nc_write_buf_release(&arg);
+        return NULL;
+    }
+
+    return nc_msg_buf_finish(&arg);
+}
+
+struct nc_msg_buf *
+nc_msg_buf_hello(const char **capabilities)
+{
+    struct wclb_arg arg;
+
+    if (nc_msg_buf_start(&arg)) {
+        return NULL;
+    }
+
+    nc_write_hello_cpblts(&arg, capabilities);
+
+    return nc_msg_buf_finish(&arg);
+}
+
+void
+nc_msg_buf_unref(struct nc_msg_buf *msg)
+{
+    if (msg && (atomic_fetch_sub(&msg->refs, 1) == 1)) {
+        free(msg);
+    }
+}
+
+/* return NC_MSG_ERROR can change session status, acquires IO lock */
+NC_MSG_TYPE
+nc_write_msg_buf_io(struct nc_session *session, int io_timeout, int type, const struct nc_msg_buf *msg)
+{
+    struct wclb_arg arg;
+    int ret;
+
+    assert(session && msg);
+
+    if ((session->status != NC_STATUS_RUNNING) && (session->status != NC_STATUS_STARTING)) {
+        ERR("Session %u: invalid session to write to.", session->id);
+        return NC_MSG_ERROR;
+    }
+
+    /* nothing is buffered, the message is only framed for this session */
+    memset(&arg, 0, sizeof arg);
+    arg.session = session;
+    arg.chunk_size = session->chunk_size ? session->chunk_size : NC_WRITE_CHUNK_SIZE;
+
+    /* SESSION IO LOCK */
+    ret = nc_session_io_lock(session, io_timeout, __func__);
+    if (ret < 0) {
+        return NC_MSG_ERROR;
+    } else if (!ret) {
+        return NC_MSG_WOULDBLOCK;
+    }
+
+    /* a partially written queued notification must be finished first, all of them before a notification */
+    if ((session->side != NC_SERVER) || (nc_ntf_queue_write(session, 0, type != NC_MSG_NOTIF) != -1)) {
+        nc_write_clb_flush(&arg, msg->data, msg->len, 1);
+    }
+
+    if ((session->status != NC_STATUS_RUNNING) && (session->status != NC_STATUS_STARTING)) {
+        /* error was already written */
+        ret = NC_MSG_ERROR;
+    } else {
+        ret = type;
+        NC_STATS_ADD(session, msgs_out[type], 1);
+    }
+
+    /* SESSION IO UNLOCK */
     nc_session_io_unlock(session, __func__);
     return ret;
 }
 
+/* gather the message framed for the session from the offset off of the framed message into as many buffers
+ * as fit, total is set to the length of the whole framed message, returns the number of buffers */
+static int
+nc_msg_buf_iov(const struct nc_session *session, const struct nc_msg_buf *msg, size_t chunk_size, size_t off,
+               struct iovec *iov, char hdrs[][NC_CHUNK_HDR_LEN + 1], size_t *total)
+{
+    char hdr[NC_CHUNK_HDR_LEN + 1];
+    const char *piece;
+    size_t done = 0, len;
+    int iovcnt = 0, hdrcnt = 0, hdr_piece = 0;
+
+    *total = 0;
+    while (1) {
+        /* next piece of the framed message */
+        if (session->version == NC_VERSION_10) {
+            if (!done) {
+                piece = msg->data;
+                len = msg->len;
+                done = len;
+            } else if (done == msg->len) {
+                piece = NC_VERSION_10_ENDTAG;
+                len = strlen(NC_VERSION_10_ENDTAG);
+                ++done;
+            } else {
+                break;
+            }
+        } else {
+            if (!hdr_piece && (done < msg->len)) {
+                len = (msg->len - done < chunk_size) ? msg->len - done : chunk_size;
+                piece = (hdrcnt < NC_WRITE_IOV / 2) ? hdrs[hdrcnt] : hdr;
+                len = sprintf((char *)piece, "\n#%zu\n", len);
+                hdr_piece = 1;
+            } else if (hdr_piece) {
+                piece = msg->data + done;
+                len = (msg->len - done < chunk_size) ? msg->len - done : chunk_size;
+                done += len;
+                hdr_piece = 0;
+            } else if (done == msg->len) {
+                piece = "\n##\n";
+                len = 4;
+                ++done;
+            } else {
+                break;
+            }
+        }
+
+        if ((*total + len > off) && (iovcnt < NC_WRITE_IOV)) {
+            /* not written yet */
+            if (off > *total) {
+                iov[iovcnt].iov_base = (char *)piece + (off - *total);
+                iov[iovcnt].iov_len = len - (off - *total);
+            } else {
+                iov[iovcnt].iov_base = (char *)piece;
+                iov[iovcnt].iov_len = len;
+            }
+            if (piece == hdrs[hdrcnt]) {
+                ++hdrcnt;
+            }
+            ++iovcnt;
+        }
+        *total += len;
+    }
+
+    return iovcnt;
+}
+
+/* drop the queued notifications not being written yet until size more bytes fit, all of them if size is 0,
+ * should be called holding the queue lock, returns the number of the notifications dropped */
+static uint32_t
+nc_ntf_queue_drop(struct nc_ntf_queue *queue, size_t size)
+{
+    struct nc_ntf_queue_item **prev, *item;
+    uint32_t count = 0;
+
+    prev = &queue->head;
+    if (*prev && (queue->head_busy || queue->head_started)) {
+        /* it must be finished */
+        prev = &(*prev)->next;
+    }
+
+    while ((item = *prev) && (!size || (queue->size + size > queue->max_size))) {
+        *prev = item->next;
+        if (queue->tail == item) {
+            /* only the head can precede the dropped notifications */
+            queue->tail = (prev == &queue->head) ? NULL : queue->head;
+        }
+        queue->size -= item->msg->len;
+        atomic_fetch_sub(&queue->count, 1);
+        ++queue->dropped;
+        ++count;
+
+        nc_msg_buf_unref(item->msg);
+        free(item);
+    }
+
+    return count;
+}
+
+NC_MSG_TYPE
+nc_ntf_queue_add(struct nc_session *session, struct nc_msg_buf *msg, int timeout)
+{
+    struct nc_ntf_queue *queue = session->opts.server.ntf_queue;
+    struct nc_ntf_queue_item *item;
+    struct timespec ts_timeout, ts_cur;
+    NC_MSG_TYPE ret = NC_MSG_ERROR;
+    int r, wait = -1;
+
+    assert(queue);
+
+    item = malloc(sizeof *item);
+    if (!item) {
+        ERRMEM;
+        return NC_MSG_ERROR;
+    }
+    atomic_fetch_add(&msg->refs, 1);
+    item->msg = msg;
+    item->next = NULL;
+
+    if (timeout > 0) {
+        nc_gettimespec_mono(&ts_timeout);
+        nc_addtimespec(&ts_timeout, timeout);
+    }
+
+    while (1) {
+        /* QUEUE LOCK */
+        pthread_mutex_lock(&queue->lock);
+
+        if (!queue->max_size) {
+            /* QUEUE UNLOCK */
+            pthread_mutex_unlock(&queue->lock);
+
+            /* disabled */
+            ret = NC_MSG_NONE;
+            goto cleanup;
+        } else if (!queue->count || (queue->size + msg->len <= queue->max_size)) {
+            break;
+        }
+
+        if (queue->policy == NC_NOTIF_QUEUE_DROP_OLDEST) {
+            /* a single notification larger than the queue is still queued alone */
+            nc_ntf_queue_drop(queue, msg->len);
+            break;
+        } else if (queue->policy == NC_NOTIF_QUEUE_TERMINATE) {
+            nc_ntf_queue_drop(queue, 0);
+            ++queue->dropped;
+            session->opts.server.ntf_status = 0;
+
+            /* QUEUE UNLOCK */
+            pthread_mutex_unlock(&queue->lock);
+
+            ERR("Session %u: notification queue full, subscription terminated.", session->id);
+            goto cleanup;
+        }
+
+        /* QUEUE UNLOCK */
+        pthread_mutex_unlock(&queue->lock);
+
+        /* NC_NOTIF_QUEUE_BLOCK, make room by writing the queued notifications */
+        if (timeout > 0) {
+            nc_gettimespec_mono(&ts_cur);
+            wait = nc_difftimespec(&ts_cur, &ts_timeout);
+            if (wait < 1) {
+                ret = NC_MSG_WOULDBLOCK;
+                goto cleanup;
+            }
+        } else if (!timeout) {
+            ret = NC_MSG_WOULDBLOCK;
+            goto cleanup;
+        }
+
+        /* SESSION IO LOCK */
+        r = nc_session_io_lock(session, wait, __func__);
+        if (r < 0) {
+            goto cleanup;
+        } else if (!r) {
+            ret = NC_MSG_WOULDBLOCK;
+            goto cleanup;
+        }
+        r = nc_ntf_queue_write(session, 1, 0);
+        nc_session_io_unlock(session, __func__);
+
+        if ((r == -1) || ((r == 1) && (nc_session_wait(session, 1, wait) < 0))) {
+            goto cleanup;
+        }
+    }
+
+    if (queue->tail) {
+        queue->tail->next = item;
+    } else {
+        queue->head = item;
+    }
+    queue->tail = item;
+    queue->size += msg->len;
+    atomic_fetch_add(&queue->count, 1);
+    item = NULL;
+    ret = NC_MSG_NOTIF;
+
+    /* QUEUE UNLOCK */
+    pthread_mutex_unlock(&queue->lock);
+
+cleanup:
+    if (item) {
+        nc_msg_buf_unref(item->msg);
+        free(item);
+    }
+    return ret;
+}
+
+int
+nc_ntf_queue_write(struct nc_session *session, int nonblock, int started)
+{
+    struct nc_ntf_queue *queue = session->opts.server.ntf_queue;
+    struct nc_ntf_queue_item *item;
+    struct iovec iov[NC_WRITE_IOV];
+    char hdrs[NC_WRITE_IOV / 2][NC_CHUNK_HDR_LEN + 1];
+    size_t chunk_size, total, len, written;
+    int iovcnt, i, r;
+
+    if (!queue) {
+        return 0;
+    }
+    chunk_size = session->chunk_size ? session->chunk_size : NC_WRITE_CHUNK_SIZE;
+
+    while (1) {
+        /* QUEUE LOCK */
+        pthread_mutex_lock(&queue->lock);
+
+        item = queue->head;
+        if (!item || (started && !queue->head_started)) {
+            /* QUEUE UNLOCK */
+            pthread_mutex_unlock(&queue->lock);
+            return 0;
+        }
+
+        /* it cannot be dropped now */
+        queue->head_busy = 1;
+
+        /* QUEUE UNLOCK */
+        pthread_mutex_unlock(&queue->lock);
+
+        iovcnt = nc_msg_buf_iov(session, item->msg, chunk_size, queue->head_off, iov, hdrs, &total);
+        for (len = 0, i = 0; i < iovcnt; ++i) {
+            len += iov[i].iov_len;
+        }
+        written = 0;
+        r = nc_write_iov(session, iov, iovcnt, nonblock ? &written : NULL);
+        if (!nonblock && !r) {
+            written = len;
+        }
+
+        /* QUEUE LOCK */
+        pthread_mutex_lock(&queue->lock);
+
+        queue->head_busy = 0;
+        queue->head_off += written;
+        if (queue->head_off == total) {
+            /* whole notification written */
+            queue->head = item->next;
+            if (!queue->head) {
+                queue->tail = NULL;
+            }
+            queue->head_off = 0;
+            queue->head_started = 0;
+            queue->size -= item->msg->len;
+            atomic_fetch_sub(&queue->count, 1);
+            ++queue->sent;
+        } else {
+            /* the rest must follow, whatever the transport buffered */
+            queue->head_started = 1;
+            item = NULL;
+        }
+
+        /* QUEUE UNLOCK */
+        pthread_mutex_unlock(&queue->lock);
+
+        if (item) {
+            NC_STATS_ADD(session, msgs_out[NC_MSG_NOTIF], 1);
+            if (session->version == NC_VERSION_11) {
+                NC_STATS_ADD(session, chunks_out, (item->msg->len + chunk_size - 1) / chunk_size);
+            }
+            nc_msg_buf_unref(item->msg);
+            free(item);
+        }
+
+        if (r) {
+            return -1;
+        } else if (written < len) {
+            /* the transport would block */
+            return 1;
+        }
+    }
+}
+
+void
+nc_ntf_queue_free(struct nc_ntf_queue *queue)
+{
+    struct nc_ntf_queue_item *item, *next;
+
+    if (!queue) {
+        return;
+    }
+
+    for (item = queue->head; item; item = next) {
+        next = item->next;
+        nc_msg_buf_unref(item->msg);
+        free(item);
+    }
+    pthread_mutex_destroy(&queue->lock);
+    free(queue);
+}
+
 void *
 nc_realloc(void *ptr, size_t size)
 {
@@ -227,6 +227,10 @@
  * the standard way of connecting. nc_connect_libssl() again enables
  * to customize the TLS session in every way _libssl_ allows.
  *
+ * Clients reconnecting to the same servers often can enable a session cache
+ * with nc_client_tls_set_session_cache() so that nc_connect_tls() resumes
+ * the previous sessions instead of performing full handshakes.
+ *
  * Functions List
  * --------------
  *
@@ -238,6 +242,8 @@
  * - nc_client_tls_get_trusted_ca_paths()
  * - nc_client_tls_set_crl_paths()
  * - nc_client_tls_get_crl_paths()
+ * - nc_client_tls_set_session_cache()
+ * - nc_client_tls_get_session_cache_stats()
  *
  * - nc_connect_tls()
  * - nc_connect_libssl()
@@ -296,6 +302,8 @@
  * - nc_client_tls_ch_get_trusted_ca_paths()
  * - nc_client_tls_ch_set_crl_paths()
  * - nc_client_tls_ch_get_crl_paths()
+ * - nc_client_tls_ch_set_session_cache()
+ * - nc_client_tls_ch_get_session_cache_stats()
  *
  * - nc_accept_callhome()
  *
@@ -324,7 +332,8 @@
  *
  * Context does not only determine server modules, but its overall
  * functionality as well. For every RPC the server should support,
- * an nc_rpc_clb callback should be set on that node in the context using nc_set_rpc_callback().
+ * an nc_rpc_clb callback should be set on that node in the context using nc_set_rpc_callback()
+ * or registered with the server using nc_server_set_rpc_clb(), which also counts its invocations.
  * Server then calls these as appropriate [during poll](@ref howtoservercomm).
  *
  * Just like in the [client](@ref howtoclient), you can let _libnetconf2_
@@ -347,6 +356,10 @@
  * - nc_server_set_hello_timeout()
  * - nc_server_set_idle_timeout()
  *
+ * - nc_server_set_rpc_clb()
+ * - nc_server_set_rpc_clb_path()
+ * - nc_server_get_rpc_clb_calls()
+ *
  * - nc_server_add_endpt()
  * - nc_server_del_endpt()
  * - nc_server_endpt_set_address()
@@ -414,6 +427,13 @@
  * If you need to remove trusted certificates, you can do so with nc_server_tls_endpt_del_trusted_cert_list().
  * To clear all Certificate Revocation Lists use nc_server_tls_endpt_clear_crls().
  *
+ * The certificates are loaded only for the first accepted session of an endpoint and reused
+ * until its options change. If the certificates returned by the callbacks change, call
+ * nc_server_tls_reload_certs().
+ *
+ * Reconnecting clients can skip most of the handshake if the endpoint allows TLS session
+ * resumption with nc_server_tls_endpt_set_resumption().
+ *
  * Functions List
  * --------------
  *
@@ -425,6 +445,7 @@
  * - nc_server_tls_endpt_set_trusted_ca_paths()
  * - nc_server_tls_endpt_set_crl_paths()
  * - nc_server_tls_endpt_clear_crls()
+ * - nc_server_tls_endpt_set_resumption()
  * - nc_server_tls_endpt_add_ctn()
  * - nc_server_tls_endpt_del_ctn()
  * - nc_server_tls_endpt_get_ctn()
@@ -432,6 +453,7 @@
  * - nc_server_tls_set_server_cert_clb()
  * - nc_server_tls_set_server_cert_chain_clb()
  * - nc_server_tls_set_trusted_cert_list_clb()
+ * - nc_server_tls_reload_certs()
  *
  * FD
  * ==
@@ -496,6 +518,7 @@
  * - nc_server_tls_ch_client_set_trusted_ca_paths()
  * - nc_server_tls_ch_client_set_crl_paths()
  * - nc_server_tls_ch_client_clear_crls()
+ * - nc_server_tls_ch_client_set_resumption()
  * - nc_server_tls_ch_client_add_ctn()
  * - nc_server_tls_ch_client_del_ctn()
  * - nc_server_tls_ch_client_get_ctn()
@@ -15,6 +15,7 @@
 #ifndef NC_MESSAGES_P_H_
 #define NC_MESSAGES_P_H_
 
+#include <stdatomic.h>
 #include <libyang/libyang.h>
 
 #include "messages_server.h"
@@ -68,10 +69,18 @@ struct nc_server_rpc {
     struct lyd_node *tree;   /**< libyang data tree of the message (NETCONF operation) */
 };
 
+/* serialized message shared by all the sessions it is written to */
+struct nc_msg_buf {
+    atomic_uint refs;
+    size_t len;
+    char data[];
+};
+
 struct nc_server_notif {
     char *eventtime;        /**< eventTime of the notification */
     struct lyd_node *tree;  /**< libyang data tree of the message */
     int free;
+    _Atomic(struct nc_msg_buf *) msg; /**< the notification serialized once for all the sessions, if sent to several */
 };
 
 struct nc_client_reply_error {
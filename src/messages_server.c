@@ -879,6 +879,7 @@ next_node:
         ntf->tree = event;
     }
     ntf->free = (paramtype == NC_PARAMTYPE_CONST ? 0 : 1);
+    ntf->msg = NULL;
 
     return ntf;
 }
@@ -894,6 +895,7 @@ nc_server_notif_free(struct nc_server_notif *notif)
         lyd_free(notif->tree);
         free(notif->eventtime);
     }
+    nc_msg_buf_unref(notif->msg);
     free(notif);
 }
 
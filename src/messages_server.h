@@ -329,6 +329,26 @@ struct nc_server_notif *nc_server_notif_new(struct lyd_node *event, char *eventt
  */
 NC_MSG_TYPE nc_server_notif_send(struct nc_session *session, struct nc_server_notif *notif, int timeout);
 
+/**
+ * @brief Send NETCONF Event Notification via several sessions.
+ *
+ * The notification is serialized only once, on the first call with this object, and the same
+ * data are then written to every session with only its framing added. Hence, the notification
+ * must not be modified after it has been sent by this function.
+ *
+ * @param[in] sessions NETCONF sessions where the Event Notification will be written, all with
+ *            notifications enabled.
+ * @param[in] count Count of @p sessions.
+ * @param[in] notif NETCONF Notification object to send via the sessions.
+ * @param[in] timeout Timeout for writing into each session in milliseconds. Use negative value for infinite
+ *            waiting and 0 for return if data cannot be sent immediately.
+ * @param[out] results Optional array of @p count items set to the nc_server_notif_send() return value
+ *             of the respective session.
+ * @return Number of sessions the notification was sent to, -1 on error before anything was sent.
+ */
+int nc_server_notif_send_multi(struct nc_session **sessions, uint32_t count, struct nc_server_notif *notif, int timeout,
+                               NC_MSG_TYPE *results);
+
 /**
  * @brief Free a server Event Notification object.
  *
@@ -0,0 +1,232 @@
+/**
+ * \file scan.c
+ * \brief libnetconf2 - framing delimiter and XML special character scanning functions
+ *
+ * Copyright (c) 2019 CESNET, z.s.p.o.
+ *
+ * This source code is licensed under BSD 3-Clause License (the "License").
+ * You may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     https://opensource.org/licenses/BSD-3-Clause
+ */
+
+#define _GNU_SOURCE
+#include <stdint.h>
+#include <string.h>
+
+#include "libnetconf.h"
+
+#ifdef NC_SCAN_X86
+#   include <immintrin.h>
+#endif
+
+const char *
+nc_scan_tag_scalar(const char *data, size_t len, const char *tag, size_t tag_len)
+{
+    const char *ptr, *last;
+
+    if (!tag_len) {
+        return data;
+    } else if (tag_len > len) {
+        return NULL;
+    }
+
+    /* last position the tag can start on */
+    last = data + (len - tag_len);
+    for (ptr = data; (ptr = memchr(ptr, tag[0], (last - ptr) + 1)); ++ptr) {
+        if (!memcmp(ptr, tag, tag_len)) {
+            return ptr;
+        }
+        if (ptr == last) {
+            break;
+        }
+    }
+
+    return NULL;
+}
+
+#ifdef NC_SCAN_X86
+
+/*
+ * Both kernels compare blocks of data with the first and the last byte of the tag at once,
+ * only positions where both of them match are compared with the whole tag.
+ */
+
+__attribute__((target("sse2")))
+const char *
+nc_scan_tag_sse2(const char *data, size_t len, const char *tag, size_t tag_len)
+{
+    __m128i first, last, eq_lo, eq_hi;
+    uint32_t mask;
+    size_t i = 0;
+
+    if (!tag_len) {
+        return data;
+    } else if (tag_len > len) {
+        return NULL;
+    }
+
+    first = _mm_set1_epi8(tag[0]);
+    last = _mm_set1_epi8(tag[tag_len - 1]);
+    for (; i + (tag_len - 1) + 32 <= len; i += 32) {
+        /* 2 blocks at once, there are usually no candidates at all */
+        eq_lo = _mm_and_si128(_mm_cmpeq_epi8(first, _mm_loadu_si128((const __m128i *)(data + i))),
+                _mm_cmpeq_epi8(last, _mm_loadu_si128((const __m128i *)(data + i + (tag_len - 1)))));
+        eq_hi = _mm_and_si128(_mm_cmpeq_epi8(first, _mm_loadu_si128((const __m128i *)(data + i + 16))),
+                _mm_cmpeq_epi8(last, _mm_loadu_si128((const __m128i *)(data + i + 16 + (tag_len - 1)))));
+
+        mask = _mm_movemask_epi8(eq_lo) | (_mm_movemask_epi8(eq_hi) << 16);
+        while (mask) {
+            if (!memcmp(data + i + __builtin_ctz(mask), tag, tag_len)) {
+                return data + i + __builtin_ctz(mask);
+            }
+            /* clear the lowest set bit */
+            mask &= mask - 1;
+        }
+    }
+
+    /* the rest shorter than 2 blocks */
+    return nc_scan_tag_scalar(data + i, len - i, tag, tag_len);
+}
+
+__attribute__((target("avx2")))
+const char *
+nc_scan_tag_avx2(const char *data, size_t len, const char *tag, size_t tag_len)
+{
+    __m256i first, last, eq_lo, eq_hi;
+    uint64_t mask;
+    size_t i = 0;
+
+    if (!tag_len) {
+        return data;
+    } else if (tag_len > len) {
+        return NULL;
+    }
+
+    first = _mm256_set1_epi8(tag[0]);
+    last = _mm256_set1_epi8(tag[tag_len - 1]);
+    for (; i + (tag_len - 1) + 64 <= len; i += 64) {
+        /* 2 blocks at once, there are usually no candidates at all */
+        eq_lo = _mm256_and_si256(_mm256_cmpeq_epi8(first, _mm256_loadu_si256((const __m256i *)(data + i))),
+                _mm256_cmpeq_epi8(last, _mm256_loadu_si256((const __m256i *)(data + i + (tag_len - 1)))));
+        eq_hi = _mm256_and_si256(_mm256_cmpeq_epi8(first, _mm256_loadu_si256((const __m256i *)(data + i + 32))),
+                _mm256_cmpeq_epi8(last, _mm256_loadu_si256((const __m256i *)(data + i + 32 + (tag_len - 1)))));
+        if (_mm256_testz_si256(_mm256_or_si256(eq_lo, eq_hi), _mm256_or_si256(eq_lo, eq_hi))) {
+            continue;
+        }
+
+        mask = (uint32_t)_mm256_movemask_epi8(eq_lo) | ((uint64_t)(uint32_t)_mm256_movemask_epi8(eq_hi) << 32);
+        while (mask) {
+            if (!memcmp(data + i + __builtin_ctzll(mask), tag, tag_len)) {
+                return data + i + __builtin_ctzll(mask);
+            }
+            /* clear the lowest set bit */
+            mask &= mask - 1;
+        }
+    }
+
+    /* the rest shorter than 2 blocks */
+    return nc_scan_tag_sse2(data + i, len - i, tag, tag_len);
+}
+
+#endif /* NC_SCAN_X86 */
+
+const char *
+nc_scan_tag(const char *data, size_t len, const char *tag, size_t tag_len)
+{
+#ifdef NC_SCAN_X86
+    if (__builtin_cpu_supports("avx2")) {
+        return nc_scan_tag_avx2(data, len, tag, tag_len);
+    } else if (__builtin_cpu_supports("sse2")) {
+        return nc_scan_tag_sse2(data, len, tag, tag_len);
+    }
+#endif
+
+    return nc_scan_tag_scalar(data, len, tag, tag_len);
+}
+
+size_t
+nc_scan_xml_special_scalar(const char *data, size_t len)
+{
+    size_t i;
+
+    for (i = 0; i < len; ++i) {
+        if ((data[i] == '&') || (data[i] == '<') || (data[i] == '>')) {
+            break;
+        }
+    }
+
+    return i;
+}
+
+#ifdef NC_SCAN_X86
+
+/*
+ * '<' (0x3C) and '>' (0x3E) differ only in the second bit, so both are found by a single
+ * comparison of the data with this bit set, '&' needs another one.
+ */
+
+__attribute__((target("sse2")))
+size_t
+nc_scan_xml_special_sse2(const char *data, size_t len)
+{
+    __m128i amp, gt, bit, block;
+    uint32_t mask;
+    size_t i;
+
+    amp = _mm_set1_epi8('&');
+    gt = _mm_set1_epi8('>');
+    bit = _mm_set1_epi8(0x02);
+    for (i = 0; i + 16 <= len; i += 16) {
+        block = _mm_loadu_si128((const __m128i *)(data + i));
+        mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(block, amp),
+                _mm_cmpeq_epi8(_mm_or_si128(block, bit), gt)));
+        if (mask) {
+            return i + __builtin_ctz(mask);
+        }
+    }
+
+    /* the rest shorter than a block */
+    return i + nc_scan_xml_special_scalar(data + i, len - i);
+}
+
+__attribute__((target("avx2")))
+size_t
+nc_scan_xml_special_avx2(const char *data, size_t len)
+{
+    __m256i amp, gt, bit, block;
+    uint32_t mask;
+    size_t i;
+
+    amp = _mm256_set1_epi8('&');
+    gt = _mm256_set1_epi8('>');
+    bit = _mm256_set1_epi8(0x02);
+    for (i = 0; i + 32 <= len; i += 32) {
+        block = _mm256_loadu_si256((const __m256i *)(data + i));
+        mask = _mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(block, amp),
+                _mm256_cmpeq_epi8(_mm256_or_si256(block, bit), gt)));
+        if (mask) {
+            return i + __builtin_ctz(mask);
+        }
+    }
+
+    /* the rest shorter than a block */
+    return i + nc_scan_xml_special_sse2(data + i, len - i);
+}
+
+#endif /* NC_SCAN_X86 */
+
+size_t
+nc_scan_xml_special(const char *data, size_t len)
+{
+#ifdef NC_SCAN_X86
+    if (__builtin_cpu_supports("avx2")) {
+        return nc_scan_xml_special_avx2(data, len);
+    } else if (__builtin_cpu_supports("sse2")) {
+        return nc_scan_xml_special_sse2(data, len);
+    }
+#endif
+
+    return nc_scan_xml_special_scalar(data, len);
+}
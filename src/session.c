@@ -44,13 +44,19 @@
 
 /* in seconds */
 #define NC_CLIENT_HELLO_TIMEOUT 60
-#define NC_SERVER_HELLO_TIMEOUT 60
 
 /* in milliseconds */
 #define NC_CLOSE_REPLY_TIMEOUT 200
 
 extern struct nc_server_opts server_opts;
 
+/* maximum size of a received message, 0 for unlimited */
+volatile size_t nc_max_msg_size = 0;
+volatile int nc_print_unlocked = 0;
+
+/* transport counters of all the sessions */
+struct nc_stats_counters nc_stats_global;
+
 int
 nc_gettimespec_mono(struct timespec *ts)
 {
@@ -167,6 +173,7 @@ nc_new_session(NC_SIDE side, int shared_ti)
         pthread_mutex_init(sess->opts.server.rpc_lock, NULL);
         pthread_cond_init(sess->opts.server.rpc_cond, NULL);
         *sess->opts.server.rpc_inuse = 0;
+        pthread_mutex_init(&sess->opts.server.ps_lock, NULL);
     }
 
     if (!shared_ti) {
@@ -345,7 +352,7 @@ nc_session_io_lock(struct nc_session *session, int timeout, const char *func)
     } else if (!timeout) {
         ret = pthread_mutex_trylock(session->io_lock);
     } else { /* timeout == -1 */
-        ret = pthread_mutex_lock(session->opts.server.rpc_lock);
+        ret = pthread_mutex_lock(session->io_lock);
     }
 
     if (ret) {
@@ -509,6 +516,102 @@ nc_session_get_data(const struct nc_session *session)
     return session->data;
 }
 
+API int
+nc_session_set_chunk_size(struct nc_session *session, uint32_t size)
+{
+    if (!session) {
+        ERRARG("session");
+        return -1;
+    } else if (size && ((size < NC_WRITE_CHUNK_MIN) || (size > NC_WRITE_CHUNK_MAX))) {
+        ERRARG("size");
+        return -1;
+    }
+
+    session->chunk_size = size;
+    return 0;
+}
+
+API uint32_t
+nc_session_get_chunk_size(const struct nc_session *session)
+{
+    if (!session) {
+        ERRARG("session");
+        return 0;
+    }
+
+    return session->chunk_size ? session->chunk_size : NC_WRITE_CHUNK_SIZE;
+}
+
+static void
+nc_stats_load(struct nc_stats_counters *counters, struct nc_stats *stats)
+{
+    int i;
+
+    stats->bytes_in = atomic_load_explicit(&counters->bytes_in, memory_order_relaxed);
+    stats->bytes_out = atomic_load_explicit(&counters->bytes_out, memory_order_relaxed);
+    for (i = 0; i <= NC_MSG_NOTIF; ++i) {
+        stats->msgs_in[i] = atomic_load_explicit(&counters->msgs_in[i], memory_order_relaxed);
+        stats->msgs_out[i] = atomic_load_explicit(&counters->msgs_out[i], memory_order_relaxed);
+    }
+    stats->chunks_in = atomic_load_explicit(&counters->chunks_in, memory_order_relaxed);
+    stats->chunks_out = atomic_load_explicit(&counters->chunks_out, memory_order_relaxed);
+    stats->bad_framing = atomic_load_explicit(&counters->bad_framing, memory_order_relaxed);
+    stats->read_calls = atomic_load_explicit(&counters->read_calls, memory_order_relaxed);
+    stats->write_calls = atomic_load_explicit(&counters->write_calls, memory_order_relaxed);
+    stats->write_retries = atomic_load_explicit(&counters->write_retries, memory_order_relaxed);
+}
+
+API int
+nc_session_get_stats(const struct nc_session *session, struct nc_stats *stats)
+{
+    if (!session) {
+        ERRARG("session");
+        return -1;
+    } else if (!stats) {
+        ERRARG("stats");
+        return -1;
+    }
+
+    /* the counters are updated concurrently, loading them does not modify the session */
+    nc_stats_load((struct nc_stats_counters *)&session->stats, stats);
+    return 0;
+}
+
+API void
+nc_get_stats(struct nc_stats *stats)
+{
+    if (!stats) {
+        ERRARG("stats");
+        return;
+    }
+
+    nc_stats_load(&nc_stats_global, stats);
+}
+
+API void
+nc_set_max_msg_size(size_t max_size)
+{
+    nc_max_msg_size = max_size;
+}
+
+API size_t
+nc_get_max_msg_size(void)
+{
+    return nc_max_msg_size;
+}
+
+API void
+nc_set_print_unlocked(int enable)
+{
+    nc_print_unlocked = enable ? 1 : 0;
+}
+
+API int
+nc_get_print_unlocked(void)
+{
+    return nc_print_unlocked;
+}
+
 NC_MSG_TYPE
 nc_send_msg_io(struct nc_session *session, int io_timeout, struct lyd_node *op)
 {
@@ -752,6 +855,13 @@ nc_session_free(struct nc_session *session, void (*data_free)(void *))
     lydict_remove(session->ctx, session->host);
 
     /* final cleanup */
+    if ((session->side == NC_SERVER) && session->opts.server.ntf_queue) {
+        nc_ntf_queue_free(session->opts.server.ntf_queue);
+    }
+    if ((session->side == NC_SERVER) && session->opts.server.hs) {
+        lydict_remove(session->ctx, session->opts.server.hs->endpt_name);
+        free(session->opts.server.hs);
+    }
     if ((session->side == NC_SERVER) && session->opts.server.rpc_lock) {
         if (rpc_locked) {
             nc_session_rpc_unlock(session, NC_SESSION_LOCK_TIMEOUT, __func__);
@@ -761,6 +871,7 @@ nc_session_free(struct nc_session *session, void (*data_free)(void *))
         free(session->opts.server.rpc_lock);
         free(session->opts.server.rpc_cond);
         free((int *)session->opts.server.rpc_inuse);
+        pthread_mutex_destroy(&session->opts.server.ps_lock);
     }
 
     if (session->io_lock && !multisession) {
@@ -768,6 +879,9 @@ nc_session_free(struct nc_session *session, void (*data_free)(void *))
         free(session->io_lock);
     }
 
+    free(session->rbuf.data);
+    free(session->rmsg.data);
+
     if (!(session->flags & NC_SESSION_SHAREDCTX)) {
         ly_ctx_destroy(session->ctx, NULL);
     }
@@ -1094,35 +1208,94 @@ parse_cpblts(struct lyxml_elem *xml, char ***list)
     return ver;
 }
 
+/* returns a reference of the serialized server <hello>, it is created only once for each context module set */
+static struct nc_msg_buf *
+nc_server_hello_get(struct ly_ctx *ctx)
+{
+    struct nc_msg_buf *hello = NULL;
+    const char **cpblts;
+    unsigned int module_set_id;
+    int i;
+
+    module_set_id = ly_ctx_get_module_set_id(ctx);
+
+    /* HELLO LOCK */
+    pthread_mutex_lock(&server_opts.hello_lock);
+
+    if (!server_opts.hello || (server_opts.hello_ctx != ctx) || (server_opts.hello_module_set_id != module_set_id)) {
+        nc_msg_buf_unref(server_opts.hello);
+        server_opts.hello = NULL;
+
+        cpblts = nc_server_get_cpblts_version(ctx, LYS_VERSION_1);
+        if (!cpblts) {
+            goto cleanup;
+        }
+        server_opts.hello = nc_msg_buf_hello(cpblts);
+        server_opts.hello_ctx = ctx;
+        server_opts.hello_module_set_id = module_set_id;
+
+        for (i = 0; cpblts[i]; ++i) {
+            lydict_remove(ctx, cpblts[i]);
+        }
+        free(cpblts);
+    }
+
+    if (server_opts.hello) {
+        hello = server_opts.hello;
+        atomic_fetch_add(&hello->refs, 1);
+    }
+
+cleanup:
+    /* HELLO UNLOCK */
+    pthread_mutex_unlock(&server_opts.hello_lock);
+    return hello;
+}
+
+void
+nc_server_hello_clear(void)
+{
+    /* HELLO LOCK */
+    pthread_mutex_lock(&server_opts.hello_lock);
+
+    nc_msg_buf_unref(server_opts.hello);
+    server_opts.hello = NULL;
+    server_opts.hello_ctx = NULL;
+
+    /* HELLO UNLOCK */
+    pthread_mutex_unlock(&server_opts.hello_lock);
+}
+
 static NC_MSG_TYPE
 nc_send_hello_io(struct nc_session *session)
 {
     NC_MSG_TYPE ret;
-    int i, io_timeout;
+    int i;
     const char **cpblts;
-    uint32_t *sid;
+    struct nc_msg_buf *hello;
 
-    if (session->side == NC_CLIENT) {
-        /* client side hello - send only NETCONF base capabilities */
-        cpblts = malloc(3 * sizeof *cpblts);
-        if (!cpblts) {
-            ERRMEM;
+    if (session->side == NC_SERVER) {
+        hello = nc_server_hello_get(session->ctx);
+        if (!hello) {
             return NC_MSG_ERROR;
         }
-        cpblts[0] = lydict_insert(session->ctx, "urn:ietf:params:netconf:base:1.0", 0);
-        cpblts[1] = lydict_insert(session->ctx, "urn:ietf:params:netconf:base:1.1", 0);
-        cpblts[2] = NULL;
 
-        io_timeout = NC_CLIENT_HELLO_TIMEOUT * 1000;
-        sid = NULL;
-    } else {
-        cpblts = nc_server_get_cpblts_version(session->ctx, LYS_VERSION_1);
+        ret = nc_write_msg_io(session, NC_SERVER_HELLO_TIMEOUT * 1000, NC_MSG_HELLO, NULL, &session->id, hello);
 
-        io_timeout = NC_SERVER_HELLO_TIMEOUT * 1000;
-        sid = &session->id;
+        nc_msg_buf_unref(hello);
+        return ret;
     }
 
-    ret = nc_write_msg_io(session, io_timeout, NC_MSG_HELLO, cpblts, sid);
+    /* client side hello - send only NETCONF base capabilities */
+    cpblts = malloc(3 * sizeof *cpblts);
+    if (!cpblts) {
+        ERRMEM;
+        return NC_MSG_ERROR;
+    }
+    cpblts[0] = lydict_insert(session->ctx, "urn:ietf:params:netconf:base:1.0", 0);
+    cpblts[1] = lydict_insert(session->ctx, "urn:ietf:params:netconf:base:1.1", 0);
+    cpblts[2] = NULL;
+
+    ret = nc_write_msg_io(session, NC_CLIENT_HELLO_TIMEOUT * 1000, NC_MSG_HELLO, cpblts, NULL);
 
     for (i = 0; cpblts[i]; ++i) {
         lydict_remove(session->ctx, cpblts[i]);
@@ -1210,17 +1383,14 @@ error:
     return NC_MSG_ERROR;
 }
 
+/* process the result of reading the client's <hello>, xml is freed */
 static NC_MSG_TYPE
-nc_recv_server_hello_io(struct nc_session *session)
+nc_server_hello_process(struct nc_session *session, NC_MSG_TYPE msgtype, struct lyxml_elem *xml)
 {
-    struct lyxml_elem *xml = NULL, *node;
-    NC_MSG_TYPE msgtype;
+    struct lyxml_elem *node;
     int ver = -1;
     int flag = 0;
 
-    msgtype = nc_read_msg_poll_io(session, (server_opts.hello_timeout ?
-                                            server_opts.hello_timeout * 1000 : NC_SERVER_HELLO_TIMEOUT * 1000), &xml);
-
     switch (msgtype) {
     case NC_MSG_HELLO:
         /* get know NETCONF version */
@@ -1265,6 +1435,18 @@ cleanup:
     return msgtype;
 }
 
+static NC_MSG_TYPE
+nc_recv_server_hello_io(struct nc_session *session)
+{
+    struct lyxml_elem *xml = NULL;
+    NC_MSG_TYPE msgtype;
+
+    msgtype = nc_read_msg_poll_io(session, (server_opts.hello_timeout ?
+                                            server_opts.hello_timeout * 1000 : NC_SERVER_HELLO_TIMEOUT * 1000), &xml);
+
+    return nc_server_hello_process(session, msgtype, xml);
+}
+
 NC_MSG_TYPE
 nc_handshake_io(struct nc_session *session)
 {
@@ -1284,6 +1466,31 @@ nc_handshake_io(struct nc_session *session)
     return type;
 }
 
+NC_MSG_TYPE
+nc_handshake_step_io(struct nc_session *session)
+{
+    struct lyxml_elem *xml = NULL;
+    NC_MSG_TYPE type;
+
+    assert((session->side == NC_SERVER) && session->opts.server.hs);
+
+    if (session->opts.server.hs->stage == NC_HS_HELLO_SEND) {
+        type = nc_send_hello_io(session);
+        if (type != NC_MSG_HELLO) {
+            return type;
+        }
+        session->opts.server.hs->stage = NC_HS_HELLO_RECV;
+    }
+
+    /* read only the data available, the rest is read once it arrives */
+    type = nc_read_msg_io(session, 0, &xml, 1, 0);
+    if (type == NC_MSG_WOULDBLOCK) {
+        return type;
+    }
+
+    return nc_server_hello_process(session, type, xml);
+}
+
 #ifdef NC_ENABLED_SSH
 
 static void
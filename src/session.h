@@ -201,6 +201,102 @@ void nc_session_set_data(struct nc_session *session, void *data);
  */
 void *nc_session_get_data(const struct nc_session *session);
 
+/**
+ * @brief Transport statistics of a session or of all the sessions.
+ *
+ * All the counters only increase, from the creation of the session or the start of the process, respectively.
+ */
+struct nc_stats {
+    uint64_t bytes_in;                       /**< bytes read from the transport */
+    uint64_t bytes_out;                      /**< bytes written into the transport */
+    uint64_t msgs_in[NC_MSG_NOTIF + 1];      /**< messages received, indexed by their NC_MSG_TYPE */
+    uint64_t msgs_out[NC_MSG_NOTIF + 1];     /**< messages sent, indexed by their NC_MSG_TYPE */
+    uint64_t chunks_in;                      /**< NETCONF 1.1 chunks received */
+    uint64_t chunks_out;                     /**< NETCONF 1.1 chunks sent */
+    uint64_t bad_framing;                    /**< messages with invalid framing or exceeding the maximum size */
+    uint64_t read_calls;                     /**< transport read operations */
+    uint64_t write_calls;                    /**< transport write operations */
+    uint64_t write_retries;                  /**< writes repeated because only a part of the data (or none)
+                                                  could be written */
+};
+
+/**
+ * @brief Get the transport statistics of a session.
+ *
+ * @param[in] session Session to get the information from.
+ * @param[out] stats Current values of the session counters.
+ * @return 0 on success, -1 on error.
+ */
+int nc_session_get_stats(const struct nc_session *session, struct nc_stats *stats);
+
+/**
+ * @brief Get the transport statistics of all the sessions (including the already freed ones) of the process.
+ *
+ * @param[out] stats Current values of the global counters.
+ */
+void nc_get_stats(struct nc_stats *stats);
+
+/**
+ * @brief Set the size of the buffer messages sent on a session are written into.
+ *
+ * Every full buffer is written using a single write operation, on NETCONF 1.1 sessions as a single
+ * chunk so it is also the maximum size of a sent chunk. Larger buffers mean fewer system calls
+ * when sending large messages at the expense of memory used while sending them.
+ *
+ * @param[in] session Session to modify.
+ * @param[in] size Chunk size in bytes, from 64 B to 4 MiB, 0 to use the default (64 KiB).
+ * @return 0 on success, -1 on error.
+ */
+int nc_session_set_chunk_size(struct nc_session *session, uint32_t size);
+
+/**
+ * @brief Get the size of the buffer messages sent on a session are written into.
+ *
+ * @param[in] session Session to get the information from.
+ * @return Chunk size in bytes.
+ */
+uint32_t nc_session_get_chunk_size(const struct nc_session *session);
+
+/**
+ * @brief Set the maximum size of a received message, it applies to all the sessions.
+ *
+ * A larger message is rejected as soon as its size exceeds the limit, without reading
+ * (and storing) the rest of it. The session it was received on is invalidated, a server
+ * replies with a malformed-message error first, if using NETCONF 1.1.
+ *
+ * @param[in] max_size Maximum message size in bytes, 0 means no limit (default).
+ */
+void nc_set_max_msg_size(size_t max_size);
+
+/**
+ * @brief Get the maximum size of a received message.
+ *
+ * @return Maximum message size in bytes, 0 if not limited.
+ */
+size_t nc_get_max_msg_size(void);
+
+/**
+ * @brief Set whether replies and notifications are printed before acquiring the session IO lock,
+ * it applies to all the sessions.
+ *
+ * By default, a message is printed and written in parts while holding the session IO lock so
+ * other messages (such as notifications) to the session wait for the whole message to be printed.
+ * If enabled, the whole message is first printed into a buffer of the thread and the lock is held
+ * only while it is being written. It shortens the lock hold time at the expense of keeping
+ * the whole printed message in memory.
+ *
+ * @param[in] enable Non-zero to print messages before acquiring the lock, zero to print them while
+ *            holding it (default).
+ */
+void nc_set_print_unlocked(int enable);
+
+/**
+ * @brief Get whether replies and notifications are printed before acquiring the session IO lock.
+ *
+ * @return Non-zero if enabled, zero otherwise.
+ */
+int nc_get_print_unlocked(void);
+
 /**
  * @brief Free the NETCONF session object.
  *
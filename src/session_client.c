@@ -1697,7 +1697,7 @@ nc_client_ch_add_bind_listen(const char *address, uint16_t port, NC_TRANSPORT_IM
         return -1;
     }
 
-    sock = nc_sock_listen(address, port);
+    sock = nc_sock_listen(address, port, NC_REVERSE_QUEUE, 0);
     if (sock == -1) {
         return -1;
     }
@@ -455,6 +455,34 @@ int nc_client_tls_set_crl_paths(const char *crl_file, const char *crl_dir);
  */
 void nc_client_tls_get_crl_paths(const char **crl_file, const char **crl_dir);
 
+/**
+ * @brief Set client TLS session cache used for resuming sessions with servers connected to before.
+ *
+ * The last session of every server (host and port as passed to nc_connect_tls()) is cached
+ * and offered on the next connect to the same server, which then skips the full handshake
+ * if the server accepts it. Setting the cache flushes all the cached sessions, as does changing
+ * any certificate or CRL path. The cache is disabled by default.
+ *
+ * @param[in] cache_size Maximum number of cached sessions (servers), the least recently used ones are evicted.
+ *                       0 disables the cache.
+ * @param[in] timeout Maximum lifetime of a cached session in seconds, it is never longer than the lifetime
+ *                    announced by the server. 0 for only the server lifetime.
+ * @return 0 on success, -1 on error.
+ */
+int nc_client_tls_set_session_cache(uint32_t cache_size, uint32_t timeout);
+
+/**
+ * @brief Get client TLS session cache statistics.
+ *
+ * A hit is a connection that resumed a cached session, a miss is any other connection
+ * established while the cache was enabled.
+ *
+ * @param[out] count Number of currently cached sessions. Can be NULL.
+ * @param[out] hits Number of resumed sessions. Can be NULL.
+ * @param[out] misses Number of full handshakes. Can be NULL.
+ */
+void nc_client_tls_get_session_cache_stats(uint32_t *count, uint64_t *hits, uint64_t *misses);
+
 /**
  * @brief Connect to the NETCONF server using TLS transport (via libssl)
  *
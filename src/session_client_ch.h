@@ -335,6 +335,26 @@ int nc_client_tls_ch_set_crl_paths(const char *crl_file, const char *crl_dir);
  */
 void nc_client_tls_ch_get_crl_paths(const char **crl_file, const char **crl_dir);
 
+/**
+ * @brief Set client Call Home TLS session cache, works the same as nc_client_tls_set_session_cache().
+ *
+ * Sessions are cached per the server address and port of the accepted Call Home connection.
+ *
+ * @param[in] cache_size Maximum number of cached sessions, 0 disables the cache.
+ * @param[in] timeout Maximum lifetime of a cached session in seconds, 0 for only the server lifetime.
+ * @return 0 on success, -1 on error.
+ */
+int nc_client_tls_ch_set_session_cache(uint32_t cache_size, uint32_t timeout);
+
+/**
+ * @brief Get client Call Home TLS session cache statistics, works the same as nc_client_tls_get_session_cache_stats().
+ *
+ * @param[out] count Number of currently cached sessions. Can be NULL.
+ * @param[out] hits Number of resumed sessions. Can be NULL.
+ * @param[out] misses Number of full handshakes. Can be NULL.
+ */
+void nc_client_tls_ch_get_session_cache_stats(uint32_t *count, uint64_t *hits, uint64_t *misses);
+
 /**@} Client-side Call Home on TLS */
 
 #endif /* NC_ENABLED_TLS */
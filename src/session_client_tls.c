@@ -17,6 +17,8 @@
 
 #include <assert.h>
 #include <errno.h>
+#include <poll.h>
+#include <pthread.h>
 #include <string.h>
 #include <unistd.h>
 
@@ -38,6 +40,16 @@ int nc_session_new_ctx( struct nc_session *session, struct ly_ctx *ctx);
 
 static int tlsauth_ch;
 
+/* server a client TLS session is being established with, valid only while connecting */
+struct nc_client_tls_sess_peer {
+    struct nc_client_tls_opts *opts;
+    const char *host;
+    uint16_t port;
+};
+
+static int tls_sess_peer_idx = -1;
+static pthread_once_t tls_sess_peer_once = PTHREAD_ONCE_INIT;
+
 #if OPENSSL_VERSION_NUMBER >= 0x10100000L // >= 1.1.0
 
 static int
@@ -230,9 +242,311 @@ tlsauth_verify_callback(int preverify_ok, X509_STORE_CTX *x509_ctx)
 
 #endif
 
+static uint32_t
+nc_client_tls_sess_hash(const char *host, uint16_t port)
+{
+    uint32_t hash = 2166136261U;
+
+    /* FNV-1a */
+    for (; *host; ++host) {
+        hash = (hash ^ (unsigned char)*host) * 16777619U;
+    }
+    hash = (hash ^ (port & 0xff)) * 16777619U;
+    hash = (hash ^ (port >> 8)) * 16777619U;
+
+    return hash;
+}
+
+static struct nc_client_tls_sess **
+nc_client_tls_sess_find(struct nc_client_tls_opts *opts, const char *host, uint16_t port)
+{
+    struct nc_client_tls_sess **item;
+
+    if (!opts->sess_buckets) {
+        return NULL;
+    }
+
+    item = &opts->sess_buckets[nc_client_tls_sess_hash(host, port) & (opts->sess_bucket_count - 1)];
+    for (; *item; item = &(*item)->next) {
+        if (((*item)->port == port) && !strcmp((*item)->host, host)) {
+            return item;
+        }
+    }
+
+    return NULL;
+}
+
+static void
+nc_client_tls_sess_lru_unlink(struct nc_client_tls_opts *opts, struct nc_client_tls_sess *sess)
+{
+    if (sess->lru_prev) {
+        sess->lru_prev->lru_next = sess->lru_next;
+    } else {
+        opts->sess_lru_head = sess->lru_next;
+    }
+    if (sess->lru_next) {
+        sess->lru_next->lru_prev = sess->lru_prev;
+    } else {
+        opts->sess_lru_tail = sess->lru_prev;
+    }
+    sess->lru_prev = NULL;
+    sess->lru_next = NULL;
+}
+
+static void
+nc_client_tls_sess_lru_push(struct nc_client_tls_opts *opts, struct nc_client_tls_sess *sess)
+{
+    sess->lru_next = opts->sess_lru_head;
+    if (opts->sess_lru_head) {
+        opts->sess_lru_head->lru_prev = sess;
+    } else {
+        opts->sess_lru_tail = sess;
+    }
+    opts->sess_lru_head = sess;
+}
+
+/* item points to the bucket link of the removed session */
+static void
+nc_client_tls_sess_del(struct nc_client_tls_opts *opts, struct nc_client_tls_sess **item)
+{
+    struct nc_client_tls_sess *sess = *item;
+
+    *item = sess->next;
+    nc_client_tls_sess_lru_unlink(opts, sess);
+
+    free(sess->host);
+    SSL_SESSION_free(sess->sess);
+    free(sess);
+    --opts->sess_count;
+}
+
+static void
+nc_client_tls_sess_clear(struct nc_client_tls_opts *opts)
+{
+    struct nc_client_tls_sess *sess, *next;
+
+    for (sess = opts->sess_lru_head; sess; sess = next) {
+        next = sess->lru_next;
+        free(sess->host);
+        SSL_SESSION_free(sess->sess);
+        free(sess);
+    }
+    free(opts->sess_buckets);
+
+    opts->sess_buckets = NULL;
+    opts->sess_bucket_count = 0;
+    opts->sess_count = 0;
+    opts->sess_lru_head = NULL;
+    opts->sess_lru_tail = NULL;
+}
+
+/* takes the session reference on success */
+static int
+nc_client_tls_sess_put(struct nc_client_tls_opts *opts, const char *host, uint16_t port, SSL_SESSION *tls_sess)
+{
+    struct nc_client_tls_sess **item, *sess;
+    struct timespec ts_cur;
+    uint32_t lifetime;
+
+    if (!opts->sess_cache_size) {
+        return -1;
+    }
+
+    if (!opts->sess_buckets) {
+        /* at most one session per bucket on average */
+        for (opts->sess_bucket_count = 16; opts->sess_bucket_count < opts->sess_cache_size; opts->sess_bucket_count <<= 1) {}
+        opts->sess_buckets = calloc(opts->sess_bucket_count, sizeof *opts->sess_buckets);
+        if (!opts->sess_buckets) {
+            ERRMEM;
+            opts->sess_bucket_count = 0;
+            return -1;
+        }
+    }
+
+    if ((item = nc_client_tls_sess_find(opts, host, port))) {
+        /* replace the previous session of this server */
+        sess = *item;
+        SSL_SESSION_free(sess->sess);
+        nc_client_tls_sess_lru_unlink(opts, sess);
+    } else {
+        if (opts->sess_count == opts->sess_cache_size) {
+            /* evict the least recently used session */
+            sess = opts->sess_lru_tail;
+            nc_client_tls_sess_del(opts, nc_client_tls_sess_find(opts, sess->host, sess->port));
+        }
+
+        sess = calloc(1, sizeof *sess);
+        if (!sess) {
+            ERRMEM;
+            return -1;
+        }
+        sess->host = strdup(host);
+        if (!sess->host) {
+            ERRMEM;
+            free(sess);
+            return -1;
+        }
+        sess->port = port;
+
+        item = &opts->sess_buckets[nc_client_tls_sess_hash(host, port) & (opts->sess_bucket_count - 1)];
+        sess->next = *item;
+        *item = sess;
+        ++opts->sess_count;
+    }
+
+    sess->sess = tls_sess;
+    lifetime = SSL_SESSION_get_timeout(tls_sess);
+    if (opts->sess_timeout && (opts->sess_timeout < lifetime)) {
+        lifetime = opts->sess_timeout;
+    }
+    nc_gettimespec_mono(&ts_cur);
+    sess->expires = ts_cur.tv_sec + lifetime;
+    nc_client_tls_sess_lru_push(opts, sess);
+
+    return 0;
+}
+
+static SSL_SESSION *
+nc_client_tls_sess_get(struct nc_client_tls_opts *opts, const char *host, uint16_t port)
+{
+    struct nc_client_tls_sess **item, *sess;
+    struct timespec ts_cur;
+
+    if (!(item = nc_client_tls_sess_find(opts, host, port))) {
+        return NULL;
+    }
+    sess = *item;
+
+    nc_gettimespec_mono(&ts_cur);
+    if (ts_cur.tv_sec >= sess->expires) {
+        nc_client_tls_sess_del(opts, item);
+        return NULL;
+    }
+
+    nc_client_tls_sess_lru_unlink(opts, sess);
+    nc_client_tls_sess_lru_push(opts, sess);
+    return sess->sess;
+}
+
+static int
+nc_client_tls_sess_new_clb(SSL *tls, SSL_SESSION *tls_sess)
+{
+    struct nc_client_tls_sess_peer *peer;
+
+    /* sessions (TLS 1.3 tickets) received after the connection was established are ignored */
+    peer = SSL_get_ex_data(tls, tls_sess_peer_idx);
+    if (!peer || nc_client_tls_sess_put(peer->opts, peer->host, peer->port, tls_sess)) {
+        return 0;
+    }
+
+    /* the reference is kept */
+    return 1;
+}
+
+static void
+nc_client_tls_sess_peer_init(void)
+{
+    tls_sess_peer_idx = SSL_get_ex_new_index(0, NULL, NULL, NULL, NULL);
+}
+
+static int
+nc_client_tls_sess_start(SSL *tls, struct nc_client_tls_sess_peer *peer)
+{
+    SSL_SESSION *tls_sess;
+
+    if (!peer->opts->sess_cache_size) {
+        return 0;
+    }
+
+    if (SSL_set_ex_data(tls, tls_sess_peer_idx, peer) != 1) {
+        ERR("Failed to set TLS session data (%s).", ERR_reason_error_string(ERR_get_error()));
+        return -1;
+    }
+
+    /* offer the last session of this server */
+    if ((tls_sess = nc_client_tls_sess_get(peer->opts, peer->host, peer->port)) && (SSL_set_session(tls, tls_sess) != 1)) {
+        ERR("Failed to set the cached TLS session (%s).", ERR_reason_error_string(ERR_get_error()));
+        return -1;
+    }
+
+    return 0;
+}
+
+static void
+nc_client_tls_sess_connected(SSL *tls, struct nc_client_tls_opts *opts)
+{
+    if (!opts->sess_cache_size) {
+        return;
+    }
+
+    if (SSL_session_reused(tls)) {
+        ++opts->sess_hits;
+    } else {
+        ++opts->sess_misses;
+    }
+}
+
+static void
+nc_client_tls_sess_finish(SSL *tls)
+{
+    SSL_set_ex_data(tls, tls_sess_peer_idx, NULL);
+}
+
+static int
+_nc_client_tls_set_session_cache(uint32_t cache_size, uint32_t timeout, struct nc_client_tls_opts *opts)
+{
+    /* the hash table is allocated again for the new size on the next store */
+    nc_client_tls_sess_clear(opts);
+
+    opts->sess_cache_size = cache_size;
+    opts->sess_timeout = timeout;
+
+    return 0;
+}
+
+API int
+nc_client_tls_set_session_cache(uint32_t cache_size, uint32_t timeout)
+{
+    return _nc_client_tls_set_session_cache(cache_size, timeout, &tls_opts);
+}
+
+API int
+nc_client_tls_ch_set_session_cache(uint32_t cache_size, uint32_t timeout)
+{
+    return _nc_client_tls_set_session_cache(cache_size, timeout, &tls_ch_opts);
+}
+
+static void
+_nc_client_tls_get_session_cache_stats(uint32_t *count, uint64_t *hits, uint64_t *misses, struct nc_client_tls_opts *opts)
+{
+    if (count) {
+        *count = opts->sess_count;
+    }
+    if (hits) {
+        *hits = opts->sess_hits;
+    }
+    if (misses) {
+        *misses = opts->sess_misses;
+    }
+}
+
+API void
+nc_client_tls_get_session_cache_stats(uint32_t *count, uint64_t *hits, uint64_t *misses)
+{
+    _nc_client_tls_get_session_cache_stats(count, hits, misses, &tls_opts);
+}
+
+API void
+nc_client_tls_ch_get_session_cache_stats(uint32_t *count, uint64_t *hits, uint64_t *misses)
+{
+    _nc_client_tls_get_session_cache_stats(count, hits, misses, &tls_ch_opts);
+}
+
 static void
 _nc_client_tls_destroy_opts(struct nc_client_tls_opts *opts)
 {
+    nc_client_tls_sess_clear(opts);
+
     free(opts->cert_path);
     free(opts->key_path);
     free(opts->ca_file);
@@ -495,9 +809,14 @@ nc_client_tls_update_opts(struct nc_client_tls_opts *opts)
     char *key;
     X509_LOOKUP *lookup;
 
+    pthread_once(&tls_sess_peer_once, nc_client_tls_sess_peer_init);
+
     if (!opts->tls_ctx || opts->tls_ctx_change) {
         SSL_CTX_free(opts->tls_ctx);
 
+        /* sessions established with the previous certificates must not be resumed */
+        nc_client_tls_sess_clear(opts);
+
 #if OPENSSL_VERSION_NUMBER >= 0x10100000L // >= 1.1.0
         /* prepare global SSL context, highest available method is negotiated autmatically  */
         if (!(opts->tls_ctx = SSL_CTX_new(TLS_client_method())))
@@ -532,12 +851,21 @@ nc_client_tls_update_opts(struct nc_client_tls_opts *opts)
             ERR("Failed to load the locations of trusted CA certificates (%s).", ERR_reason_error_string(ERR_get_error()));
             return -1;
         }
+
+        /* sessions are stored only in our cache, the callback decides whether to keep them */
+        SSL_CTX_set_session_cache_mode(opts->tls_ctx, SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+        SSL_CTX_sess_set_new_cb(opts->tls_ctx, nc_client_tls_sess_new_clb);
+
+        opts->tls_ctx_change = 0;
     }
 
     if (opts->crl_store_change || (!opts->crl_store && (opts->crl_file || opts->crl_dir))) {
         /* set the revocation store with the correct paths for the callback */
         X509_STORE_free(opts->crl_store);
 
+        /* server certificates of the cached sessions were not checked against the new CRLs */
+        nc_client_tls_sess_clear(opts);
+
         opts->crl_store = X509_STORE_new();
         if (!opts->crl_store) {
             ERR("Unable to create a certificate store (%s).", ERR_reason_error_string(ERR_get_error()));
@@ -570,6 +898,8 @@ nc_client_tls_update_opts(struct nc_client_tls_opts *opts)
                 return -1;
             }
         }
+
+        opts->crl_store_change = 0;
     }
 
     return 0;
@@ -579,8 +909,9 @@ API struct nc_session *
 nc_connect_tls(const char *host, unsigned short port, struct ly_ctx *ctx)
 {
     struct nc_session *session = NULL;
-    int sock, verify, ret;
+    int sock, verify, ret, err, wait;
     struct timespec ts_timeout, ts_cur;
+    struct nc_client_tls_sess_peer peer;
 
     if (!tls_opts.cert_path || (!tls_opts.ca_file && !tls_opts.ca_dir)) {
         ERRINIT;
@@ -627,17 +958,29 @@ nc_connect_tls(const char *host, unsigned short port, struct ly_ctx *ctx)
     /* set the SSL_MODE_AUTO_RETRY flag to allow OpenSSL perform re-handshake automatically */
     SSL_set_mode(session->ti.tls, SSL_MODE_AUTO_RETRY);
 
+    /* try to resume a previous session with this server */
+    peer.opts = &tls_opts;
+    peer.host = host;
+    peer.port = port;
+    if (nc_client_tls_sess_start(session->ti.tls, &peer)) {
+        goto fail;
+    }
+
     /* connect and perform the handshake */
     nc_gettimespec_mono(&ts_timeout);
     nc_addtimespec(&ts_timeout, NC_TRANSPORT_TIMEOUT);
     tlsauth_ch = 0;
-    while (((ret = SSL_connect(session->ti.tls)) == -1) && (SSL_get_error(session->ti.tls, ret) == SSL_ERROR_WANT_READ)) {
-        usleep(NC_TIMEOUT_STEP);
+    while (((ret = SSL_connect(session->ti.tls)) == -1) && (((err = SSL_get_error(session->ti.tls, ret)) == SSL_ERROR_WANT_READ)
+            || (err == SSL_ERROR_WANT_WRITE))) {
         nc_gettimespec_mono(&ts_cur);
-        if (nc_difftimespec(&ts_cur, &ts_timeout) < 1) {
+        wait = nc_difftimespec(&ts_cur, &ts_timeout);
+        if (wait < 1) {
             ERR("SSL_connect timeout.");
             goto fail;
         }
+        if (nc_sock_wait(sock, (err == SSL_ERROR_WANT_READ) ? POLLIN : POLLOUT, wait) < 0) {
+            goto fail;
+        }
     }
     if (ret != 1) {
         switch (SSL_get_error(session->ti.tls, ret)) {
@@ -653,6 +996,7 @@ nc_connect_tls(const char *host, unsigned short port, struct ly_ctx *ctx)
         }
         goto fail;
     }
+    nc_client_tls_sess_connected(session->ti.tls, &tls_opts);
 
     /* check certificate verification result */
     verify = SSL_get_verify_result(session->ti.tls);
@@ -669,11 +1013,12 @@ nc_connect_tls(const char *host, unsigned short port, struct ly_ctx *ctx)
     }
     ctx = session->ctx;
 
-    /* NETCONF handshake */
+    /* NETCONF handshake, TLS 1.3 sessions are received with the server <hello> */
     if (nc_handshake_io(session) != NC_MSG_HELLO) {
         goto fail;
     }
     session->status = NC_STATUS_RUNNING;
+    nc_client_tls_sess_finish(session->ti.tls);
 
     if (nc_ctx_check_and_fill(session) == -1) {
         goto fail;
@@ -739,10 +1084,11 @@ fail:
 struct nc_session *
 nc_accept_callhome_tls_sock(int sock, const char *host, uint16_t port, struct ly_ctx *ctx, int timeout)
 {
-    int verify, ret;
+    int verify, ret, err, wait = -1;
     SSL *tls;
     struct nc_session *session;
     struct timespec ts_timeout, ts_cur;
+    struct nc_client_tls_sess_peer peer;
 
     if (nc_client_tls_update_opts(&tls_ch_opts)) {
         close(sock);
@@ -760,22 +1106,36 @@ nc_accept_callhome_tls_sock(int sock, const char *host, uint16_t port, struct ly
     /* set the SSL_MODE_AUTO_RETRY flag to allow OpenSSL perform re-handshake automatically */
     SSL_set_mode(tls, SSL_MODE_AUTO_RETRY);
 
+    /* try to resume a previous session with this server */
+    peer.opts = &tls_ch_opts;
+    peer.host = host;
+    peer.port = port;
+    if (nc_client_tls_sess_start(tls, &peer)) {
+        SSL_free(tls);
+        return NULL;
+    }
+
     /* connect and perform the handshake */
     if (timeout > -1) {
         nc_gettimespec_mono(&ts_timeout);
         nc_addtimespec(&ts_timeout, timeout);
     }
     tlsauth_ch = 1;
-    while (((ret = SSL_connect(tls)) == -1) && (SSL_get_error(tls, ret) == SSL_ERROR_WANT_READ)) {
-        usleep(NC_TIMEOUT_STEP);
+    while (((ret = SSL_connect(tls)) == -1) && (((err = SSL_get_error(tls, ret)) == SSL_ERROR_WANT_READ)
+            || (err == SSL_ERROR_WANT_WRITE))) {
         if (timeout > -1) {
             nc_gettimespec_mono(&ts_cur);
-            if (nc_difftimespec(&ts_cur, &ts_timeout) < 1) {
+            wait = nc_difftimespec(&ts_cur, &ts_timeout);
+            if (wait < 1) {
                 ERR("SSL_connect timeout.");
                 SSL_free(tls);
                 return NULL;
             }
         }
+        if (nc_sock_wait(sock, (err == SSL_ERROR_WANT_READ) ? POLLIN : POLLOUT, wait) < 0) {
+            SSL_free(tls);
+            return NULL;
+        }
     }
     if (ret != 1) {
         switch (SSL_get_error(tls, ret)) {
@@ -792,6 +1152,7 @@ nc_accept_callhome_tls_sock(int sock, const char *host, uint16_t port, struct ly
         SSL_free(tls);
         return NULL;
     }
+    nc_client_tls_sess_connected(tls, &tls_ch_opts);
 
     /* check certificate verification result */
     verify = SSL_get_verify_result(tls);
@@ -805,6 +1166,7 @@ nc_accept_callhome_tls_sock(int sock, const char *host, uint16_t port, struct ly
 
     session = nc_connect_libssl(tls, ctx);
     if (session) {
+        nc_client_tls_sess_finish(tls);
         session->flags |= NC_SESSION_CALLHOME;
 
         /* store information into session and the dictionary */
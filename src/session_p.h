@@ -26,6 +26,8 @@
 #include "netconf.h"
 #include "session.h"
 #include "messages_client.h"
+#include "messages_server.h"
+#include "session_server.h"
 
 #ifdef NC_ENABLED_SSH
 
@@ -88,6 +90,18 @@ struct nc_server_ssh_opts {
 #   include <openssl/bio.h>
 #   include <openssl/ssl.h>
 
+/* cached client TLS session of a single server */
+struct nc_client_tls_sess {
+    char *host;
+    uint16_t port;
+    SSL_SESSION *sess;
+    time_t expires;                         /**< monotonic time the session is no longer offered */
+
+    struct nc_client_tls_sess *next;        /**< next session in the same hash bucket */
+    struct nc_client_tls_sess *lru_prev;    /**< more recently used session */
+    struct nc_client_tls_sess *lru_next;    /**< less recently used session */
+};
+
 /* ACCESS unlocked */
 struct nc_client_tls_opts {
     char *cert_path;
@@ -101,6 +115,17 @@ struct nc_client_tls_opts {
     char *crl_dir;
     int8_t crl_store_change;
     X509_STORE *crl_store;
+
+    /* session cache, disabled if sess_cache_size is 0 */
+    uint32_t sess_cache_size;
+    uint32_t sess_timeout;
+    struct nc_client_tls_sess **sess_buckets;
+    uint32_t sess_bucket_count;             /**< power of 2 */
+    uint32_t sess_count;
+    struct nc_client_tls_sess *sess_lru_head;   /**< most recently used */
+    struct nc_client_tls_sess *sess_lru_tail;   /**< least recently used, evicted first */
+    uint64_t sess_hits;
+    uint64_t sess_misses;
 };
 
 /* ACCESS locked, separate locks */
@@ -112,6 +137,21 @@ struct nc_server_tls_opts {
     const char *trusted_ca_dir;
     X509_STORE *crl_store;
 
+    SSL_CTX *tls_ctx;          /**< context with the server and the trusted certificates, created for the first
+                                    accepted session and shared by the next ones, NULL if the options changed */
+    uint32_t tls_ctx_gen;      /**< generation of the certificates the context was created with */
+
+    uint32_t sess_cache_size;  /**< maximum number of sessions in the session ID cache, 0 if disabled */
+    int sess_tickets;          /**< whether session tickets are issued */
+    uint32_t sess_timeout;     /**< lifetime of resumable sessions in seconds */
+    unsigned char sid_ctx[16]; /**< random session ID context, sessions are resumed only on the same options */
+    struct nc_tls_ticket_key {
+        unsigned char name[16];
+        unsigned char aes_key[32];
+        unsigned char hmac_key[32];
+        time_t created;        /**< monotonic time of the key creation, 0 for no key */
+    } ticket_keys[2];          /**< key encrypting new tickets and the previous one, still accepted */
+
     struct nc_ctn {
         uint32_t id;
         const char *fingerprint;
@@ -163,6 +203,23 @@ struct nc_server_opts {
     unsigned int capabilities_count;
     const char **capabilities;
 
+    /* ACCESS locked with hello_lock */
+    struct nc_msg_buf *hello;           /**< serialized server \<hello\> without the session ID, NULL if not cached */
+    struct ly_ctx *hello_ctx;           /**< context the cached \<hello\> was created for */
+    unsigned int hello_module_set_id;   /**< module set ID of the context when the \<hello\> was created */
+    pthread_mutex_t hello_lock;
+
+    /* ACCESS locked, add/modify callbacks - WRITE rpc_clb_lock
+     *                dispatch - READ rpc_clb_lock, the counters are atomic */
+    struct nc_rpc_clb_item {
+        const struct lys_node *node;    /**< RPC or action schema node, NULL for an empty item */
+        nc_rpc_clb clb;                 /**< callback, NULL if it was removed */
+        atomic_uint_fast64_t calls;     /**< number of the callback invocations */
+    } *rpc_clbs;                        /**< open addressing hash table keyed by the schema node */
+    uint32_t rpc_clb_size;              /**< size of the table, a power of 2 */
+    uint32_t rpc_clb_count;             /**< number of the used items, at most half of the size */
+    pthread_rwlock_t rpc_clb_lock;
+
     /* ACCESS unlocked */
     uint16_t hello_timeout;
     uint16_t idle_timeout;
@@ -220,6 +277,10 @@ struct nc_server_opts {
      *                modify/poll binds - bind_lock */
     struct nc_bind *binds;
     pthread_mutex_t bind_lock;
+    int listen_backlog;
+    atomic_int reuseport;          /**< every thread accepting sessions listens on its own SO_REUSEPORT sockets,
+                                        the bind sockets are only bound */
+    atomic_uint_fast32_t bind_gen; /**< changed with the binds, the threads then update their sockets */
     struct nc_endpt {
         const char *name;
         NC_TRANSPORT_IMPL ti;
@@ -291,6 +352,11 @@ struct nc_server_opts {
  */
 #define NC_TRANSPORT_TIMEOUT 10000
 
+/**
+ * Timeout in seconds for the client \<hello\> to arrive if no hello timeout is set.
+ */
+#define NC_SERVER_HELLO_TIMEOUT 60
+
 /**
  * Timeout in msec for acquiring a lock of a session (used with a condition, so higher numbers could be required
  * only in case of extreme concurrency).
@@ -303,15 +369,35 @@ struct nc_server_opts {
 #define NC_SESSION_FREE_LOCK_TIMEOUT 1000
 
 /**
- * Timeout in msec for acquiring a lock of a pollsession structure.
+ * Number of session slots allocated at once in a pollsession.
  */
-#define NC_PS_LOCK_TIMEOUT 200
+#define NC_PS_CHUNK_SIZE 256
 
 /**
- * Timeout in msec for a thread to wait for its turn to work with a pollsession structure.
- *
+ * No pollsession slot.
+ */
+#define NC_PS_NO_SLOT UINT32_MAX
+
+/**
+ * Maximum number of events read from the pollsession epoll set at once.
  */
-#define NC_PS_QUEUE_TIMEOUT 1000
+#define NC_PS_EPOLL_EVENTS 64
+
+/**
+ * Maximum time in msec of waiting for pollsession events, then the server idle timeout is checked for changes.
+ */
+#define NC_PS_WAIT_MAX 5000
+
+/**
+ * Number of other channels of an SSH session remembered to have data buffered after checking a channel,
+ * all of them are checked if there are more.
+ */
+#define NC_PS_SSH_READY_MAX 8
+
+/**
+ * Timeout in msec of a server worker polling its sessions, then it looks for events on the sessions of busy workers.
+ */
+#define NC_WORKERS_POLL_TIMEOUT 50
 
 /**
  * Time slept in msec if no endpoint was created for a running Call Home client.
@@ -324,10 +410,78 @@ struct nc_server_opts {
 #define NC_CH_ENDPT_FAIL_WAIT 1000
 
 /**
- * Number of sockets kept waiting to be accepted.
+ * Default number of sockets kept waiting to be accepted.
  */
 #define NC_REVERSE_QUEUE 5
 
+/**
+ * Default lifetime of resumable TLS sessions in seconds, session ticket keys are rotated after this time.
+ */
+#define NC_TLS_SESS_TIMEOUT 300
+
+/**
+ * Maximum size of a received message in bytes, 0 for no limit (nc_set_max_msg_size()).
+ */
+extern volatile size_t nc_max_msg_size;
+
+/**
+ * Whether replies and notifications are printed before acquiring the session IO lock (nc_set_print_unlocked()).
+ */
+extern volatile int nc_print_unlocked;
+
+/**
+ * @brief Transport counters of a session or global ones, see struct nc_stats.
+ */
+struct nc_stats_counters {
+    atomic_uint_fast64_t bytes_in;
+    atomic_uint_fast64_t bytes_out;
+    atomic_uint_fast64_t msgs_in[NC_MSG_NOTIF + 1];
+    atomic_uint_fast64_t msgs_out[NC_MSG_NOTIF + 1];
+    atomic_uint_fast64_t chunks_in;
+    atomic_uint_fast64_t chunks_out;
+    atomic_uint_fast64_t bad_framing;
+    atomic_uint_fast64_t read_calls;
+    atomic_uint_fast64_t write_calls;
+    atomic_uint_fast64_t write_retries;
+};
+
+/**
+ * Transport counters of all the sessions (nc_get_stats()).
+ */
+extern struct nc_stats_counters nc_stats_global;
+
+/**
+ * Add to a transport counter of a session and to the global one, they are only statistics so no ordering is needed.
+ */
+#define NC_STATS_ADD(session, counter, value) \
+    do { \
+        atomic_fetch_add_explicit(&(session)->stats.counter, (value), memory_order_relaxed); \
+        atomic_fetch_add_explicit(&nc_stats_global.counter, (value), memory_order_relaxed); \
+    } while (0)
+
+/**
+ * Size in bytes of the session input buffer, data are read from the transport in blocks of up to this size.
+ */
+#define NC_READ_BUF_SIZE 16384
+
+/**
+ * Maximum size in bytes of the room made for a received NETCONF 1.1 chunk before its data arrive, the announced
+ * chunk size is only a hint, the message grows further as the data are read.
+ */
+#define NC_READ_CHUNK_RESERVE (4 * NC_READ_BUF_SIZE)
+
+/**
+ * Default size in bytes of the buffer a message is written into and so the maximum size of a sent
+ * NETCONF 1.1 chunk (nc_session_set_chunk_size()).
+ */
+#define NC_WRITE_CHUNK_SIZE 65536
+
+/**
+ * Limits of the chunk size that can be set, the minimum must fit any escaped character.
+ */
+#define NC_WRITE_CHUNK_MIN 64
+#define NC_WRITE_CHUNK_MAX (4 * 1024 * 1024)
+
 /**
  * @brief Type of the session
  */
@@ -355,6 +509,47 @@ struct nc_msg_cont {
     struct nc_msg_cont *next;
 };
 
+/**
+ * @brief Stages of a server session handshake advanced in steps by a pollsession, see nc_ps_accept()
+ */
+enum nc_hs_stage {
+    NC_HS_TRANSPORT = 0,       /**< SSH key exchange or TLS handshake */
+    NC_HS_SSH_AUTH,            /**< SSH authentication */
+    NC_HS_SSH_CHANNEL,         /**< waiting for the SSH channel with the "netconf" subsystem */
+    NC_HS_HELLO_SEND,          /**< transport established, server \<hello\> not sent yet */
+    NC_HS_HELLO_RECV           /**< waiting for the client \<hello\> */
+};
+
+/* state of a server session being established without blocking */
+struct nc_server_hs {
+    const char *endpt_name;    /**< endpoint the session was accepted on (dictionary), its options are
+                                    looked up in every transport step because they may change meanwhile */
+    NC_TRANSPORT_IMPL ti;
+    enum nc_hs_stage stage;
+    time_t deadline;           /**< monotonic time the current stage must be finished by, 0 for none */
+    uint8_t wait_out;          /**< the transport waits for the socket to become writable, too */
+};
+
+/* notifications waiting to be written to a session, see nc_session_set_notif_queue() */
+struct nc_ntf_queue {
+    pthread_mutex_t lock;      /**< protects all the members, it must not be locked while holding a PS lock */
+    struct nc_ntf_queue_item {
+        struct nc_msg_buf *msg;
+        struct nc_ntf_queue_item *next;
+    } *head, *tail;
+    atomic_uint count;         /**< number of the queued notifications, can be read without the lock */
+    size_t size;               /**< size of the queued notifications */
+    size_t head_off;           /**< part of the framed head notification already written */
+    uint8_t head_started;      /**< the head notification was offered to the transport but not finished, even if
+                                    nothing was written (TLS may have buffered it), it must be finished before
+                                    any other message is written and it is never dropped */
+    uint8_t head_busy;         /**< the head notification is being written (by the IO lock holder) */
+    size_t max_size;
+    NC_NOTIF_QUEUE_POLICY policy;
+    uint64_t sent;
+    uint64_t dropped;
+};
+
 /**
  * @brief NETCONF session structure
  */
@@ -391,16 +586,36 @@ struct nc_session {
         SSL *tls;
 #endif
     } ti;                          /**< transport implementation data */
+    struct {
+        char *data;                /**< input buffer of NC_READ_BUF_SIZE bytes, allocated on the first read */
+        size_t start;              /**< offset of the first unprocessed byte */
+        size_t end;                /**< offset following the last read byte */
+    } rbuf;                        /**< data read from the transport, but not yet processed */
+    struct {
+        char *data;                /**< message decoded so far */
+        size_t len;                /**< length of the decoded message */
+        size_t size;               /**< allocated size of data */
+        size_t scanned;            /**< NETCONF 1.0 - length of data already searched for the end tag */
+        uint64_t chunk_left;       /**< NETCONF 1.1 - bytes of the current chunk not received yet */
+        int active;                /**< whether a message is being received */
+        struct timespec ts_act_timeout; /**< the whole message must be received before this time */
+    } rmsg;                        /**< state of the message being received, kept between partial reads */
+    uint32_t chunk_size;           /**< size of the output buffer and maximum sent chunk, 0 for NC_WRITE_CHUNK_SIZE */
+    struct nc_stats_counters stats; /**< transport counters */
     const char *username;
     const char *host;
     uint16_t port;
 
     /* other */
+    uint32_t ps_slot;              /**< slot of the session in the pollsession it was last added to */
+    _Atomic(struct nc_pollsession *) ps; /**< pollsession the session is in, to be told about queued notifications,
+                                              changed only with opts.server.ps_lock held */
     struct ly_ctx *ctx;            /**< libyang context of the session */
     void *data;                    /**< arbitrary user data */
     uint8_t flags;                 /**< various flags of the session - TODO combine with status and/or side */
 #define NC_SESSION_SHAREDCTX 0x01
 #define NC_SESSION_CALLHOME 0x02
+#define NC_SESSION_FD_NOTSOCK 0x80 /* NC_TI_FD output is not a socket, MSG_NOSIGNAL cannot be used */
 
     union {
         struct {
@@ -429,6 +644,13 @@ struct nc_session {
             pthread_mutex_t *ch_lock;      /**< Call Home thread lock */
             pthread_cond_t *ch_cond;       /**< Call Home thread condition */
 
+            struct nc_server_hs *hs;       /**< handshake state while the session is being established
+                                                by a pollsession, NULL otherwise */
+            _Atomic(struct nc_ntf_queue *) ntf_queue; /**< notifications written asynchronously, NULL if they
+                                                           are written directly, kept until the session is freed */
+            pthread_mutex_t ps_lock;       /**< lock for changing ps, held while a notifier takes a reference
+                                                of the pollsession so that it cannot be freed meanwhile */
+
             /* server flags */
 #ifdef NC_ENABLED_SSH
             /* SSH session authenticated */
@@ -449,28 +671,95 @@ struct nc_session {
     } opts;
 };
 
+/**
+ * Bits of the slot index on a timer wheel level, which has 1 << NC_TIMER_SLOT_BITS slots.
+ */
+#define NC_TIMER_SLOT_BITS 6
+#define NC_TIMER_SLOTS (1 << NC_TIMER_SLOT_BITS)
+
+/**
+ * Number of timer wheel levels, timers expiring later than 1 << (NC_TIMER_SLOT_BITS * NC_TIMER_LEVELS) seconds
+ * (about 194 days) from now are moved between the slots of the highest level until they are close enough.
+ */
+#define NC_TIMER_LEVELS 4
+
+struct nc_timer {
+    time_t expire;             /**< monotonic time in seconds */
+    void *data;                /**< user data of the timer */
+    struct nc_timer *next;
+    struct nc_timer **pprev;   /**< pointer to this timer in the slot list, NULL if the timer is not scheduled */
+    uint8_t level;
+    uint8_t slot;
+};
+
+/* hierarchical timer wheel of second granularity, level N slot covers (1 << (NC_TIMER_SLOT_BITS * N)) seconds,
+ * its timers are moved to the lower levels once it is reached and expired from level 0 */
+struct nc_timer_wheel {
+    struct nc_timer *slots[NC_TIMER_LEVELS][NC_TIMER_SLOTS];
+    uint64_t occupied[NC_TIMER_LEVELS]; /**< bitmaps of the non-empty slots */
+    time_t now;                /**< the time the wheel was run until */
+    uint32_t count;            /**< number of scheduled timers */
+};
+
 enum nc_ps_session_state {
     NC_PS_STATE_NONE = 0,      /**< session is not being worked with */
     NC_PS_STATE_BUSY,          /**< session is being polled or communicated on (and locked) */
     NC_PS_STATE_INVALID        /**< session is invalid and was already returned by another poll */
 };
 
+/* slot of a pollsession session */
 struct nc_ps_session {
-    struct nc_session *session;
+    struct nc_session *session; /**< NULL if the slot is unused */
     enum nc_ps_session_state state;
+    int fd;                    /**< session input fd in the epoll set if registered by this slot, -1 otherwise */
+    struct nc_ps_session *fd_next; /**< ring of the slots of SSH channels sharing the fd, it is registered once by
+                                        one of them and an event makes all of them pending, NULL if not shared */
+    uint8_t in_epoll;          /**< whether an event on the session fd makes it pending, it is always pending if not */
+    uint32_t slot;             /**< index of this slot */
+    uint32_t idx;              /**< index of the session in the pollsession sessions */
+    uint32_t next_unused;      /**< next unused slot, an event on the fd of a removed session may still be being
+                                    processed, so the slots are reused but never freed with the pollsession */
+    uint32_t pending_pos;      /**< index of the session in the pollsession pending, if there */
+    uint8_t pending;           /**< whether the session is in the pending list */
+    uint8_t checked;           /**< whether the session is being checked by a thread not holding the PS lock,
+                                    it is neither pending nor removed meanwhile */
+    uint8_t recheck;           /**< the session should become pending once it is checked */
+    uint8_t event;             /**< the session has an #NC_PSPOLL_RPC event not processed yet, it is RPC locked
+                                    and not removed meanwhile */
+    uint8_t wait_out;          /**< the fd is waited for to become writable as well, for a handshake */
+    struct nc_timer timer;     /**< the session is checked when its idle, active read, or handshake timeout
+                                    may elapse */
 };
 
-/* ACCESS locked */
+/* ACCESS locked, held only for short periods, threads take the sessions to be checked one at a time */
 struct nc_pollsession {
-    struct nc_ps_session **sessions;
-    uint16_t session_count;
-    uint16_t last_event_session;
-
-    pthread_cond_t cond;
+    struct nc_ps_session **chunks;   /**< slots of the sessions in chunks of NC_PS_CHUNK_SIZE, a chunk is never moved
+                                          so that the sessions can be checked without the PS lock */
+    uint32_t chunk_count;
+    uint32_t *sessions;              /**< index map, slots of the sessions in the order they were added in, the last
+                                          one is moved in place of a removed one */
+    uint32_t session_count;
+    uint32_t size;                   /**< allocated items of sessions and pending, at least session_count */
+    uint32_t unused;                 /**< first unused slot, NC_PS_NO_SLOT if there is none */
+
+    struct nc_ps_session **pending; /**< round buffer of the sessions to be checked without waiting for an event
+                                         on their fd, these are the sessions that may have data buffered, no fd
+                                         in the epoll set, or whose fd has signalled an event */
+    uint32_t pending_begin;          /**< pending list starts on pending[pending_begin] */
+    uint32_t pending_count;
+    int epfd;                        /**< epoll set of the session fds, they are added with EPOLLONESHOT and
+                                          re-armed after the session is found to have no more data, -1 if not used */
+    int evfd;                        /**< eventfd in the epoll set (also EPOLLONESHOT) to wake up a thread waiting
+                                          for events if there are sessions pending */
+    int woken;                       /**< evfd was signalled and not yet read */
+    unsigned int waiting;            /**< number of threads waiting for events */
+    struct nc_timer_wheel timers;    /**< timers of the sessions, run once per wakeup */
+    uint16_t idle_timeout;           /**< server idle timeout the timers were scheduled with */
+    atomic_uint notifiers;           /**< number of threads making a session pending from outside the pollsession,
+                                          the pollsession is not freed until there are none */
+
+    pthread_cond_t cond;             /**< signalled when a session stops being checked or its event is processed */
     pthread_mutex_t lock;
-    uint8_t queue[NC_PS_QUEUE_SIZE]; /**< round buffer, queue is empty when queue_len == 0 */
-    uint8_t queue_begin;             /**< queue starts on queue[queue_begin] */
-    uint8_t queue_len;               /**< queue ends on queue[(queue_begin + queue_len - 1) % NC_PS_QUEUE_SIZE] */
 };
 
 struct nc_ntf_thread_arg {
@@ -504,10 +793,6 @@ int nc_session_io_lock(struct nc_session *session, int timeout, const char *func
 
 int nc_session_io_unlock(struct nc_session *session, const char *func);
 
-int nc_ps_lock(struct nc_pollsession *ps, uint8_t *id, const char *func);
-
-int nc_ps_unlock(struct nc_pollsession *ps, uint8_t id, const char *func);
-
 /**
  * @brief Fill libyang context in \p session. Context models are based on the stored session
  *        capabilities. If the server does not support \<get-schema\>, the models are searched
@@ -527,6 +812,18 @@ int nc_ctx_check_and_fill(struct nc_session *session);
  */
 NC_MSG_TYPE nc_handshake_io(struct nc_session *session);
 
+/**
+ * @brief Perform a step of the NETCONF handshake on a server \p session without blocking.
+ *
+ * Server \<hello\> is sent in the first step (stage #NC_HS_HELLO_SEND), then the client \<hello\>
+ * is read as far as it is available in every step.
+ *
+ * @param[in] session NETCONF session with an established transport and handshake state.
+ * @return NC_MSG_HELLO on success, NC_MSG_WOULDBLOCK if the client \<hello\> is not complete yet,
+ * NC_MSG_BAD_HELLO on client \<hello\> message parsing fail, NC_MSG_ERROR on other error.
+ */
+NC_MSG_TYPE nc_handshake_step_io(struct nc_session *session);
+
 /**
  * @brief Create a socket connection.
  *
@@ -554,9 +851,11 @@ int nc_sock_accept(int sock, int timeout, char **peer_host, uint16_t *peer_port)
  *
  * @param[in] address IP address to listen on.
  * @param[in] port Port to listen on.
+ * @param[in] backlog Maximum number of connections waiting to be accepted, -1 to only bind the socket.
+ * @param[in] reuseport Whether to set SO_REUSEPORT so that more sockets can listen on \p address and \p port.
  * @return Listening socket, -1 on error.
  */
-int nc_sock_listen(const char *address, uint16_t port);
+int nc_sock_listen(const char *address, uint16_t port, int backlog, int reuseport);
 
 /**
  * @brief Accept a new connection on a listening socket.
@@ -598,6 +897,15 @@ struct nc_ch_client *nc_server_ch_client_lock(const char *name, NC_TRANSPORT_IMP
  */
 void nc_server_ch_client_unlock(struct nc_ch_client *client);
 
+/**
+ * @brief Get a pollsession slot, should be called holding the PS lock.
+ *
+ * @param[in] ps Pollsession structure.
+ * @param[in] slot Index of the slot.
+ * @return Slot structure, its address never changes.
+ */
+struct nc_ps_session *nc_ps_slot(const struct nc_pollsession *ps, uint32_t slot);
+
 /**
  * @brief Add a client Call Home bind, listen on it.
  *
@@ -658,6 +966,32 @@ struct nc_session *nc_accept_callhome_ssh_sock(int sock, const char *host, uint1
  */
 int nc_accept_ssh_session(struct nc_session *session, int sock, int timeout);
 
+/**
+ * @brief Start establishing SSH transport on a socket, it is then established by nc_accept_ssh_session_step().
+ *
+ * @param[in] session Session structure of the new connection.
+ * @param[in] sock Socket of the new connection, it is closed on error.
+ * @return 0 on success, -1 on error.
+ */
+int nc_accept_ssh_session_start(struct nc_session *session, int sock);
+
+/**
+ * @brief Perform a step of establishing SSH transport without blocking, the handshake stage is updated.
+ *
+ * @param[in] session Session structure of the new connection with handshake state and endpoint options.
+ * @return 1 once the NETCONF SSH channel is open, 0 if waiting for the client, -1 on error.
+ */
+int nc_accept_ssh_session_step(struct nc_session *session);
+
+/**
+ * @brief Prepare a new NETCONF SSH channel of a session for its NETCONF handshake to be performed
+ * in steps by a pollsession, see nc_ps_handshake_step().
+ *
+ * @param[in] orig_session Session with a new NETCONF SSH channel.
+ * @return Session of the new channel with the handshake stage #NC_HS_HELLO_SEND, NULL if there is none.
+ */
+struct nc_session *nc_session_ssh_channel_hs(struct nc_session *orig_session);
+
 /**
  * @brief Callback called when a new SSH message is received.
  *
@@ -688,12 +1022,151 @@ struct nc_session *nc_accept_callhome_tls_sock(int sock, const char *host, uint1
  */
 int nc_accept_tls_session(struct nc_session *session, int sock, int timeout);
 
+/**
+ * @brief Start establishing TLS transport on a socket, it is then established by nc_accept_tls_session_step().
+ *
+ * @param[in] session Session structure of the new connection.
+ * @param[in] sock Socket of the new connection, it is closed on error.
+ * @return 0 on success, -1 on error.
+ */
+int nc_accept_tls_session_start(struct nc_session *session, int sock);
+
+/**
+ * @brief Perform a step of the TLS handshake without blocking.
+ *
+ * @param[in] session Session structure of the new connection with handshake state and endpoint options.
+ * @return 1 once the handshake is finished, 0 if waiting for the client, -1 on error.
+ */
+int nc_accept_tls_session_step(struct nc_session *session);
+
 void nc_server_tls_clear_opts(struct nc_server_tls_opts *opts);
 
 void nc_client_tls_destroy_opts(void);
 
 #endif /* NC_ENABLED_TLS */
 
+/**
+ * Functions
+ * - scan.c
+ */
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+/* SSE2/AVX2 scanning kernels can be built */
+#   define NC_SCAN_X86
+#endif
+
+/**
+ * @brief Find the first occurrence of a tag (framing delimiter) in data.
+ *
+ * The fastest kernel supported by the CPU is used (AVX2, SSE2, or the portable one).
+ *
+ * @param[in] data Data to search in.
+ * @param[in] len Length of \p data.
+ * @param[in] tag Tag to find, need not be null-terminated.
+ * @param[in] tag_len Length of \p tag.
+ * @return Pointer to the first occurrence of \p tag in \p data, NULL if there is none.
+ */
+const char *nc_scan_tag(const char *data, size_t len, const char *tag, size_t tag_len);
+
+/**
+ * @brief Portable (memchr() and memcmp()) kernel of nc_scan_tag().
+ */
+const char *nc_scan_tag_scalar(const char *data, size_t len, const char *tag, size_t tag_len);
+
+#ifdef NC_SCAN_X86
+
+/**
+ * @brief SSE2 kernel of nc_scan_tag(), the CPU must support SSE2.
+ */
+const char *nc_scan_tag_sse2(const char *data, size_t len, const char *tag, size_t tag_len);
+
+/**
+ * @brief AVX2 kernel of nc_scan_tag(), the CPU must support AVX2.
+ */
+const char *nc_scan_tag_avx2(const char *data, size_t len, const char *tag, size_t tag_len);
+
+#endif
+
+/**
+ * @brief Find the first character that must be escaped in XML text content ('&', '<', or '>').
+ *
+ * The fastest kernel supported by the CPU is used (AVX2, SSE2, or the portable one).
+ *
+ * @param[in] data Text to search in.
+ * @param[in] len Length of \p data.
+ * @return Offset of the first such character, \p len if there is none.
+ */
+size_t nc_scan_xml_special(const char *data, size_t len);
+
+/**
+ * @brief Portable kernel of nc_scan_xml_special().
+ */
+size_t nc_scan_xml_special_scalar(const char *data, size_t len);
+
+#ifdef NC_SCAN_X86
+
+/**
+ * @brief SSE2 kernel of nc_scan_xml_special(), the CPU must support SSE2.
+ */
+size_t nc_scan_xml_special_sse2(const char *data, size_t len);
+
+/**
+ * @brief AVX2 kernel of nc_scan_xml_special(), the CPU must support AVX2.
+ */
+size_t nc_scan_xml_special_avx2(const char *data, size_t len);
+
+#endif
+
+/**
+ * Functions
+ * - timer.c
+ */
+
+/**
+ * @brief Initialize a timer wheel.
+ *
+ * @param[in] wheel Timer wheel to initialize.
+ * @param[in] now Current monotonic time in seconds.
+ */
+void nc_timer_wheel_init(struct nc_timer_wheel *wheel, time_t now);
+
+/**
+ * @brief Schedule a timer, it is rescheduled if it already is.
+ *
+ * @param[in] wheel Timer wheel.
+ * @param[in] timer Zeroed or previously used timer.
+ * @param[in] expire Monotonic time in seconds of the expiration, the timer expires on the next run of the wheel
+ * if it has already passed.
+ */
+void nc_timer_add(struct nc_timer_wheel *wheel, struct nc_timer *timer, time_t expire);
+
+/**
+ * @brief Cancel a timer, nothing is done if it is not scheduled.
+ *
+ * @param[in] wheel Timer wheel.
+ * @param[in] timer Timer to cancel.
+ */
+void nc_timer_del(struct nc_timer_wheel *wheel, struct nc_timer *timer);
+
+/**
+ * @brief Get the time the wheel should be run next at so that no timer expires late.
+ *
+ * It is the time of the first expiration or of moving some timers between levels, whichever is sooner.
+ *
+ * @param[in] wheel Timer wheel.
+ * @return Monotonic time in seconds, 0 if there are no timers.
+ */
+time_t nc_timer_next(const struct nc_timer_wheel *wheel);
+
+/**
+ * @brief Run the wheel until the current time, each expiration takes O(1).
+ *
+ * @param[in] wheel Timer wheel.
+ * @param[in] now Current monotonic time in seconds.
+ * @return List (linked by next) of the expired timers, which are no longer scheduled.
+ */
+struct nc_timer *nc_timer_run(struct nc_timer_wheel *wheel, time_t now);
+
 /**
  * Functions
  * - io.c
@@ -725,13 +1198,18 @@ NC_MSG_TYPE nc_read_msg_poll_io(struct nc_session* session, int io_timeout, stru
  * @param[in] io_timeout Timeout in milliseconds. Negative value means infinite timeout,
  *            zero value causes to return immediately.
  * @param[out] data XML tree built from the read data.
+ * @param[in] partial True to read only the data available right away. If they do not complete the message,
+ *            the part received is kept in \p session, #NC_MSG_WOULDBLOCK returned, and the next call continues
+ *            with the rest of it.
  * @param[in] passing_io_lock True if \p session IO lock is already held. This function always unlocks
  *            it before returning!
  * @return Type of the read message. #NC_MSG_WOULDBLOCK is returned if timeout is positive
- * (or zero) value and it passed out without any data on the wire. #NC_MSG_ERROR is
- * returned on error and #NC_MSG_NONE is never returned by this function.
+ * (or zero) value and it passed out without any data on the wire or if only a part of the message
+ * was read in the partial mode. #NC_MSG_ERROR is returned on error and #NC_MSG_NONE is never
+ * returned by this function.
  */
-NC_MSG_TYPE nc_read_msg_io(struct nc_session* session, int io_timeout, struct lyxml_elem **data, int passing_io_lock);
+NC_MSG_TYPE nc_read_msg_io(struct nc_session* session, int io_timeout, struct lyxml_elem **data, int partial,
+                           int passing_io_lock);
 
 /**
  * @brief Write message into wire.
@@ -753,8 +1231,10 @@ NC_MSG_TYPE nc_read_msg_io(struct nc_session* session, int io_timeout, struct ly
  * - #NC_MSG_NOTIF
  *   - `struct nc_server_notif *notif;` - notification object. Required parameter.
  * - #NC_MSG_HELLO
- *   - `const char **capabs;` - capabilities array ended with NULL. Required parameter.
+ *   - `const char **capabs;` - capabilities array ended with NULL. If NULL, the next parameter is used instead.
  *   - `uint32_t *sid;` - session ID to be included in the hello message. Optional parameter.
+ *   - `const struct nc_msg_buf *hello;` - capabilities serialized by nc_msg_buf_hello(). Required
+ *     parameter only if `capabs` is NULL.
  *
  * @return Type of the written message. #NC_MSG_WOULDBLOCK is returned if timeout is positive
  * (or zero) value and IO lock could not be acquired in that time. #NC_MSG_ERROR is
@@ -762,6 +1242,92 @@ NC_MSG_TYPE nc_read_msg_io(struct nc_session* session, int io_timeout, struct ly
  */
 NC_MSG_TYPE nc_write_msg_io(struct nc_session *session, int io_timeout, int type, ...);
 
+/**
+ * @brief Serialize a notification into a new shared message buffer.
+ *
+ * @param[in] notif Notification to serialize.
+ * @return Message buffer with a single reference, NULL on error.
+ */
+struct nc_msg_buf *nc_msg_buf_notif(const struct nc_server_notif *notif);
+
+/**
+ * @brief Drop the cached server \<hello\>, must be called whenever the server capabilities options change.
+ *
+ * The cache is also recreated automatically when the module set ID of the context changes.
+ */
+void nc_server_hello_clear(void);
+
+/**
+ * @brief Serialize the beginning of a \<hello\> with the capabilities into a new shared message buffer.
+ *
+ * @param[in] capabilities Capabilities array ended with NULL.
+ * @return Message buffer with a single reference, NULL on error.
+ */
+struct nc_msg_buf *nc_msg_buf_hello(const char **capabilities);
+
+/**
+ * @brief Drop a reference of a shared message buffer, it is freed with the last one.
+ *
+ * @param[in] msg Message buffer, can be NULL.
+ */
+void nc_msg_buf_unref(struct nc_msg_buf *msg);
+
+/**
+ * @brief Write an already serialized message into wire, only the session framing is added to it.
+ *
+ * @param[in] session NETCONF session to which the message will be written.
+ * @param[in] io_timeout Timeout in milliseconds. Negative value means infinite timeout,
+ *            zero value causes to return immediately.
+ * @param[in] type The type of the serialized message, specified as #NC_MSG_TYPE value.
+ * @param[in] msg Serialized message.
+ * @return Same as nc_write_msg_io().
+ */
+NC_MSG_TYPE nc_write_msg_buf_io(struct nc_session *session, int io_timeout, int type, const struct nc_msg_buf *msg);
+
+/**
+ * @brief Queue a serialized notification to be written to a session, the queue overflow policy is applied.
+ *
+ * @param[in] session Server session with a notification queue.
+ * @param[in] msg Serialized notification, the queue takes its own reference.
+ * @param[in] timeout Timeout in milliseconds for the queue to make room with #NC_NOTIF_QUEUE_BLOCK policy.
+ * @return #NC_MSG_NOTIF if queued, #NC_MSG_WOULDBLOCK if there was no room for it in time,
+ *         #NC_MSG_NONE if the queue is disabled and the notification is to be written directly,
+ *         #NC_MSG_ERROR on error or if the subscription was terminated.
+ */
+NC_MSG_TYPE nc_ntf_queue_add(struct nc_session *session, struct nc_msg_buf *msg, int timeout);
+
+/**
+ * @brief Write the queued notifications, the session must be IO locked.
+ *
+ * @param[in] session Server session, it need not have a notification queue.
+ * @param[in] nonblock Whether to write only as much as the transport accepts without waiting.
+ * @param[in] started Whether to finish only the notification that has been partially written, if any.
+ * @return 0 if all the requested notifications were written, 1 if some are left to be written,
+ *         -1 on error (the session is invalidated).
+ */
+int nc_ntf_queue_write(struct nc_session *session, int nonblock, int started);
+
+/**
+ * @brief Free a notification queue with all the notifications in it.
+ *
+ * @param[in] queue Notification queue to free, can be NULL.
+ */
+void nc_ntf_queue_free(struct nc_ntf_queue *queue);
+
+/**
+ * @brief Wait for a transport socket to become ready for reading or writing.
+ *
+ * If the library is built with busy waiting (NC_BUSY_WAIT), it only sleeps for #NC_TIMEOUT_STEP
+ * and the caller is expected to check its own timeout.
+ *
+ * @param[in] sock Socket to wait on.
+ * @param[in] events Poll events to wait for (POLLIN, POLLOUT).
+ * @param[in] timeout Timeout in msec, -1 for infinite.
+ * @return 1 if ready (errors are left for the following I/O operation to detect), 0 on timeout or an interrupt,
+ *         -1 on error.
+ */
+int nc_sock_wait(int sock, short events, int timeout);
+
 /**
  * @brief Check whether a session is still connected (on transport layer).
  *
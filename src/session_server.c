@@ -32,11 +32,19 @@
 #include "libnetconf.h"
 #include "session_server.h"
 
+#ifdef HAVE_EPOLL
+#   include <sys/epoll.h>
+#   include <sys/eventfd.h>
+#endif
+
 struct nc_server_opts server_opts = {
 #ifdef NC_ENABLED_SSH
     .authkey_lock = PTHREAD_MUTEX_INITIALIZER,
 #endif
+    .hello_lock = PTHREAD_MUTEX_INITIALIZER,
+    .rpc_clb_lock = PTHREAD_RWLOCK_INITIALIZER,
     .bind_lock = PTHREAD_MUTEX_INITIALIZER,
+    .listen_backlog = NC_REVERSE_QUEUE,
     .endpt_lock = PTHREAD_RWLOCK_INITIALIZER,
     .ch_client_lock = PTHREAD_RWLOCK_INITIALIZER
 };
@@ -162,7 +170,7 @@ nc_session_set_status(struct nc_session *session, NC_STATUS status)
 }
 
 int
-nc_sock_listen(const char *address, uint16_t port)
+nc_sock_listen(const char *address, uint16_t port, int backlog, int reuseport)
 {
     int opt;
     int is_ipv4, sock;
@@ -194,6 +202,17 @@ nc_sock_listen(const char *address, uint16_t port)
         ERR("Could not set SO_KEEPALIVE option (%s).", strerror(errno));
         goto fail;
     }
+#ifdef SO_REUSEPORT
+    if (reuseport) {
+        opt = 1;
+        if (setsockopt(sock, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof opt) == -1) {
+            ERR("Could not set SO_REUSEPORT socket option (%s).", strerror(errno));
+            goto fail;
+        }
+    }
+#else
+    (void)reuseport;
+#endif
 
     bzero(&saddr, sizeof(struct sockaddr_storage));
     if (is_ipv4) {
@@ -229,7 +248,7 @@ nc_sock_listen(const char *address, uint16_t port)
         }
     }
 
-    if (listen(sock, NC_REVERSE_QUEUE) == -1) {
+    if ((backlog > -1) && (listen(sock, backlog) == -1)) {
         ERR("Unable to start listening on \"%s\" port %d (%s).", address, port, strerror(errno));
         goto fail;
     }
@@ -548,6 +567,16 @@ nc_server_destroy(void)
     free(server_opts.capabilities);
     server_opts.capabilities = NULL;
     server_opts.capabilities_count = 0;
+    nc_server_hello_clear();
+
+    /* WRITE LOCK */
+    pthread_rwlock_wrlock(&server_opts.rpc_clb_lock);
+    free(server_opts.rpc_clbs);
+    server_opts.rpc_clbs = NULL;
+    server_opts.rpc_clb_size = 0;
+    server_opts.rpc_clb_count = 0;
+    /* UNLOCK */
+    pthread_rwlock_unlock(&server_opts.rpc_clb_lock);
 
 #if defined(NC_ENABLED_SSH) || defined(NC_ENABLED_TLS)
     nc_server_del_endpt(NULL, 0);
@@ -595,6 +624,7 @@ nc_server_set_capab_withdefaults(NC_WD_MODE basic_mode, int also_supported)
 
     server_opts.wd_basic_mode = basic_mode;
     server_opts.wd_also_supported = also_supported;
+    nc_server_hello_clear();
     return 0;
 }
 
@@ -632,6 +662,7 @@ nc_server_set_capability(const char *value)
     }
     server_opts.capabilities = new;
     server_opts.capabilities[server_opts.capabilities_count - 1] = lydict_insert(server_opts.ctx, value, 0);
+    nc_server_hello_clear();
 
     return EXIT_SUCCESS;
 }
@@ -721,161 +752,315 @@ nc_accept_inout(int fdin, int fdout, const char *username, struct nc_session **s
     return msgtype;
 }
 
+/* wake up a thread waiting for events to check the pending sessions, should be called holding the PS lock */
 static void
-nc_ps_queue_add_id(struct nc_pollsession *ps, uint8_t *id)
+nc_ps_wake(struct nc_pollsession *ps)
 {
-    uint8_t q_last;
+#ifdef HAVE_EPOLL
+    uint64_t one = 1;
 
-    if (ps->queue_len == NC_PS_QUEUE_SIZE) {
-        ERRINT;
+    if ((ps->evfd == -1) || !ps->waiting || ps->woken) {
+        /* no one to wake up or someone is already being woken up */
         return;
     }
 
-    /* get a unique queue value (by adding 1 to the last added value, if any) */
-    if (ps->queue_len) {
-        q_last = (ps->queue_begin + ps->queue_len - 1) % NC_PS_QUEUE_SIZE;
-        *id = ps->queue[q_last] + 1;
-    } else {
-        *id = 0;
+    if (write(ps->evfd, &one, sizeof one) == -1) {
+        WRN("Failed to wake up a pollsession thread (%s).", strerror(errno));
+        return;
     }
+    ps->woken = 1;
+#else
+    (void)ps;
+#endif
+}
 
-    /* add the id into the queue */
-    ++ps->queue_len;
-    q_last = (ps->queue_begin + ps->queue_len - 1) % NC_PS_QUEUE_SIZE;
-    ps->queue[q_last] = *id;
+struct nc_ps_session *
+nc_ps_slot(const struct nc_pollsession *ps, uint32_t slot)
+{
+    return &ps->chunks[slot / NC_PS_CHUNK_SIZE][slot % NC_PS_CHUNK_SIZE];
 }
 
+/* the session is to be checked by the first thread free to do so, should be called holding the PS lock */
 static void
-nc_ps_queue_remove_id(struct nc_pollsession *ps, uint8_t id)
+nc_ps_pending_add(struct nc_pollsession *ps, struct nc_ps_session *ps_session)
 {
-    uint8_t i, q_idx, found = 0;
+    if (ps_session->checked) {
+        /* the thread checking it will make it pending */
+        ps_session->recheck = 1;
+    } else if (!ps_session->pending) {
+        ps_session->pending = 1;
+        ps_session->pending_pos = (ps->pending_begin + ps->pending_count) % ps->size;
+        ps->pending[ps_session->pending_pos] = ps_session;
+        ++ps->pending_count;
+    }
+}
 
-    for (i = 0; i < ps->queue_len; ++i) {
-        /* get the actual queue idx */
-        q_idx = (ps->queue_begin + i) % NC_PS_QUEUE_SIZE;
+/* take the first pending session to be checked by this thread, should be called holding the PS lock */
+static struct nc_ps_session *
+nc_ps_pending_take(struct nc_pollsession *ps)
+{
+    struct nc_ps_session *ps_session;
 
-        if (found) {
-            if (ps->queue[q_idx] == id) {
-                /* another equal value, simply cannot be */
-                ERRINT;
-            }
-            if (found == 2) {
-                /* move the following values */
-                ps->queue[q_idx ? q_idx - 1 : NC_PS_QUEUE_SIZE - 1] = ps->queue[q_idx];
-            }
-        } else if (ps->queue[q_idx] == id) {
-            /* found our id, there can be no more equal valid values */
-            if (i == 0) {
-                found = 1;
-            } else {
-                /* this is not okay, our id is in the middle of the queue */
-                found = 2;
-            }
-        }
+    if (!ps->pending_count) {
+        return NULL;
     }
-    if (!found) {
-        ERRINT;
+
+    ps_session = ps->pending[ps->pending_begin];
+    ps->pending_begin = (ps->pending_begin + 1) % ps->size;
+    --ps->pending_count;
+
+    ps_session->pending = 0;
+    ps_session->checked = 1;
+    return ps_session;
+}
+
+static void
+nc_ps_pending_del(struct nc_pollsession *ps, struct nc_ps_session *ps_session)
+{
+    uint32_t last;
+
+    if (!ps_session->pending) {
         return;
     }
 
-    --ps->queue_len;
-    if (found == 1) {
-        /* remove the id by moving the queue, otherwise all the values in the queue were moved */
-        ps->queue_begin = (ps->queue_begin + 1) % NC_PS_QUEUE_SIZE;
-    }
+    /* the last pending session takes its place */
+    last = (ps->pending_begin + ps->pending_count - 1) % ps->size;
+    ps->pending[ps_session->pending_pos] = ps->pending[last];
+    ps->pending[ps_session->pending_pos]->pending_pos = ps_session->pending_pos;
+    --ps->pending_count;
+    ps_session->pending = 0;
 }
 
-int
-nc_ps_lock(struct nc_pollsession *ps, uint8_t *id, const char *func)
+/* add the session input fd into the epoll set, the session is always pending if it cannot be */
+static void
+nc_ps_epoll_add(struct nc_pollsession *ps, struct nc_ps_session *ps_session)
 {
-    int ret;
-    struct timespec ts;
-
-    nc_gettimespec_real(&ts);
-    nc_addtimespec(&ts, NC_PS_LOCK_TIMEOUT);
+#ifdef HAVE_EPOLL
+    struct nc_session *session = ps_session->session;
+    struct epoll_event ev;
+    int fd = -1;
+#ifdef NC_ENABLED_SSH
+    struct nc_ps_session *sibling;
+    uint32_t i;
+#endif
 
-    /* LOCK */
-    ret = pthread_mutex_timedlock(&ps->lock, &ts);
-    if (ret) {
-        ERR("%s: failed to lock a pollsession (%s).", func, strerror(ret));
-        return -1;
+    ps_session->fd = -1;
+    ps_session->fd_next = NULL;
+    ps_session->in_epoll = 0;
+    if (ps->epfd == -1) {
+        return;
     }
 
-    /* check that the queue is long enough */
-    if (ps->queue_len == NC_PS_QUEUE_SIZE) {
-        ERR("%s: pollsession queue size (%d) too small.", func, NC_PS_QUEUE_SIZE);
-        pthread_mutex_unlock(&ps->lock);
-        return -1;
+    switch (session->ti_type) {
+    case NC_TI_FD:
+        fd = session->ti.fd.in;
+        break;
+#ifdef NC_ENABLED_SSH
+    case NC_TI_LIBSSH:
+        fd = ssh_get_fd(session->ti.libssh.session);
+        break;
+#endif
+#ifdef NC_ENABLED_TLS
+    case NC_TI_OPENSSL:
+        fd = SSL_get_rfd(session->ti.tls);
+        break;
+#endif
+    case NC_TI_NONE:
+        break;
+    }
+    if (fd < 0) {
+        return;
     }
 
-    /* add ourselves into the queue */
-    nc_ps_queue_add_id(ps, id);
+#ifdef NC_ENABLED_SSH
+    if ((session->ti_type == NC_TI_LIBSSH) && session->ti.libssh.next) {
+        /* the socket may already be in the set for another channel of the SSH session */
+        for (i = 0; i < ps->session_count; ++i) {
+            sibling = nc_ps_slot(ps, ps->sessions[i]);
+            if ((sibling != ps_session) && sibling->in_epoll && (sibling->session->ti_type == NC_TI_LIBSSH)
+                    && (sibling->session->ti.libssh.session == session->ti.libssh.session)) {
+                ps_session->fd_next = sibling->fd_next ? sibling->fd_next : sibling;
+                sibling->fd_next = ps_session;
+                ps_session->in_epoll = 1;
+                return;
+            }
+        }
+    }
+#endif
 
-    /* is it our turn? */
-    while (ps->queue[ps->queue_begin] != *id) {
-        nc_gettimespec_real(&ts);
-        nc_addtimespec(&ts, NC_PS_QUEUE_TIMEOUT);
+    ev.events = EPOLLIN | EPOLLONESHOT;
+    ev.data.ptr = ps_session;
+    if (epoll_ctl(ps->epfd, EPOLL_CTL_ADD, fd, &ev) == -1) {
+        /* regular files, for instance */
+        VRB("Session %u: fd %d cannot be waited for (%s).", session->id, fd, strerror(errno));
+        return;
+    }
+    ps_session->fd = fd;
+    ps_session->in_epoll = 1;
+#else
+    (void)ps;
+    ps_session->fd = -1;
+    ps_session->fd_next = NULL;
+    ps_session->in_epoll = 0;
+#endif
+}
 
-        ret = pthread_cond_timedwait(&ps->cond, &ps->lock, &ts);
-        if (ret) {
-            ERR("%s: failed to wait for a pollsession condition (%s).", func, strerror(ret));
-            /* remove ourselves from the queue */
-            nc_ps_queue_remove_id(ps, *id);
-            pthread_mutex_unlock(&ps->lock);
-            return -1;
+/* remove the session input fd from the epoll set, should be called before the session is freed */
+static void
+nc_ps_epoll_del(struct nc_pollsession *ps, struct nc_ps_session *ps_session)
+{
+#ifdef HAVE_EPOLL
+    struct nc_ps_session *prev, *next;
+    struct epoll_event ev;
+
+    if (ps_session->fd_next) {
+        /* leave the channels sharing the fd */
+        next = ps_session->fd_next;
+        for (prev = next; prev->fd_next != ps_session; prev = prev->fd_next) {}
+        prev->fd_next = (prev == next) ? NULL : next;
+
+        if (ps_session->fd > -1) {
+            /* another channel takes the fd over, it may not be re-armed by this one anymore */
+            ev.events = EPOLLIN | EPOLLONESHOT;
+            ev.data.ptr = next;
+            if (epoll_ctl(ps->epfd, EPOLL_CTL_MOD, ps_session->fd, &ev) == -1) {
+                WRN("Session %u: failed to re-arm fd %d (%s).", next->session->id, ps_session->fd, strerror(errno));
+            }
+            next->fd = ps_session->fd;
+            nc_ps_pending_add(ps, next);
         }
+    } else if (ps_session->fd > -1) {
+        epoll_ctl(ps->epfd, EPOLL_CTL_DEL, ps_session->fd, NULL);
     }
 
-    /* UNLOCK */
-    pthread_mutex_unlock(&ps->lock);
+    ps_session->fd = -1;
+    ps_session->fd_next = NULL;
+    ps_session->in_epoll = 0;
+#else
+    (void)ps;
+    (void)ps_session;
+#endif
+}
+
+/* wait for the next event on the session fd, returns -1 if the session must be checked without waiting */
+static int
+nc_ps_epoll_rearm(struct nc_pollsession *ps, struct nc_ps_session *ps_session)
+{
+#ifdef HAVE_EPOLL
+    struct nc_ps_session *iter, *owner = NULL;
+    struct epoll_event ev;
+
+    if (!ps_session->in_epoll) {
+        return -1;
+    }
+
+    /* the fd may be registered by another channel sharing it, which may be waiting for it to become writable */
+    ev.events = EPOLLIN | EPOLLONESHOT;
+    iter = ps_session;
+    do {
+        if (iter->fd > -1) {
+            owner = iter;
+        }
+        if (iter->wait_out) {
+            ev.events |= EPOLLOUT;
+        }
+        iter = iter->fd_next;
+    } while (iter && (iter != ps_session));
+    if (!owner) {
+        ERRINT;
+        return -1;
+    }
 
+    ev.data.ptr = owner;
+    if (epoll_ctl(ps->epfd, EPOLL_CTL_MOD, owner->fd, &ev) == -1) {
+        WRN("Session %u: failed to re-arm fd %d (%s).", ps_session->session->id, owner->fd, strerror(errno));
+        return -1;
+    }
     return 0;
+#else
+    (void)ps;
+    (void)ps_session;
+    return -1;
+#endif
 }
 
-int
-nc_ps_unlock(struct nc_pollsession *ps, uint8_t id, const char *func)
+/* wait for events on the session fds, should be called holding the PS lock which is released meanwhile,
+ * returns the number of sessions that became pending (1 also if woken up), -1 on error */
+static int
+nc_ps_epoll_wait(struct nc_pollsession *ps, int timeout)
 {
-    int ret;
-    struct timespec ts;
-
-    nc_gettimespec_real(&ts);
-    nc_addtimespec(&ts, NC_PS_LOCK_TIMEOUT);
+#ifdef HAVE_EPOLL
+    struct epoll_event events[NC_PS_EPOLL_EVENTS], ev;
+    struct nc_ps_session *ps_session, *iter;
+    uint64_t count;
+    int i, n, ret = 0;
 
-    /* LOCK */
-    ret = pthread_mutex_timedlock(&ps->lock, &ts);
-    if (ret) {
-        ERR("%s: failed to lock a pollsession (%s).", func, strerror(ret));
-        ret = -1;
+    if (ps->epfd == -1) {
+        return 0;
     }
 
-    /* we must be the first, it was our turn after all, right? */
-    if (ps->queue[ps->queue_begin] != id) {
-        ERRINT;
-        /* UNLOCK */
-        if (!ret) {
-            pthread_mutex_unlock(&ps->lock);
+    ++ps->waiting;
+
+    /* PS UNLOCK, other threads wait for other events or check sessions meanwhile */
+    pthread_mutex_unlock(&ps->lock);
+
+    n = epoll_wait(ps->epfd, events, NC_PS_EPOLL_EVENTS, timeout);
+
+    /* PS LOCK */
+    pthread_mutex_lock(&ps->lock);
+
+    --ps->waiting;
+    if (n == -1) {
+        if (errno == EINTR) {
+            return 0;
         }
+        ERR("Waiting for pollsession events failed (%s).", strerror(errno));
         return -1;
     }
 
-    /* remove ourselves from the queue */
-    nc_ps_queue_remove_id(ps, id);
-
-    /* broadcast to all other threads that the queue moved */
-    pthread_cond_broadcast(&ps->cond);
+    for (i = 0; i < n; ++i) {
+        ps_session = events[i].data.ptr;
+        if (!ps_session) {
+            /* woken up by another thread, evfd is one-shot as well so that only one thread is woken up */
+            if (read(ps->evfd, &count, sizeof count) == -1) {
+                /* nothing to read */
+            }
+            ps->woken = 0;
 
-    /* UNLOCK */
-    if (!ret) {
-        pthread_mutex_unlock(&ps->lock);
+            ev.events = EPOLLIN | EPOLLONESHOT;
+            ev.data.ptr = NULL;
+            if (epoll_ctl(ps->epfd, EPOLL_CTL_MOD, ps->evfd, &ev) == -1) {
+                WRN("Failed to re-arm a pollsession eventfd (%s).", strerror(errno));
+            }
+            ++ret;
+        } else if (ps_session->session) {
+            /* (the session could have been removed before we got the lock), all the SSH channels sharing the fd
+             * are checked, any of them may have data */
+            iter = ps_session;
+            do {
+                nc_ps_pending_add(ps, iter);
+                iter = iter->fd_next;
+            } while (iter && (iter != ps_session));
+            ++ret;
+        }
     }
 
     return ret;
+#else
+    (void)ps;
+    (void)timeout;
+    return 0;
+#endif
 }
 
 API struct nc_pollsession *
 nc_ps_new(void)
 {
     struct nc_pollsession *ps;
+    struct timespec ts_cur;
+#ifdef HAVE_EPOLL
+    struct epoll_event ev;
+#endif
 
     ps = calloc(1, sizeof(struct nc_pollsession));
     if (!ps) {
@@ -885,169 +1070,413 @@ nc_ps_new(void)
     pthread_cond_init(&ps->cond, NULL);
     pthread_mutex_init(&ps->lock, NULL);
 
+    ps->unused = NC_PS_NO_SLOT;
+    nc_gettimespec_mono(&ts_cur);
+    nc_timer_wheel_init(&ps->timers, ts_cur.tv_sec);
+    ps->idle_timeout = server_opts.idle_timeout;
+
+    ps->epfd = -1;
+    ps->evfd = -1;
+#ifdef HAVE_EPOLL
+    ps->epfd = epoll_create1(EPOLL_CLOEXEC);
+    ps->evfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    ev.events = EPOLLIN | EPOLLONESHOT;
+    ev.data.ptr = NULL;
+    if ((ps->epfd == -1) || (ps->evfd == -1) || (epoll_ctl(ps->epfd, EPOLL_CTL_ADD, ps->evfd, &ev) == -1)) {
+        /* every session is checked in turn then */
+        WRN("Failed to create a pollsession epoll set (%s).", strerror(errno));
+        if (ps->epfd > -1) {
+            close(ps->epfd);
+            ps->epfd = -1;
+        }
+        if (ps->evfd > -1) {
+            close(ps->evfd);
+            ps->evfd = -1;
+        }
+    }
+#endif
+
     return ps;
 }
 
 API void
 nc_ps_free(struct nc_pollsession *ps)
 {
-    uint16_t i;
+    struct nc_ps_session *ps_session;
+    struct nc_pollsession *cur;
+    uint32_t i;
 
     if (!ps) {
         return;
     }
 
-    if (ps->queue_len) {
+    if (ps->waiting) {
         ERR("FATAL: Freeing a pollsession structure that is currently being worked with!");
     }
 
     for (i = 0; i < ps->session_count; i++) {
-        free(ps->sessions[i]);
+        ps_session = nc_ps_slot(ps, ps->sessions[i]);
+        if (ps_session->checked || ps_session->event) {
+            ERR("FATAL: Freeing a pollsession structure with session %u being worked with!", ps_session->session->id);
+        }
+        nc_ps_epoll_del(ps, ps_session);
+
+        /* SESSION PS LOCK */
+        pthread_mutex_lock(&ps_session->session->opts.server.ps_lock);
+        cur = ps;
+        atomic_compare_exchange_strong(&ps_session->session->ps, &cur, NULL);
+        /* SESSION PS UNLOCK */
+        pthread_mutex_unlock(&ps_session->session->opts.server.ps_lock);
+    }
+
+    /* no new notifier can reference the pollsession now, wait for the current ones */
+    while (atomic_load(&ps->notifiers)) {
+        usleep(NC_TIMEOUT_STEP);
+    }
+
+    for (i = 0; i < ps->chunk_count; ++i) {
+        free(ps->chunks[i]);
     }
 
+    free(ps->chunks);
     free(ps->sessions);
+    free(ps->pending);
+    if (ps->epfd > -1) {
+        close(ps->epfd);
+    }
+    if (ps->evfd > -1) {
+        close(ps->evfd);
+    }
     pthread_mutex_destroy(&ps->lock);
     pthread_cond_destroy(&ps->cond);
 
     free(ps);
 }
 
-API int
-nc_ps_add_session(struct nc_pollsession *ps, struct nc_session *session)
+/* allocate another chunk of slots, should be called holding the PS lock */
+static int
+nc_ps_add_chunk(struct nc_pollsession *ps)
 {
-    uint8_t q_id;
-
-    if (!ps) {
-        ERRARG("ps");
-        return -1;
-    } else if (!session) {
-        ERRARG("session");
-        return -1;
-    }
+    struct nc_ps_session **chunks, *chunk;
+    uint32_t i;
 
-    /* LOCK */
-    if (nc_ps_lock(ps, &q_id, __func__)) {
+    if (ps->chunk_count == NC_PS_NO_SLOT / NC_PS_CHUNK_SIZE) {
+        ERR("Maximum number of sessions in a pollsession reached.");
         return -1;
     }
 
-    ++ps->session_count;
-    ps->sessions = nc_realloc(ps->sessions, ps->session_count * sizeof *ps->sessions);
-    if (!ps->sessions) {
+    chunks = realloc(ps->chunks, (ps->chunk_count + 1) * sizeof *ps->chunks);
+    if (!chunks) {
         ERRMEM;
-        /* UNLOCK */
-        nc_ps_unlock(ps, q_id, __func__);
         return -1;
     }
-    ps->sessions[ps->session_count - 1] = calloc(1, sizeof **ps->sessions);
-    if (!ps->sessions[ps->session_count - 1]) {
+    ps->chunks = chunks;
+
+    chunk = calloc(NC_PS_CHUNK_SIZE, sizeof *chunk);
+    if (!chunk) {
         ERRMEM;
-        --ps->session_count;
-        /* UNLOCK */
-        nc_ps_unlock(ps, q_id, __func__);
         return -1;
     }
-    ps->sessions[ps->session_count - 1]->session = session;
-    ps->sessions[ps->session_count - 1]->state = NC_PS_STATE_NONE;
-
-    /* UNLOCK */
-    return nc_ps_unlock(ps, q_id, __func__);
-}
-
-static int
-_nc_ps_del_session(struct nc_pollsession *ps, struct nc_session *session, int index)
-{
-    uint16_t i;
-
-    if (index >= 0) {
-        i = (uint16_t)index;
-        goto remove;
-    }
-    for (i = 0; i < ps->session_count; ++i) {
-        if (ps->sessions[i]->session == session) {
-remove:
-            --ps->session_count;
-            if (i <= ps->session_count) {
-                free(ps->sessions[i]);
-                ps->sessions[i] = ps->sessions[ps->session_count];
-            }
-            if (!ps->session_count) {
-                free(ps->sessions);
-                ps->sessions = NULL;
-            }
-            ps->last_event_session = 0;
-            return 0;
-        }
+    for (i = 0; i < NC_PS_CHUNK_SIZE; ++i) {
+        chunk[i].slot = ps->chunk_count * NC_PS_CHUNK_SIZE + i;
+        chunk[i].fd = -1;
+        chunk[i].next_unused = (i < NC_PS_CHUNK_SIZE - 1) ? chunk[i].slot + 1 : ps->unused;
     }
+    ps->chunks[ps->chunk_count++] = chunk;
+    ps->unused = chunk[0].slot;
 
-    return -1;
+    return 0;
 }
 
 API int
-nc_ps_del_session(struct nc_pollsession *ps, struct nc_session *session)
+nc_ps_add_session(struct nc_pollsession *ps, struct nc_session *session)
 {
-    uint8_t q_id;
-    int ret, ret2;
+    struct nc_ps_session **pending, *ps_session;
+    uint32_t *sessions, size, slot, i;
 
     if (!ps) {
         ERRARG("ps");
         return -1;
-    } else if (!session) {
+    } else if (!session || (session->side != NC_SERVER)) {
         ERRARG("session");
         return -1;
     }
 
-    /* LOCK */
-    if (nc_ps_lock(ps, &q_id, __func__)) {
-        return -1;
+    /* PS LOCK */
+    pthread_mutex_lock(&ps->lock);
+
+    if ((ps->unused == NC_PS_NO_SLOT) && nc_ps_add_chunk(ps)) {
+        goto error;
     }
 
-    ret = _nc_ps_del_session(ps, session, -1);
+    /* there must be room for all the sessions in the pending list */
+    if (ps->session_count == ps->size) {
+        size = ps->size ? ps->size * 2 : NC_PS_CHUNK_SIZE;
+        if (size < ps->size) {
+            size = NC_PS_NO_SLOT;
+        }
 
-    /* UNLOCK */
-    ret2 = nc_ps_unlock(ps, q_id, __func__);
+        sessions = realloc(ps->sessions, size * sizeof *ps->sessions);
+        if (!sessions) {
+            ERRMEM;
+            goto error;
+        }
+        ps->sessions = sessions;
+
+        pending = malloc(size * sizeof *ps->pending);
+        if (!pending) {
+            ERRMEM;
+            goto error;
+        }
+        for (i = 0; i < ps->pending_count; ++i) {
+            pending[i] = ps->pending[(ps->pending_begin + i) % ps->size];
+            pending[i]->pending_pos = i;
+        }
+        free(ps->pending);
+        ps->pending = pending;
+        ps->pending_begin = 0;
+        ps->size = size;
+    }
+
+    /* take an unused slot */
+    ps_session = nc_ps_slot(ps, ps->unused);
+    ps->unused = ps_session->next_unused;
+    slot = ps_session->slot;
+    memset(ps_session, 0, sizeof *ps_session);
+    ps_session->slot = slot;
+    ps_session->session = session;
+    ps_session->state = NC_PS_STATE_NONE;
+    ps_session->idx = ps->session_count;
+    ps_session->timer.data = ps_session;
+    ps->sessions[ps->session_count++] = slot;
+    session->ps_slot = slot;
+
+    /* SESSION PS LOCK */
+    pthread_mutex_lock(&session->opts.server.ps_lock);
+    atomic_store(&session->ps, ps);
+    /* SESSION PS UNLOCK */
+    pthread_mutex_unlock(&session->opts.server.ps_lock);
+    nc_ps_epoll_add(ps, ps_session);
+
+    /* some data may have already been read, its timer is scheduled once it is checked */
+    nc_ps_pending_add(ps, ps_session);
+    nc_ps_wake(ps);
+
+    /* PS UNLOCK */
+    pthread_mutex_unlock(&ps->lock);
+    return 0;
 
-    return (ret || ret2 ? -1 : 0);
+error:
+    /* PS UNLOCK */
+    pthread_mutex_unlock(&ps->lock);
+    return -1;
 }
 
-API struct nc_session *
-nc_ps_get_session(const struct nc_pollsession *ps, uint16_t idx)
+/* find the slot of a session, should be called holding the PS lock */
+static struct nc_ps_session *
+nc_ps_find_session(const struct nc_pollsession *ps, const struct nc_session *session)
 {
-    uint8_t q_id;
-    struct nc_session *ret = NULL;
+    struct nc_ps_session *ps_session;
+    uint32_t i;
 
-    if (!ps) {
-        ERRARG("ps");
-        return NULL;
+    if (session->ps_slot < ps->chunk_count * NC_PS_CHUNK_SIZE) {
+        ps_session = nc_ps_slot(ps, session->ps_slot);
+        if (ps_session->session == session) {
+            return ps_session;
+        }
     }
 
-    /* LOCK */
-    if (nc_ps_lock((struct nc_pollsession *)ps, &q_id, __func__)) {
-        return NULL;
+    /* the session has been added to another pollsession since */
+    for (i = 0; i < ps->session_count; ++i) {
+        ps_session = nc_ps_slot(ps, ps->sessions[i]);
+        if (ps_session->session == session) {
+            return ps_session;
+        }
     }
 
-    if (idx < ps->session_count) {
-        ret = ps->sessions[idx]->session;
+    return NULL;
+}
+
+/* should be called holding the PS lock, it is released meanwhile if the session is being checked by another thread
+ * or has an event not processed yet */
+static int
+_nc_ps_del_session(struct nc_pollsession *ps, struct nc_session *session)
+{
+    struct nc_ps_session *ps_session;
+    struct nc_pollsession *cur;
+
+    while (1) {
+        ps_session = nc_ps_find_session(ps, session);
+        if (!ps_session) {
+            return -1;
+        } else if (!ps_session->checked && !ps_session->event) {
+            break;
+        }
+
+        /* wait for the thread checking it or processing its event, the session may be removed meanwhile */
+        pthread_cond_wait(&ps->cond, &ps->lock);
     }
 
-    /* UNLOCK */
-    nc_ps_unlock((struct nc_pollsession *)ps, q_id, __func__);
+    nc_ps_pending_del(ps, ps_session);
+    nc_ps_epoll_del(ps, ps_session);
+    nc_timer_del(&ps->timers, &ps_session->timer);
 
-    return ret;
+    /* SESSION PS LOCK */
+    pthread_mutex_lock(&session->opts.server.ps_lock);
+    cur = ps;
+    atomic_compare_exchange_strong(&session->ps, &cur, NULL);
+    /* SESSION PS UNLOCK */
+    pthread_mutex_unlock(&session->opts.server.ps_lock);
+    ps_session->session = NULL;
+    ps_session->next_unused = ps->unused;
+    ps->unused = ps_session->slot;
+
+    /* the last session takes its place */
+    ps->sessions[ps_session->idx] = ps->sessions[--ps->session_count];
+    nc_ps_slot(ps, ps->sessions[ps_session->idx])->idx = ps_session->idx;
+
+    return 0;
 }
 
-API uint16_t
-nc_ps_session_count(struct nc_pollsession *ps)
+API int
+nc_ps_del_session(struct nc_pollsession *ps, struct nc_session *session)
 {
+    int ret;
+
     if (!ps) {
         ERRARG("ps");
-        return 0;
+        return -1;
+    } else if (!session) {
+        ERRARG("session");
+        return -1;
     }
 
-    return ps->session_count;
-}
+    /* PS LOCK */
+    pthread_mutex_lock(&ps->lock);
 
-/* should be called holding the session RPC lock! IO lock will be acquired as needed
- * returns: NC_PSPOLL_ERROR,
+    ret = _nc_ps_del_session(ps, session);
+
+    /* PS UNLOCK */
+    pthread_mutex_unlock(&ps->lock);
+
+    return ret;
+}
+
+/* write as much of the session notification queue as the transport accepts without waiting,
+ * returns 1 if some are left queued, 0 if not or if another thread is writing them, -1 on error */
+static int
+nc_ps_notif_write(struct nc_session *session)
+{
+    int ret;
+
+    /* SESSION IO LOCK */
+    ret = nc_session_io_lock(session, 0, __func__);
+    if (ret < 0) {
+        return -1;
+    } else if (!ret) {
+        /* the thread writing lets the pollsession know if it does not write all of them */
+        return 0;
+    }
+
+    ret = nc_ntf_queue_write(session, 1, 0);
+
+    /* SESSION IO UNLOCK */
+    nc_session_io_unlock(session, __func__);
+    return ret;
+}
+
+/* let the pollsession of the session check it, it has notifications queued or its data may have been read by
+ * another thread, must not be called holding the queue lock or the session IO lock */
+static void
+nc_ps_session_pending(struct nc_session *session)
+{
+    struct nc_pollsession *ps;
+    struct nc_ps_session *ps_session;
+
+    /* SESSION PS LOCK */
+    pthread_mutex_lock(&session->opts.server.ps_lock);
+
+    /* the session may be removed meanwhile but the pollsession is not freed until the reference is dropped */
+    ps = atomic_load(&session->ps);
+    if (ps) {
+        atomic_fetch_add(&ps->notifiers, 1);
+    }
+
+    /* SESSION PS UNLOCK */
+    pthread_mutex_unlock(&session->opts.server.ps_lock);
+
+    if (!ps) {
+        /* not polled, notifications are written before the following message */
+        return;
+    }
+
+    /* PS LOCK */
+    pthread_mutex_lock(&ps->lock);
+
+    /* if the session is being worked with, it is checked again once the work is done */
+    ps_session = nc_ps_find_session(ps, session);
+    if (ps_session) {
+        nc_ps_pending_add(ps, ps_session);
+        nc_ps_wake(ps);
+    }
+
+    /* PS UNLOCK */
+    pthread_mutex_unlock(&ps->lock);
+
+    atomic_fetch_sub(&ps->notifiers, 1);
+}
+
+/* a message was written on the session by a thread not polling it, must not be called holding the session IO lock */
+static void
+nc_ps_session_written(struct nc_session *session)
+{
+#ifdef NC_ENABLED_SSH
+    if (session->ti_type == NC_TI_LIBSSH) {
+        /* libssh may have read an RPC while waiting for the channel window, no event would be signalled for it */
+        nc_ps_session_pending(session);
+    }
+#else
+    (void)session;
+#endif
+}
+
+API struct nc_session *
+nc_ps_get_session(const struct nc_pollsession *ps, uint32_t idx)
+{
+    struct nc_session *ret = NULL;
+
+    if (!ps) {
+        ERRARG("ps");
+        return NULL;
+    }
+
+    /* PS LOCK */
+    pthread_mutex_lock((pthread_mutex_t *)&ps->lock);
+
+    if (idx < ps->session_count) {
+        ret = nc_ps_slot(ps, ps->sessions[idx])->session;
+    }
+
+    /* PS UNLOCK */
+    pthread_mutex_unlock((pthread_mutex_t *)&ps->lock);
+
+    return ret;
+}
+
+API uint32_t
+nc_ps_session_count(struct nc_pollsession *ps)
+{
+    if (!ps) {
+        ERRARG("ps");
+        return 0;
+    }
+
+    return ps->session_count;
+}
+
+/* should be called holding the session RPC lock! IO lock will be acquired as needed
+ * returns: NC_PSPOLL_ERROR,
+ *          NC_PSPOLL_TIMEOUT (the whole message not received yet),
  *          NC_PSPOLL_BAD_RPC,
  *          NC_PSPOLL_BAD_RPC | NC_PSPOLL_REPLY_ERROR,
  *          NC_PSPOLL_RPC
@@ -1071,7 +1500,7 @@ nc_server_recv_rpc_io(struct nc_session *session, int io_timeout, struct nc_serv
         return NC_PSPOLL_ERROR;
     }
 
-    msgtype = nc_read_msg_io(session, io_timeout, &xml, 0);
+    msgtype = nc_read_msg_io(session, io_timeout, &xml, 1, 0);
 
     switch (msgtype) {
     case NC_MSG_RPC:
@@ -1110,9 +1539,13 @@ nc_server_recv_rpc_io(struct nc_session *session, int io_timeout, struct nc_serv
         ERR("Session %u: received <notification> from a NETCONF client.", session->id);
         ret = NC_PSPOLL_BAD_RPC;
         goto error;
+    case NC_MSG_WOULDBLOCK:
+        /* only a part of the message received, or the IO lock timeout elapsed */
+        ret = NC_PSPOLL_TIMEOUT;
+        break;
     default:
         /* NC_MSG_ERROR,
-         * NC_MSG_WOULDBLOCK and NC_MSG_NONE is not returned by nc_read_msg_io()
+         * NC_MSG_NONE is not returned by nc_read_msg_io()
          */
         ret = NC_PSPOLL_ERROR;
         break;
@@ -1133,10 +1566,241 @@ nc_set_global_rpc_clb(nc_rpc_clb clb)
     global_rpc_clb = clb;
 }
 
+static uint32_t
+nc_rpc_clb_hash(const struct lys_node *node)
+{
+    uint64_t key = (uintptr_t)node;
+
+    /* mix the pointer bits, the low ones are always the same because of alignment */
+    key ^= key >> 33;
+    key *= 0xff51afd7ed558ccdULL;
+    key ^= key >> 33;
+
+    return (uint32_t)key;
+}
+
+/* READ or WRITE rpc_clb_lock must be held */
+static struct nc_rpc_clb_item *
+nc_rpc_clb_find(const struct lys_node *node)
+{
+    uint32_t i, mask;
+
+    if (!server_opts.rpc_clb_size) {
+        return NULL;
+    }
+
+    /* the table is never full so the search always ends */
+    mask = server_opts.rpc_clb_size - 1;
+    for (i = nc_rpc_clb_hash(node) & mask; server_opts.rpc_clbs[i].node; i = (i + 1) & mask) {
+        if (server_opts.rpc_clbs[i].node == node) {
+            return &server_opts.rpc_clbs[i];
+        }
+    }
+
+    return NULL;
+}
+
+/* WRITE rpc_clb_lock must be held */
+static struct nc_rpc_clb_item *
+nc_rpc_clb_insert(const struct lys_node *node)
+{
+    struct nc_rpc_clb_item *old, *item;
+    uint32_t i, j, mask, old_size;
+
+    if ((server_opts.rpc_clb_count + 1) * 2 > server_opts.rpc_clb_size) {
+        /* grow and rehash */
+        old = server_opts.rpc_clbs;
+        old_size = server_opts.rpc_clb_size;
+
+        server_opts.rpc_clb_size = old_size ? old_size * 2 : 16;
+        server_opts.rpc_clbs = calloc(server_opts.rpc_clb_size, sizeof *server_opts.rpc_clbs);
+        if (!server_opts.rpc_clbs) {
+            ERRMEM;
+            server_opts.rpc_clbs = old;
+            server_opts.rpc_clb_size = old_size;
+            return NULL;
+        }
+
+        mask = server_opts.rpc_clb_size - 1;
+        for (i = 0; i < old_size; ++i) {
+            if (!old[i].node) {
+                continue;
+            }
+            for (j = nc_rpc_clb_hash(old[i].node) & mask; server_opts.rpc_clbs[j].node; j = (j + 1) & mask);
+            server_opts.rpc_clbs[j].node = old[i].node;
+            server_opts.rpc_clbs[j].clb = old[i].clb;
+            atomic_init(&server_opts.rpc_clbs[j].calls, atomic_load(&old[i].calls));
+        }
+        free(old);
+    }
+
+    mask = server_opts.rpc_clb_size - 1;
+    for (i = nc_rpc_clb_hash(node) & mask; server_opts.rpc_clbs[i].node; i = (i + 1) & mask);
+    item = &server_opts.rpc_clbs[i];
+    item->node = node;
+    item->clb = NULL;
+    atomic_init(&item->calls, 0);
+    ++server_opts.rpc_clb_count;
+
+    return item;
+}
+
+API int
+nc_server_set_rpc_clb(const struct lys_node *node, nc_rpc_clb clb)
+{
+    struct nc_rpc_clb_item *item;
+    int ret = 0;
+
+    if (!node || !(node->nodetype & (LYS_RPC | LYS_ACTION))) {
+        ERRARG("node");
+        return -1;
+    }
+
+    /* WRITE LOCK */
+    pthread_rwlock_wrlock(&server_opts.rpc_clb_lock);
+
+    item = nc_rpc_clb_find(node);
+    if (!item && clb) {
+        item = nc_rpc_clb_insert(node);
+    }
+    if (item) {
+        /* a removed callback keeps its item so that the counter is preserved */
+        item->clb = clb;
+    } else if (clb) {
+        ret = -1;
+    }
+
+    /* UNLOCK */
+    pthread_rwlock_unlock(&server_opts.rpc_clb_lock);
+
+    return ret;
+}
+
+API int
+nc_server_set_rpc_clb_path(struct ly_ctx *ctx, const char *path, nc_rpc_clb clb)
+{
+    const struct lys_node *node;
+
+    if (!ctx) {
+        ERRARG("ctx");
+        return -1;
+    } else if (!path) {
+        ERRARG("path");
+        return -1;
+    }
+
+    node = ly_ctx_get_node(ctx, NULL, path, 0);
+    if (!node) {
+        ERR("Schema node \"%s\" was not found.", path);
+        return -1;
+    }
+
+    return nc_server_set_rpc_clb(node, clb);
+}
+
+API uint64_t
+nc_server_get_rpc_clb_calls(const struct lys_node *node)
+{
+    struct nc_rpc_clb_item *item;
+    uint64_t calls = 0;
+
+    if (!node) {
+        ERRARG("node");
+        return 0;
+    }
+
+    /* READ LOCK */
+    pthread_rwlock_rdlock(&server_opts.rpc_clb_lock);
+
+    item = nc_rpc_clb_find(node);
+    if (item) {
+        calls = atomic_load(&item->calls);
+    }
+
+    /* UNLOCK */
+    pthread_rwlock_unlock(&server_opts.rpc_clb_lock);
+
+    return calls;
+}
+
+/* callback of the RPC or action, the registered one first, then the one stored in the schema node, then the global one */
+static nc_rpc_clb
+nc_rpc_clb_get(const struct lys_node *rpc_act)
+{
+    struct nc_rpc_clb_item *item;
+    nc_rpc_clb clb = NULL;
+
+    /* READ LOCK */
+    pthread_rwlock_rdlock(&server_opts.rpc_clb_lock);
+
+    item = nc_rpc_clb_find(rpc_act);
+    if (item && item->clb) {
+        clb = item->clb;
+        atomic_fetch_add(&item->calls, 1);
+    }
+
+    /* UNLOCK */
+    pthread_rwlock_unlock(&server_opts.rpc_clb_lock);
+
+    if (!clb) {
+        clb = rpc_act->priv ? (nc_rpc_clb)rpc_act->priv : global_rpc_clb;
+    }
+
+    return clb;
+}
+
+/* the notification serialized once for all the sessions it is sent to */
+static struct nc_msg_buf *
+nc_server_notif_msg(struct nc_server_notif *notif)
+{
+    struct nc_msg_buf *msg, *cur = NULL;
+
+    msg = atomic_load(&notif->msg);
+    if (!msg) {
+        msg = nc_msg_buf_notif(notif);
+        if (!msg) {
+            return NULL;
+        }
+        if (!atomic_compare_exchange_strong(&notif->msg, &cur, msg)) {
+            /* serialized concurrently */
+            nc_msg_buf_unref(msg);
+            msg = cur;
+        }
+    }
+
+    return msg;
+}
+
+/* queue the notification and write as much of the queue as the transport accepts without waiting, the rest is
+ * written by the pollsession of the session, returns NC_MSG_NONE if the notification is to be written directly */
+static NC_MSG_TYPE
+nc_server_notif_queue(struct nc_session *session, struct nc_msg_buf *msg, int timeout)
+{
+    NC_MSG_TYPE ret;
+
+    ret = nc_ntf_queue_add(session, msg, timeout);
+    if (ret != NC_MSG_NOTIF) {
+        return ret;
+    }
+
+    if (nc_ps_notif_write(session) == -1) {
+        return NC_MSG_ERROR;
+    }
+    if (atomic_load(&session->opts.server.ntf_queue->count)) {
+        /* even if being written by another thread, it may not be the one writing them all */
+        nc_ps_session_pending(session);
+    } else {
+        nc_ps_session_written(session);
+    }
+
+    return ret;
+}
+
 API NC_MSG_TYPE
 nc_server_notif_send(struct nc_session *session, struct nc_server_notif *notif, int timeout)
 {
-    NC_MSG_TYPE ret;
+    NC_MSG_TYPE ret = NC_MSG_NONE;
+    struct nc_msg_buf *msg;
 
     /* check parameters */
     if (!session || (session->side != NC_SERVER) || !session->opts.server.ntf_status) {
@@ -1147,8 +1811,15 @@ nc_server_notif_send(struct nc_session *session, struct nc_server_notif *notif,
         return NC_MSG_ERROR;
     }
 
-    /* we do not need RPC lock for this, IO lock will be acquired properly */
-    ret = nc_write_msg_io(session, timeout, NC_MSG_NOTIF, notif);
+    if (session->opts.server.ntf_queue) {
+        msg = nc_server_notif_msg(notif);
+        ret = msg ? nc_server_notif_queue(session, msg, timeout) : NC_MSG_ERROR;
+    }
+    if (ret == NC_MSG_NONE) {
+        /* we do not need RPC lock for this, IO lock will be acquired properly */
+        ret = nc_write_msg_io(session, timeout, NC_MSG_NOTIF, notif);
+        nc_ps_session_written(session);
+    }
     if (ret == NC_MSG_ERROR) {
         ERR("Session %u: failed to write notification.", session->id);
     }
@@ -1156,6 +1827,58 @@ nc_server_notif_send(struct nc_session *session, struct nc_server_notif *notif,
     return ret;
 }
 
+API int
+nc_server_notif_send_multi(struct nc_session **sessions, uint32_t count, struct nc_server_notif *notif, int timeout,
+                           NC_MSG_TYPE *results)
+{
+    struct nc_msg_buf *msg;
+    NC_MSG_TYPE r;
+    uint32_t i;
+    int ret = 0;
+
+    /* check parameters */
+    if (!sessions) {
+        ERRARG("sessions");
+        return -1;
+    } else if (!notif || !notif->tree || !notif->eventtime) {
+        ERRARG("notif");
+        return -1;
+    }
+    for (i = 0; i < count; ++i) {
+        if (!sessions[i] || (sessions[i]->side != NC_SERVER) || !sessions[i]->opts.server.ntf_status) {
+            ERRARG("sessions");
+            return -1;
+        }
+    }
+
+    /* serialize the notification only once, even if sent to several groups of sessions */
+    msg = nc_server_notif_msg(notif);
+    if (!msg) {
+        return -1;
+    }
+
+    for (i = 0; i < count; ++i) {
+        r = NC_MSG_NONE;
+        if (sessions[i]->opts.server.ntf_queue) {
+            r = nc_server_notif_queue(sessions[i], msg, timeout);
+        }
+        if (r == NC_MSG_NONE) {
+            r = nc_write_msg_buf_io(sessions[i], timeout, NC_MSG_NOTIF, msg);
+            nc_ps_session_written(sessions[i]);
+        }
+        if (r == NC_MSG_NOTIF) {
+            ++ret;
+        } else if (r == NC_MSG_ERROR) {
+            ERR("Session %u: failed to write notification.", sessions[i]->id);
+        }
+        if (results) {
+            results[i] = r;
+        }
+    }
+
+    return ret;
+}
+
 /* must be called holding the session RPC lock! IO lock will be acquired as needed
  * returns: NC_PSPOLL_ERROR,
  *          NC_PSPOLL_ERROR | NC_PSPOLL_REPLY_ERROR,
@@ -1168,7 +1891,7 @@ nc_server_send_reply_io(struct nc_session *session, int io_timeout, struct nc_se
     nc_rpc_clb clb;
     struct nc_server_reply *reply;
     struct lys_node *rpc_act = NULL;
-    struct lyd_node *next, *elem;
+    struct lyd_node *elem;
     int ret = 0;
     NC_MSG_TYPE r;
 
@@ -1181,25 +1904,28 @@ nc_server_send_reply_io(struct nc_session *session, int io_timeout, struct nc_se
         /* RPC */
         rpc_act = rpc->tree->schema;
     } else {
-        /* action */
-        LY_TREE_DFS_BEGIN(rpc->tree, next, elem) {
-            if (elem->schema->nodetype == LYS_ACTION) {
-                rpc_act = elem->schema;
-                break;
+        /* action, the tree is only the path to it so descend into the only inner node on each level,
+         * the other siblings are list keys */
+        elem = rpc->tree;
+        while (elem && (elem->schema->nodetype != LYS_ACTION)) {
+            if (elem->schema->nodetype & (LYS_CONTAINER | LYS_LIST)) {
+                elem = elem->child;
+            } else {
+                elem = elem->next;
             }
-            LY_TREE_DFS_END(rpc->tree, next, elem);
         }
-        if (!rpc_act) {
+        if (!elem) {
             ERRINT;
             return NC_PSPOLL_ERROR;
         }
+        rpc_act = elem->schema;
     }
 
-    if (!rpc_act->priv) {
+    clb = nc_rpc_clb_get(rpc_act);
+    if (!clb) {
         /* no callback, reply with a not-implemented error */
         reply = nc_server_reply_err(nc_err(NC_ERR_OP_NOT_SUPPORTED, NC_ERR_TYPE_PROT));
     } else {
-        clb = (nc_rpc_clb)rpc_act->priv;
         reply = clb(rpc->tree, session);
     }
 
@@ -1225,6 +1951,44 @@ nc_server_send_reply_io(struct nc_session *session, int io_timeout, struct nc_se
     return ret;
 }
 
+/* other channels of an SSH session found to have data buffered by libssh, the socket they share signals no event
+ * once the data are read from it */
+struct nc_ps_ssh_ready {
+    struct nc_session *sessions[NC_PS_SSH_READY_MAX];
+    uint16_t count;            /**< more than NC_PS_SSH_READY_MAX if all the channels should be checked */
+};
+
+#ifdef NC_ENABLED_SSH
+
+/* remember the other channels of the SSH session with data, should be called holding the session IO lock */
+static void
+nc_ps_ssh_ready_check(struct nc_session *session, struct nc_ps_ssh_ready *ready)
+{
+    struct nc_session *iter;
+
+    if ((session->ti_type != NC_TI_LIBSSH) || !session->ti.libssh.next) {
+        return;
+    }
+
+    for (iter = session->ti.libssh.next; iter != session; iter = iter->ti.libssh.next) {
+        if (((iter->status != NC_STATUS_RUNNING) && (iter->status != NC_STATUS_STARTING)) || !iter->ti.libssh.channel) {
+            continue;
+        }
+
+        /* data, EOF, or an error */
+        if (ssh_channel_poll(iter->ti.libssh.channel, 0)) {
+            if (ready->count < NC_PS_SSH_READY_MAX) {
+                ready->sessions[ready->count] = iter;
+            }
+            if (ready->count <= NC_PS_SSH_READY_MAX) {
+                ++ready->count;
+            }
+        }
+    }
+}
+
+#endif
+
 /* session must be running and session RPC lock held!
  * returns: NC_PSPOLL_SESSION_TERM | NC_PSPOLL_SESSION_ERROR, (msg filled)
  *          NC_PSPOLL_ERROR, (msg filled)
@@ -1234,12 +1998,15 @@ nc_server_send_reply_io(struct nc_session *session, int io_timeout, struct nc_se
  *          NC_PSPOLL_SSH_MSG
  */
 static int
-nc_ps_poll_session_io(struct nc_session *session, int io_timeout, time_t now_mono, char *msg)
+nc_ps_poll_session_io(struct nc_session *session, int io_timeout, time_t now_mono, char *msg,
+                      struct nc_ps_ssh_ready *ready)
 {
     struct pollfd pfd;
     int r, ret = 0;
 #ifdef NC_ENABLED_SSH
     struct nc_session *new;
+#else
+    (void)ready;
 #endif
 
     /* check timeout first */
@@ -1259,6 +2026,21 @@ nc_ps_poll_session_io(struct nc_session *session, int io_timeout, time_t now_mon
         return NC_PSPOLL_TIMEOUT;
     }
 
+    if (session->rmsg.active && (now_mono >= session->rmsg.ts_act_timeout.tv_sec)) {
+        /* a message is being received for too long */
+        sprintf(msg, "active read timeout elapsed");
+        session->status = NC_STATUS_INVALID;
+        session->term_reason = NC_SESSION_TERM_OTHER;
+        nc_session_io_unlock(session, __func__);
+        return NC_PSPOLL_SESSION_TERM | NC_PSPOLL_SESSION_ERROR;
+    }
+
+    if ((session->rbuf.end > session->rbuf.start) && !session->rmsg.active) {
+        /* the rest of the previously read data (if a message is being received, they are not enough to continue) */
+        nc_session_io_unlock(session, __func__);
+        return NC_PSPOLL_RPC;
+    }
+
     switch (session->ti_type) {
 #ifdef NC_ENABLED_SSH
     case NC_TI_LIBSSH:
@@ -1280,7 +2062,7 @@ nc_ps_poll_session_io(struct nc_session *session, int io_timeout, time_t now_mon
                 if (session->ti.libssh.next) {
                     for (new = session->ti.libssh.next; new != session; new = new->ti.libssh.next) {
                         if ((new->status == NC_STATUS_STARTING) && new->ti.libssh.channel
-                                && (new->flags & NC_SESSION_SSH_SUBSYS_NETCONF)) {
+                                && (new->flags & NC_SESSION_SSH_SUBSYS_NETCONF) && !new->opts.server.hs) {
                             /* new NETCONF SSH channel */
                             ret = NC_PSPOLL_SSH_CHANNEL;
                             break;
@@ -1300,6 +2082,9 @@ nc_ps_poll_session_io(struct nc_session *session, int io_timeout, time_t now_mon
             /* we have some application data */
             ret = NC_PSPOLL_RPC;
         }
+
+        /* the other channels have no event for the data just read from the socket */
+        nc_ps_ssh_ready_check(session, ready);
         break;
 #endif
 #ifdef NC_ENABLED_TLS
@@ -1381,329 +2166,790 @@ nc_ps_poll_session_io(struct nc_session *session, int io_timeout, time_t now_mon
     return ret;
 }
 
-API int
-nc_ps_poll(struct nc_pollsession *ps, int timeout, struct nc_session **session)
+#if defined(NC_ENABLED_SSH) || defined(NC_ENABLED_TLS)
+
+/* find an endpoint, should be called holding ENDPT READ LOCK */
+static struct nc_endpt *
+nc_server_endpt_find(const char *name, NC_TRANSPORT_IMPL ti)
 {
-    int ret, r;
-    uint8_t q_id;
-    uint16_t i, j;
-    char msg[256];
-    struct timespec ts_timeout, ts_cur;
-    struct nc_session *cur_session;
-    struct nc_ps_session *cur_ps_session;
-    struct nc_server_rpc *rpc = NULL;
+    uint16_t i;
 
-    if (!ps) {
-        ERRARG("ps");
-        return NC_PSPOLL_ERROR;
+    for (i = 0; i < server_opts.endpt_count; ++i) {
+        if (!strcmp(server_opts.endpts[i].name, name) && (server_opts.endpts[i].ti == ti)) {
+            return &server_opts.endpts[i];
+        }
     }
 
-    /* PS LOCK */
-    if (nc_ps_lock(ps, &q_id, __func__)) {
-        return NC_PSPOLL_ERROR;
+    return NULL;
+}
+
+/* advance the handshake of a session accepted by nc_ps_accept() as far as the data available allow,
+ * should be called holding the session RPC lock
+ * returns: NC_PSPOLL_SESSION_NEW (the session is running),
+ *          NC_PSPOLL_TIMEOUT (waiting for the client),
+ *          NC_PSPOLL_SESSION_TERM | NC_PSPOLL_SESSION_ERROR, (msg filled) */
+static int
+nc_ps_handshake_step(struct nc_session *session, time_t now_mono, char *msg)
+{
+    struct nc_server_hs *hs = session->opts.server.hs;
+    struct timespec ts_cur;
+    NC_MSG_TYPE msgtype;
+    struct nc_endpt *endpt;
+    int r = -1;
+
+    if (hs->deadline && (now_mono >= hs->deadline)) {
+        sprintf(msg, "handshake timeout elapsed");
+        session->status = NC_STATUS_INVALID;
+        session->term_reason = NC_SESSION_TERM_TIMEOUT;
+        return NC_PSPOLL_SESSION_TERM | NC_PSPOLL_SESSION_ERROR;
+    }
+
+    if (hs->stage < NC_HS_HELLO_SEND) {
+        /* ENDPT READ LOCK */
+        pthread_rwlock_rdlock(&server_opts.endpt_lock);
+
+        endpt = nc_server_endpt_find(hs->endpt_name, hs->ti);
+        if (endpt) {
+#ifdef NC_ENABLED_SSH
+            if (hs->ti == NC_TI_LIBSSH) {
+                session->data = endpt->opts.ssh;
+                r = nc_accept_ssh_session_step(session);
+            }
+#endif
+#ifdef NC_ENABLED_TLS
+            if (hs->ti == NC_TI_OPENSSL) {
+                session->data = endpt->opts.tls;
+                r = nc_accept_tls_session_step(session);
+            }
+#endif
+            session->data = NULL;
+        }
+
+        /* ENDPT UNLOCK */
+        pthread_rwlock_unlock(&server_opts.endpt_lock);
+
+        if (!endpt) {
+            sprintf(msg, "endpoint \"%.200s\" removed during the handshake", hs->endpt_name);
+            session->status = NC_STATUS_INVALID;
+            session->term_reason = NC_SESSION_TERM_OTHER;
+            return NC_PSPOLL_SESSION_TERM | NC_PSPOLL_SESSION_ERROR;
+        } else if (r < 0) {
+            sprintf(msg, "transport handshake failed");
+            session->status = NC_STATUS_INVALID;
+            session->term_reason = NC_SESSION_TERM_OTHER;
+            return NC_PSPOLL_SESSION_TERM | NC_PSPOLL_SESSION_ERROR;
+        } else if (!r) {
+            return NC_PSPOLL_TIMEOUT;
+        }
+
+        /* transport established */
+        hs->stage = NC_HS_HELLO_SEND;
+        hs->wait_out = 0;
+        nc_gettimespec_mono(&ts_cur);
+        hs->deadline = ts_cur.tv_sec + (server_opts.hello_timeout ? server_opts.hello_timeout : NC_SERVER_HELLO_TIMEOUT);
     }
 
-    if (!ps->session_count) {
-        nc_ps_unlock(ps, q_id, __func__);
-        return NC_PSPOLL_NOSESSIONS;
+    msgtype = nc_handshake_step_io(session);
+    if (msgtype == NC_MSG_WOULDBLOCK) {
+        return NC_PSPOLL_TIMEOUT;
+    } else if (msgtype != NC_MSG_HELLO) {
+        sprintf(msg, "NETCONF handshake failed");
+        if (session->status != NC_STATUS_INVALID) {
+            session->status = NC_STATUS_INVALID;
+            session->term_reason = NC_SESSION_TERM_OTHER;
+        }
+        return NC_PSPOLL_SESSION_TERM | NC_PSPOLL_SESSION_ERROR;
     }
 
-    /* fill timespecs */
+    lydict_remove(server_opts.ctx, hs->endpt_name);
+    free(hs);
+    session->opts.server.hs = NULL;
+
     nc_gettimespec_mono(&ts_cur);
-    if (timeout > -1) {
-        nc_gettimespec_mono(&ts_timeout);
-        nc_addtimespec(&ts_timeout, timeout);
+    session->opts.server.last_rpc = ts_cur.tv_sec;
+    nc_gettimespec_real(&ts_cur);
+    session->opts.server.session_start = ts_cur.tv_sec;
+    session->status = NC_STATUS_RUNNING;
+
+    return NC_PSPOLL_SESSION_NEW;
+}
+
+#endif /* NC_ENABLED_SSH || NC_ENABLED_TLS */
+
+/* when the session should be checked for its idle, active read, or handshake timeout, 0 if never, should be called
+ * holding the session RPC lock */
+static time_t
+nc_ps_session_deadline(struct nc_session *session, time_t now_mono)
+{
+    time_t deadline = 0;
+
+    if (session->opts.server.hs) {
+        /* being established */
+        return session->opts.server.hs->deadline;
     }
 
-    /* poll all the sessions one-by-one */
-    do {
-        /* loop from i to j once (all sessions) */
-        if (ps->last_event_session == ps->session_count - 1) {
-            i = j = 0;
+    if (!(session->flags & NC_SESSION_CALLHOME) && server_opts.idle_timeout) {
+        if (session->opts.server.ntf_status) {
+            /* the idle timeout applies again once the subscription ends */
+            deadline = now_mono + server_opts.idle_timeout;
         } else {
-            i = j = ps->last_event_session + 1;
+            deadline = session->opts.server.last_rpc + server_opts.idle_timeout;
         }
-        do {
-            cur_ps_session = ps->sessions[i];
-            cur_session = cur_ps_session->session;
+    }
+    if (session->rmsg.active && (!deadline || (session->rmsg.ts_act_timeout.tv_sec < deadline))) {
+        deadline = session->rmsg.ts_act_timeout.tv_sec;
+    }
 
-            /* SESSION RPC LOCK */
-            r = nc_session_rpc_lock(cur_session, 0, __func__);
-            if (r == -1) {
-                ret = NC_PSPOLL_ERROR;
-            } else if (r == 1) {
-                /* no one else is currently working with the session, so we can, otherwise skip it */
-                switch (cur_ps_session->state) {
-                case NC_PS_STATE_NONE:
-                    if (cur_session->status == NC_STATUS_RUNNING) {
-                        /* session is fine, work with it */
-                        cur_ps_session->state = NC_PS_STATE_BUSY;
-
-                        ret = nc_ps_poll_session_io(cur_session, NC_SESSION_LOCK_TIMEOUT, ts_cur.tv_sec, msg);
-                        switch (ret) {
-                        case NC_PSPOLL_SESSION_TERM | NC_PSPOLL_SESSION_ERROR:
-                            ERR("Session %u: %s.", cur_session->id, msg);
-                            cur_ps_session->state = NC_PS_STATE_INVALID;
-                            break;
-                        case NC_PSPOLL_ERROR:
-                            ERR("Session %u: %s.", cur_session->id, msg);
-                            cur_ps_session->state = NC_PS_STATE_NONE;
-                            break;
-                        case NC_PSPOLL_TIMEOUT:
-#ifdef NC_ENABLED_SSH
-                        case NC_PSPOLL_SSH_CHANNEL:
-                        case NC_PSPOLL_SSH_MSG:
-#endif
-                            cur_ps_session->state = NC_PS_STATE_NONE;
-                            break;
-                        case NC_PSPOLL_RPC:
-                            /* let's keep the state busy, we are not done with this session */
-                            break;
-                        }
-                    } else {
-                        /* session is not fine, let the caller know */
-                        ret = NC_PSPOLL_SESSION_TERM;
-                        if (cur_session->term_reason != NC_SESSION_TERM_CLOSED) {
-                            ret |= NC_PSPOLL_SESSION_ERROR;
-                        }
-                        cur_ps_session->state = NC_PS_STATE_INVALID;
-                    }
-                    break;
-                case NC_PS_STATE_BUSY:
-                    /* it definitely should not be busy because we have the lock */
-                    ERRINT;
-                    ret = NC_PSPOLL_ERROR;
-                    break;
-                case NC_PS_STATE_INVALID:
-                    /* we got it locked, but it will be freed, let it be */
-                    ret = NC_PSPOLL_TIMEOUT;
-                    break;
-                }
+    return deadline;
+}
 
-                /* keep RPC lock in this one case */
-                if (ret != NC_PSPOLL_RPC) {
-                    /* SESSION RPC UNLOCK */
-                    nc_session_rpc_unlock(cur_session, NC_SESSION_LOCK_TIMEOUT, __func__);
-                }
-            } else {
-                /* timeout */
-                ret = NC_PSPOLL_TIMEOUT;
-            }
+/* check the session for an event or advance its handshake, keep is set if the session should stay pending, rearm
+ * if its fd should be waited for, deadline to when its timer should expire (0 to leave it), ready are filled with
+ * the other SSH channels to be checked
+ * returns: see nc_ps_poll_session_io() and nc_ps_handshake_step(), NC_PSPOLL_TIMEOUT also if the session cannot
+ *          be checked now,
+ *          NC_PSPOLL_SESSION_TERM (| NC_PSPOLL_SESSION_ERROR) for an invalid session,
+ *          the session is RPC locked only if NC_PSPOLL_RPC is returned */
+static int
+nc_ps_poll_session(struct nc_ps_session *ps_session, time_t now_mono, int *keep, int *rearm, time_t *deadline,
+                   struct nc_ps_ssh_ready *ready)
+{
+    struct nc_session *session = ps_session->session;
+    char msg[256];
+    int r, ret;
 
-            /* something happened */
-            if (ret != NC_PSPOLL_TIMEOUT) {
-                break;
+    *keep = 0;
+    *rearm = 0;
+    *deadline = 0;
+    ready->count = 0;
+
+    /* SESSION RPC LOCK */
+    r = nc_session_rpc_lock(session, 0, __func__);
+    if (r == -1) {
+        *keep = 1;
+        return NC_PSPOLL_ERROR;
+    } else if (!r) {
+        /* someone else is working with the session, if it is polled by another thread, it will be made pending
+         * again or waited for once it is finished with */
+        *keep = (ps_session->state != NC_PS_STATE_BUSY) || !ps_session->in_epoll;
+        return NC_PSPOLL_TIMEOUT;
+    }
+
+    /* no one else is currently working with the session, so we can */
+    switch (ps_session->state) {
+    case NC_PS_STATE_NONE:
+        if (session->status == NC_STATUS_RUNNING) {
+            /* session is fine, work with it */
+            ps_session->state = NC_PS_STATE_BUSY;
+
+            /* write the queued notifications, the transport is waited for to accept the rest */
+            r = 0;
+            if (session->opts.server.ntf_queue && atomic_load(&session->opts.server.ntf_queue->count)) {
+                r = nc_ps_notif_write(session);
             }
+            ps_session->wait_out = (r == 1);
 
-            if (i == ps->session_count - 1) {
-                i = 0;
+            if (r == -1) {
+                sprintf(msg, "failed to write queued notifications");
+                ret = NC_PSPOLL_SESSION_TERM | NC_PSPOLL_SESSION_ERROR;
             } else {
-                ++i;
+                ret = nc_ps_poll_session_io(session, NC_SESSION_LOCK_TIMEOUT, now_mono, msg, ready);
             }
-        } while (i != j);
-
-        /* no event, no session remains locked */
-        if (ret == NC_PSPOLL_TIMEOUT) {
-            usleep(NC_TIMEOUT_STEP);
-            /* update current time */
-            nc_gettimespec_mono(&ts_cur);
-
-            if ((timeout > -1) && (nc_difftimespec(&ts_cur, &ts_timeout) < 1)) {
-                /* final timeout */
+            switch (ret) {
+            case NC_PSPOLL_SESSION_TERM | NC_PSPOLL_SESSION_ERROR:
+                ERR("Session %u: %s.", session->id, msg);
+                ps_session->state = NC_PS_STATE_INVALID;
+                break;
+            case NC_PSPOLL_ERROR:
+                ERR("Session %u: %s.", session->id, msg);
+                ps_session->state = NC_PS_STATE_NONE;
+                *keep = 1;
+                break;
+            case NC_PSPOLL_TIMEOUT:
+                /* no data available, wait for some */
+                ps_session->state = NC_PS_STATE_NONE;
+                *rearm = 1;
+                break;
+#ifdef NC_ENABLED_SSH
+            case NC_PSPOLL_SSH_CHANNEL:
+            case NC_PSPOLL_SSH_MSG:
+                /* there may be more */
+                ps_session->state = NC_PS_STATE_NONE;
+                *keep = 1;
+                break;
+#endif
+            case NC_PSPOLL_RPC:
+                /* let's keep the state busy, we are not done with this session */
                 break;
             }
-        }
-    } while (ret == NC_PSPOLL_TIMEOUT);
+#if defined(NC_ENABLED_SSH) || defined(NC_ENABLED_TLS)
+        } else if ((session->status == NC_STATUS_STARTING) && session->opts.server.hs) {
+            /* session is being established */
+            ps_session->state = NC_PS_STATE_BUSY;
 
-    /* do we want to return the session? */
-    switch (ret) {
-    case NC_PSPOLL_RPC:
-    case NC_PSPOLL_SESSION_TERM:
-    case NC_PSPOLL_SESSION_TERM | NC_PSPOLL_SESSION_ERROR:
+            ret = nc_ps_handshake_step(session, now_mono, msg);
 #ifdef NC_ENABLED_SSH
-    case NC_PSPOLL_SSH_CHANNEL:
-    case NC_PSPOLL_SSH_MSG:
+            if (session->ti_type == NC_TI_LIBSSH) {
+                /* the data of the other channels may have been read from the socket */
+                ready->count = NC_PS_SSH_READY_MAX + 1;
+            }
+#endif
+            switch (ret) {
+            case NC_PSPOLL_SESSION_TERM | NC_PSPOLL_SESSION_ERROR:
+                ERR("Session %u: %s.", session->id, msg);
+                ps_session->state = NC_PS_STATE_INVALID;
+                break;
+            case NC_PSPOLL_TIMEOUT:
+                /* wait for the client */
+                ps_session->state = NC_PS_STATE_NONE;
+                ps_session->wait_out = session->opts.server.hs->wait_out;
+                *rearm = 1;
+                break;
+            case NC_PSPOLL_SESSION_NEW:
+                /* it is removed from the pollsession and returned */
+                ps_session->state = NC_PS_STATE_NONE;
+                ps_session->wait_out = 0;
+                break;
+            }
 #endif
-        if (session) {
-            *session = cur_session;
+        } else {
+            /* session is not fine, let the caller know */
+            ret = NC_PSPOLL_SESSION_TERM;
+            if (session->term_reason != NC_SESSION_TERM_CLOSED) {
+                ret |= NC_PSPOLL_SESSION_ERROR;
+            }
+            ps_session->state = NC_PS_STATE_INVALID;
         }
-        ps->last_event_session = i;
         break;
+    case NC_PS_STATE_BUSY:
+        /* it definitely should not be busy because we have the lock */
+        ERRINT;
+        ret = NC_PSPOLL_ERROR;
+        break;
+    case NC_PS_STATE_INVALID:
     default:
+        /* we got it locked, but it will be freed, let it be */
+        ret = NC_PSPOLL_TIMEOUT;
         break;
     }
 
-    /* PS UNLOCK */
-    nc_ps_unlock(ps, q_id, __func__);
-
-    /* we have some data available and the session is RPC locked (but not IO locked) */
-    if (ret == NC_PSPOLL_RPC) {
-        ret = nc_server_recv_rpc_io(cur_session, timeout, &rpc);
-        if (ret & (NC_PSPOLL_ERROR | NC_PSPOLL_BAD_RPC)) {
-            if (cur_session->status != NC_STATUS_RUNNING) {
-                ret |= NC_PSPOLL_SESSION_TERM | NC_PSPOLL_SESSION_ERROR;
-                cur_ps_session->state = NC_PS_STATE_INVALID;
-            } else {
-                cur_ps_session->state = NC_PS_STATE_NONE;
-            }
-        } else {
-            cur_session->opts.server.last_rpc = ts_cur.tv_sec;
-
-            /* process RPC, not needed afterwards */
-            ret |= nc_server_send_reply_io(cur_session, timeout, rpc);
-            nc_server_rpc_free(rpc, server_opts.ctx);
-
-            if (cur_session->status != NC_STATUS_RUNNING) {
-                ret |= NC_PSPOLL_SESSION_TERM;
-                if (!(cur_session->term_reason & (NC_SESSION_TERM_CLOSED | NC_SESSION_TERM_KILLED))) {
-                    ret |= NC_PSPOLL_SESSION_ERROR;
-                }
-                cur_ps_session->state = NC_PS_STATE_INVALID;
-            } else {
-                cur_ps_session->state = NC_PS_STATE_NONE;
-            }
-        }
+    if (!ps_session->in_epoll && (ps_session->state != NC_PS_STATE_INVALID)) {
+        /* no event would ever be signalled for the session */
+        *keep = 1;
+    }
+    if (ps_session->state == NC_PS_STATE_NONE) {
+        *deadline = nc_ps_session_deadline(session, now_mono);
+    }
 
+    /* keep RPC lock in this one case */
+    if (ret != NC_PSPOLL_RPC) {
         /* SESSION RPC UNLOCK */
-        nc_session_rpc_unlock(cur_session, NC_SESSION_LOCK_TIMEOUT, __func__);
+        nc_session_rpc_unlock(session, NC_SESSION_LOCK_TIMEOUT, __func__);
     }
 
     return ret;
 }
 
-API void
-nc_ps_clear(struct nc_pollsession *ps, int all, void (*data_free)(void *))
+/* the session was checked by this thread, make it pending again or wait for it, the other SSH channels with data
+ * are made pending as well, should be called holding the PS lock */
+static void
+nc_ps_session_checked(struct nc_pollsession *ps, struct nc_ps_session *ps_session, int keep, int rearm, time_t deadline,
+                      const struct nc_ps_ssh_ready *ready)
 {
-    uint8_t q_id;
+    struct nc_ps_session *iter;
     uint16_t i;
-    struct nc_session *session;
 
-    if (!ps) {
-        ERRARG("ps");
-        return;
+    /* only the channels in this pollsession share its epoll set */
+    for (iter = ps_session->fd_next; ready->count && iter && (iter != ps_session); iter = iter->fd_next) {
+        for (i = 0; (i < ready->count) && (i < NC_PS_SSH_READY_MAX) && (ready->sessions[i] != iter->session); ++i) {}
+        if ((ready->count > NC_PS_SSH_READY_MAX) || (i < ready->count)) {
+            nc_ps_pending_add(ps, iter);
+        }
     }
 
-    /* LOCK */
-    if (nc_ps_lock(ps, &q_id, __func__)) {
-        return;
+    ps_session->checked = 0;
+    if (deadline) {
+        nc_timer_add(&ps->timers, &ps_session->timer, deadline);
+    }
+    if (keep || ps_session->recheck || (rearm && nc_ps_epoll_rearm(ps, ps_session))) {
+        nc_ps_pending_add(ps, ps_session);
     }
+    ps_session->recheck = 0;
 
-    if (all) {
-        for (i = 0; i < ps->session_count; i++) {
-            nc_session_free(ps->sessions[i]->session, data_free);
-            free(ps->sessions[i]);
-        }
-        free(ps->sessions);
-        ps->sessions = NULL;
-        ps->session_count = 0;
-        ps->last_event_session = 0;
-    } else {
-        for (i = 0; i < ps->session_count; ) {
-            if (ps->sessions[i]->session->status != NC_STATUS_RUNNING) {
-                session = ps->sessions[i]->session;
-                _nc_ps_del_session(ps, NULL, i);
-                nc_session_free(session, data_free);
-                continue;
-            }
+    /* someone may be waiting to remove it */
+    pthread_cond_broadcast(&ps->cond);
+}
+
+/* make the sessions whose timeout may have elapsed pending, their fds would not signal it, the timers
+ * are then rescheduled when the sessions are checked */
+static void
+nc_ps_run_timers(struct nc_pollsession *ps, time_t now_mono)
+{
+    struct nc_timer *timer;
+    uint32_t i;
 
-            ++i;
+    if (ps->idle_timeout != server_opts.idle_timeout) {
+        /* the timers were scheduled with another idle timeout */
+        ps->idle_timeout = server_opts.idle_timeout;
+        for (i = 0; i < ps->session_count; ++i) {
+            nc_ps_pending_add(ps, nc_ps_slot(ps, ps->sessions[i]));
         }
     }
 
-    /* UNLOCK */
-    nc_ps_unlock(ps, q_id, __func__);
+    for (timer = nc_timer_run(&ps->timers, now_mono); timer; timer = timer->next) {
+        nc_ps_pending_add(ps, timer->data);
+    }
 }
 
-#if defined(NC_ENABLED_SSH) || defined(NC_ENABLED_TLS)
-
-API int
-nc_server_add_endpt(const char *name, NC_TRANSPORT_IMPL ti)
+/* the event of the session was processed, it is checked again or waited for, should be called
+ * holding the session RPC lock */
+static void
+nc_ps_session_done(struct nc_pollsession *ps, struct nc_ps_session *ps_session)
 {
-    uint16_t i;
-    int ret = 0;
+    struct nc_session *session = ps_session->session;
+    struct timespec ts_cur;
+    time_t deadline = 0;
 
-    if (!name) {
-        ERRARG("name");
-        return -1;
+    if (ps_session->state != NC_PS_STATE_INVALID) {
+        nc_gettimespec_mono(&ts_cur);
+        deadline = nc_ps_session_deadline(session, ts_cur.tv_sec);
     }
 
-    /* BIND LOCK */
-    pthread_mutex_lock(&server_opts.bind_lock);
+    /* PS LOCK */
+    pthread_mutex_lock(&ps->lock);
 
-    /* ENDPT WRITE LOCK */
-    pthread_rwlock_wrlock(&server_opts.endpt_lock);
+    /* someone may be waiting to remove it */
+    ps_session->event = 0;
+    pthread_cond_broadcast(&ps->cond);
 
-    /* check name uniqueness */
-    for (i = 0; i < server_opts.endpt_count; ++i) {
-        if (!strcmp(server_opts.endpts[i].name, name)) {
-            ERR("Endpoint \"%s\" already exists.", name);
-            ret = -1;
-            goto cleanup;
-        }
+    if (ps_session->state == NC_PS_STATE_INVALID) {
+        /* it is not waited for */
+
+        /* PS UNLOCK */
+        pthread_mutex_unlock(&ps->lock);
+        return;
     }
 
-    ++server_opts.endpt_count;
-    server_opts.endpts = nc_realloc(server_opts.endpts, server_opts.endpt_count * sizeof *server_opts.endpts);
-    if (!server_opts.endpts) {
-        ERRMEM;
-        ret = -1;
-        goto cleanup;
+    if (deadline) {
+        nc_timer_add(&ps->timers, &ps_session->timer, deadline);
     }
-    server_opts.endpts[server_opts.endpt_count - 1].name = lydict_insert(server_opts.ctx, name, 0);
-    server_opts.endpts[server_opts.endpt_count - 1].ti = ti;
 
-    server_opts.binds = nc_realloc(server_opts.binds, server_opts.endpt_count * sizeof *server_opts.binds);
-    if (!server_opts.binds) {
-        ERRMEM;
-        ret = -1;
-        goto cleanup;
+    /* data of the next message may have been read, SSH and TLS buffer them even on their own,
+     * notifications may have been queued meanwhile */
+    if ((session->ti_type != NC_TI_FD) || (session->rbuf.end > session->rbuf.start)
+            || (session->opts.server.ntf_queue && atomic_load(&session->opts.server.ntf_queue->count))
+            || nc_ps_epoll_rearm(ps, ps_session)) {
+        nc_ps_pending_add(ps, ps_session);
+        nc_ps_wake(ps);
     }
 
-    server_opts.binds[server_opts.endpt_count - 1].address = NULL;
-    server_opts.binds[server_opts.endpt_count - 1].port = 0;
-    server_opts.binds[server_opts.endpt_count - 1].sock = -1;
-    server_opts.binds[server_opts.endpt_count - 1].pollin = 0;
+    /* PS UNLOCK */
+    pthread_mutex_unlock(&ps->lock);
+}
 
-    switch (ti) {
-#ifdef NC_ENABLED_SSH
-    case NC_TI_LIBSSH:
-        server_opts.endpts[server_opts.endpt_count - 1].opts.ssh = calloc(1, sizeof(struct nc_server_ssh_opts));
-        if (!server_opts.endpts[server_opts.endpt_count - 1].opts.ssh) {
-            ERRMEM;
-            ret = -1;
-            goto cleanup;
-        }
-        server_opts.endpts[server_opts.endpt_count - 1].opts.ssh->auth_methods =
-            NC_SSH_AUTH_PUBLICKEY | NC_SSH_AUTH_PASSWORD | NC_SSH_AUTH_INTERACTIVE;
-        server_opts.endpts[server_opts.endpt_count - 1].opts.ssh->auth_attempts = 3;
-        server_opts.endpts[server_opts.endpt_count - 1].opts.ssh->auth_timeout = 10;
-        break;
-#endif
-#ifdef NC_ENABLED_TLS
-    case NC_TI_OPENSSL:
-        server_opts.endpts[server_opts.endpt_count - 1].opts.tls = calloc(1, sizeof(struct nc_server_tls_opts));
-        if (!server_opts.endpts[server_opts.endpt_count - 1].opts.tls) {
-            ERRMEM;
-            ret = -1;
-            goto cleanup;
-        }
-        break;
-#endif
-    default:
-        ERRINT;
-        ret = -1;
-        goto cleanup;
-    }
+/* collect up to max_events events on the sessions, ts_timeout is NULL for infinite waiting and ts_cur is updated
+ * returns: NC_PSPOLL_NOSESSIONS,
+ *          NC_PSPOLL_TIMEOUT,
+ *          NC_PSPOLL_ERROR,
+ *          0 (events filled, the sessions with NC_PSPOLL_RPC are RPC locked) */
+static int
+nc_ps_poll_events(struct nc_pollsession *ps, const struct timespec *ts_timeout, struct timespec *ts_cur,
+                  struct nc_ps_event *events, uint16_t max_events, uint16_t *event_count)
+{
+    int ret = NC_PSPOLL_TIMEOUT, r, keep, rearm, step, wait, timer_wait;
+    uint32_t count;
+    time_t deadline;
+    struct nc_ps_session *ps_session;
+    struct nc_ps_ssh_ready ready;
 
-cleanup:
-    /* ENDPT UNLOCK */
-    pthread_rwlock_unlock(&server_opts.endpt_lock);
+    *event_count = 0;
 
-    /* BIND UNLOCK */
-    pthread_mutex_unlock(&server_opts.bind_lock);
+    /* PS LOCK */
+    pthread_mutex_lock(&ps->lock);
 
-    return ret;
-}
+    while (1) {
+        if (!ps->session_count) {
+            ret = NC_PSPOLL_NOSESSIONS;
+            break;
+        }
+
+        nc_ps_run_timers(ps, ts_cur->tv_sec);
+
+        /* check the sessions pending now one at a time, other threads can check the others meanwhile */
+        for (count = ps->pending_count; count && (*event_count < max_events) && (ps_session = nc_ps_pending_take(ps));
+                --count) {
+            events[*event_count].session = ps_session->session;
+            events[*event_count].ps_session = ps_session;
+            if (ps->pending_count) {
+                nc_ps_wake(ps);
+            }
+
+            /* PS UNLOCK */
+            pthread_mutex_unlock(&ps->lock);
+
+            r = nc_ps_poll_session(ps_session, ts_cur->tv_sec, &keep, &rearm, &deadline, &ready);
+
+            /* PS LOCK */
+            pthread_mutex_lock(&ps->lock);
+
+            nc_ps_session_checked(ps, ps_session, keep, rearm, deadline, &ready);
+            if (r == NC_PSPOLL_RPC) {
+                /* the event holds the session until it is processed */
+                ps_session->event = 1;
+            } else if (r == NC_PSPOLL_SESSION_NEW) {
+                /* the session is established, it is handed over to the caller */
+                _nc_ps_del_session(ps, ps_session->session);
+                events[*event_count].ps_session = NULL;
+            }
+
+            /* something happened */
+            if (r != NC_PSPOLL_TIMEOUT) {
+                events[(*event_count)++].ret = r;
+            }
+        }
+        if (*event_count == max_events) {
+            break;
+        }
+
+        /* no more events, no session remains locked except those with events, wait for some */
+        step = ps->pending_count || (ps->epfd == -1);
+        if (step || *event_count) {
+            wait = 0;
+        } else {
+            wait = NC_PS_WAIT_MAX;
+            if (ts_timeout && (nc_difftimespec(ts_cur, ts_timeout) < wait)) {
+                wait = nc_difftimespec(ts_cur, ts_timeout);
+            }
+
+            /* until the next timer expiration */
+            deadline = nc_timer_next(&ps->timers);
+            if (deadline && (deadline - ts_cur->tv_sec <= wait / 1000)) {
+                timer_wait = (deadline - ts_cur->tv_sec) * 1000 - ts_cur->tv_nsec / 1000000;
+                if (timer_wait < wait) {
+                    wait = timer_wait;
+                }
+            }
+            if (wait < 0) {
+                wait = 0;
+            }
+        }
+        r = nc_ps_epoll_wait(ps, wait);
+        if (r == -1) {
+            ret = NC_PSPOLL_ERROR;
+            break;
+        } else if (!r && *event_count) {
+            /* we have something already */
+            break;
+        } else if (!r && step) {
+            /* sessions that cannot be waited for in the epoll set are checked in steps */
+
+            /* PS UNLOCK */
+            pthread_mutex_unlock(&ps->lock);
+
+            usleep(NC_TIMEOUT_STEP);
+
+            /* PS LOCK */
+            pthread_mutex_lock(&ps->lock);
+        }
+
+        /* update current time */
+        nc_gettimespec_mono(ts_cur);
+
+        if (!r && ts_timeout && (nc_difftimespec(ts_cur, ts_timeout) < 1)) {
+            /* final timeout */
+            break;
+        }
+    }
+
+    if (ps->pending_count) {
+        /* we are not checking them anymore */
+        nc_ps_wake(ps);
+    }
+
+    /* PS UNLOCK */
+    pthread_mutex_unlock(&ps->lock);
+
+    if (*event_count) {
+        /* an error may have occured after some events were collected, they must be returned */
+        ret = 0;
+    }
+    return ret;
+}
+
+/* receive the RPC on a session with an NC_PSPOLL_RPC event, process it and reply
+ * returns: see nc_ps_poll(), NC_PSPOLL_TIMEOUT if the whole RPC has not been received yet */
+static int
+nc_ps_process_rpc(struct nc_pollsession *ps, struct nc_ps_session *ps_session, int timeout)
+{
+    struct nc_session *session = ps_session->session;
+    struct nc_server_rpc *rpc = NULL;
+    struct timespec ts_cur;
+    int ret;
+
+    /* we have some data available and the session is RPC locked (but not IO locked) */
+    ret = nc_server_recv_rpc_io(session, timeout, &rpc);
+    if (ret == NC_PSPOLL_TIMEOUT) {
+        /* the rest of the message is not available yet, it will be read once it is */
+        ps_session->state = NC_PS_STATE_NONE;
+    } else if (ret & (NC_PSPOLL_ERROR | NC_PSPOLL_BAD_RPC)) {
+        if (session->status != NC_STATUS_RUNNING) {
+            ret |= NC_PSPOLL_SESSION_TERM | NC_PSPOLL_SESSION_ERROR;
+            ps_session->state = NC_PS_STATE_INVALID;
+        } else {
+            ps_session->state = NC_PS_STATE_NONE;
+        }
+    } else {
+        nc_gettimespec_mono(&ts_cur);
+        session->opts.server.last_rpc = ts_cur.tv_sec;
+
+        /* process RPC, not needed afterwards */
+        ret |= nc_server_send_reply_io(session, timeout, rpc);
+        nc_server_rpc_free(rpc, server_opts.ctx);
+
+        if (session->status != NC_STATUS_RUNNING) {
+            ret |= NC_PSPOLL_SESSION_TERM;
+            if (!(session->term_reason & (NC_SESSION_TERM_CLOSED | NC_SESSION_TERM_KILLED))) {
+                ret |= NC_PSPOLL_SESSION_ERROR;
+            }
+            ps_session->state = NC_PS_STATE_INVALID;
+        } else {
+            ps_session->state = NC_PS_STATE_NONE;
+        }
+    }
+
+    /* check the session again or wait for it */
+    nc_ps_session_done(ps, ps_session);
+
+    /* SESSION RPC UNLOCK */
+    nc_session_rpc_unlock(session, NC_SESSION_LOCK_TIMEOUT, __func__);
+
+    return ret;
+}
+
+API int
+nc_ps_poll(struct nc_pollsession *ps, int timeout, struct nc_session **session)
+{
+    int ret;
+    uint16_t count;
+    struct timespec ts_timeout, ts_cur;
+    struct nc_ps_event event;
+
+    if (!ps) {
+        ERRARG("ps");
+        return NC_PSPOLL_ERROR;
+    }
+
+    /* fill timespecs */
+    nc_gettimespec_mono(&ts_cur);
+    if (timeout > -1) {
+        nc_gettimespec_mono(&ts_timeout);
+        nc_addtimespec(&ts_timeout, timeout);
+    }
+
+    do {
+        ret = nc_ps_poll_events(ps, (timeout > -1) ? &ts_timeout : NULL, &ts_cur, &event, 1, &count);
+        if (!count) {
+            break;
+        }
+        ret = event.ret;
+
+        /* do we want to return the session? */
+        switch (ret) {
+        case NC_PSPOLL_RPC:
+        case NC_PSPOLL_SESSION_TERM:
+        case NC_PSPOLL_SESSION_TERM | NC_PSPOLL_SESSION_ERROR:
+        case NC_PSPOLL_SESSION_NEW:
+#ifdef NC_ENABLED_SSH
+        case NC_PSPOLL_SSH_CHANNEL:
+        case NC_PSPOLL_SSH_MSG:
+#endif
+            if (session) {
+                *session = event.session;
+            }
+            break;
+        default:
+            break;
+        }
+
+        if (ret == NC_PSPOLL_RPC) {
+            ret = nc_ps_process_rpc(ps, event.ps_session, timeout);
+            nc_gettimespec_mono(&ts_cur);
+        }
+
+        /* keep polling for the rest of the timeout if the whole RPC has not been received yet */
+    } while ((ret == NC_PSPOLL_TIMEOUT) && ((timeout < 0) || (nc_difftimespec(&ts_cur, &ts_timeout) > 0)));
+
+    return ret;
+}
+
+API int
+nc_ps_poll_batch(struct nc_pollsession *ps, int timeout, struct nc_ps_event *events, uint16_t max_events)
+{
+    int ret;
+    uint16_t count;
+    struct timespec ts_timeout, ts_cur;
+
+    if (!ps) {
+        ERRARG("ps");
+        return -1;
+    } else if (!events || !max_events) {
+        ERRARG("events");
+        return -1;
+    }
+
+    /* fill timespecs */
+    nc_gettimespec_mono(&ts_cur);
+    if (timeout > -1) {
+        nc_gettimespec_mono(&ts_timeout);
+        nc_addtimespec(&ts_timeout, timeout);
+    }
+
+    ret = nc_ps_poll_events(ps, (timeout > -1) ? &ts_timeout : NULL, &ts_cur, events, max_events, &count);
+    if (ret == NC_PSPOLL_ERROR) {
+        return -1;
+    }
+
+    return count;
+}
+
+API int
+nc_ps_process(struct nc_pollsession *ps, struct nc_ps_event *event, int timeout)
+{
+    if (!ps) {
+        ERRARG("ps");
+        return NC_PSPOLL_ERROR;
+    } else if (!event || !event->ps_session || (event->ret != NC_PSPOLL_RPC)) {
+        ERRARG("event");
+        return NC_PSPOLL_ERROR;
+    }
+
+    event->ret = nc_ps_process_rpc(ps, event->ps_session, timeout);
+    event->ps_session = NULL;
+
+    return event->ret;
+}
+
+API void
+nc_ps_clear(struct nc_pollsession *ps, int all, void (*data_free)(void *))
+{
+    uint32_t i;
+    struct nc_session *session;
+
+    if (!ps) {
+        ERRARG("ps");
+        return;
+    }
+
+    /* PS LOCK */
+    pthread_mutex_lock(&ps->lock);
+
+    for (i = 0; i < ps->session_count; ) {
+        session = nc_ps_slot(ps, ps->sessions[i])->session;
+        if (all || (session->status != NC_STATUS_RUNNING)) {
+            /* it may have been removed by another thread while waiting for it */
+            if (!_nc_ps_del_session(ps, session)) {
+                nc_session_free(session, data_free);
+            }
+            continue;
+        }
+
+        ++i;
+    }
+
+    /* PS UNLOCK */
+    pthread_mutex_unlock(&ps->lock);
+}
+
+#if defined(NC_ENABLED_SSH) || defined(NC_ENABLED_TLS)
+
+API int
+nc_server_add_endpt(const char *name, NC_TRANSPORT_IMPL ti)
+{
+    uint16_t i;
+    int ret = 0;
+
+    if (!name) {
+        ERRARG("name");
+        return -1;
+    }
+
+    /* BIND LOCK */
+    pthread_mutex_lock(&server_opts.bind_lock);
+
+    /* ENDPT WRITE LOCK */
+    pthread_rwlock_wrlock(&server_opts.endpt_lock);
+
+    /* check name uniqueness */
+    for (i = 0; i < server_opts.endpt_count; ++i) {
+        if (!strcmp(server_opts.endpts[i].name, name)) {
+            ERR("Endpoint \"%s\" already exists.", name);
+            ret = -1;
+            goto cleanup;
+        }
+    }
+
+    ++server_opts.endpt_count;
+    server_opts.endpts = nc_realloc(server_opts.endpts, server_opts.endpt_count * sizeof *server_opts.endpts);
+    if (!server_opts.endpts) {
+        ERRMEM;
+        ret = -1;
+        goto cleanup;
+    }
+    server_opts.endpts[server_opts.endpt_count - 1].name = lydict_insert(server_opts.ctx, name, 0);
+    server_opts.endpts[server_opts.endpt_count - 1].ti = ti;
+
+    server_opts.binds = nc_realloc(server_opts.binds, server_opts.endpt_count * sizeof *server_opts.binds);
+    if (!server_opts.binds) {
+        ERRMEM;
+        ret = -1;
+        goto cleanup;
+    }
+
+    server_opts.binds[server_opts.endpt_count - 1].address = NULL;
+    server_opts.binds[server_opts.endpt_count - 1].port = 0;
+    server_opts.binds[server_opts.endpt_count - 1].sock = -1;
+    server_opts.binds[server_opts.endpt_count - 1].pollin = 0;
+
+    switch (ti) {
+#ifdef NC_ENABLED_SSH
+    case NC_TI_LIBSSH:
+        server_opts.endpts[server_opts.endpt_count - 1].opts.ssh = calloc(1, sizeof(struct nc_server_ssh_opts));
+        if (!server_opts.endpts[server_opts.endpt_count - 1].opts.ssh) {
+            ERRMEM;
+            ret = -1;
+            goto cleanup;
+        }
+        server_opts.endpts[server_opts.endpt_count - 1].opts.ssh->auth_methods =
+            NC_SSH_AUTH_PUBLICKEY | NC_SSH_AUTH_PASSWORD | NC_SSH_AUTH_INTERACTIVE;
+        server_opts.endpts[server_opts.endpt_count - 1].opts.ssh->auth_attempts = 3;
+        server_opts.endpts[server_opts.endpt_count - 1].opts.ssh->auth_timeout = 10;
+        break;
+#endif
+#ifdef NC_ENABLED_TLS
+    case NC_TI_OPENSSL:
+        server_opts.endpts[server_opts.endpt_count - 1].opts.tls = calloc(1, sizeof(struct nc_server_tls_opts));
+        if (!server_opts.endpts[server_opts.endpt_count - 1].opts.tls) {
+            ERRMEM;
+            ret = -1;
+            goto cleanup;
+        }
+        break;
+#endif
+    default:
+        ERRINT;
+        ret = -1;
+        goto cleanup;
+    }
+
+cleanup:
+    /* ENDPT UNLOCK */
+    pthread_rwlock_unlock(&server_opts.endpt_lock);
+
+    /* BIND UNLOCK */
+    pthread_mutex_unlock(&server_opts.bind_lock);
+
+    return ret;
+}
 
 int
 nc_server_endpt_set_address_port(const char *endpt_name, const char *address, uint16_t port)
@@ -1749,7 +2995,12 @@ nc_server_endpt_set_address_port(const char *endpt_name, const char *address, ui
     /* we have all the information we need to create a listening socket */
     if (address && port) {
         /* create new socket, close the old one */
-        sock = nc_sock_listen(address, port);
+        if (server_opts.reuseport) {
+            /* only reserve the address, the accepting threads listen on their own sockets */
+            sock = nc_sock_listen(address, port, -1, 1);
+        } else {
+            sock = nc_sock_listen(address, port, server_opts.listen_backlog, 0);
+        }
         if (sock == -1) {
             ret = -1;
             goto cleanup;
@@ -1759,6 +3010,7 @@ nc_server_endpt_set_address_port(const char *endpt_name, const char *address, ui
             close(bind->sock);
         }
         bind->sock = sock;
+        atomic_fetch_add(&server_opts.bind_gen, 1);
     } /* else we are just setting address or port */
 
     if (set_addr) {
@@ -1788,121 +3040,400 @@ cleanup:
     return ret;
 }
 
-API int
-nc_server_endpt_set_address(const char *endpt_name, const char *address)
+API int
+nc_server_endpt_set_address(const char *endpt_name, const char *address)
+{
+    return nc_server_endpt_set_address_port(endpt_name, address, 0);
+}
+
+API int
+nc_server_endpt_set_port(const char *endpt_name, uint16_t port)
+{
+    return nc_server_endpt_set_address_port(endpt_name, NULL, port);
+}
+
+API int
+nc_server_del_endpt(const char *name, NC_TRANSPORT_IMPL ti)
+{
+    uint32_t i;
+    int ret = -1;
+
+    /* BIND LOCK */
+    pthread_mutex_lock(&server_opts.bind_lock);
+
+    /* ENDPT WRITE LOCK */
+    pthread_rwlock_wrlock(&server_opts.endpt_lock);
+
+    if (!name && !ti) {
+        /* remove all endpoints */
+        for (i = 0; i < server_opts.endpt_count; ++i) {
+            lydict_remove(server_opts.ctx, server_opts.endpts[i].name);
+            switch (server_opts.endpts[i].ti) {
+#ifdef NC_ENABLED_SSH
+            case NC_TI_LIBSSH:
+                nc_server_ssh_clear_opts(server_opts.endpts[i].opts.ssh);
+                free(server_opts.endpts[i].opts.ssh);
+                break;
+#endif
+#ifdef NC_ENABLED_TLS
+            case NC_TI_OPENSSL:
+                nc_server_tls_clear_opts(server_opts.endpts[i].opts.tls);
+                free(server_opts.endpts[i].opts.tls);
+                break;
+#endif
+            default:
+                ERRINT;
+                /* won't get here ...*/
+                break;
+            }
+            ret = 0;
+        }
+        free(server_opts.endpts);
+        server_opts.endpts = NULL;
+
+        /* remove all binds */
+        for (i = 0; i < server_opts.endpt_count; ++i) {
+            lydict_remove(server_opts.ctx, server_opts.binds[i].address);
+            if (server_opts.binds[i].sock > -1) {
+                close(server_opts.binds[i].sock);
+            }
+        }
+        free(server_opts.binds);
+        server_opts.binds = NULL;
+
+        server_opts.endpt_count = 0;
+
+    } else {
+        /* remove one endpoint with bind(s) or all endpoints using one transport protocol */
+        for (i = 0; i < server_opts.endpt_count; ++i) {
+            if ((name && !strcmp(server_opts.endpts[i].name, name)) || (!name && (server_opts.endpts[i].ti == ti))) {
+                /* remove endpt */
+                lydict_remove(server_opts.ctx, server_opts.endpts[i].name);
+                switch (server_opts.endpts[i].ti) {
+#ifdef NC_ENABLED_SSH
+                case NC_TI_LIBSSH:
+                    nc_server_ssh_clear_opts(server_opts.endpts[i].opts.ssh);
+                    free(server_opts.endpts[i].opts.ssh);
+                    break;
+#endif
+#ifdef NC_ENABLED_TLS
+                case NC_TI_OPENSSL:
+                    nc_server_tls_clear_opts(server_opts.endpts[i].opts.tls);
+                    free(server_opts.endpts[i].opts.tls);
+                    break;
+#endif
+                default:
+                    ERRINT;
+                    break;
+                }
+
+                /* remove bind(s) */
+                lydict_remove(server_opts.ctx, server_opts.binds[i].address);
+                if (server_opts.binds[i].sock > -1) {
+                    close(server_opts.binds[i].sock);
+                }
+
+                /* move last endpt and bind(s) to the empty space */
+                --server_opts.endpt_count;
+                if (!server_opts.endpt_count) {
+                    free(server_opts.binds);
+                    server_opts.binds = NULL;
+                    free(server_opts.endpts);
+                    server_opts.endpts = NULL;
+                } else if (i < server_opts.endpt_count) {
+                    memcpy(&server_opts.binds[i], &server_opts.binds[server_opts.endpt_count], sizeof *server_opts.binds);
+                    memcpy(&server_opts.endpts[i], &server_opts.endpts[server_opts.endpt_count], sizeof *server_opts.endpts);
+                }
+
+                ret = 0;
+                if (name) {
+                    break;
+                }
+            }
+        }
+    }
+
+    if (!ret) {
+        /* the endpoint indices may have changed */
+        atomic_fetch_add(&server_opts.bind_gen, 1);
+    }
+
+    /* ENDPT UNLOCK */
+    pthread_rwlock_unlock(&server_opts.endpt_lock);
+
+    /* BIND UNLOCK */
+    pthread_mutex_unlock(&server_opts.bind_lock);
+
+    return ret;
+}
+
+API int
+nc_server_set_listen_backlog(int backlog)
+{
+    uint16_t i;
+
+    if (backlog < 1) {
+        ERRARG("backlog");
+        return -1;
+    }
+
+    /* BIND LOCK */
+    pthread_mutex_lock(&server_opts.bind_lock);
+
+    server_opts.listen_backlog = backlog;
+    if (!server_opts.reuseport) {
+        /* listening again only changes the backlog */
+        for (i = 0; i < server_opts.endpt_count; ++i) {
+            if ((server_opts.binds[i].sock > -1) && (listen(server_opts.binds[i].sock, backlog) == -1)) {
+                WRN("Failed to change the backlog of \"%s\" port %u (%s).", server_opts.binds[i].address,
+                    server_opts.binds[i].port, strerror(errno));
+            }
+        }
+    }
+    atomic_fetch_add(&server_opts.bind_gen, 1);
+
+    /* BIND UNLOCK */
+    pthread_mutex_unlock(&server_opts.bind_lock);
+
+    return 0;
+}
+
+API int
+nc_server_set_reuseport(int reuseport)
+{
+#ifdef SO_REUSEPORT
+    uint16_t i;
+    int ret = 0;
+
+    /* BIND LOCK */
+    pthread_mutex_lock(&server_opts.bind_lock);
+
+    for (i = 0; i < server_opts.endpt_count; ++i) {
+        if (server_opts.binds[i].sock > -1) {
+            ERR("SO_REUSEPORT mode cannot be changed while endpoint \"%s\" is listening.", server_opts.endpts[i].name);
+            ret = -1;
+            break;
+        }
+    }
+    if (!ret) {
+        server_opts.reuseport = reuseport ? 1 : 0;
+        atomic_fetch_add(&server_opts.bind_gen, 1);
+    }
+
+    /* BIND UNLOCK */
+    pthread_mutex_unlock(&server_opts.bind_lock);
+
+    return ret;
+#else
+    (void)reuseport;
+
+    ERR("SO_REUSEPORT is not supported.");
+    return -1;
+#endif
+}
+
+#ifdef SO_REUSEPORT
+
+/* listening sockets of a thread accepting sessions in the SO_REUSEPORT mode */
+struct nc_thread_binds {
+    struct nc_bind *binds;     /* copies of the server binds with the sockets of the thread */
+    uint16_t count;
+    uint_fast32_t gen;         /* server bind generation the sockets are for */
+};
+
+static pthread_key_t nc_thread_binds_key;
+static pthread_once_t nc_thread_binds_once = PTHREAD_ONCE_INIT;
+
+static void
+nc_thread_binds_clear(struct nc_thread_binds *tb)
+{
+    uint16_t i;
+
+    for (i = 0; i < tb->count; ++i) {
+        if (tb->binds[i].sock > -1) {
+            close(tb->binds[i].sock);
+        }
+        free((char *)tb->binds[i].address);
+    }
+    free(tb->binds);
+    tb->binds = NULL;
+    tb->count = 0;
+}
+
+static void
+nc_thread_binds_free(void *arg)
+{
+    nc_thread_binds_clear(arg);
+    free(arg);
+}
+
+static void
+nc_thread_binds_key_create(void)
+{
+    pthread_key_create(&nc_thread_binds_key, nc_thread_binds_free);
+}
+
+/* listen on the addresses of the server binds, the sockets on the same addresses are kept because they may have
+ * connections waiting, should be called holding the BIND lock */
+static int
+nc_thread_binds_update(struct nc_thread_binds *tb)
+{
+    struct nc_bind *binds = NULL, *bind;
+    uint16_t i, j;
+
+    if (server_opts.endpt_count) {
+        binds = calloc(server_opts.endpt_count, sizeof *binds);
+        if (!binds) {
+            ERRMEM;
+            return -1;
+        }
+    }
+
+    for (i = 0; i < server_opts.endpt_count; ++i) {
+        bind = &server_opts.binds[i];
+        binds[i].sock = -1;
+        if (bind->sock == -1) {
+            /* no address or port */
+            continue;
+        }
+
+        binds[i].address = strdup(bind->address);
+        binds[i].port = bind->port;
+        if (!binds[i].address) {
+            ERRMEM;
+            continue;
+        }
+
+        for (j = 0; j < tb->count; ++j) {
+            if ((tb->binds[j].sock > -1) && (tb->binds[j].port == bind->port)
+                    && !strcmp(tb->binds[j].address, bind->address)) {
+                binds[i].sock = tb->binds[j].sock;
+                tb->binds[j].sock = -1;
+                if (listen(binds[i].sock, server_opts.listen_backlog) == -1) {
+                    WRN("Failed to change the backlog of \"%s\" port %u (%s).", bind->address, bind->port,
+                        strerror(errno));
+                }
+                break;
+            }
+        }
+        if (binds[i].sock == -1) {
+            binds[i].sock = nc_sock_listen(bind->address, bind->port, server_opts.listen_backlog, 1);
+        }
+    }
+
+    nc_thread_binds_clear(tb);
+    tb->binds = binds;
+    tb->count = server_opts.endpt_count;
+    tb->gen = server_opts.bind_gen;
+    return 0;
+}
+
+/* accept a connection on the listening sockets of this thread, returns holding ENDPT READ LOCK if one was accepted */
+static int
+nc_accept_reuseport(int timeout, char **host, uint16_t *port, uint16_t *idx)
+{
+    struct nc_thread_binds *tb;
+    int ret;
+
+    pthread_once(&nc_thread_binds_once, nc_thread_binds_key_create);
+    tb = pthread_getspecific(nc_thread_binds_key);
+    if (!tb) {
+        tb = calloc(1, sizeof *tb);
+        if (!tb) {
+            ERRMEM;
+            return -1;
+        }
+        tb->gen = server_opts.bind_gen - 1;
+        pthread_setspecific(nc_thread_binds_key, tb);
+    }
+
+    if (tb->gen != server_opts.bind_gen) {
+        /* BIND LOCK */
+        pthread_mutex_lock(&server_opts.bind_lock);
+
+        ret = nc_thread_binds_update(tb);
+
+        /* BIND UNLOCK */
+        pthread_mutex_unlock(&server_opts.bind_lock);
+
+        if (ret) {
+            return -1;
+        }
+    }
+
+    if (!tb->count) {
+        ERR("No endpoints to accept sessions on.");
+        return -1;
+    }
+
+    /* no lock is needed, the sockets are of this thread only */
+    ret = nc_sock_accept_binds(tb->binds, tb->count, timeout, host, port, idx);
+    if (ret < 1) {
+        return ret;
+    }
+
+    /* ENDPT READ LOCK */
+    pthread_rwlock_rdlock(&server_opts.endpt_lock);
+
+    if ((*idx >= server_opts.endpt_count) || (server_opts.binds[*idx].port != tb->binds[*idx].port)
+            || !server_opts.binds[*idx].address || strcmp(server_opts.binds[*idx].address, tb->binds[*idx].address)) {
+        /* the endpoints changed meanwhile and this one no longer listens on the address */
+        /* ENDPT UNLOCK */
+        pthread_rwlock_unlock(&server_opts.endpt_lock);
+
+        VRB("Dropping a connection accepted while the endpoints were being changed.");
+        close(ret);
+        return 0;
+    }
+
+    return ret;
+}
+
+/* close the SO_REUSEPORT listening sockets of this thread, if any */
+static void
+nc_accept_reuseport_clear(void)
 {
-    return nc_server_endpt_set_address_port(endpt_name, address, 0);
-}
+    struct nc_thread_binds *tb;
 
-API int
-nc_server_endpt_set_port(const char *endpt_name, uint16_t port)
-{
-    return nc_server_endpt_set_address_port(endpt_name, NULL, port);
+    pthread_once(&nc_thread_binds_once, nc_thread_binds_key_create);
+    tb = pthread_getspecific(nc_thread_binds_key);
+    if (tb && tb->count) {
+        nc_thread_binds_clear(tb);
+    }
 }
 
-API int
-nc_server_del_endpt(const char *name, NC_TRANSPORT_IMPL ti)
-{
-    uint32_t i;
-    int ret = -1;
-
-    /* BIND LOCK */
-    pthread_mutex_lock(&server_opts.bind_lock);
-
-    /* ENDPT WRITE LOCK */
-    pthread_rwlock_wrlock(&server_opts.endpt_lock);
-
-    if (!name && !ti) {
-        /* remove all endpoints */
-        for (i = 0; i < server_opts.endpt_count; ++i) {
-            lydict_remove(server_opts.ctx, server_opts.endpts[i].name);
-            switch (server_opts.endpts[i].ti) {
-#ifdef NC_ENABLED_SSH
-            case NC_TI_LIBSSH:
-                nc_server_ssh_clear_opts(server_opts.endpts[i].opts.ssh);
-                free(server_opts.endpts[i].opts.ssh);
-                break;
-#endif
-#ifdef NC_ENABLED_TLS
-            case NC_TI_OPENSSL:
-                nc_server_tls_clear_opts(server_opts.endpts[i].opts.tls);
-                free(server_opts.endpts[i].opts.tls);
-                break;
-#endif
-            default:
-                ERRINT;
-                /* won't get here ...*/
-                break;
-            }
-            ret = 0;
-        }
-        free(server_opts.endpts);
-        server_opts.endpts = NULL;
-
-        /* remove all binds */
-        for (i = 0; i < server_opts.endpt_count; ++i) {
-            lydict_remove(server_opts.ctx, server_opts.binds[i].address);
-            if (server_opts.binds[i].sock > -1) {
-                close(server_opts.binds[i].sock);
-            }
-        }
-        free(server_opts.binds);
-        server_opts.binds = NULL;
+#endif /* SO_REUSEPORT */
 
-        server_opts.endpt_count = 0;
+/* wait for a new connection on the listening sockets, returns its socket holding ENDPT READ LOCK,
+ * 0 on timeout, -1 on error */
+static int
+nc_accept_sock(int timeout, char **host, uint16_t *port, uint16_t *bind_idx)
+{
+    int ret;
 
-    } else {
-        /* remove one endpoint with bind(s) or all endpoints using one transport protocol */
-        for (i = 0; i < server_opts.endpt_count; ++i) {
-            if ((name && !strcmp(server_opts.endpts[i].name, name)) || (!name && (server_opts.endpts[i].ti == ti))) {
-                /* remove endpt */
-                lydict_remove(server_opts.ctx, server_opts.endpts[i].name);
-                switch (server_opts.endpts[i].ti) {
-#ifdef NC_ENABLED_SSH
-                case NC_TI_LIBSSH:
-                    nc_server_ssh_clear_opts(server_opts.endpts[i].opts.ssh);
-                    free(server_opts.endpts[i].opts.ssh);
-                    break;
-#endif
-#ifdef NC_ENABLED_TLS
-                case NC_TI_OPENSSL:
-                    nc_server_tls_clear_opts(server_opts.endpts[i].opts.tls);
-                    free(server_opts.endpts[i].opts.tls);
-                    break;
+#ifdef SO_REUSEPORT
+    if (server_opts.reuseport) {
+        return nc_accept_reuseport(timeout, host, port, bind_idx);
+    }
+    nc_accept_reuseport_clear();
 #endif
-                default:
-                    ERRINT;
-                    break;
-                }
-
-                /* remove bind(s) */
-                lydict_remove(server_opts.ctx, server_opts.binds[i].address);
-                if (server_opts.binds[i].sock > -1) {
-                    close(server_opts.binds[i].sock);
-                }
 
-                /* move last endpt and bind(s) to the empty space */
-                --server_opts.endpt_count;
-                if (!server_opts.endpt_count) {
-                    free(server_opts.binds);
-                    server_opts.binds = NULL;
-                    free(server_opts.endpts);
-                    server_opts.endpts = NULL;
-                } else if (i < server_opts.endpt_count) {
-                    memcpy(&server_opts.binds[i], &server_opts.binds[server_opts.endpt_count], sizeof *server_opts.binds);
-                    memcpy(&server_opts.endpts[i], &server_opts.endpts[server_opts.endpt_count], sizeof *server_opts.endpts);
-                }
+    /* BIND LOCK */
+    pthread_mutex_lock(&server_opts.bind_lock);
 
-                ret = 0;
-                if (name) {
-                    break;
-                }
-            }
-        }
+    if (!server_opts.endpt_count) {
+        ERR("No endpoints to accept sessions on.");
+        /* BIND UNLOCK */
+        pthread_mutex_unlock(&server_opts.bind_lock);
+        return -1;
     }
 
-    /* ENDPT UNLOCK */
-    pthread_rwlock_unlock(&server_opts.endpt_lock);
+    ret = nc_sock_accept_binds(server_opts.binds, server_opts.endpt_count, timeout, host, port, bind_idx);
+    if (ret > 0) {
+        /* switch bind_lock for endpt_lock, so that another thread can accept another session */
+        /* ENDPT READ LOCK */
+        pthread_rwlock_rdlock(&server_opts.endpt_lock);
+    }
 
     /* BIND UNLOCK */
     pthread_mutex_unlock(&server_opts.bind_lock);
@@ -1910,6 +3441,27 @@ nc_server_del_endpt(const char *name, NC_TRANSPORT_IMPL ti)
     return ret;
 }
 
+/* create the session of an accepted connection, host is spent */
+static struct nc_session *
+nc_accept_new_session(char *host, uint16_t port)
+{
+    struct nc_session *session;
+
+    session = nc_new_session(NC_SERVER, 0);
+    if (!session) {
+        ERRMEM;
+        free(host);
+        return NULL;
+    }
+    session->status = NC_STATUS_STARTING;
+    session->ctx = server_opts.ctx;
+    session->flags = NC_SESSION_SHAREDCTX;
+    session->host = lydict_insert_zc(server_opts.ctx, host);
+    session->port = port;
+
+    return session;
+}
+
 API NC_MSG_TYPE
 nc_accept(int timeout, struct nc_session **session)
 {
@@ -1927,49 +3479,22 @@ nc_accept(int timeout, struct nc_session **session)
         return NC_MSG_ERROR;
     }
 
-    /* BIND LOCK */
-    pthread_mutex_lock(&server_opts.bind_lock);
-
-    if (!server_opts.endpt_count) {
-        ERR("No endpoints to accept sessions on.");
-        /* BIND UNLOCK */
-        pthread_mutex_unlock(&server_opts.bind_lock);
-        return NC_MSG_ERROR;
-    }
-
-    ret = nc_sock_accept_binds(server_opts.binds, server_opts.endpt_count, timeout, &host, &port, &bind_idx);
+    ret = nc_accept_sock(timeout, &host, &port, &bind_idx);
     if (ret < 1) {
-        /* BIND UNLOCK */
-        pthread_mutex_unlock(&server_opts.bind_lock);
         free(host);
         if (!ret) {
             return NC_MSG_WOULDBLOCK;
         }
         return NC_MSG_ERROR;
     }
-
-    /* switch bind_lock for endpt_lock, so that another thread can accept another session */
-    /* ENDPT READ LOCK */
-    pthread_rwlock_rdlock(&server_opts.endpt_lock);
-
-    /* BIND UNLOCK */
-    pthread_mutex_unlock(&server_opts.bind_lock);
-
     sock = ret;
 
-    *session = nc_new_session(NC_SERVER, 0);
+    *session = nc_accept_new_session(host, port);
     if (!(*session)) {
-        ERRMEM;
         close(sock);
-        free(host);
         msgtype = NC_MSG_ERROR;
         goto cleanup;
     }
-    (*session)->status = NC_STATUS_STARTING;
-    (*session)->ctx = server_opts.ctx;
-    (*session)->flags = NC_SESSION_SHAREDCTX;
-    (*session)->host = lydict_insert_zc(server_opts.ctx, host);
-    (*session)->port = port;
 
     /* sock gets assigned to session or closed */
 #ifdef NC_ENABLED_SSH
@@ -2038,6 +3563,96 @@ cleanup:
     return msgtype;
 }
 
+API int
+nc_ps_accept(struct nc_pollsession *ps, int timeout)
+{
+    struct nc_session *session;
+    struct nc_server_hs *hs;
+    struct nc_endpt *endpt;
+    struct timespec ts_cur;
+    char *host = NULL;
+    uint16_t port, bind_idx;
+    int sock, ret;
+
+    if (!server_opts.ctx) {
+        ERRINIT;
+        return -1;
+    } else if (!ps) {
+        ERRARG("ps");
+        return -1;
+    }
+
+    ret = nc_accept_sock(timeout, &host, &port, &bind_idx);
+    if (ret < 1) {
+        free(host);
+        return ret;
+    }
+    sock = ret;
+    endpt = &server_opts.endpts[bind_idx];
+
+    session = nc_accept_new_session(host, port);
+    if (!session) {
+        close(sock);
+        goto error_unlock;
+    }
+    hs = calloc(1, sizeof *hs);
+    if (!hs) {
+        ERRMEM;
+        close(sock);
+        goto error_unlock;
+    }
+    session->opts.server.hs = hs;
+    hs->endpt_name = lydict_insert(server_opts.ctx, endpt->name, 0);
+    hs->ti = endpt->ti;
+    hs->stage = NC_HS_TRANSPORT;
+    nc_gettimespec_mono(&ts_cur);
+    hs->deadline = ts_cur.tv_sec + NC_TRANSPORT_TIMEOUT / 1000;
+
+    /* sock gets assigned to session or closed, nothing is waited for */
+#ifdef NC_ENABLED_SSH
+    if (endpt->ti == NC_TI_LIBSSH) {
+        session->data = endpt->opts.ssh;
+        ret = nc_accept_ssh_session_start(session, sock);
+    } else
+#endif
+#ifdef NC_ENABLED_TLS
+    if (endpt->ti == NC_TI_OPENSSL) {
+        session->data = endpt->opts.tls;
+        ret = nc_accept_tls_session_start(session, sock);
+    } else
+#endif
+    {
+        ERRINT;
+        close(sock);
+        ret = -1;
+    }
+    session->data = NULL;
+    if (ret) {
+        goto error_unlock;
+    }
+
+    /* ENDPT UNLOCK */
+    pthread_rwlock_unlock(&server_opts.endpt_lock);
+
+    /* assign new SID atomically */
+    session->id = atomic_fetch_add(&server_opts.new_session_id, 1);
+
+    /* the handshake is performed by the threads polling the pollsession */
+    if (nc_ps_add_session(ps, session)) {
+        nc_session_free(session, NULL);
+        return -1;
+    }
+
+    return 1;
+
+error_unlock:
+    /* ENDPT UNLOCK */
+    pthread_rwlock_unlock(&server_opts.endpt_lock);
+
+    nc_session_free(session, NULL);
+    return -1;
+}
+
 API int
 nc_server_ch_add_client(const char *name, NC_TRANSPORT_IMPL ti)
 {
@@ -3110,3 +4725,82 @@ nc_session_get_notif_status(const struct nc_session *session)
 
     return session->opts.server.ntf_status;
 }
+
+API int
+nc_session_set_notif_queue(struct nc_session *session, size_t max_size, NC_NOTIF_QUEUE_POLICY policy)
+{
+    struct nc_ntf_queue *queue, *cur = NULL;
+
+    if (!session || (session->side != NC_SERVER)) {
+        ERRARG("session");
+        return -1;
+    } else if ((policy != NC_NOTIF_QUEUE_BLOCK) && (policy != NC_NOTIF_QUEUE_DROP_OLDEST)
+            && (policy != NC_NOTIF_QUEUE_TERMINATE)) {
+        ERRARG("policy");
+        return -1;
+    }
+
+    queue = session->opts.server.ntf_queue;
+    if (!queue) {
+        if (!max_size) {
+            /* nothing to do */
+            return 0;
+        }
+
+        /* notifications may be being sent meanwhile */
+        queue = calloc(1, sizeof *queue);
+        if (!queue) {
+            ERRMEM;
+            return -1;
+        }
+        pthread_mutex_init(&queue->lock, NULL);
+        if (!atomic_compare_exchange_strong(&session->opts.server.ntf_queue, &cur, queue)) {
+            nc_ntf_queue_free(queue);
+            queue = cur;
+        }
+    }
+
+    /* QUEUE LOCK */
+    pthread_mutex_lock(&queue->lock);
+
+    queue->max_size = max_size;
+    queue->policy = policy;
+
+    /* QUEUE UNLOCK */
+    pthread_mutex_unlock(&queue->lock);
+
+    return 0;
+}
+
+API int
+nc_session_get_notif_queue_stats(const struct nc_session *session, struct nc_notif_queue_stats *stats)
+{
+    struct nc_ntf_queue *queue;
+
+    if (!session || (session->side != NC_SERVER)) {
+        ERRARG("session");
+        return -1;
+    } else if (!stats) {
+        ERRARG("stats");
+        return -1;
+    }
+
+    memset(stats, 0, sizeof *stats);
+    queue = session->opts.server.ntf_queue;
+    if (!queue) {
+        return 0;
+    }
+
+    /* QUEUE LOCK */
+    pthread_mutex_lock(&queue->lock);
+
+    stats->count = atomic_load(&queue->count);
+    stats->size = queue->size;
+    stats->sent = queue->sent;
+    stats->dropped = queue->dropped;
+
+    /* QUEUE UNLOCK */
+    pthread_mutex_unlock(&queue->lock);
+
+    return 0;
+}
@@ -79,12 +79,50 @@ void nc_session_set_status(struct nc_session *session, NC_STATUS status);
 
 /**
  * @brief Set a global nc_rpc_clb that is called if the particular RPC request is
- * received and the private field in the corresponding RPC schema node is NULL.
+ * received, no callback is registered for it using nc_server_set_rpc_clb(), and
+ * the private field in the corresponding RPC schema node is NULL.
  *
  * @param[in] clb An user-defined nc_rpc_clb function callback, NULL to default.
  */
 void nc_set_global_rpc_clb(nc_rpc_clb clb);
 
+/**
+ * @brief Register a callback of an RPC or an action.
+ *
+ * The callbacks are kept in a table of the server keyed by the schema node so, unlike
+ * nc_set_rpc_callback(), they do not use the private field of the node and the lookup
+ * is done in constant time. A registered callback takes precedence over the private
+ * field of the node. The callbacks can be changed at any time, also while the sessions
+ * are being polled. All the callbacks are unregistered by nc_server_destroy(), which
+ * must be called before the context of the nodes is destroyed.
+ *
+ * @param[in] node RPC or action schema node.
+ * @param[in] clb Callback to register, NULL to unregister the current one.
+ * @return 0 on success, -1 on error.
+ */
+int nc_server_set_rpc_clb(const struct lys_node *node, nc_rpc_clb clb);
+
+/**
+ * @brief Register a callback of an RPC or an action specified by its schema path.
+ *
+ * @param[in] ctx Context to find the schema node in.
+ * @param[in] path Schema path of the RPC or action, for example "/ietf-netconf:get".
+ * @param[in] clb Callback to register, NULL to unregister the current one.
+ * @return 0 on success, -1 on error.
+ */
+int nc_server_set_rpc_clb_path(struct ly_ctx *ctx, const char *path, nc_rpc_clb clb);
+
+/**
+ * @brief Get the number of invocations of the callback registered for an RPC or an action.
+ *
+ * Only the callbacks registered using nc_server_set_rpc_clb() are counted. The counter
+ * is kept even after the callback is unregistered.
+ *
+ * @param[in] node RPC or action schema node.
+ * @return Number of the callback invocations, 0 if it was never registered.
+ */
+uint64_t nc_server_get_rpc_clb_calls(const struct lys_node *node);
+
 /**@} Server Session */
 
 /**
@@ -251,7 +289,9 @@ struct nc_pollsession *nc_ps_new(void);
  * @brief Free a pollsession structure.
  *
  * !IMPORTANT! Make sure that \p ps is not accessible (is not used)
- * by any thread before and after this call!
+ * by any thread before and after this call! All the #NC_PSPOLL_RPC events returned
+ * by nc_ps_poll_batch() must be processed before. Threads sending notifications
+ * on its sessions are waited for.
  *
  * @param[in] ps Pollsession structure to free.
  */
@@ -260,6 +300,9 @@ void nc_ps_free(struct nc_pollsession *ps);
 /**
  * @brief Add a session to a pollsession structure.
  *
+ * All the sessions (channels) of a single SSH session should be added to the same pollsession,
+ * they share the socket, which is then waited for only once.
+ *
  * @param[in] ps Pollsession structure to modify.
  * @param[in] session Session to add to \p ps.
  * @return 0 on success, -1 on error.
@@ -269,6 +312,10 @@ int nc_ps_add_session(struct nc_pollsession *ps, struct nc_session *session);
 /**
  * @brief Remove a session from a pollsession structure.
  *
+ * If the session is being polled by another thread or has an #NC_PSPOLL_RPC event returned by
+ * nc_ps_poll_batch() not processed yet, the function waits until it is. The event must then
+ * be processed by another thread.
+ *
  * @param[in] ps Pollsession structure to modify.
  * @param[in] session Session to remove from \p ps.
  * @return 0 on success, -1 on not found.
@@ -282,7 +329,7 @@ int nc_ps_del_session(struct nc_pollsession *ps, struct nc_session *session);
  * @param[in] idx Index of the session.
  * @return Session on index, NULL if out-of-bounds.
  */
-struct nc_session *nc_ps_get_session(const struct nc_pollsession *ps, uint16_t idx);
+struct nc_session *nc_ps_get_session(const struct nc_pollsession *ps, uint32_t idx);
 
 /**
  * @brief Learn the number of sessions in a pollsession structure.
@@ -292,7 +339,7 @@ struct nc_session *nc_ps_get_session(const struct nc_pollsession *ps, uint16_t i
  * @param[in] ps Pollsession structure to check.
  * @return Number of sessions (even invalid ones) in \p ps, -1 on error.
  */
-uint16_t nc_ps_session_count(struct nc_pollsession *ps);
+uint32_t nc_ps_session_count(struct nc_pollsession *ps);
 
 #define NC_PSPOLL_NOSESSIONS 0x0001    /**< No sessions to poll. */
 #define NC_PSPOLL_TIMEOUT 0x0002       /**< Timeout elapsed. */
@@ -307,6 +354,7 @@ uint16_t nc_ps_session_count(struct nc_pollsession *ps);
 #   define NC_PSPOLL_SSH_MSG 0x00100      /**< SSH message received (and processed, if relevant, only with SSH support). */
 #   define NC_PSPOLL_SSH_CHANNEL 0x0200   /**< New SSH channel opened on an existing session (only with SSH support). */
 #endif
+#define NC_PSPOLL_SESSION_NEW 0x0400   /**< Session accepted by nc_ps_accept() was established, it was removed from the pollsession. */
 
 /**
  * @brief Poll sessions and process any received RPCs.
@@ -315,6 +363,12 @@ uint16_t nc_ps_session_count(struct nc_pollsession *ps);
  * is a session termination (#NC_PSPOLL_SESSION_TERM returned), the session
  * should be removed from \p ps.
  *
+ * If supported (epoll), the function waits in the kernel for data on any of the sessions
+ * so idle sessions cost nothing. Otherwise, all the sessions are checked in short steps.
+ *
+ * Any number of threads can poll one \p ps at the same time, each of them takes
+ * a different session with an event.
+ *
  * @param[in] ps Pollsession structure to use.
  * @param[in] timeout Poll timeout in milliseconds. 0 for non-blocking call, -1 for
  *                    infinite waiting.
@@ -324,11 +378,51 @@ uint16_t nc_ps_session_count(struct nc_pollsession *ps);
  */
 int nc_ps_poll(struct nc_pollsession *ps, int timeout, struct nc_session **session);
 
+/**
+ * @brief Event on a session returned by nc_ps_poll_batch().
+ */
+struct nc_ps_event {
+    struct nc_session *session;       /**< Session of the event. */
+    int ret;                          /**< Bitfield of NC_PSPOLL_* macros as returned by nc_ps_poll(). */
+    struct nc_ps_session *ps_session; /**< Internal. */
+};
+
+/**
+ * @brief Poll sessions and return all the events found in one pass, up to \p max_events.
+ *
+ * Unlike nc_ps_poll(), RPCs are not processed. An event with #NC_PSPOLL_RPC only means
+ * that an RPC is being received on the session and it must be passed to nc_ps_process(),
+ * which can be called by any thread. Until then, no other event is returned for the session
+ * and it is not removed from \p ps (nc_ps_del_session() waits for it). All such events
+ * must be processed before nc_ps_clear() or nc_ps_free() is called.
+ * Other events are the same as those of nc_ps_poll().
+ *
+ * @param[in] ps Pollsession structure to use.
+ * @param[in] timeout Poll timeout in milliseconds for the first event. 0 for non-blocking call,
+ *                    -1 for infinite waiting.
+ * @param[out] events Array of at least \p max_events events to fill.
+ * @param[in] max_events Maximum number of events returned.
+ * @return Number of events, 0 if the timeout elapsed or there are no sessions, -1 on error.
+ */
+int nc_ps_poll_batch(struct nc_pollsession *ps, int timeout, struct nc_ps_event *events, uint16_t max_events);
+
+/**
+ * @brief Receive and process an RPC of an #NC_PSPOLL_RPC event returned by nc_ps_poll_batch().
+ *
+ * @param[in] ps Pollsession structure the event was returned for.
+ * @param[in,out] event Event to process, its result is stored in it.
+ * @param[in] timeout Timeout in milliseconds for receiving the RPC and sending its reply.
+ * @return Bitfield of NC_PSPOLL_* macros as returned by nc_ps_poll(),
+ *         #NC_PSPOLL_TIMEOUT if the whole RPC has not been received yet.
+ */
+int nc_ps_process(struct nc_pollsession *ps, struct nc_ps_event *event, int timeout);
+
 /**
  * @brief Remove sessions from a pollsession structure and
  *        call nc_session_free() on them.
  *
  * Calling this function with \p all false makes sense if nc_ps_poll() returned #NC_PSPOLL_SESSION_TERM.
+ * The sessions with unprocessed #NC_PSPOLL_RPC events are waited for, see nc_ps_poll_batch().
  *
  * @param[in] ps Pollsession structure to clear.
  * @param[in] all Whether to free all sessions, or only the invalid ones.
@@ -336,6 +430,42 @@ int nc_ps_poll(struct nc_pollsession *ps, int timeout, struct nc_session **sessi
  */
 void nc_ps_clear(struct nc_pollsession *ps, int all, void (*data_free)(void *));
 
+/**
+ * @brief Start worker threads serving server sessions.
+ *
+ * Every worker polls its own pollsession (shard) and new sessions are added
+ * to the shard with the least sessions. Sessions are accepted on all the endpoints
+ * (if SSH or TLS is supported) by nc_ps_accept() so that their handshakes are performed
+ * by the workers. New NETCONF SSH channels are accepted, too, their handshakes are performed
+ * in the shard with the other channels of the SSH session.
+ * Sessions created otherwise can be added by nc_server_workers_add_session().
+ *
+ * A worker with no events on its sessions takes the sessions with events from
+ * the shards of busy workers so that a session flooding its worker with RPCs
+ * does not delay the other sessions in the shard.
+ *
+ * Terminated sessions are removed and freed by the workers.
+ *
+ * @param[in] count Number of worker threads.
+ * @param[in] session_clb Optional callback called for every new session before it is served.
+ * @param[in] data_free Optional session user data destructor.
+ * @return 0 on success, -1 on error.
+ */
+int nc_server_workers_start(uint16_t count, void (*session_clb)(struct nc_session *session), void (*data_free)(void *));
+
+/**
+ * @brief Add a session to be served by the worker threads.
+ *
+ * @param[in] session Running server session, it is freed by the workers once terminated.
+ * @return 0 on success, -1 on error.
+ */
+int nc_server_workers_add_session(struct nc_session *session);
+
+/**
+ * @brief Stop the worker threads and free all their sessions.
+ */
+void nc_server_workers_stop(void);
+
 #if defined(NC_ENABLED_SSH) || defined(NC_ENABLED_TLS)
 
 /**@} Server Session */
@@ -399,6 +529,31 @@ int nc_server_endpt_set_address(const char *endpt_name, const char *address);
  */
 int nc_server_endpt_set_port(const char *endpt_name, uint16_t port);
 
+/**
+ * @brief Set the maximum number of connections waiting to be accepted on an endpoint.
+ *
+ * Applies to all the listening sockets, also those already listening. Default is 5.
+ *
+ * @param[in] backlog Listen backlog, may be capped by the system (somaxconn on Linux).
+ * @return 0 on success, -1 on error.
+ */
+int nc_server_set_listen_backlog(int backlog);
+
+/**
+ * @brief Enable or disable the SO_REUSEPORT accepting mode.
+ *
+ * In this mode every thread calling nc_accept() listens on its own SO_REUSEPORT socket for each endpoint.
+ * The system distributes the new connections among them and the threads wait for them without any lock,
+ * so many threads can accept sessions at once. A socket of a thread is closed when the thread exits and the
+ * connections waiting on it are dropped.
+ *
+ * Can be changed only while no endpoint has both its address and port set.
+ *
+ * @param[in] reuseport Non-zero to enable, 0 to disable.
+ * @return 0 on success, -1 on error (also if SO_REUSEPORT is not supported).
+ */
+int nc_server_set_reuseport(int reuseport);
+
 /**@} Server */
 
 /**
@@ -420,6 +575,28 @@ int nc_server_endpt_set_port(const char *endpt_name, uint16_t port);
  */
 NC_MSG_TYPE nc_accept(int timeout, struct nc_session **session);
 
+/**
+ * @brief Accept a new connection on the listening endpoints and establish the session in a pollsession.
+ *
+ * Unlike nc_accept(), the session is not established by this function. It is added to \p ps
+ * and the transport handshake (SSH key exchange and authentication or TLS handshake) and
+ * the NETCONF handshake are performed in steps by the threads polling \p ps, each step
+ * only with the data the client has sent so far. A slow client then delays neither
+ * the accepting thread nor the other sessions.
+ *
+ * Once the session is established, nc_ps_poll() returns #NC_PSPOLL_SESSION_NEW with it.
+ * The session is removed from \p ps at that moment so that it can be prepared
+ * and added to any pollsession. If the handshake fails or times out,
+ * #NC_PSPOLL_SESSION_TERM | #NC_PSPOLL_SESSION_ERROR is returned instead
+ * and the session should be removed from \p ps and freed as any other.
+ *
+ * @param[in] ps Pollsession structure to establish the session in.
+ * @param[in] timeout Timeout for receiving a new connection in milliseconds, 0 for
+ *                    non-blocking call, -1 for infinite waiting.
+ * @return 1 if a connection was accepted, 0 on timeout, -1 on error.
+ */
+int nc_ps_accept(struct nc_pollsession *ps, int timeout);
+
 #endif /* NC_ENABLED_SSH || NC_ENABLED_TLS */
 
 #ifdef NC_ENABLED_SSH
@@ -749,6 +926,23 @@ int nc_server_tls_endpt_set_crl_paths(const char *endpt_name, const char *crl_fi
  */
 void nc_server_tls_endpt_clear_crls(const char *endpt_name);
 
+/**
+ * @brief Set TLS session resumption. Resumed sessions skip the asymmetric cryptography of a full handshake.
+ *
+ * Sessions can be resumed using a session ID cache of the endpoint and/or using session tickets
+ * encrypted with keys held in memory only and rotated after \p timeout. The client certificate
+ * of a resumed session is verified and cert-to-name performed again with the current options.
+ * Any change of the endpoint TLS options discards its session ID cache. Resumption is disabled
+ * by default.
+ *
+ * @param[in] endpt_name Existing endpoint name.
+ * @param[in] cache_size Maximum number of sessions in the session ID cache, 0 to disable it.
+ * @param[in] tickets Whether to issue session tickets.
+ * @param[in] timeout Lifetime of resumable sessions in seconds, 0 for the default (300).
+ * @return 0 on success, -1 on error.
+ */
+int nc_server_tls_endpt_set_resumption(const char *endpt_name, uint32_t cache_size, int tickets, uint32_t timeout);
+
 /**
  * @brief Add a cert-to-name entry.
  *
@@ -815,6 +1009,16 @@ const X509 *nc_session_get_client_cert(const struct nc_session *session);
  */
 void nc_server_tls_set_verify_clb(int (*verify_clb)(const struct nc_session *session));
 
+/**
+ * @brief Make all the endpoints and Call Home clients load their server and trusted certificates again.
+ *
+ * The certificates are loaded using the callbacks only for the first accepted session and kept
+ * until the TLS options of the endpoint or Call Home client change. Call this function whenever
+ * the certificates returned by the callbacks change, the new ones are used from the next
+ * accepted session.
+ */
+void nc_server_tls_reload_certs(void);
+
 /**@} Server TLS */
 
 #endif /* NC_ENABLED_TLS */
@@ -851,6 +1055,53 @@ void nc_session_set_notif_status(struct nc_session *session, int notif_status);
  */
 int nc_session_get_notif_status(const struct nc_session *session);
 
+/**
+ * @brief Policy applied when a notification does not fit into the notification queue of a session.
+ */
+typedef enum {
+    NC_NOTIF_QUEUE_BLOCK = 0,   /**< wait for the queue to make room, at most for the sending timeout */
+    NC_NOTIF_QUEUE_DROP_OLDEST, /**< drop the oldest queued notifications not being written yet */
+    NC_NOTIF_QUEUE_TERMINATE    /**< drop all the queued notifications not being written yet and terminate
+                                     the subscription, the session notification status is cleared */
+} NC_NOTIF_QUEUE_POLICY;
+
+/**
+ * @brief Notification queue statistics of a session.
+ */
+struct nc_notif_queue_stats {
+    uint32_t count;             /**< notifications currently queued */
+    size_t size;                /**< size of the notifications currently queued */
+    uint64_t sent;              /**< queued notifications written */
+    uint64_t dropped;           /**< notifications dropped because of the queue overflow */
+};
+
+/**
+ * @brief Make the notifications sent via a session be queued and written asynchronously.
+ *
+ * nc_server_notif_send() and nc_server_notif_send_multi() then only serialize the notification into the queue
+ * and write as much of it as the transport accepts without waiting. The rest is written by the pollsession
+ * the session is in when its transport becomes writable, or before any following message otherwise. The
+ * notifications must not be modified after they have been sent.
+ *
+ * The pollsession must not be freed while notifications are being sent via its sessions.
+ *
+ * @param[in] session Server session to modify.
+ * @param[in] max_size Maximum size of the queued notifications, 0 to write them directly again (the notifications
+ *            still queued are written before the next one).
+ * @param[in] policy Policy applied when a notification does not fit into the queue.
+ * @return 0 on success, -1 on error.
+ */
+int nc_session_set_notif_queue(struct nc_session *session, size_t max_size, NC_NOTIF_QUEUE_POLICY policy);
+
+/**
+ * @brief Get the notification queue statistics of a session.
+ *
+ * @param[in] session Session to get the information from.
+ * @param[out] stats Current notification queue statistics, all zero if the session has no queue.
+ * @return 0 on success, -1 on error.
+ */
+int nc_session_get_notif_queue_stats(const struct nc_session *session, struct nc_notif_queue_stats *stats);
+
 /**@} Server Session */
 
 #endif /* NC_SESSION_SERVER_H_ */
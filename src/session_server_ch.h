@@ -344,6 +344,17 @@ int nc_server_tls_ch_client_set_crl_paths(const char *client_name, const char *c
  */
 void nc_server_tls_ch_client_clear_crls(const char *client_name);
 
+/**
+ * @brief Set Call Home TLS session resumption, see nc_server_tls_endpt_set_resumption().
+ *
+ * @param[in] client_name Existing Call Home client name.
+ * @param[in] cache_size Maximum number of sessions in the session ID cache, 0 to disable it.
+ * @param[in] tickets Whether to issue session tickets.
+ * @param[in] timeout Lifetime of resumable sessions in seconds, 0 for the default (300).
+ * @return 0 on success, -1 on error.
+ */
+int nc_server_tls_ch_client_set_resumption(const char *client_name, uint32_t cache_size, int tickets, uint32_t timeout);
+
 /**
  * @brief Add a cert-to-name entry.
  *
@@ -23,6 +23,7 @@
 #include <crypt.h>
 #include <errno.h>
 #include <time.h>
+#include <poll.h>
 
 #include "session_server.h"
 #include "session_server_ch.h"
@@ -1381,12 +1382,11 @@ nc_ssh_bind_add_hostkeys(ssh_bind sbind, const char **hostkeys, uint8_t hostkey_
 }
 
 int
-nc_accept_ssh_session(struct nc_session *session, int sock, int timeout)
+nc_accept_ssh_session_start(struct nc_session *session, int sock)
 {
     ssh_bind sbind;
     struct nc_server_ssh_opts *opts;
-    int libssh_auth_methods = 0, ret;
-    struct timespec ts_timeout, ts_cur;
+    int libssh_auth_methods = 0;
 
     opts = session->data;
 
@@ -1439,20 +1439,118 @@ nc_accept_ssh_session(struct nc_session *session, int sock, int timeout)
     ssh_bind_free(sbind);
 
     ssh_set_blocking(session->ti.libssh.session, 0);
+    return 0;
+}
+
+int
+nc_accept_ssh_session_step(struct nc_session *session)
+{
+    struct nc_server_ssh_opts *opts = session->data;
+    struct nc_server_hs *hs = session->opts.server.hs;
+    struct timespec ts_cur;
+    int ret;
+
+    hs->wait_out = 0;
+    switch (hs->stage) {
+    case NC_HS_TRANSPORT:
+        ret = ssh_handle_key_exchange(session->ti.libssh.session);
+        if (ret == SSH_AGAIN) {
+            /* wait for the client, or for the socket to accept the rest of our data */
+            if (ssh_get_poll_flags(session->ti.libssh.session) & SSH_WRITE_PENDING) {
+                hs->wait_out = 1;
+            }
+            return 0;
+        } else if (ret != SSH_OK) {
+            ERR("SSH key exchange error (%s).", ssh_get_error(session->ti.libssh.session));
+            return -1;
+        }
+
+        hs->stage = NC_HS_SSH_AUTH;
+        hs->deadline = 0;
+        if (opts->auth_timeout) {
+            nc_gettimespec_mono(&ts_cur);
+            hs->deadline = ts_cur.tv_sec + opts->auth_timeout;
+        }
+        /* fallthrough */
+    case NC_HS_SSH_AUTH:
+        if (!nc_session_is_connected(session)) {
+            ERR("Communication SSH socket unexpectedly closed.");
+            return -1;
+        }
+
+        if (ssh_execute_message_callbacks(session->ti.libssh.session) != SSH_OK) {
+            ERR("Failed to receive SSH messages on a session (%s).",
+                ssh_get_error(session->ti.libssh.session));
+            return -1;
+        }
+
+        if (!(session->flags & NC_SESSION_SSH_AUTHENTICATED)) {
+            if (session->opts.server.ssh_auth_attempts >= opts->auth_attempts) {
+                ERR("Too many failed authentication attempts of user \"%s\".", session->username);
+                return -1;
+            }
+            ret = 0;
+            break;
+        }
+
+        hs->stage = NC_HS_SSH_CHANNEL;
+        nc_gettimespec_mono(&ts_cur);
+        hs->deadline = ts_cur.tv_sec + NC_TRANSPORT_TIMEOUT / 1000;
+        /* fallthrough */
+    case NC_HS_SSH_CHANNEL:
+        ret = nc_open_netconf_channel(session, 0);
+        if (ret < 1) {
+            break;
+        }
+
+        session->flags &= ~NC_SESSION_SSH_NEW_MSG;
+        return 1;
+    default:
+        ERRINT;
+        return -1;
+    }
+
+    if (!ret && (ssh_get_poll_flags(session->ti.libssh.session) & SSH_WRITE_PENDING)) {
+        /* our replies are not sent whole yet */
+        hs->wait_out = 1;
+    }
+    return ret;
+}
+
+int
+nc_accept_ssh_session(struct nc_session *session, int sock, int timeout)
+{
+    struct nc_server_ssh_opts *opts;
+    int ret, wait = -1;
+    short events;
+    struct timespec ts_timeout, ts_cur;
+
+    if (nc_accept_ssh_session_start(session, sock)) {
+        return -1;
+    }
+    opts = session->data;
 
     if (timeout > -1) {
         nc_gettimespec_mono(&ts_timeout);
         nc_addtimespec(&ts_timeout, timeout);
     }
     while ((ret = ssh_handle_key_exchange(session->ti.libssh.session)) == SSH_AGAIN) {
-        /* this tends to take longer */
-        usleep(NC_TIMEOUT_STEP * 20);
         if (timeout > -1) {
             nc_gettimespec_mono(&ts_cur);
-            if (nc_difftimespec(&ts_cur, &ts_timeout) < 1) {
+            wait = nc_difftimespec(&ts_cur, &ts_timeout);
+            if (wait < 1) {
                 break;
             }
         }
+
+        /* wait for the client, or for the socket to accept the rest of our data */
+        events = POLLIN;
+        if (ssh_get_poll_flags(session->ti.libssh.session) & SSH_WRITE_PENDING) {
+            events |= POLLOUT;
+        }
+        if (nc_sock_wait(ssh_get_fd(session->ti.libssh.session), events, wait) < 0) {
+            return -1;
+        }
     }
     if (ret == SSH_AGAIN) {
         ERR("SSH key exchange timeout.");
@@ -1539,7 +1637,7 @@ nc_session_accept_ssh_channel(struct nc_session *orig_session, struct nc_session
                 new_session != orig_session;
                 new_session = new_session->ti.libssh.next) {
             if ((new_session->status == NC_STATUS_STARTING) && new_session->ti.libssh.channel
-                    && (new_session->flags & NC_SESSION_SSH_SUBSYS_NETCONF)) {
+                    && (new_session->flags & NC_SESSION_SSH_SUBSYS_NETCONF) && !new_session->opts.server.hs) {
                 /* we found our session */
                 break;
             }
@@ -1576,11 +1674,10 @@ nc_session_accept_ssh_channel(struct nc_session *orig_session, struct nc_session
 API NC_MSG_TYPE
 nc_ps_accept_ssh_channel(struct nc_pollsession *ps, struct nc_session **session)
 {
-    uint8_t q_id;
     NC_MSG_TYPE msgtype;
     struct nc_session *new_session = NULL, *cur_session;
     struct timespec ts_cur;
-    uint16_t i;
+    uint32_t i;
 
     if (!ps) {
         ERRARG("ps");
@@ -1590,13 +1687,11 @@ nc_ps_accept_ssh_channel(struct nc_pollsession *ps, struct nc_session **session)
         return NC_MSG_ERROR;
     }
 
-    /* LOCK */
-    if (nc_ps_lock(ps, &q_id, __func__)) {
-        return NC_MSG_ERROR;
-    }
+    /* PS LOCK */
+    pthread_mutex_lock(&ps->lock);
 
     for (i = 0; i < ps->session_count; ++i) {
-        cur_session = ps->sessions[i]->session;
+        cur_session = nc_ps_slot(ps, ps->sessions[i])->session;
         if ((cur_session->status == NC_STATUS_RUNNING) && (cur_session->ti_type == NC_TI_LIBSSH)
                 && cur_session->ti.libssh.next) {
             /* an SSH session with more channels */
@@ -1604,7 +1699,7 @@ nc_ps_accept_ssh_channel(struct nc_pollsession *ps, struct nc_session **session)
                     new_session != cur_session;
                     new_session = new_session->ti.libssh.next) {
                 if ((new_session->status == NC_STATUS_STARTING) && new_session->ti.libssh.channel
-                        && (new_session->flags & NC_SESSION_SSH_SUBSYS_NETCONF)) {
+                        && (new_session->flags & NC_SESSION_SSH_SUBSYS_NETCONF) && !new_session->opts.server.hs) {
                     /* we found our session */
                     break;
                 }
@@ -1617,8 +1712,8 @@ nc_ps_accept_ssh_channel(struct nc_pollsession *ps, struct nc_session **session)
         }
     }
 
-    /* UNLOCK */
-    nc_ps_unlock(ps, q_id, __func__);
+    /* PS UNLOCK */
+    pthread_mutex_unlock(&ps->lock);
 
     if (!new_session) {
         ERR("No session with a NETCONF SSH channel ready was found.");
@@ -1643,3 +1738,56 @@ nc_ps_accept_ssh_channel(struct nc_pollsession *ps, struct nc_session **session)
 
     return msgtype;
 }
+
+struct nc_session *
+nc_session_ssh_channel_hs(struct nc_session *orig_session)
+{
+    struct nc_session *new_session = NULL;
+    struct nc_server_hs *hs;
+    struct timespec ts_cur;
+
+    if ((orig_session->ti_type != NC_TI_LIBSSH) || !orig_session->ti.libssh.next) {
+        return NULL;
+    }
+
+    /* channels are created and their handshake state assigned only with the IO lock held */
+
+    /* SESSION IO LOCK */
+    if (nc_session_io_lock(orig_session, NC_SESSION_LOCK_TIMEOUT, __func__) != 1) {
+        return NULL;
+    }
+
+    for (new_session = orig_session->ti.libssh.next;
+            new_session != orig_session;
+            new_session = new_session->ti.libssh.next) {
+        if ((new_session->status == NC_STATUS_STARTING) && new_session->ti.libssh.channel
+                && (new_session->flags & NC_SESSION_SSH_SUBSYS_NETCONF) && !new_session->opts.server.hs) {
+            /* we found our session */
+            break;
+        }
+    }
+    if (new_session == orig_session) {
+        new_session = NULL;
+        goto cleanup;
+    }
+
+    hs = calloc(1, sizeof *hs);
+    if (!hs) {
+        ERRMEM;
+        new_session = NULL;
+        goto cleanup;
+    }
+    hs->ti = NC_TI_LIBSSH;
+    hs->stage = NC_HS_HELLO_SEND;
+    nc_gettimespec_mono(&ts_cur);
+    hs->deadline = ts_cur.tv_sec + (server_opts.hello_timeout ? server_opts.hello_timeout : NC_SERVER_HELLO_TIMEOUT);
+    new_session->opts.server.hs = hs;
+
+    /* assign new SID atomically */
+    new_session->id = atomic_fetch_add(&server_opts.new_session_id, 1);
+
+cleanup:
+    /* SESSION IO UNLOCK */
+    nc_session_io_unlock(orig_session, __func__);
+    return new_session;
+}
@@ -23,6 +23,12 @@
 #include <openssl/err.h>
 #include <openssl/x509v3.h>
 #include <openssl/x509.h>
+#include <openssl/rand.h>
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L // >= 3.0.0
+#   include <openssl/core_names.h>
+#else
+#   include <openssl/hmac.h>
+#endif
 
 #include "session_server.h"
 #include "session_server_ch.h"
@@ -35,6 +41,13 @@ extern struct nc_server_opts server_opts;
 static pthread_key_t verify_key;
 static pthread_once_t verify_once = PTHREAD_ONCE_INIT;
 
+/* protects the cached contexts of all the options */
+static pthread_mutex_t tls_ctx_lock = PTHREAD_MUTEX_INITIALIZER;
+/* changed when all the certificates must be reloaded, the cached contexts are then created again */
+static atomic_uint_fast32_t tls_ctx_gen;
+/* protects the session ticket keys of all the options */
+static pthread_mutex_t tls_ticket_lock = PTHREAD_MUTEX_INITIALIZER;
+
 static char *
 asn1time_to_str(const ASN1_TIME *t)
 {
@@ -904,9 +917,31 @@ fail:
 
 #endif
 
+/* the options of the cached context changed */
+static void
+nc_server_tls_ctx_clear(struct nc_server_tls_opts *opts)
+{
+    /* TLS CTX LOCK */
+    pthread_mutex_lock(&tls_ctx_lock);
+
+    SSL_CTX_free(opts->tls_ctx);
+    opts->tls_ctx = NULL;
+
+    /* TLS CTX UNLOCK */
+    pthread_mutex_unlock(&tls_ctx_lock);
+}
+
+API void
+nc_server_tls_reload_certs(void)
+{
+    atomic_fetch_add(&tls_ctx_gen, 1);
+}
+
 static int
 nc_server_tls_set_server_cert(const char *name, struct nc_server_tls_opts *opts)
 {
+    nc_server_tls_ctx_clear(opts);
+
     if (!name) {
         if (opts->server_cert) {
             lydict_remove(server_opts.ctx, opts->server_cert);
@@ -984,6 +1019,8 @@ nc_server_tls_set_server_cert_clb(int (*cert_clb)(const char *name, void *user_d
     server_opts.server_cert_clb = cert_clb;
     server_opts.server_cert_data = user_data;
     server_opts.server_cert_data_free = free_user_data;
+
+    nc_server_tls_reload_certs();
 }
 
 API void
@@ -999,6 +1036,8 @@ nc_server_tls_set_server_cert_chain_clb(int (*cert_chain_clb)(const char *name,
     server_opts.server_cert_chain_clb = cert_chain_clb;
     server_opts.server_cert_chain_data = user_data;
     server_opts.server_cert_chain_data_free = free_user_data;
+
+    nc_server_tls_reload_certs();
 }
 
 static int
@@ -1009,6 +1048,8 @@ nc_server_tls_add_trusted_cert_list(const char *name, struct nc_server_tls_opts
         return -1;
     }
 
+    nc_server_tls_ctx_clear(opts);
+
     ++opts->trusted_cert_list_count;
     opts->trusted_cert_lists = nc_realloc(opts->trusted_cert_lists, opts->trusted_cert_list_count * sizeof *opts->trusted_cert_lists);
     if (!opts->trusted_cert_lists) {
@@ -1081,6 +1122,8 @@ nc_server_tls_set_trusted_cert_list_clb(int (*cert_list_clb)(const char *name, v
     server_opts.trusted_cert_list_clb = cert_list_clb;
     server_opts.trusted_cert_list_data = user_data;
     server_opts.trusted_cert_list_data_free = free_user_data;
+
+    nc_server_tls_reload_certs();
 }
 
 static int
@@ -1088,6 +1131,8 @@ nc_server_tls_del_trusted_cert_list(const char *name, struct nc_server_tls_opts
 {
     uint16_t i;
 
+    nc_server_tls_ctx_clear(opts);
+
     if (!name) {
         for (i = 0; i < opts->trusted_cert_list_count; ++i) {
             lydict_remove(server_opts.ctx, opts->trusted_cert_lists[i]);
@@ -1171,6 +1216,8 @@ nc_server_tls_set_trusted_ca_paths(const char *ca_file, const char *ca_dir, stru
         return -1;
     }
 
+    nc_server_tls_ctx_clear(opts);
+
     if (ca_file) {
         if (opts->trusted_ca_file) {
             lydict_remove(server_opts.ctx, opts->trusted_ca_file);
@@ -1236,6 +1283,66 @@ nc_server_tls_ch_client_set_trusted_ca_paths(const char *client_name, const char
     return ret;
 }
 
+static int
+nc_server_tls_set_resumption(uint32_t cache_size, int tickets, uint32_t timeout, struct nc_server_tls_opts *opts)
+{
+    nc_server_tls_ctx_clear(opts);
+
+    opts->sess_cache_size = cache_size;
+    opts->sess_tickets = tickets ? 1 : 0;
+    opts->sess_timeout = timeout;
+
+    return 0;
+}
+
+API int
+nc_server_tls_endpt_set_resumption(const char *endpt_name, uint32_t cache_size, int tickets, uint32_t timeout)
+{
+    int ret;
+    struct nc_endpt *endpt;
+
+    if (!endpt_name) {
+        ERRARG("endpt_name");
+        return -1;
+    }
+
+    /* LOCK */
+    endpt = nc_server_endpt_lock_get(endpt_name, NC_TI_OPENSSL, NULL);
+    if (!endpt) {
+        return -1;
+    }
+    ret = nc_server_tls_set_resumption(cache_size, tickets, timeout, endpt->opts.tls);
+    /* UNLOCK */
+    pthread_rwlock_unlock(&server_opts.endpt_lock);
+
+    return ret;
+}
+
+API int
+nc_server_tls_ch_client_set_resumption(const char *client_name, uint32_t cache_size, int tickets, uint32_t timeout)
+{
+    int ret;
+    struct nc_ch_client *client;
+
+    if (!client_name) {
+        ERRARG("client_name");
+        return -1;
+    }
+
+    /* LOCK */
+    client = nc_server_ch_client_lock(client_name, NC_TI_OPENSSL, NULL);
+    if (!client) {
+        return -1;
+    }
+
+    ret = nc_server_tls_set_resumption(cache_size, tickets, timeout, client->opts.tls);
+
+    /* UNLOCK */
+    nc_server_ch_client_unlock(client);
+
+    return ret;
+}
+
 static int
 nc_server_tls_set_crl_paths(const char *crl_file, const char *crl_dir, struct nc_server_tls_opts *opts)
 {
@@ -1712,6 +1819,8 @@ nc_server_tls_clear_opts(struct nc_server_tls_opts *opts)
     lydict_remove(server_opts.ctx, opts->trusted_ca_dir);
     nc_server_tls_clear_crls(opts);
     nc_server_tls_del_ctn(-1, NULL, 0, NULL, opts);
+    nc_server_tls_ctx_clear(opts);
+    OPENSSL_cleanse(opts->ticket_keys, sizeof opts->ticket_keys);
 }
 
 static void
@@ -1913,17 +2022,118 @@ nc_tls_store_set_trusted_certs(X509_STORE *cert_store, const char **trusted_cert
     return 0;
 }
 
-int
-nc_accept_tls_session(struct nc_session *session, int sock, int timeout)
+/* key for a new ticket or the key of a received ticket, returns 1 for the current key, 2 for the previous one,
+ * 0 if there is none */
+static int
+nc_tls_ticket_key_get(struct nc_server_tls_opts *opts, unsigned char *key_name, int enc, struct nc_tls_ticket_key *key)
+{
+    struct nc_tls_ticket_key *cur;
+    struct timespec ts;
+    uint32_t timeout;
+    int i, ret = 0;
+
+    timeout = opts->sess_timeout ? opts->sess_timeout : NC_TLS_SESS_TIMEOUT;
+    nc_gettimespec_mono(&ts);
+
+    /* TICKET LOCK */
+    pthread_mutex_lock(&tls_ticket_lock);
+
+    cur = &opts->ticket_keys[0];
+    if (enc) {
+        if (!cur->created || (ts.tv_sec >= cur->created + timeout)) {
+            /* rotate the keys, tickets of the previous one are still accepted until they expire */
+            opts->ticket_keys[1] = *cur;
+            if ((RAND_bytes(cur->name, sizeof cur->name) != 1) || (RAND_bytes(cur->aes_key, sizeof cur->aes_key) != 1)
+                    || (RAND_bytes(cur->hmac_key, sizeof cur->hmac_key) != 1)) {
+                ERR("Failed to generate a session ticket key (%s).", ERR_reason_error_string(ERR_get_error()));
+                OPENSSL_cleanse(cur, sizeof *cur);
+                goto cleanup;
+            }
+            cur->created = ts.tv_sec;
+        }
+
+        *key = *cur;
+        memcpy(key_name, cur->name, sizeof cur->name);
+        ret = 1;
+    } else {
+        for (i = 0; i < 2; ++i) {
+            if (opts->ticket_keys[i].created && (ts.tv_sec < opts->ticket_keys[i].created + 2 * timeout)
+                    && !memcmp(key_name, opts->ticket_keys[i].name, sizeof opts->ticket_keys[i].name)) {
+                *key = opts->ticket_keys[i];
+                ret = i + 1;
+                break;
+            }
+        }
+    }
+
+cleanup:
+    /* TICKET UNLOCK */
+    pthread_mutex_unlock(&tls_ticket_lock);
+
+    return ret;
+}
+
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L // >= 3.0.0
+static int
+nc_tls_ticket_key_clb(SSL *UNUSED(tls), unsigned char *key_name, unsigned char *iv, EVP_CIPHER_CTX *cipher_ctx,
+                      EVP_MAC_CTX *hmac_ctx, int enc)
+#else
+static int
+nc_tls_ticket_key_clb(SSL *UNUSED(tls), unsigned char *key_name, unsigned char *iv, EVP_CIPHER_CTX *cipher_ctx,
+                      HMAC_CTX *hmac_ctx, int enc)
+#endif
+{
+    struct nc_session *session;
+    struct nc_tls_ticket_key key;
+    int ret, r;
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L // >= 3.0.0
+    OSSL_PARAM params[2];
+#endif
+
+    /* get the thread session, its options were looked up for this handshake step */
+    session = pthread_getspecific(verify_key);
+    if (!session || !session->data) {
+        ERRINT;
+        return 0;
+    }
+
+    ret = nc_tls_ticket_key_get(session->data, key_name, enc, &key);
+    if (!ret) {
+        /* no ticket issued or an unknown one received, full handshake */
+        return 0;
+    }
+
+    if (enc) {
+        r = (RAND_bytes(iv, EVP_CIPHER_iv_length(EVP_aes_256_cbc())) == 1)
+                && (EVP_EncryptInit_ex(cipher_ctx, EVP_aes_256_cbc(), NULL, key.aes_key, iv) == 1);
+    } else {
+        r = (EVP_DecryptInit_ex(cipher_ctx, EVP_aes_256_cbc(), NULL, key.aes_key, iv) == 1);
+    }
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L // >= 3.0.0
+    params[0] = OSSL_PARAM_construct_utf8_string(OSSL_MAC_PARAM_DIGEST, "SHA256", 0);
+    params[1] = OSSL_PARAM_construct_end();
+    r = r && (EVP_MAC_init(hmac_ctx, key.hmac_key, sizeof key.hmac_key, params) == 1);
+#else
+    r = r && (HMAC_Init_ex(hmac_ctx, key.hmac_key, sizeof key.hmac_key, EVP_sha256(), NULL) == 1);
+#endif
+    OPENSSL_cleanse(&key, sizeof key);
+
+    if (!r) {
+        ERR("Failed to initialize a session ticket encryption (%s).", ERR_reason_error_string(ERR_get_error()));
+        return -1;
+    }
+
+    /* a ticket of the previous key is renewed */
+    return ret;
+}
+
+static SSL_CTX *
+nc_tls_ctx_new(struct nc_server_tls_opts *opts)
 {
     X509_STORE *cert_store;
     SSL_CTX *tls_ctx;
     X509_LOOKUP *lookup;
-    struct nc_server_tls_opts *opts;
-    int ret;
-    struct timespec ts_timeout, ts_cur;
-
-    opts = session->data;
+    uint32_t i;
 
     /* SSL_CTX */
 #if OPENSSL_VERSION_NUMBER >= 0x10100000L // >= 1.1.0
@@ -1936,6 +2146,36 @@ nc_accept_tls_session(struct nc_session *session, int sock, int timeout)
         goto error;
     }
     SSL_CTX_set_verify(tls_ctx, SSL_VERIFY_PEER | SSL_VERIFY_FAIL_IF_NO_PEER_CERT, nc_tlsclb_verify);
+
+    /* sessions are resumed only on the same options, the client certificate is verified again after the handshake */
+    for (i = 0; (i < sizeof opts->sid_ctx) && !opts->sid_ctx[i]; ++i);
+    if ((i == sizeof opts->sid_ctx) && (RAND_bytes(opts->sid_ctx, sizeof opts->sid_ctx) != 1)) {
+        ERR("Failed to generate a session ID context (%s).", ERR_reason_error_string(ERR_get_error()));
+        goto error;
+    }
+    SSL_CTX_set_session_id_context(tls_ctx, opts->sid_ctx, sizeof opts->sid_ctx);
+    SSL_CTX_set_timeout(tls_ctx, opts->sess_timeout ? opts->sess_timeout : NC_TLS_SESS_TIMEOUT);
+
+    if (opts->sess_cache_size) {
+        SSL_CTX_set_session_cache_mode(tls_ctx, SSL_SESS_CACHE_SERVER);
+        SSL_CTX_sess_set_cache_size(tls_ctx, opts->sess_cache_size);
+    } else {
+        SSL_CTX_set_session_cache_mode(tls_ctx, SSL_SESS_CACHE_OFF);
+    }
+    if (opts->sess_tickets) {
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L // >= 3.0.0
+        SSL_CTX_set_tlsext_ticket_key_evp_cb(tls_ctx, nc_tls_ticket_key_clb);
+#else
+        SSL_CTX_set_tlsext_ticket_key_cb(tls_ctx, nc_tls_ticket_key_clb);
+#endif
+    } else {
+        SSL_CTX_set_options(tls_ctx, SSL_OP_NO_TICKET);
+    }
+#ifdef SSL_OP_NO_RENEGOTIATION
+    /* the options (and the session data pointing to them) are only available during the accept */
+    SSL_CTX_set_options(tls_ctx, SSL_OP_NO_RENEGOTIATION);
+#endif
+
     if (nc_tls_ctx_set_server_cert_key(tls_ctx, opts->server_cert)) {
         goto error;
     }
@@ -1974,21 +2214,165 @@ nc_accept_tls_session(struct nc_session *session, int sock, int timeout)
         }
     }
 
-    session->ti_type = NC_TI_OPENSSL;
-    session->ti.tls = SSL_new(tls_ctx);
+    return tls_ctx;
 
-    /* context can be freed already, trusted certs must be freed manually */
+error:
     SSL_CTX_free(tls_ctx);
-    tls_ctx = NULL;
+    return NULL;
+}
+
+/* new TLS structure from the cached context of the options, which is created first if needed */
+static SSL *
+nc_tls_new(struct nc_server_tls_opts *opts)
+{
+    SSL *tls = NULL;
+    uint32_t gen;
+
+    gen = atomic_load(&tls_ctx_gen);
 
+    /* TLS CTX LOCK */
+    pthread_mutex_lock(&tls_ctx_lock);
+
+    if (opts->tls_ctx && (opts->tls_ctx_gen != gen)) {
+        /* the certificates are to be reloaded */
+        SSL_CTX_free(opts->tls_ctx);
+        opts->tls_ctx = NULL;
+    }
+    if (!opts->tls_ctx) {
+        opts->tls_ctx = nc_tls_ctx_new(opts);
+        opts->tls_ctx_gen = gen;
+    }
+
+    if (opts->tls_ctx) {
+        /* the structure holds its own reference of the context */
+        tls = SSL_new(opts->tls_ctx);
+        if (!tls) {
+            ERR("Failed to create TLS structure from context.");
+        }
+    }
+
+    /* TLS CTX UNLOCK */
+    pthread_mutex_unlock(&tls_ctx_lock);
+
+    return tls;
+}
+
+int
+nc_accept_tls_session_start(struct nc_session *session, int sock)
+{
+    struct nc_server_tls_opts *opts;
+
+    opts = session->data;
+
+    session->ti_type = NC_TI_OPENSSL;
+    session->ti.tls = nc_tls_new(opts);
     if (!session->ti.tls) {
-        ERR("Failed to create TLS structure from context.");
-        goto error;
+        close(sock);
+        return -1;
     }
 
     SSL_set_fd(session->ti.tls, sock);
-    sock = -1;
-    SSL_set_mode(session->ti.tls, SSL_MODE_AUTO_RETRY);
+    /* a queued notification is written in pieces, a write is not always retried from the same buffer */
+    SSL_set_mode(session->ti.tls, SSL_MODE_AUTO_RETRY | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+    return 0;
+}
+
+static void
+nc_tls_accept_error(struct nc_session *session, int ret)
+{
+    switch (SSL_get_error(session->ti.tls, ret)) {
+    case SSL_ERROR_SYSCALL:
+        ERR("SSL_accept failed (%s).", strerror(errno));
+        break;
+    case SSL_ERROR_SSL:
+        ERR("SSL_accept failed (%s).", ERR_reason_error_string(ERR_get_error()));
+        break;
+    default:
+        ERR("SSL_accept failed.");
+        break;
+    }
+}
+
+/* a resumed session skipped the client certificate verification, it is performed now with the current options */
+static int
+nc_tls_resumed_verify(struct nc_session *session)
+{
+    X509_STORE_CTX *store_ctx = NULL;
+    X509 *cert;
+    int ret = -1;
+
+    if (!SSL_session_reused(session->ti.tls)) {
+        return 0;
+    }
+
+    cert = SSL_get_peer_certificate(session->ti.tls);
+    if (!cert) {
+        ERR("Resumed TLS session without a client certificate.");
+        return -1;
+    }
+
+    store_ctx = X509_STORE_CTX_new();
+    if (!store_ctx || (X509_STORE_CTX_init(store_ctx, SSL_CTX_get_cert_store(SSL_get_SSL_CTX(session->ti.tls)), cert,
+                                           SSL_get_peer_cert_chain(session->ti.tls)) != 1)) {
+        ERR("Failed to create a certificate verification context (%s).", ERR_reason_error_string(ERR_get_error()));
+        goto cleanup;
+    }
+    X509_STORE_CTX_set_default(store_ctx, "ssl_client");
+    X509_STORE_CTX_set_verify_cb(store_ctx, nc_tlsclb_verify);
+
+    if (X509_verify_cert(store_ctx) != 1) {
+        ERR("Client certificate of a resumed TLS session failed verification (%s).",
+            X509_verify_cert_error_string(X509_STORE_CTX_get_error(store_ctx)));
+        goto cleanup;
+    } else if (!session->username) {
+        ERR("Client certificate of a resumed TLS session failed cert-to-name.");
+        goto cleanup;
+    }
+    VRB("Resumed TLS session of the client \"%s\".", session->username);
+    ret = 0;
+
+cleanup:
+    X509_STORE_CTX_free(store_ctx);
+    X509_free(cert);
+    return ret;
+}
+
+int
+nc_accept_tls_session_step(struct nc_session *session)
+{
+    int ret, err;
+
+    /* store session on per-thread basis */
+    pthread_once(&verify_once, nc_tls_make_verify_key);
+    pthread_setspecific(verify_key, session);
+
+    session->opts.server.hs->wait_out = 0;
+    ret = SSL_accept(session->ti.tls);
+    if (ret == 1) {
+        return nc_tls_resumed_verify(session) ? -1 : 1;
+    }
+
+    err = SSL_get_error(session->ti.tls, ret);
+    if (err == SSL_ERROR_WANT_READ) {
+        return 0;
+    } else if (err == SSL_ERROR_WANT_WRITE) {
+        session->opts.server.hs->wait_out = 1;
+        return 0;
+    }
+
+    nc_tls_accept_error(session, ret);
+    return -1;
+}
+
+int
+nc_accept_tls_session(struct nc_session *session, int sock, int timeout)
+{
+    int ret, err, wait = -1;
+    struct timespec ts_timeout, ts_cur;
+
+    if (nc_accept_tls_session_start(session, sock)) {
+        return -1;
+    }
 
     /* store session on per-thread basis */
     pthread_once(&verify_once, nc_tls_make_verify_key);
@@ -1998,38 +2382,29 @@ nc_accept_tls_session(struct nc_session *session, int sock, int timeout)
         nc_gettimespec_mono(&ts_timeout);
         nc_addtimespec(&ts_timeout, timeout);
     }
-    while (((ret = SSL_accept(session->ti.tls)) == -1) && (SSL_get_error(session->ti.tls, ret) == SSL_ERROR_WANT_READ)) {
-        usleep(NC_TIMEOUT_STEP);
+    while (((ret = SSL_accept(session->ti.tls)) == -1) && (((err = SSL_get_error(session->ti.tls, ret)) == SSL_ERROR_WANT_READ)
+            || (err == SSL_ERROR_WANT_WRITE))) {
         if (timeout > -1) {
             nc_gettimespec_mono(&ts_cur);
-            if (nc_difftimespec(&ts_cur, &ts_timeout) < 1) {
+            wait = nc_difftimespec(&ts_cur, &ts_timeout);
+            if (wait < 1) {
                 ERR("SSL_accept timeout.");
                 return 0;
             }
         }
+        if (nc_sock_wait(SSL_get_fd(session->ti.tls), (err == SSL_ERROR_WANT_READ) ? POLLIN : POLLOUT, wait) < 0) {
+            return -1;
+        }
     }
 
     if (ret != 1) {
-        switch (SSL_get_error(session->ti.tls, ret)) {
-        case SSL_ERROR_SYSCALL:
-            ERR("SSL_accept failed (%s).", strerror(errno));
-            break;
-        case SSL_ERROR_SSL:
-            ERR("SSL_accept failed (%s).", ERR_reason_error_string(ERR_get_error()));
-            break;
-        default:
-            ERR("SSL_accept failed.");
-            break;
-        }
+        nc_tls_accept_error(session, ret);
         return -1;
     }
 
-    return 1;
-
-error:
-    if (sock > -1) {
-        close(sock);
+    if (nc_tls_resumed_verify(session)) {
+        return -1;
     }
-    SSL_CTX_free(tls_ctx);
-    return -1;
+
+    return 1;
 }
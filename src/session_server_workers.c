@@ -0,0 +1,376 @@
+/**
+ * \file session_server_workers.c
+ * \brief libnetconf2 server worker threads serving sessions in sharded pollsessions
+ *
+ * Copyright (c) 2019 CESNET, z.s.p.o.
+ *
+ * This source code is licensed under BSD 3-Clause License (the "License").
+ * You may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     https://opensource.org/licenses/BSD-3-Clause
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "libnetconf.h"
+#include "session_server.h"
+
+struct nc_worker {
+    pthread_t tid;
+    uint16_t idx;
+    struct nc_pollsession *ps;  /**< shard of the sessions served primarily by this worker */
+};
+
+/* ACCESS locked */
+static struct {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;        /**< signalled when a session is added or the workers are stopped */
+    atomic_int running;
+    struct nc_worker *workers;
+    uint16_t count;
+#if defined(NC_ENABLED_SSH) || defined(NC_ENABLED_TLS)
+    pthread_t accept_tid;
+#endif
+    void (*session_clb)(struct nc_session *session);
+    void (*data_free)(void *);
+} nc_workers = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .cond = PTHREAD_COND_INITIALIZER,
+};
+
+/* the shard with the least sessions */
+static struct nc_pollsession *
+nc_workers_shard(void)
+{
+    uint16_t i, min = 0;
+
+    for (i = 1; i < nc_workers.count; ++i) {
+        if (nc_ps_session_count(nc_workers.workers[i].ps) < nc_ps_session_count(nc_workers.workers[min].ps)) {
+            min = i;
+        }
+    }
+
+    return nc_workers.workers[min].ps;
+}
+
+/* add an established session to a shard, ps is NULL for the one with the least sessions */
+static int
+nc_workers_add_session(struct nc_pollsession *ps, struct nc_session *session)
+{
+    int ret;
+
+    if (nc_workers.session_clb) {
+        nc_workers.session_clb(session);
+    }
+
+    /* LOCK */
+    pthread_mutex_lock(&nc_workers.lock);
+
+    if (!nc_workers.running) {
+        ERR("Server workers are not running.");
+        ret = -1;
+    } else {
+        ret = nc_ps_add_session(ps ? ps : nc_workers_shard(), session);
+        pthread_cond_broadcast(&nc_workers.cond);
+    }
+
+    /* UNLOCK */
+    pthread_mutex_unlock(&nc_workers.lock);
+
+    return ret;
+}
+
+/* handle the result of polling a shard, returns whether an event occured */
+static int
+nc_workers_poll_result(struct nc_pollsession *ps, int ret, struct nc_session *session)
+{
+    struct nc_pollsession *new_ps;
+#ifdef NC_ENABLED_SSH
+    struct nc_session *new_session;
+#endif
+
+    if (ret & (NC_PSPOLL_NOSESSIONS | NC_PSPOLL_TIMEOUT)) {
+        return 0;
+    }
+
+    if (ret & NC_PSPOLL_SESSION_TERM) {
+        nc_ps_del_session(ps, session);
+        nc_session_free(session, nc_workers.data_free);
+    } else if (ret & NC_PSPOLL_SESSION_NEW) {
+        /* accepted session established, it is no longer in the shard */
+        new_ps = NULL;
+#ifdef NC_ENABLED_SSH
+        if ((session->ti_type == NC_TI_LIBSSH) && session->ti.libssh.next) {
+            /* all the channels of an SSH session must be in the same shard */
+            new_ps = ps;
+        }
+#endif
+        if (nc_workers_add_session(new_ps, session)) {
+            nc_session_free(session, nc_workers.data_free);
+        }
+    }
+#ifdef NC_ENABLED_SSH
+    else if (ret & NC_PSPOLL_SSH_CHANNEL) {
+        /* the NETCONF handshake on the new channel is performed by the shard, it does not block the worker */
+        new_session = nc_session_ssh_channel_hs(session);
+        if (new_session && nc_ps_add_session(ps, new_session)) {
+            nc_session_free(new_session, nc_workers.data_free);
+        }
+    }
+#endif
+
+    return 1;
+}
+
+/* whether the shard worker is not waiting for events, it may be processing an RPC while there are more on the shard */
+static int
+nc_workers_shard_busy(struct nc_pollsession *ps)
+{
+    int ret;
+
+    /* PS LOCK */
+    pthread_mutex_lock(&ps->lock);
+
+    ret = ps->session_count && !ps->waiting;
+
+    /* PS UNLOCK */
+    pthread_mutex_unlock(&ps->lock);
+
+    return ret;
+}
+
+/* take events from the shards of busy workers, returns whether there were any */
+static int
+nc_workers_steal(struct nc_worker *worker)
+{
+    struct nc_pollsession *ps;
+    struct nc_session *session;
+    uint16_t i;
+    int ret, stolen = 0;
+
+    for (i = 1; nc_workers.running && (i < nc_workers.count); ++i) {
+        ps = nc_workers.workers[(worker->idx + i) % nc_workers.count].ps;
+        while (nc_workers.running && nc_workers_shard_busy(ps)) {
+            session = NULL;
+            ret = nc_ps_poll(ps, 0, &session);
+            if (!nc_workers_poll_result(ps, ret, session)) {
+                break;
+            }
+            stolen = 1;
+        }
+    }
+
+    return stolen;
+}
+
+static void *
+nc_worker_thread(void *arg)
+{
+    struct nc_worker *worker = arg;
+    struct nc_session *session;
+    struct timespec ts;
+    int ret;
+
+    while (nc_workers.running) {
+        if (!nc_ps_session_count(worker->ps)) {
+            /* nothing to serve, steal or wait for a new session */
+            if (nc_workers_steal(worker)) {
+                continue;
+            }
+
+            nc_gettimespec_real(&ts);
+            nc_addtimespec(&ts, NC_WORKERS_POLL_TIMEOUT);
+
+            /* LOCK */
+            pthread_mutex_lock(&nc_workers.lock);
+            if (nc_workers.running && !nc_ps_session_count(worker->ps)) {
+                pthread_cond_timedwait(&nc_workers.cond, &nc_workers.lock, &ts);
+            }
+            /* UNLOCK */
+            pthread_mutex_unlock(&nc_workers.lock);
+            continue;
+        }
+
+        session = NULL;
+        ret = nc_ps_poll(worker->ps, NC_WORKERS_POLL_TIMEOUT, &session);
+        if (!nc_workers_poll_result(worker->ps, ret, session) && (ret & NC_PSPOLL_TIMEOUT)) {
+            /* no events on our sessions, help the others */
+            nc_workers_steal(worker);
+        }
+    }
+
+    return NULL;
+}
+
+#if defined(NC_ENABLED_SSH) || defined(NC_ENABLED_TLS)
+
+static void *
+nc_workers_accept_thread(void *arg)
+{
+    struct nc_pollsession *ps;
+
+    (void)arg;
+
+    while (nc_workers.running) {
+        if (!nc_server_endpt_count()) {
+            /* nothing to accept on yet */
+            usleep(NC_WORKERS_POLL_TIMEOUT * 1000);
+            continue;
+        }
+
+        /* LOCK */
+        pthread_mutex_lock(&nc_workers.lock);
+        ps = nc_workers_shard();
+        /* UNLOCK */
+        pthread_mutex_unlock(&nc_workers.lock);
+
+        /* the handshake is performed by the workers, a slow client does not delay accepting the others */
+        if (nc_ps_accept(ps, NC_WORKERS_POLL_TIMEOUT) == 1) {
+            /* LOCK */
+            pthread_mutex_lock(&nc_workers.lock);
+            pthread_cond_broadcast(&nc_workers.cond);
+            /* UNLOCK */
+            pthread_mutex_unlock(&nc_workers.lock);
+        }
+    }
+
+    return NULL;
+}
+
+#endif
+
+API int
+nc_server_workers_start(uint16_t count, void (*session_clb)(struct nc_session *session), void (*data_free)(void *))
+{
+    uint16_t i;
+    int r;
+
+    if (!count) {
+        ERRARG("count");
+        return -1;
+    }
+
+    /* LOCK */
+    pthread_mutex_lock(&nc_workers.lock);
+
+    if (nc_workers.count) {
+        ERR("Server workers are already running.");
+        goto error;
+    }
+
+    nc_workers.workers = calloc(count, sizeof *nc_workers.workers);
+    if (!nc_workers.workers) {
+        ERRMEM;
+        goto error;
+    }
+    for (i = 0; i < count; ++i) {
+        nc_workers.workers[i].idx = i;
+        nc_workers.workers[i].ps = nc_ps_new();
+        if (!nc_workers.workers[i].ps) {
+            goto error_free;
+        }
+    }
+    nc_workers.count = count;
+    nc_workers.session_clb = session_clb;
+    nc_workers.data_free = data_free;
+    nc_workers.running = 1;
+
+    for (i = 0; i < count; ++i) {
+        r = pthread_create(&nc_workers.workers[i].tid, NULL, nc_worker_thread, &nc_workers.workers[i]);
+        if (r) {
+            ERR("Creating a new thread failed (%s).", strerror(r));
+            goto error_join;
+        }
+    }
+#if defined(NC_ENABLED_SSH) || defined(NC_ENABLED_TLS)
+    r = pthread_create(&nc_workers.accept_tid, NULL, nc_workers_accept_thread, NULL);
+    if (r) {
+        ERR("Creating a new thread failed (%s).", strerror(r));
+        goto error_join;
+    }
+#endif
+
+    /* UNLOCK */
+    pthread_mutex_unlock(&nc_workers.lock);
+    return 0;
+
+error_join:
+    nc_workers.running = 0;
+    pthread_cond_broadcast(&nc_workers.cond);
+    pthread_mutex_unlock(&nc_workers.lock);
+    while (i) {
+        pthread_join(nc_workers.workers[--i].tid, NULL);
+    }
+    pthread_mutex_lock(&nc_workers.lock);
+    i = count;
+    nc_workers.count = 0;
+error_free:
+    while (i) {
+        nc_ps_free(nc_workers.workers[--i].ps);
+    }
+    free(nc_workers.workers);
+    nc_workers.workers = NULL;
+error:
+    /* UNLOCK */
+    pthread_mutex_unlock(&nc_workers.lock);
+    return -1;
+}
+
+API int
+nc_server_workers_add_session(struct nc_session *session)
+{
+    if (!session || (session->side != NC_SERVER) || (session->status != NC_STATUS_RUNNING)) {
+        ERRARG("session");
+        return -1;
+    }
+
+    return nc_workers_add_session(NULL, session);
+}
+
+API void
+nc_server_workers_stop(void)
+{
+    uint16_t i;
+
+    /* LOCK */
+    pthread_mutex_lock(&nc_workers.lock);
+
+    if (!nc_workers.running) {
+        /* UNLOCK */
+        pthread_mutex_unlock(&nc_workers.lock);
+        return;
+    }
+    nc_workers.running = 0;
+    pthread_cond_broadcast(&nc_workers.cond);
+
+    /* UNLOCK, the workers may need it to finish */
+    pthread_mutex_unlock(&nc_workers.lock);
+
+#if defined(NC_ENABLED_SSH) || defined(NC_ENABLED_TLS)
+    pthread_join(nc_workers.accept_tid, NULL);
+#endif
+    for (i = 0; i < nc_workers.count; ++i) {
+        pthread_join(nc_workers.workers[i].tid, NULL);
+    }
+
+    /* LOCK */
+    pthread_mutex_lock(&nc_workers.lock);
+
+    for (i = 0; i < nc_workers.count; ++i) {
+        nc_ps_clear(nc_workers.workers[i].ps, 1, nc_workers.data_free);
+        nc_ps_free(nc_workers.workers[i].ps);
+    }
+    free(nc_workers.workers);
+    nc_workers.workers = NULL;
+    nc_workers.count = 0;
+
+    /* UNLOCK */
+    pthread_mutex_unlock(&nc_workers.lock);
+}
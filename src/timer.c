@@ -0,0 +1,178 @@
+/**
+ * \file timer.c
+ * \brief libnetconf2 - hierarchical timer wheel
+ *
+ * Copyright (c) 2019 CESNET, z.s.p.o.
+ *
+ * This source code is licensed under BSD 3-Clause License (the "License").
+ * You may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     https://opensource.org/licenses/BSD-3-Clause
+ */
+
+#define _GNU_SOURCE
+#include <stdint.h>
+#include <string.h>
+
+#include "libnetconf.h"
+
+#define NC_TIMER_SHIFT(level) (NC_TIMER_SLOT_BITS * (level))
+
+/* put the timer into the slot processed at or before its expiration, it must not be before the wheel time */
+static void
+nc_timer_link(struct nc_timer_wheel *wheel, struct nc_timer *timer)
+{
+    time_t diff;
+    uint8_t level, slot;
+
+    /* the highest slot index group in which the expiration differs from the wheel time determines the level,
+     * the slot is then always ahead of the current one on that level */
+    diff = timer->expire ^ wheel->now;
+    for (level = 0; (level < NC_TIMER_LEVELS) && (diff >> NC_TIMER_SHIFT(level + 1)); ++level);
+
+    if (level == NC_TIMER_LEVELS) {
+        level = NC_TIMER_LEVELS - 1;
+        if ((timer->expire >> NC_TIMER_SHIFT(level)) - (wheel->now >> NC_TIMER_SHIFT(level)) < NC_TIMER_SLOTS) {
+            /* in the next round of the highest level */
+            slot = (timer->expire >> NC_TIMER_SHIFT(level)) & (NC_TIMER_SLOTS - 1);
+        } else {
+            /* too far in the future, wait in the last slot of the highest level and be moved again from there */
+            slot = ((wheel->now >> NC_TIMER_SHIFT(level)) - 1) & (NC_TIMER_SLOTS - 1);
+        }
+    } else {
+        slot = (timer->expire >> NC_TIMER_SHIFT(level)) & (NC_TIMER_SLOTS - 1);
+    }
+
+    timer->level = level;
+    timer->slot = slot;
+    timer->next = wheel->slots[level][slot];
+    if (timer->next) {
+        timer->next->pprev = &timer->next;
+    }
+    timer->pprev = &wheel->slots[level][slot];
+    wheel->slots[level][slot] = timer;
+    wheel->occupied[level] |= UINT64_C(1) << slot;
+}
+
+static void
+nc_timer_unlink(struct nc_timer_wheel *wheel, struct nc_timer *timer)
+{
+    *timer->pprev = timer->next;
+    if (timer->next) {
+        timer->next->pprev = timer->pprev;
+    }
+    if (!wheel->slots[timer->level][timer->slot]) {
+        wheel->occupied[timer->level] &= ~(UINT64_C(1) << timer->slot);
+    }
+    timer->next = NULL;
+    timer->pprev = NULL;
+}
+
+void
+nc_timer_wheel_init(struct nc_timer_wheel *wheel, time_t now)
+{
+    memset(wheel, 0, sizeof *wheel);
+    wheel->now = now;
+}
+
+void
+nc_timer_add(struct nc_timer_wheel *wheel, struct nc_timer *timer, time_t expire)
+{
+    if (timer->pprev) {
+        nc_timer_unlink(wheel, timer);
+    } else {
+        ++wheel->count;
+    }
+
+    /* the current second has already been processed */
+    timer->expire = (expire > wheel->now) ? expire : wheel->now + 1;
+    nc_timer_link(wheel, timer);
+}
+
+void
+nc_timer_del(struct nc_timer_wheel *wheel, struct nc_timer *timer)
+{
+    if (timer->pprev) {
+        nc_timer_unlink(wheel, timer);
+        --wheel->count;
+    }
+}
+
+time_t
+nc_timer_next(const struct nc_timer_wheel *wheel)
+{
+    time_t next = 0, t;
+    uint64_t occupied;
+    uint8_t level, cur;
+
+    for (level = 0; level < NC_TIMER_LEVELS; ++level) {
+        if (!wheel->occupied[level]) {
+            continue;
+        }
+
+        /* rotate the bitmap so that the slot following the current one is the lowest bit */
+        cur = ((wheel->now >> NC_TIMER_SHIFT(level)) + 1) & (NC_TIMER_SLOTS - 1);
+        occupied = wheel->occupied[level];
+        if (cur) {
+            occupied = (occupied >> cur) | (occupied << (NC_TIMER_SLOTS - cur));
+        }
+
+        /* when the first occupied slot is processed */
+        t = ((wheel->now >> NC_TIMER_SHIFT(level)) + __builtin_ctzll(occupied) + 1) << NC_TIMER_SHIFT(level);
+        if (!next || (t < next)) {
+            next = t;
+        }
+    }
+
+    return next;
+}
+
+struct nc_timer *
+nc_timer_run(struct nc_timer_wheel *wheel, time_t now)
+{
+    struct nc_timer *expired = NULL, *timer, *next;
+    time_t t;
+    int level;
+    uint8_t slot;
+
+    while (wheel->now < now) {
+        /* skip the seconds in which nothing is to be done */
+        t = nc_timer_next(wheel);
+        if (!t || (t > now)) {
+            wheel->now = now;
+            break;
+        }
+        wheel->now = t;
+
+        /* move the timers of the higher level slots reached to the lower levels */
+        for (level = NC_TIMER_LEVELS - 1; level > 0; --level) {
+            if (wheel->now & ((UINT64_C(1) << NC_TIMER_SHIFT(level)) - 1)) {
+                continue;
+            }
+
+            slot = (wheel->now >> NC_TIMER_SHIFT(level)) & (NC_TIMER_SLOTS - 1);
+            timer = wheel->slots[level][slot];
+            wheel->slots[level][slot] = NULL;
+            wheel->occupied[level] &= ~(UINT64_C(1) << slot);
+            for (; timer; timer = next) {
+                next = timer->next;
+                nc_timer_link(wheel, timer);
+            }
+        }
+
+        /* expire the timers of the current second */
+        slot = wheel->now & (NC_TIMER_SLOTS - 1);
+        for (timer = wheel->slots[0][slot]; timer; timer = next) {
+            next = timer->next;
+            timer->pprev = NULL;
+            timer->next = expired;
+            expired = timer;
+            --wheel->count;
+        }
+        wheel->slots[0][slot] = NULL;
+        wheel->occupied[0] &= ~(UINT64_C(1) << slot);
+    }
+
+    return expired;
+}
@@ -22,6 +22,7 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <string.h>
+#include <time.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/socket.h>
@@ -39,6 +40,9 @@ struct nc_session *server_session;
 struct nc_session *client_session;
 struct ly_ctx *ctx;
 volatile int glob_state;
+int notif_multi;
+int notif_queue;
+int registered_clb_calls;
 
 struct nc_server_reply *
 my_get_rpc_clb(struct lyd_node *rpc, struct nc_session *session)
@@ -49,6 +53,16 @@ my_get_rpc_clb(struct lyd_node *rpc, struct nc_session *session)
     return nc_server_reply_ok();
 }
 
+struct nc_server_reply *
+my_get_registered_rpc_clb(struct lyd_node *rpc, struct nc_session *session)
+{
+    assert_string_equal(rpc->schema->name, "get");
+    assert_ptr_equal(session, server_session);
+
+    ++registered_clb_calls;
+    return nc_server_reply_ok();
+}
+
 struct nc_server_reply *
 my_getconfig_rpc_clb(struct lyd_node *rpc, struct nc_session *session)
 {
@@ -103,6 +117,7 @@ test_new_session(NC_SIDE side)
         pthread_mutex_init(sess->opts.server.rpc_lock, NULL);
         pthread_cond_init(sess->opts.server.rpc_cond, NULL);
         *sess->opts.server.rpc_inuse = 0;
+        pthread_mutex_init(&sess->opts.server.ps_lock, NULL);
     }
 
     sess->io_lock = malloc(sizeof *sess->io_lock);
@@ -229,6 +244,411 @@ test_send_recv_ok_11(void **state)
     test_send_recv_ok();
 }
 
+static void
+test_send_recv_partial(const char *part1, const char *part2)
+{
+    int ret;
+    struct nc_pollsession *ps;
+
+    ps = nc_ps_new();
+    assert_non_null(ps);
+    nc_ps_add_session(ps, server_session);
+
+    /* only a part of the RPC, the poll must not wait for the rest */
+    assert_int_equal(write(client_session->ti.fd.out, part1, strlen(part1)), strlen(part1));
+    ret = nc_ps_poll(ps, 0, NULL);
+    assert_int_equal(ret, NC_PSPOLL_TIMEOUT);
+    assert_int_equal(server_session->status, NC_STATUS_RUNNING);
+
+    /* the rest of it */
+    assert_int_equal(write(client_session->ti.fd.out, part2, strlen(part2)), strlen(part2));
+    ret = nc_ps_poll(ps, 0, NULL);
+    assert_int_equal(ret, NC_PSPOLL_RPC);
+
+    nc_ps_free(ps);
+}
+
+static void
+test_send_recv_partial_10(void **state)
+{
+    (void)state;
+
+    server_session->version = NC_VERSION_10;
+    client_session->version = NC_VERSION_10;
+
+    test_send_recv_partial("<rpc xmlns=\"urn:ietf:params:xml:ns:netconf:base:1.0\" message-id=\"1\"><ge",
+                           "t/></rpc>]]>]]>");
+}
+
+static void
+test_send_recv_partial_11(void **state)
+{
+    (void)state;
+
+    server_session->version = NC_VERSION_11;
+    client_session->version = NC_VERSION_11;
+
+    test_send_recv_partial("\n#80\n<rpc xmlns=\"urn:ietf:params:xml:ns:netconf:base:1.0\" message-id=\"1\"><ge",
+                           "t/></rpc>\n##\n");
+}
+
+static void
+test_send_recv_partial_huge_chunk(void **state)
+{
+    int ret;
+    const char *part = "\n#4294967295\n<rpc xmlns=\"urn:ietf:params:xml:ns:netconf:base:1.0\" message-id=\"1\">";
+    struct nc_pollsession *ps;
+
+    (void)state;
+
+    server_session->version = NC_VERSION_11;
+    client_session->version = NC_VERSION_11;
+
+    ps = nc_ps_new();
+    assert_non_null(ps);
+    nc_ps_add_session(ps, server_session);
+
+    /* the announced chunk size is not allocated before its data arrive */
+    assert_int_equal(write(client_session->ti.fd.out, part, strlen(part)), strlen(part));
+    ret = nc_ps_poll(ps, 0, NULL);
+    assert_int_equal(ret, NC_PSPOLL_TIMEOUT);
+    assert_int_equal(server_session->status, NC_STATUS_RUNNING);
+    assert_true(server_session->rmsg.size <= NC_READ_CHUNK_RESERVE + 1);
+
+    nc_ps_free(ps);
+}
+
+static void *
+send_rpc_thread(void *arg)
+{
+    uint64_t msgid;
+    struct nc_rpc *rpc = arg;
+
+    usleep(100000);
+    assert_int_equal(nc_send_rpc(client_session, rpc, 0, &msgid), NC_MSG_RPC);
+
+    return NULL;
+}
+
+static void
+test_send_recv_wait(void **state)
+{
+    (void)state;
+    int ret;
+    pthread_t tid;
+    struct nc_rpc *rpc;
+    struct nc_pollsession *ps;
+
+    server_session->version = NC_VERSION_11;
+    client_session->version = NC_VERSION_11;
+
+    ps = nc_ps_new();
+    assert_non_null(ps);
+    nc_ps_add_session(ps, server_session);
+
+    /* nothing received */
+    ret = nc_ps_poll(ps, 0, NULL);
+    assert_int_equal(ret, NC_PSPOLL_TIMEOUT);
+
+    /* the poll waits until the RPC is sent */
+    rpc = nc_rpc_get(NULL, 0, 0);
+    assert_non_null(rpc);
+    pthread_create(&tid, NULL, send_rpc_thread, rpc);
+
+    ret = nc_ps_poll(ps, 5000, NULL);
+    assert_int_equal(ret, NC_PSPOLL_RPC);
+
+    pthread_join(tid, NULL);
+    nc_rpc_free(rpc);
+    nc_ps_free(ps);
+}
+
+static void
+test_send_recv_rpc_clb(void **state)
+{
+    (void)state;
+    const struct lys_node *node;
+
+    server_session->version = NC_VERSION_11;
+    client_session->version = NC_VERSION_11;
+
+    /* only RPCs and actions can have a callback */
+    node = ly_ctx_get_node(ctx, NULL, "/ietf-netconf-acm:nacm", 0);
+    assert_non_null(node);
+    assert_int_equal(nc_server_set_rpc_clb(node, my_get_registered_rpc_clb), -1);
+
+    node = ly_ctx_get_node(ctx, NULL, "/ietf-netconf:get", 0);
+    assert_non_null(node);
+    assert_int_equal(nc_server_set_rpc_clb_path(ctx, "/ietf-netconf:get", my_get_registered_rpc_clb), 0);
+    assert_int_equal(nc_server_get_rpc_clb_calls(node), 0);
+
+    /* the registered callback takes precedence over the one in the schema node */
+    test_send_recv_ok();
+    test_send_recv_ok();
+    assert_int_equal(registered_clb_calls, 2);
+    assert_int_equal(nc_server_get_rpc_clb_calls(node), 2);
+
+    /* the schema node callback is used again after unregistering, the counter is kept */
+    assert_int_equal(nc_server_set_rpc_clb(node, NULL), 0);
+    test_send_recv_ok();
+    assert_int_equal(registered_clb_calls, 2);
+    assert_int_equal(nc_server_get_rpc_clb_calls(node), 2);
+}
+
+#define POLL_THREAD_COUNT 16
+
+static void *
+poll_thread(void *arg)
+{
+    struct nc_pollsession *ps = arg;
+
+    return (void *)(intptr_t)nc_ps_poll(ps, 1000, NULL);
+}
+
+static void
+test_send_recv_poll_threads(void **state)
+{
+    (void)state;
+    int i, rpcs = 0;
+    void *ret;
+    pthread_t tids[POLL_THREAD_COUNT], tid;
+    struct nc_rpc *rpc;
+    struct nc_pollsession *ps;
+
+    server_session->version = NC_VERSION_11;
+    client_session->version = NC_VERSION_11;
+
+    ps = nc_ps_new();
+    assert_non_null(ps);
+    nc_ps_add_session(ps, server_session);
+
+    /* there is no limit on the number of threads polling one pollsession */
+    for (i = 0; i < POLL_THREAD_COUNT; ++i) {
+        pthread_create(&tids[i], NULL, poll_thread, ps);
+    }
+
+    rpc = nc_rpc_get(NULL, 0, 0);
+    assert_non_null(rpc);
+    pthread_create(&tid, NULL, send_rpc_thread, rpc);
+
+    /* exactly one of them gets the RPC, the others time out */
+    for (i = 0; i < POLL_THREAD_COUNT; ++i) {
+        pthread_join(tids[i], &ret);
+        if ((intptr_t)ret == NC_PSPOLL_RPC) {
+            ++rpcs;
+        } else {
+            assert_int_equal((intptr_t)ret, NC_PSPOLL_TIMEOUT);
+        }
+    }
+    assert_int_equal(rpcs, 1);
+
+    pthread_join(tid, NULL);
+    nc_rpc_free(rpc);
+    nc_ps_free(ps);
+}
+
+static volatile int del_done;
+
+static void *
+del_session_thread(void *arg)
+{
+    struct nc_pollsession *ps = (struct nc_pollsession *)arg;
+
+    /* waits for the RPC event to be processed */
+    assert_int_equal(nc_ps_del_session(ps, server_session), 0);
+    del_done = 1;
+
+    return NULL;
+}
+
+static void
+test_send_recv_batch(void **state)
+{
+    (void)state;
+    int ret;
+    uint64_t msgid;
+    NC_MSG_TYPE msgtype;
+    struct nc_rpc *rpc;
+    struct nc_reply *reply;
+    struct nc_pollsession *ps;
+    struct nc_ps_event events[8];
+    pthread_t tid;
+
+    server_session->version = NC_VERSION_11;
+    client_session->version = NC_VERSION_11;
+
+    ps = nc_ps_new();
+    assert_non_null(ps);
+    nc_ps_add_session(ps, server_session);
+
+    /* nothing received */
+    ret = nc_ps_poll_batch(ps, 0, events, 8);
+    assert_int_equal(ret, 0);
+
+    rpc = nc_rpc_get(NULL, 0, 0);
+    assert_non_null(rpc);
+    msgtype = nc_send_rpc(client_session, rpc, 0, &msgid);
+    assert_int_equal(msgtype, NC_MSG_RPC);
+
+    /* the RPC is only returned, then processed */
+    ret = nc_ps_poll_batch(ps, 5000, events, 8);
+    assert_int_equal(ret, 1);
+    assert_ptr_equal(events[0].session, server_session);
+    assert_int_equal(events[0].ret, NC_PSPOLL_RPC);
+
+    /* the session cannot be removed until its event is processed */
+    del_done = 0;
+    pthread_create(&tid, NULL, del_session_thread, ps);
+    usleep(100000);
+    assert_int_equal(del_done, 0);
+
+    ret = nc_ps_process(ps, &events[0], 0);
+    assert_int_equal(ret, NC_PSPOLL_RPC);
+
+    pthread_join(tid, NULL);
+    assert_int_equal(del_done, 1);
+    assert_int_equal(nc_ps_session_count(ps), 0);
+
+    msgtype = nc_recv_reply(client_session, rpc, msgid, 0, 0, &reply);
+    assert_int_equal(msgtype, NC_MSG_REPLY);
+    assert_int_equal(reply->type, NC_RPL_OK);
+    nc_reply_free(reply);
+    nc_rpc_free(rpc);
+
+    nc_ps_free(ps);
+}
+
+#if defined(NC_ENABLED_SSH) || defined(NC_ENABLED_TLS)
+
+/* the session is established by the pollsession as if accepted by nc_ps_accept() on a transport */
+static void
+test_new_session_hs(int timeout)
+{
+    struct nc_server_hs *hs;
+    struct timespec ts;
+
+    server_session->status = NC_STATUS_STARTING;
+    fcntl(server_session->ti.fd.in, F_SETFL, O_NONBLOCK);
+
+    hs = calloc(1, sizeof *hs);
+    assert_non_null(hs);
+    hs->ti = NC_TI_FD;
+    hs->stage = NC_HS_HELLO_SEND;
+    /* the monotonic clock of the library */
+    clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+    hs->deadline = ts.tv_sec + timeout;
+    server_session->opts.server.hs = hs;
+}
+
+static void
+test_ps_handshake(void **state)
+{
+    (void)state;
+    int ret;
+    const char *hello = "<hello xmlns=\"urn:ietf:params:xml:ns:netconf:base:1.0\"><capabilities>"
+                        "<capability>urn:ietf:params:netconf:base:1.0</capability></capabilities></hello>]]>]]>";
+    struct nc_session *session = NULL;
+    struct nc_pollsession *ps;
+
+    test_new_session_hs(5);
+
+    ps = nc_ps_new();
+    assert_non_null(ps);
+    nc_ps_add_session(ps, server_session);
+
+    /* the server <hello> is sent, waiting for the client one */
+    ret = nc_ps_poll(ps, 0, &session);
+    assert_int_equal(ret, NC_PSPOLL_TIMEOUT);
+    assert_int_equal(server_session->status, NC_STATUS_STARTING);
+
+    ret = write(client_session->ti.fd.out, hello, strlen(hello));
+    assert_int_equal(ret, strlen(hello));
+
+    /* the session is established and handed over */
+    ret = nc_ps_poll(ps, 5000, &session);
+    assert_int_equal(ret, NC_PSPOLL_SESSION_NEW);
+    assert_ptr_equal(session, server_session);
+    assert_int_equal(session->status, NC_STATUS_RUNNING);
+    assert_int_equal(session->version, NC_VERSION_10);
+    assert_null(session->opts.server.hs);
+    assert_int_equal(nc_ps_session_count(ps), 0);
+
+    nc_ps_free(ps);
+}
+
+static void
+test_ps_handshake_timeout(void **state)
+{
+    (void)state;
+    int ret;
+    struct nc_session *session = NULL;
+    struct nc_pollsession *ps;
+
+    test_new_session_hs(1);
+
+    ps = nc_ps_new();
+    assert_non_null(ps);
+    nc_ps_add_session(ps, server_session);
+
+    /* the client never sends its <hello> */
+    ret = nc_ps_poll(ps, 5000, &session);
+    assert_int_equal(ret, NC_PSPOLL_SESSION_TERM | NC_PSPOLL_SESSION_ERROR);
+    assert_ptr_equal(session, server_session);
+    assert_int_equal(session->status, NC_STATUS_INVALID);
+    assert_int_equal(session->term_reason, NC_SESSION_TERM_TIMEOUT);
+
+    nc_ps_del_session(ps, session);
+    nc_ps_free(ps);
+}
+
+#endif /* NC_ENABLED_SSH || NC_ENABLED_TLS */
+
+static int
+teardown_client_session(void **state)
+{
+    (void)state;
+
+    /* the server session was freed by the workers */
+    close(client_session->ti.fd.in);
+    nc_session_free(client_session, NULL);
+
+    return 0;
+}
+
+static void
+test_send_recv_workers(void **state)
+{
+    (void)state;
+    int fd;
+    uint64_t msgid;
+    NC_MSG_TYPE msgtype;
+    struct nc_rpc *rpc;
+    struct nc_reply *reply;
+
+    server_session->version = NC_VERSION_11;
+    client_session->version = NC_VERSION_11;
+    fd = server_session->ti.fd.in;
+
+    assert_int_equal(nc_server_workers_start(4, NULL, NULL), 0);
+    assert_int_equal(nc_server_workers_add_session(server_session), 0);
+
+    /* the RPC is processed by a worker */
+    rpc = nc_rpc_get(NULL, 0, 0);
+    assert_non_null(rpc);
+
+    msgtype = nc_send_rpc(client_session, rpc, 0, &msgid);
+    assert_int_equal(msgtype, NC_MSG_RPC);
+
+    msgtype = nc_recv_reply(client_session, rpc, msgid, 5000, 0, &reply);
+    assert_int_equal(msgtype, NC_MSG_REPLY);
+    assert_int_equal(reply->type, NC_RPL_OK);
+    nc_reply_free(reply);
+    nc_rpc_free(rpc);
+
+    nc_server_workers_stop();
+    close(fd);
+}
+
 static void
 test_send_recv_error(void)
 {
@@ -348,6 +768,70 @@ test_send_recv_data_11(void **state)
     test_send_recv_data();
 }
 
+static void
+test_send_recv_data_unlocked_10(void **state)
+{
+    (void)state;
+
+    server_session->version = NC_VERSION_10;
+    client_session->version = NC_VERSION_10;
+
+    nc_set_print_unlocked(1);
+    test_send_recv_data();
+    nc_set_print_unlocked(0);
+}
+
+static void
+test_send_recv_data_unlocked_11(void **state)
+{
+    (void)state;
+
+    server_session->version = NC_VERSION_11;
+    client_session->version = NC_VERSION_11;
+
+    /* the buffered reply is split into many chunks */
+    nc_set_print_unlocked(1);
+    assert_int_equal(nc_session_set_chunk_size(server_session, NC_WRITE_CHUNK_MIN), 0);
+    test_send_recv_data();
+    nc_set_print_unlocked(0);
+}
+
+static void
+test_send_recv_stats(void **state)
+{
+    (void)state;
+    struct nc_stats cstats, sstats, global;
+
+    server_session->version = NC_VERSION_11;
+    client_session->version = NC_VERSION_11;
+
+    test_send_recv_data();
+
+    assert_int_equal(nc_session_get_stats(client_session, &cstats), 0);
+    assert_int_equal(nc_session_get_stats(server_session, &sstats), 0);
+
+    assert_int_equal(cstats.msgs_out[NC_MSG_RPC], 1);
+    assert_int_equal(sstats.msgs_in[NC_MSG_RPC], 1);
+    assert_int_equal(sstats.msgs_out[NC_MSG_REPLY], 1);
+    assert_int_equal(cstats.msgs_in[NC_MSG_REPLY], 1);
+
+    /* everything sent was received */
+    assert_int_not_equal(cstats.bytes_out, 0);
+    assert_int_equal(cstats.bytes_out, sstats.bytes_in);
+    assert_int_equal(sstats.bytes_out, cstats.bytes_in);
+    assert_int_not_equal(cstats.chunks_out, 0);
+    assert_int_equal(cstats.chunks_out, sstats.chunks_in);
+    assert_int_equal(sstats.chunks_out, cstats.chunks_in);
+    assert_int_equal(sstats.bad_framing, 0);
+    assert_int_not_equal(sstats.read_calls, 0);
+    assert_int_not_equal(sstats.write_calls, 0);
+
+    /* global counters include both sessions */
+    nc_get_stats(&global);
+    assert_true(global.bytes_out >= cstats.bytes_out + sstats.bytes_out);
+    assert_true(global.msgs_in[NC_MSG_RPC] >= 1);
+}
+
 static void
 test_notif_clb(struct nc_session *session, const struct nc_notif *notif)
 {
@@ -367,6 +851,7 @@ server_send_notif_thread(void *arg)
     NC_MSG_TYPE msg_type;
     struct lyd_node *notif_tree;
     struct nc_server_notif *notif;
+    struct nc_notif_queue_stats stats;
     char *buf;
     (void)arg;
 
@@ -385,10 +870,25 @@ server_send_notif_thread(void *arg)
 
     /* send notif */
     nc_session_set_notif_status(server_session, 1);
-    msg_type = nc_server_notif_send(server_session, notif, 100);
+    if (notif_queue) {
+        assert_int_equal(nc_session_set_notif_queue(server_session, 64 * 1024, NC_NOTIF_QUEUE_DROP_OLDEST), 0);
+    }
+    if (notif_multi) {
+        assert_int_equal(nc_server_notif_send_multi(&server_session, 1, notif, 100, &msg_type), 1);
+    } else {
+        msg_type = nc_server_notif_send(server_session, notif, 100);
+    }
     nc_server_notif_free(notif);
     assert_int_equal(msg_type, NC_MSG_NOTIF);
 
+    if (notif_queue) {
+        /* the transport accepted it right away */
+        assert_int_equal(nc_session_get_notif_queue_stats(server_session, &stats), 0);
+        assert_int_equal(stats.count, 0);
+        assert_int_equal(stats.sent, 1);
+        assert_int_equal(stats.dropped, 0);
+    }
+
     /* update state */
     glob_state = 2;
 
@@ -470,6 +970,261 @@ test_send_recv_notif_11(void **state)
     test_send_recv_notif();
 }
 
+static void
+test_send_recv_notif_queue_10(void **state)
+{
+    (void)state;
+
+    server_session->version = NC_VERSION_10;
+    client_session->version = NC_VERSION_10;
+
+    notif_queue = 1;
+    test_send_recv_notif();
+    notif_queue = 0;
+}
+
+static void
+test_send_recv_notif_queue_11(void **state)
+{
+    (void)state;
+
+    server_session->version = NC_VERSION_11;
+    client_session->version = NC_VERSION_11;
+
+    notif_queue = 1;
+    test_send_recv_notif();
+    notif_queue = 0;
+}
+
+/* notification queue small enough to overflow while the transport is full */
+#define TEST_NOTIF_QUEUE_SIZE 4096
+
+static struct nc_server_notif *
+test_notif_new(void)
+{
+    struct lyd_node *notif_tree;
+    struct nc_server_notif *notif;
+    char *buf;
+
+    notif_tree = lyd_new_path(NULL, ctx, "/nc-notifications:notificationComplete", NULL, 0, 0);
+    assert_non_null(notif_tree);
+    buf = malloc(64);
+    assert_non_null(buf);
+    notif = nc_server_notif_new(notif_tree, nc_time2datetime(time(NULL), NULL, buf), NC_PARAMTYPE_FREE);
+    assert_non_null(notif);
+
+    return notif;
+}
+
+/* send notifications until one does not fit into the queue, returns its result, sent is set to the number of those
+ * accepted */
+static NC_MSG_TYPE
+test_notif_queue_fill(struct nc_server_notif *notif, NC_NOTIF_QUEUE_POLICY policy, uint32_t *sent)
+{
+    int sndbuf = 4096;
+    uint32_t i;
+    NC_MSG_TYPE msgtype;
+    struct nc_notif_queue_stats stats;
+
+    /* the client reads nothing, so the transport is soon full */
+    setsockopt(server_session->ti.fd.out, SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof sndbuf);
+
+    nc_session_set_notif_status(server_session, 1);
+    assert_int_equal(nc_session_set_notif_queue(server_session, TEST_NOTIF_QUEUE_SIZE, policy), 0);
+
+    *sent = 0;
+    for (i = 0; i < 100000; ++i) {
+        msgtype = nc_server_notif_send(server_session, notif, 0);
+        if (msgtype != NC_MSG_NOTIF) {
+            return msgtype;
+        }
+        ++*sent;
+
+        assert_int_equal(nc_session_get_notif_queue_stats(server_session, &stats), 0);
+        if (stats.dropped) {
+            return msgtype;
+        }
+    }
+
+    fail();
+    return NC_MSG_ERROR;
+}
+
+static void
+test_send_recv_notif_queue_block(void **state)
+{
+    (void)state;
+    uint32_t sent;
+    NC_MSG_TYPE msgtype;
+    struct nc_server_notif *notif;
+    struct nc_notif_queue_stats stats;
+    struct timespec ts_start, ts_end;
+
+    server_session->version = NC_VERSION_11;
+    client_session->version = NC_VERSION_11;
+
+    notif = test_notif_new();
+    msgtype = test_notif_queue_fill(notif, NC_NOTIF_QUEUE_BLOCK, &sent);
+    assert_int_equal(msgtype, NC_MSG_WOULDBLOCK);
+
+    /* the queue makes no room while the client reads nothing */
+    clock_gettime(CLOCK_MONOTONIC, &ts_start);
+    msgtype = nc_server_notif_send(server_session, notif, 200);
+    clock_gettime(CLOCK_MONOTONIC, &ts_end);
+    assert_int_equal(msgtype, NC_MSG_WOULDBLOCK);
+    assert_true((ts_end.tv_sec - ts_start.tv_sec) * 1000 + (ts_end.tv_nsec - ts_start.tv_nsec) / 1000000 >= 190);
+
+    assert_int_equal(nc_session_get_notif_queue_stats(server_session, &stats), 0);
+    assert_int_not_equal(stats.count, 0);
+    assert_int_equal(stats.dropped, 0);
+    assert_int_equal(nc_session_get_notif_status(server_session), 1);
+
+    nc_server_notif_free(notif);
+}
+
+static void
+test_send_recv_notif_queue_drop(void **state)
+{
+    (void)state;
+    uint32_t sent, i;
+    NC_MSG_TYPE msgtype;
+    struct nc_server_notif *notif;
+    struct nc_notif_queue_stats stats, stats2;
+
+    server_session->version = NC_VERSION_11;
+    client_session->version = NC_VERSION_11;
+
+    notif = test_notif_new();
+    msgtype = test_notif_queue_fill(notif, NC_NOTIF_QUEUE_DROP_OLDEST, &sent);
+    assert_int_equal(msgtype, NC_MSG_NOTIF);
+    assert_int_equal(nc_session_get_notif_queue_stats(server_session, &stats), 0);
+    assert_int_equal(stats.dropped, 1);
+
+    /* every other notification of the same size replaces the oldest one */
+    for (i = 0; i < 10; ++i) {
+        assert_int_equal(nc_server_notif_send(server_session, notif, 0), NC_MSG_NOTIF);
+    }
+    assert_int_equal(nc_session_get_notif_queue_stats(server_session, &stats2), 0);
+    assert_int_equal(stats2.dropped, stats.dropped + 10);
+    assert_int_equal(stats2.count, stats.count);
+    assert_true(stats2.size <= TEST_NOTIF_QUEUE_SIZE);
+
+    nc_server_notif_free(notif);
+}
+
+static void
+test_send_recv_notif_queue_terminate(void **state)
+{
+    (void)state;
+    uint32_t sent;
+    NC_MSG_TYPE msgtype;
+    struct nc_server_notif *notif;
+    struct nc_notif_queue_stats stats;
+
+    server_session->version = NC_VERSION_11;
+    client_session->version = NC_VERSION_11;
+
+    notif = test_notif_new();
+    msgtype = test_notif_queue_fill(notif, NC_NOTIF_QUEUE_TERMINATE, &sent);
+    assert_int_equal(msgtype, NC_MSG_ERROR);
+
+    /* only the notification being written remains */
+    assert_int_equal(nc_session_get_notif_status(server_session), 0);
+    assert_int_equal(nc_session_get_notif_queue_stats(server_session, &stats), 0);
+    assert_true(stats.count <= 1);
+    assert_int_not_equal(stats.dropped, 0);
+
+    nc_server_notif_free(notif);
+}
+
+static volatile int poll_stop;
+
+static void *
+poll_until_stopped_thread(void *arg)
+{
+    struct nc_pollsession *ps = (struct nc_pollsession *)arg;
+
+    while (!poll_stop) {
+        nc_ps_poll(ps, 100, NULL);
+    }
+
+    return NULL;
+}
+
+static void
+test_send_recv_notif_queue_resume(void **state)
+{
+    (void)state;
+    uint32_t sent, i;
+    pthread_t tid;
+    NC_MSG_TYPE msgtype;
+    struct nc_server_notif *notif;
+    struct nc_notif *cnotif;
+    struct nc_notif_queue_stats stats;
+    struct nc_pollsession *ps;
+
+    server_session->version = NC_VERSION_11;
+    client_session->version = NC_VERSION_11;
+
+    /* the head notification is partially written and some of those after it are dropped */
+    notif = test_notif_new();
+    msgtype = test_notif_queue_fill(notif, NC_NOTIF_QUEUE_DROP_OLDEST, &sent);
+    assert_int_equal(msgtype, NC_MSG_NOTIF);
+    assert_int_equal(nc_session_get_notif_queue_stats(server_session, &stats), 0);
+    assert_int_not_equal(stats.count, 0);
+
+    /* the pollsession writes the rest once the client reads */
+    ps = nc_ps_new();
+    assert_non_null(ps);
+    nc_ps_add_session(ps, server_session);
+    poll_stop = 0;
+    pthread_create(&tid, NULL, poll_until_stopped_thread, ps);
+
+    /* all the notifications not dropped are received whole */
+    for (i = 0; i < sent - stats.dropped; ++i) {
+        msgtype = nc_recv_notif(client_session, 5000, &cnotif);
+        assert_int_equal(msgtype, NC_MSG_NOTIF);
+        assert_string_equal(cnotif->tree->schema->name, "notificationComplete");
+        nc_notif_free(cnotif);
+    }
+
+    poll_stop = 1;
+    pthread_join(tid, NULL);
+    nc_ps_free(ps);
+
+    assert_int_equal(nc_session_get_notif_queue_stats(server_session, &stats), 0);
+    assert_int_equal(stats.count, 0);
+    assert_int_equal(stats.size, 0);
+
+    nc_server_notif_free(notif);
+}
+
+static void
+test_send_recv_notif_multi_10(void **state)
+{
+    (void)state;
+
+    server_session->version = NC_VERSION_10;
+    client_session->version = NC_VERSION_10;
+
+    notif_multi = 1;
+    test_send_recv_notif();
+    notif_multi = 0;
+}
+
+static void
+test_send_recv_notif_multi_11(void **state)
+{
+    (void)state;
+
+    server_session->version = NC_VERSION_11;
+    client_session->version = NC_VERSION_11;
+
+    notif_multi = 1;
+    test_send_recv_notif();
+    notif_multi = 0;
+}
+
 int
 main(void)
 {
@@ -513,10 +1268,33 @@ main(void)
         cmocka_unit_test_setup_teardown(test_send_recv_error_10, setup_sessions, teardown_sessions),
         cmocka_unit_test_setup_teardown(test_send_recv_data_10, setup_sessions, teardown_sessions),
         cmocka_unit_test_setup_teardown(test_send_recv_notif_10, setup_sessions, teardown_sessions),
+        cmocka_unit_test_setup_teardown(test_send_recv_partial_10, setup_sessions, teardown_sessions),
+        cmocka_unit_test_setup_teardown(test_send_recv_data_unlocked_10, setup_sessions, teardown_sessions),
         cmocka_unit_test_setup_teardown(test_send_recv_ok_11, setup_sessions, teardown_sessions),
         cmocka_unit_test_setup_teardown(test_send_recv_error_11, setup_sessions, teardown_sessions),
         cmocka_unit_test_setup_teardown(test_send_recv_data_11, setup_sessions, teardown_sessions),
         cmocka_unit_test_setup_teardown(test_send_recv_notif_11, setup_sessions, teardown_sessions),
+        cmocka_unit_test_setup_teardown(test_send_recv_notif_multi_10, setup_sessions, teardown_sessions),
+        cmocka_unit_test_setup_teardown(test_send_recv_notif_multi_11, setup_sessions, teardown_sessions),
+        cmocka_unit_test_setup_teardown(test_send_recv_notif_queue_10, setup_sessions, teardown_sessions),
+        cmocka_unit_test_setup_teardown(test_send_recv_notif_queue_11, setup_sessions, teardown_sessions),
+        cmocka_unit_test_setup_teardown(test_send_recv_notif_queue_block, setup_sessions, teardown_sessions),
+        cmocka_unit_test_setup_teardown(test_send_recv_notif_queue_drop, setup_sessions, teardown_sessions),
+        cmocka_unit_test_setup_teardown(test_send_recv_notif_queue_terminate, setup_sessions, teardown_sessions),
+        cmocka_unit_test_setup_teardown(test_send_recv_notif_queue_resume, setup_sessions, teardown_sessions),
+        cmocka_unit_test_setup_teardown(test_send_recv_partial_11, setup_sessions, teardown_sessions),
+        cmocka_unit_test_setup_teardown(test_send_recv_partial_huge_chunk, setup_sessions, teardown_sessions),
+        cmocka_unit_test_setup_teardown(test_send_recv_data_unlocked_11, setup_sessions, teardown_sessions),
+        cmocka_unit_test_setup_teardown(test_send_recv_stats, setup_sessions, teardown_sessions),
+        cmocka_unit_test_setup_teardown(test_send_recv_rpc_clb, setup_sessions, teardown_sessions),
+        cmocka_unit_test_setup_teardown(test_send_recv_wait, setup_sessions, teardown_sessions),
+        cmocka_unit_test_setup_teardown(test_send_recv_poll_threads, setup_sessions, teardown_sessions),
+        cmocka_unit_test_setup_teardown(test_send_recv_workers, setup_sessions, teardown_client_session),
+        cmocka_unit_test_setup_teardown(test_send_recv_batch, setup_sessions, teardown_sessions),
+#if defined(NC_ENABLED_SSH) || defined(NC_ENABLED_TLS)
+        cmocka_unit_test_setup_teardown(test_ps_handshake, setup_sessions, teardown_sessions),
+        cmocka_unit_test_setup_teardown(test_ps_handshake_timeout, setup_sessions, teardown_sessions),
+#endif
     };
 
     ret = cmocka_run_group_tests(comm, NULL, NULL);
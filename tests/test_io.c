@@ -171,13 +171,153 @@ test_write_rpc_11_bad(void **state)
     return test_write_rpc_bad(state);
 }
 
+static void
+test_write_rpc_chunks(void **state)
+{
+    struct wr *w = (struct wr *)*state;
+    uint64_t msgid;
+    NC_MSG_TYPE type;
+    int p[2];
+    char buf[4096];
+    ssize_t len = 0, r;
+    char *ptr;
+    unsigned long chunk;
+
+    w->session->side = NC_CLIENT;
+    w->session->version = NC_VERSION_11;
+
+    assert_int_equal(nc_session_set_chunk_size(w->session, 1), -1);
+    assert_int_equal(nc_session_set_chunk_size(w->session, 64), 0);
+    assert_int_equal(nc_session_get_chunk_size(w->session), 64);
+
+    assert_int_equal(pipe(p), 0);
+    w->session->ti.fd.out = p[1];
+
+    do {
+        type = nc_send_rpc(w->session, w->rpc, 1000, &msgid);
+    } while(type == NC_MSG_WOULDBLOCK);
+    assert_int_equal(type, NC_MSG_RPC);
+    close(p[1]);
+
+    while ((r = read(p[0], buf + len, sizeof buf - 1 - len)) > 0) {
+        len += r;
+    }
+    close(p[0]);
+    buf[len] = '\0';
+
+    /* every chunk fits the set size */
+    ptr = buf;
+    while (strncmp(ptr, "\n##\n", 5)) {
+        assert_int_equal(strncmp(ptr, "\n#", 2), 0);
+        chunk = strtoul(ptr + 2, &ptr, 10);
+        assert_true(chunk && (chunk <= 64));
+        assert_int_equal(*ptr, '\n');
+        ptr += 1 + chunk;
+        assert_true(ptr < buf + len);
+    }
+    assert_ptr_equal(ptr + 5, buf + len);
+}
+
+static void
+test_write_rpc_closed(void **state)
+{
+    struct wr *w = (struct wr *)*state;
+    uint64_t msgid;
+    NC_MSG_TYPE type;
+    int p[2];
+
+    w->session->side = NC_CLIENT;
+
+    /* the peer is gone, it must be detected without the process being killed by SIGPIPE */
+    assert_int_equal(pipe(p), 0);
+    close(p[0]);
+    w->session->ti.fd.out = p[1];
+
+    do {
+        type = nc_send_rpc(w->session, w->rpc, 1000, &msgid);
+    } while(type == NC_MSG_WOULDBLOCK);
+    close(p[1]);
+
+    assert_int_equal(type, NC_MSG_ERROR);
+    assert_int_equal(w->session->status, NC_STATUS_INVALID);
+    assert_int_equal(w->session->term_reason, NC_SESSION_TERM_DROPPED);
+}
+
+static void
+test_write_rpc_10_closed(void **state)
+{
+    struct wr *w = (struct wr *)*state;
+
+    w->session->version = NC_VERSION_10;
+
+    return test_write_rpc_closed(state);
+}
+
+static void
+test_write_rpc_11_closed(void **state)
+{
+    struct wr *w = (struct wr *)*state;
+
+    w->session->version = NC_VERSION_11;
+
+    return test_write_rpc_closed(state);
+}
+
+static void
+test_write_hello_cached(void **state)
+{
+    struct wr *w = (struct wr *)*state;
+    const char *cpblts[] = {"urn:ietf:params:netconf:base:1.0", "urn:example:capab?a=1&b=2", NULL};
+    struct nc_msg_buf *hello;
+    uint32_t sid = 5;
+    int p[2];
+    char buf[2][1024];
+    ssize_t len[2];
+    int i;
+
+    w->session->side = NC_SERVER;
+    w->session->status = NC_STATUS_STARTING;
+
+    hello = nc_msg_buf_hello(cpblts);
+    assert_non_null(hello);
+
+    /* the pre-serialized capabilities must produce the same message as the capabilities array */
+    for (i = 0; i < 2; ++i) {
+        assert_int_equal(pipe(p), 0);
+        w->session->ti.fd.out = p[1];
+
+        if (!i) {
+            assert_int_equal(nc_write_msg_io(w->session, 1000, NC_MSG_HELLO, cpblts, &sid), NC_MSG_HELLO);
+        } else {
+            assert_int_equal(nc_write_msg_io(w->session, 1000, NC_MSG_HELLO, NULL, &sid, hello), NC_MSG_HELLO);
+        }
+        close(p[1]);
+
+        len[i] = read(p[0], buf[i], sizeof buf[i] - 1);
+        close(p[0]);
+        assert_true(len[i] > 0);
+        buf[i][len[i]] = '\0';
+    }
+    w->session->ti.fd.out = -1;
+    nc_msg_buf_unref(hello);
+
+    assert_int_equal(len[0], len[1]);
+    assert_string_equal(buf[0], buf[1]);
+    assert_non_null(strstr(buf[1], "<capability>urn:example:capab?a=1&amp;b=2</capability>"));
+    assert_non_null(strstr(buf[1], "</capabilities><session-id>5</session-id></hello>"));
+}
+
 int main(void)
 {
     const struct CMUnitTest io[] = {
         cmocka_unit_test_setup_teardown(test_write_rpc_10, setup_write, teardown_write),
         cmocka_unit_test_setup_teardown(test_write_rpc_10_bad, setup_write, teardown_write),
         cmocka_unit_test_setup_teardown(test_write_rpc_11, setup_write, teardown_write),
-        cmocka_unit_test_setup_teardown(test_write_rpc_11_bad, setup_write, teardown_write)};
+        cmocka_unit_test_setup_teardown(test_write_rpc_11_bad, setup_write, teardown_write),
+        cmocka_unit_test_setup_teardown(test_write_rpc_chunks, setup_write, teardown_write),
+        cmocka_unit_test_setup_teardown(test_write_rpc_10_closed, setup_write, teardown_write),
+        cmocka_unit_test_setup_teardown(test_write_rpc_11_closed, setup_write, teardown_write),
+        cmocka_unit_test_setup_teardown(test_write_hello_cached, setup_write, teardown_write)};
 
     return cmocka_run_group_tests(io, NULL, NULL);
 }
@@ -0,0 +1,380 @@
+/**
+ * \file test_scan.c
+ * \brief libnetconf2 tests - framing delimiter and XML special character scanning kernels and their benchmark
+ *
+ * Copyright (c) 2019 CESNET, z.s.p.o.
+ *
+ * This source code is licensed under BSD 3-Clause License (the "License").
+ * You may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     https://opensource.org/licenses/BSD-3-Clause
+ */
+
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <setjmp.h>
+#include <time.h>
+#include <cmocka.h>
+
+#include <libnetconf.h>
+
+#include "tests/config.h"
+
+#define BENCH_SIZE (8 * 1024 * 1024)
+#define BENCH_ROUNDS 10
+
+typedef const char *(*scan_func)(const char *data, size_t len, const char *tag, size_t tag_len);
+
+/* end tag matching as nc_read_until() used to do it, comparing the tag with strncmp() after every read */
+static const char *
+scan_strncmp(const char *data, size_t len, const char *tag, size_t tag_len)
+{
+    size_t count = 0, matched = 0, i;
+
+    while (count + (tag_len - matched) <= len) {
+        count += tag_len - matched;
+        for (i = tag_len - matched; i > 0; i--) {
+            if (!strncmp(&tag[matched], &data[count - i], i)) {
+                matched += i;
+                break;
+            } else {
+                matched = 0;
+            }
+        }
+
+        if (matched == tag_len) {
+            return data + count - tag_len;
+        }
+    }
+
+    return NULL;
+}
+
+/* obviously correct reference */
+static const char *
+scan_naive(const char *data, size_t len, const char *tag, size_t tag_len)
+{
+    size_t i;
+
+    for (i = 0; i + tag_len <= len; ++i) {
+        if (!memcmp(data + i, tag, tag_len)) {
+            return data + i;
+        }
+    }
+
+    return NULL;
+}
+
+typedef size_t (*special_func)(const char *data, size_t len);
+
+static const struct {
+    const char *name;
+    special_func func;
+    const char *cpu;
+} special_kernels[] = {
+    {"scalar", nc_scan_xml_special_scalar, NULL},
+#ifdef NC_SCAN_X86
+    {"sse2", nc_scan_xml_special_sse2, "sse2"},
+    {"avx2", nc_scan_xml_special_avx2, "avx2"},
+#endif
+    {"auto", nc_scan_xml_special, NULL},
+};
+
+static const struct {
+    const char *name;
+    scan_func func;
+    const char *cpu;
+} kernels[] = {
+    {"scalar", nc_scan_tag_scalar, NULL},
+#ifdef NC_SCAN_X86
+    {"sse2", nc_scan_tag_sse2, "sse2"},
+    {"avx2", nc_scan_tag_avx2, "avx2"},
+#endif
+    {"auto", nc_scan_tag, NULL},
+};
+
+static int
+cpu_supported(const char *cpu)
+{
+#ifdef NC_SCAN_X86
+    if (cpu && !strcmp(cpu, "sse2")) {
+        return __builtin_cpu_supports("sse2");
+    } else if (cpu && !strcmp(cpu, "avx2")) {
+        return __builtin_cpu_supports("avx2");
+    }
+#else
+    (void)cpu;
+#endif
+    return 1;
+}
+
+static void
+test_scan_kernels(void **state)
+{
+    (void) state; /* unused */
+    const char *tags[] = {NC_VERSION_10_ENDTAG, "\n#", "\n", "]]>"};
+    /* few distinct characters so that there are many partial matches */
+    const char alphabet[] = "]]]>>\n#a";
+    char data[200];
+    size_t len, t, k, round, i;
+
+    srand(42);
+    for (t = 0; t < sizeof tags / sizeof *tags; ++t) {
+        for (len = 0; len < sizeof data; ++len) {
+            for (round = 0; round < 20; ++round) {
+                for (i = 0; i < len; ++i) {
+                    data[i] = alphabet[rand() % (sizeof alphabet - 1)];
+                }
+
+                for (k = 0; k < sizeof kernels / sizeof *kernels; ++k) {
+                    if (!cpu_supported(kernels[k].cpu)) {
+                        continue;
+                    }
+                    assert_ptr_equal(kernels[k].func(data, len, tags[t], strlen(tags[t])),
+                                     scan_naive(data, len, tags[t], strlen(tags[t])));
+                }
+            }
+        }
+    }
+}
+
+static double
+bench_run(scan_func func, const char *data, size_t len, const char *tag, const char *expected)
+{
+    struct timespec start, end;
+    double sec;
+    int i;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = 0; i < BENCH_ROUNDS; ++i) {
+        assert_ptr_equal(func(data, len, tag, strlen(tag)), expected);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    sec = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    return ((double)len * BENCH_ROUNDS) / (1024 * 1024) / sec;
+}
+
+static void
+test_scan_bench(void **state)
+{
+    (void) state; /* unused */
+    const char *elem = "\n  <interface>\n    <name>eth0</name>\n    <type>ianaift:ethernetCsmacd</type>\n"
+                       "    <enabled>true</enabled>\n  </interface>";
+    const char *tags[] = {NC_VERSION_10_ENDTAG, "\n#"};
+    char *data;
+    size_t elem_len, len, t, k;
+
+    /* multi-MB pretty-printed message with the delimiter at its very end */
+    data = malloc(BENCH_SIZE);
+    assert_non_null(data);
+    elem_len = strlen(elem);
+    for (len = 0; len + elem_len + 8 < BENCH_SIZE; len += elem_len) {
+        memcpy(data + len, elem, elem_len);
+    }
+
+    for (t = 0; t < sizeof tags / sizeof *tags; ++t) {
+        memcpy(data + len, tags[t], strlen(tags[t]));
+
+        printf("[ BENCH    ] \"%s\" in %zu bytes:\n", (t ? "\\n#" : tags[t]), len + strlen(tags[t]));
+        printf("[ BENCH    ]   %-8s %10.1f MiB/s\n", "strncmp",
+               bench_run(scan_strncmp, data, len + strlen(tags[t]), tags[t], data + len));
+        for (k = 0; k < sizeof kernels / sizeof *kernels; ++k) {
+            if (!cpu_supported(kernels[k].cpu)) {
+                continue;
+            }
+            printf("[ BENCH    ]   %-8s %10.1f MiB/s\n", kernels[k].name,
+                   bench_run(kernels[k].func, data, len + strlen(tags[t]), tags[t], data + len));
+        }
+    }
+
+    free(data);
+}
+
+static void
+test_special_kernels(void **state)
+{
+    (void) state; /* unused */
+    const char alphabet[] = "&<>=;?%a";
+    char data[200];
+    size_t len, k, round, i, expected;
+
+    srand(42);
+    for (len = 0; len < sizeof data; ++len) {
+        for (round = 0; round < 20; ++round) {
+            /* mostly clean text with a rare special character */
+            for (i = 0; i < len; ++i) {
+                data[i] = (rand() % 64) ? 'a' + (rand() % 26) : alphabet[rand() % (sizeof alphabet - 1)];
+            }
+            for (expected = 0; expected < len; ++expected) {
+                if ((data[expected] == '&') || (data[expected] == '<') || (data[expected] == '>')) {
+                    break;
+                }
+            }
+
+            for (k = 0; k < sizeof special_kernels / sizeof *special_kernels; ++k) {
+                if (!cpu_supported(special_kernels[k].cpu)) {
+                    continue;
+                }
+                assert_int_equal(special_kernels[k].func(data, len), expected);
+            }
+        }
+    }
+}
+
+/* escaping as nc_write_clb() used to do it, a character at a time, into a buffer that is dumped when full */
+static size_t
+escape_switch(char *out, size_t size, const char *data, size_t len)
+{
+    size_t l, out_len = 0, total = 0;
+
+    for (l = 0; l < len; l++) {
+        if (out_len + 5 >= size) {
+            total += out_len;
+            out_len = 0;
+        }
+
+        switch (data[l]) {
+        case '&':
+            memcpy(&out[out_len], "&amp;", 5);
+            out_len += 5;
+            break;
+        case '<':
+            memcpy(&out[out_len], "&lt;", 4);
+            out_len += 4;
+            break;
+        case '>':
+            memcpy(&out[out_len], "&gt;", 4);
+            out_len += 4;
+            break;
+        default:
+            memcpy(&out[out_len], &data[l], 1);
+            out_len++;
+        }
+    }
+
+    return total + out_len;
+}
+
+static special_func escape_kernel;
+
+/* escaping as nc_write_clb() does it now, clean runs are found by a kernel and copied in bulk */
+static size_t
+escape_scan(char *out, size_t size, const char *data, size_t len)
+{
+    size_t l = 0, out_len = 0, total = 0, run, piece;
+
+    while (l < len) {
+        run = escape_kernel(data + l, len - l);
+        while (run) {
+            if (out_len == size) {
+                total += out_len;
+                out_len = 0;
+            }
+            piece = (run < size - out_len) ? run : size - out_len;
+            memcpy(&out[out_len], &data[l], piece);
+            out_len += piece;
+            l += piece;
+            run -= piece;
+        }
+        if (l == len) {
+            break;
+        }
+
+        if (out_len + 5 > size) {
+            total += out_len;
+            out_len = 0;
+        }
+        switch (data[l]) {
+        case '&':
+            memcpy(&out[out_len], "&amp;", 5);
+            out_len += 5;
+            break;
+        case '<':
+            memcpy(&out[out_len], "&lt;", 4);
+            out_len += 4;
+            break;
+        case '>':
+            memcpy(&out[out_len], "&gt;", 4);
+            out_len += 4;
+            break;
+        }
+        ++l;
+    }
+
+    return total + out_len;
+}
+
+static double
+bench_escape(size_t (*func)(char *, size_t, const char *, size_t), char *out, size_t size, const char *data,
+             size_t len, size_t expected)
+{
+    struct timespec start, end;
+    double sec;
+    int i;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = 0; i < BENCH_ROUNDS; ++i) {
+        assert_int_equal(func(out, size, data, len), expected);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    sec = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    return ((double)len * BENCH_ROUNDS) / (1024 * 1024) / sec;
+}
+
+static void
+test_special_bench(void **state)
+{
+    (void) state; /* unused */
+    /* a certificate (base64, no special characters) and log text (some) */
+    const char *texts[] = {"MIIDXTCCAkWgAwIBAgIJAKoK/OvD8XBwMA0GCSqGSIb3DQEBCwUAMEUxCzAJBgNVBAYTAkNaMRMwEQYDVQQI\n",
+                           "2019-05-12T10:22:31Z kernel: eth0 <link up> speed=1000 & duplex=full -> bridge br0\n"};
+    const char *names[] = {"certificate", "log text"};
+    char *data, *out;
+    size_t text_len, len, t, k, expected;
+
+    data = malloc(BENCH_SIZE);
+    out = malloc(NC_WRITE_CHUNK_SIZE);
+    assert_non_null(data);
+    assert_non_null(out);
+
+    for (t = 0; t < sizeof texts / sizeof *texts; ++t) {
+        text_len = strlen(texts[t]);
+        for (len = 0; len + text_len <= BENCH_SIZE; len += text_len) {
+            memcpy(data + len, texts[t], text_len);
+        }
+
+        expected = escape_switch(out, NC_WRITE_CHUNK_SIZE, data, len);
+        printf("[ BENCH    ] escaping %s, %zu bytes:\n", names[t], len);
+        printf("[ BENCH    ]   %-8s %10.1f MiB/s\n", "switch",
+               bench_escape(escape_switch, out, NC_WRITE_CHUNK_SIZE, data, len, expected));
+        for (k = 0; k < sizeof special_kernels / sizeof *special_kernels; ++k) {
+            if (!cpu_supported(special_kernels[k].cpu)) {
+                continue;
+            }
+            escape_kernel = special_kernels[k].func;
+            printf("[ BENCH    ]   %-8s %10.1f MiB/s\n", special_kernels[k].name,
+                   bench_escape(escape_scan, out, NC_WRITE_CHUNK_SIZE, data, len, expected));
+        }
+    }
+
+    free(data);
+    free(out);
+}
+
+int main(void)
+{
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test(test_scan_kernels),
+        cmocka_unit_test(test_scan_bench),
+        cmocka_unit_test(test_special_kernels),
+        cmocka_unit_test(test_special_bench),
+    };
+
+    return cmocka_run_group_tests(tests, NULL, NULL);
+}
@@ -38,16 +38,54 @@
 
 pthread_barrier_t barrier;
 
+#if defined(NC_ENABLED_SSH) && defined(NC_ENABLED_TLS)
+const int client_count = 2;
+pid_t pids[2];
+int pipes[4];
+#else
+const int client_count = 1;
+pid_t pids[1];
+int pipes[2];
+#endif
+
+#ifdef NC_ENABLED_SSH
+/* index of the TLS client pipe */
+# define TLS_PIPE 1
+#else
+# define TLS_PIPE 0
+#endif
+
 #if defined(NC_ENABLED_SSH) || defined(NC_ENABLED_TLS)
 
+static void
+server_accept_rpc(struct nc_pollsession *ps)
+{
+    NC_MSG_TYPE msgtype;
+    int ret;
+    struct nc_session *session;
+
+    msgtype = nc_accept(NC_ACCEPT_TIMEOUT, &session);
+    nc_assert(msgtype == NC_MSG_HELLO);
+
+    /* both the SSH key and the TLS certificate are mapped to this user, in resumed TLS sessions too */
+    nc_assert(!strcmp(nc_session_get_username(session), "test"));
+
+    nc_ps_add_session(ps, session);
+    ret = nc_ps_poll(ps, NC_PS_POLL_TIMEOUT, NULL);
+    nc_assert(ret & NC_PSPOLL_RPC);
+    nc_ps_clear(ps, 0, NULL);
+}
+
 static void *
 server_thread(void *arg)
 {
     (void)arg;
+    struct nc_pollsession *ps;
+#ifdef NC_ENABLED_TLS
     NC_MSG_TYPE msgtype;
     int ret;
-    struct nc_pollsession *ps;
     struct nc_session *session;
+#endif
 
     ps = nc_ps_new();
     nc_assert(ps);
@@ -55,22 +93,24 @@ server_thread(void *arg)
     pthread_barrier_wait(&barrier);
 
 #if defined(NC_ENABLED_SSH) && defined(NC_ENABLED_TLS)
-    msgtype = nc_accept(NC_ACCEPT_TIMEOUT, &session);
-    nc_assert(msgtype == NC_MSG_HELLO);
-
-    nc_ps_add_session(ps, session);
-    ret = nc_ps_poll(ps, NC_PS_POLL_TIMEOUT, NULL);
-    nc_assert(ret & NC_PSPOLL_RPC);
-    nc_ps_clear(ps, 0, NULL);
+    server_accept_rpc(ps);
 #endif
 
-    msgtype = nc_accept(NC_ACCEPT_TIMEOUT, &session);
-    nc_assert(msgtype == NC_MSG_HELLO);
+    server_accept_rpc(ps);
 
-    nc_ps_add_session(ps, session);
-    ret = nc_ps_poll(ps, NC_PS_POLL_TIMEOUT, NULL);
-    nc_assert(ret & NC_PSPOLL_RPC);
-    nc_ps_clear(ps, 0, NULL);
+#ifdef NC_ENABLED_TLS
+    /* resumed TLS session */
+    server_accept_rpc(ps);
+
+    /* the client certificate is no longer mapped, resuming its session must fail */
+    ret = nc_server_tls_endpt_del_ctn("main_tls", 0, NULL, 0, NULL);
+    nc_assert(!ret);
+    ret = write(pipes[TLS_PIPE * 2 + 1], "ctn_deleted", 11);
+    nc_assert(ret == 11);
+
+    msgtype = nc_accept(NC_ACCEPT_TIMEOUT, &session);
+    nc_assert(msgtype == NC_MSG_ERROR);
+#endif
 
     nc_ps_free(ps);
 
@@ -469,6 +509,21 @@ tls_endpt_set_trusted_ca_paths_thread(void *arg)
     return NULL;
 }
 
+static void *
+tls_endpt_set_resumption_thread(void *arg)
+{
+    (void)arg;
+    int ret;
+
+    pthread_barrier_wait(&barrier);
+
+    ret = nc_server_tls_endpt_set_resumption("quaternary", 64, 1, 600);
+    nc_assert(!ret);
+
+    nc_thread_destroy();
+    return NULL;
+}
+
 static void *
 tls_endpt_del_trusted_cert_list_thread(void *arg)
 {
@@ -541,8 +596,9 @@ static void *
 tls_client_thread(void *arg)
 {
     int ret, read_pipe = *(int *)arg;
-    char buf[9];
+    char buf[11];
     struct nc_session *session;
+    uint64_t hits, misses;
 
     ret = read(read_pipe, buf, 9);
     nc_assert(ret == 9);
@@ -552,12 +608,34 @@ tls_client_thread(void *arg)
     nc_assert(!ret);
     ret = nc_client_tls_set_trusted_ca_paths(NULL, TESTS_DIR"/data");
     nc_assert(!ret);
+    ret = nc_client_tls_set_session_cache(16, 0);
+    nc_assert(!ret);
 
     session = nc_connect_tls("127.0.0.1", 6501, NULL);
     nc_assert(session);
 
+    nc_client_tls_get_session_cache_stats(NULL, &hits, &misses);
+    nc_assert(!hits && (misses == 1));
+
     nc_session_free(session, NULL);
 
+    /* the cached session is resumed */
+    session = nc_connect_tls("127.0.0.1", 6501, NULL);
+    nc_assert(session);
+
+    nc_client_tls_get_session_cache_stats(NULL, &hits, &misses);
+    nc_assert((hits == 1) && (misses == 1));
+
+    nc_session_free(session, NULL);
+
+    /* the server refuses it once the certificate is not mapped to a username */
+    ret = read(read_pipe, buf, 11);
+    nc_assert(ret == 11);
+    nc_assert(!strncmp(buf, "ctn_deleted", 11));
+
+    session = nc_connect_tls("127.0.0.1", 6501, NULL);
+    nc_assert(!session);
+
     fprintf(stdout, "TLS client finished.\n");
 
     nc_thread_destroy();
@@ -587,6 +665,7 @@ static void *(*thread_funcs[])(void *) = {
     tls_endpt_set_server_cert_thread,
     tls_endpt_add_trusted_cert_list_thread,
     tls_endpt_set_trusted_ca_paths_thread,
+    tls_endpt_set_resumption_thread,
     tls_endpt_del_trusted_cert_list_thread,
     tls_endpt_set_crl_paths_thread,
     tls_endpt_clear_crls_thread,
@@ -597,16 +676,6 @@ static void *(*thread_funcs[])(void *) = {
 
 const int thread_count = sizeof thread_funcs / sizeof *thread_funcs;
 
-#if defined(NC_ENABLED_SSH) && defined(NC_ENABLED_TLS)
-const int client_count = 2;
-pid_t pids[2];
-int pipes[4];
-#else
-const int client_count = 1;
-pid_t pids[1];
-int pipes[2];
-#endif
-
 static void
 client_fork(void)
 {
@@ -661,7 +730,7 @@ int
 main(void)
 {
     struct ly_ctx *ctx;
-    int ret, i, clients = 0;
+    int ret, i, status, clients = 0;
     pthread_t tids[thread_count];
 
     nc_verbosity(NC_VERB_VERBOSE);
@@ -722,6 +791,8 @@ main(void)
     nc_assert(!ret);
     ret = nc_server_tls_endpt_add_ctn("main_tls", 0, "02:D3:03:0E:77:21:E2:14:1F:E5:75:48:98:6B:FD:8A:63:BB:DE:40:34", NC_TLS_CTN_SPECIFIED, "test");
     nc_assert(!ret);
+    ret = nc_server_tls_endpt_set_resumption("main_tls", 16, 1, 0);
+    nc_assert(!ret);
 
     /* client ready */
     ret = write(pipes[clients * 2 + 1], "tls_ready", 9);
@@ -748,7 +819,8 @@ main(void)
         pthread_join(tids[i], NULL);
     }
     for (i = 0; i < client_count; ++i) {
-        waitpid(pids[i], NULL, 0);
+        waitpid(pids[i], &status, 0);
+        nc_assert(WIFEXITED(status) && !WEXITSTATUS(status));
         close(pipes[i * 2 + 1]);
     }
 
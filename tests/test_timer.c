@@ -0,0 +1,130 @@
+/**
+ * \file test_timer.c
+ * \brief libnetconf2 tests - hierarchical timer wheel
+ *
+ * Copyright (c) 2019 CESNET, z.s.p.o.
+ *
+ * This source code is licensed under BSD 3-Clause License (the "License").
+ * You may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     https://opensource.org/licenses/BSD-3-Clause
+ */
+
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <setjmp.h>
+#include <cmocka.h>
+
+#include <libnetconf.h>
+
+#include "tests/config.h"
+
+#define TIMER_COUNT 1000
+
+static void
+test_timer_expire(void **state)
+{
+    (void) state; /* unused */
+    struct nc_timer_wheel wheel;
+    struct nc_timer timers[3], *expired;
+
+    memset(timers, 0, sizeof timers);
+    nc_timer_wheel_init(&wheel, 1000);
+    assert_int_equal(nc_timer_next(&wheel), 0);
+
+    nc_timer_add(&wheel, &timers[0], 1010);
+    nc_timer_add(&wheel, &timers[1], 1000 + 5000);
+    /* already elapsed, expires on the next run */
+    nc_timer_add(&wheel, &timers[2], 900);
+    assert_int_equal(wheel.count, 3);
+    assert_int_equal(nc_timer_next(&wheel), 1001);
+
+    expired = nc_timer_run(&wheel, 1009);
+    assert_ptr_equal(expired, &timers[2]);
+    assert_null(expired->next);
+    assert_null(timers[2].pprev);
+
+    assert_null(nc_timer_run(&wheel, 1009));
+    expired = nc_timer_run(&wheel, 1010);
+    assert_ptr_equal(expired, &timers[0]);
+    assert_null(expired->next);
+
+    /* rescheduled sooner */
+    nc_timer_add(&wheel, &timers[1], 1100);
+    assert_int_equal(wheel.count, 1);
+    assert_null(nc_timer_run(&wheel, 1099));
+    assert_ptr_equal(nc_timer_run(&wheel, 2000), &timers[1]);
+
+    nc_timer_add(&wheel, &timers[0], 3000);
+    nc_timer_del(&wheel, &timers[0]);
+    nc_timer_del(&wheel, &timers[0]);
+    assert_int_equal(wheel.count, 0);
+    assert_int_equal(nc_timer_next(&wheel), 0);
+    assert_null(nc_timer_run(&wheel, 10000));
+    assert_int_equal(wheel.now, 10000);
+}
+
+static void
+test_timer_random(void **state)
+{
+    (void) state; /* unused */
+    struct nc_timer_wheel wheel;
+    struct nc_timer *timers, *expired;
+    time_t now = 123456, prev, next;
+    int i, step;
+
+    timers = calloc(TIMER_COUNT, sizeof *timers);
+    assert_non_null(timers);
+    nc_timer_wheel_init(&wheel, now);
+
+    srand(42);
+    for (i = 0; i < TIMER_COUNT; ++i) {
+        /* from seconds to beyond the range of the wheel */
+        nc_timer_add(&wheel, &timers[i], now + 1 + rand() % (1 << (rand() % 26)));
+        timers[i].data = &timers[i];
+    }
+
+    while (wheel.count) {
+        next = nc_timer_next(&wheel);
+        assert_true(next > now);
+
+        /* the wheel is not always run exactly when it should be */
+        prev = now;
+        step = rand() % 3;
+        if (!step) {
+            now = next - 1;
+        } else if (step == 1) {
+            now = next + rand() % 100;
+        } else {
+            now = next;
+        }
+
+        for (expired = nc_timer_run(&wheel, now); expired; expired = expired->next) {
+            assert_true((expired->expire > prev) && (expired->expire <= now));
+            expired->data = NULL;
+        }
+
+        /* nothing that has not expired yet is returned and nothing that has is left */
+        for (i = 0; i < TIMER_COUNT; ++i) {
+            if (timers[i].data) {
+                assert_true(timers[i].expire > now);
+                assert_non_null(timers[i].pprev);
+            }
+        }
+    }
+
+    free(timers);
+}
+
+int main(void)
+{
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test(test_timer_expire),
+        cmocka_unit_test(test_timer_random),
+    };
+
+    return cmocka_run_group_tests(tests, NULL, NULL);
+}